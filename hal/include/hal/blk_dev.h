@@ -87,6 +87,14 @@ int blk_read(int device, lba_t lba, blk_size_t lba_count, void *buf);
  */
 int blk_write(int device, lba_t lba, blk_size_t lba_count, const void *buf);
 
+/** Wait for block device writes in progress
+ * Multi sector writes are completed in background, error of such write
+ * is returned by this function or by the next read or write
+ * @param device Device identifier
+ * @return 0 otherwise errno when error
+ */
+int blk_write_wait(int device);
+
 //! Block information type returned
 typedef struct blk_dev_info
 {
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <hal/hwcrypt/sha256.h>
+
 //! Error codes for verificate signature
 enum sec_verify_error
 {
@@ -19,3 +21,9 @@ enum sec_verify_error
  */
 int sec_verify_file(const char *file, const char *signature_file);
 
+/** Check resource signature against already calculated hash
+ * @param[in] hash SHA256 hash of the resource
+ * @param[in] signature_file Path to the signature
+ * @return Verificaiton error see @sec_verify_error
+ */
+int sec_verify_hash(const struct sha256_hash *hash, const char *signature_file);
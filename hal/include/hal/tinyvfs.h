@@ -70,6 +70,18 @@ int vfs_mount_init(const struct vfs_mount_point_desc mnt_desc[], size_t mnt_size
  */
 int vfs_unmount_deinit();
 
+/** Unmount filesystems of the device mounted by vfs_mount_init, before its raw write
+ * @param[in] device Partition handle
+ * @return Number of unmounted mount points otherwise error
+ */
+int vfs_unmount_device(int device);
+
+/** Mount again filesystems unmounted by vfs_unmount_device
+ * @param[in] device Partition handle
+ * @return Error status
+ */
+int vfs_remount_device(int device);
+
 /*
  * Register the filesystem
  * @param type Filesystem type
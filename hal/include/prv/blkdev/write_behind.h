@@ -0,0 +1,82 @@
+#pragma once
+
+#include <hal/blk_dev.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+//! Write behind buffers count
+#define WRITE_BEHIND_BUFFERS 2
+
+//! Device operations used by the write behind
+struct write_behind_ops
+{
+    //! Start the transfer of the buffer, the buffer is not touched until the wait
+    int (*start)(void *dev, lba_t lba, blk_size_t count, const void *buf);
+    //! Wait for the transfer started last, return its error
+    int (*wait)(void *dev);
+};
+
+/** Double buffered writer
+ * Data is copied to one buffer while the other one is transferred, so the caller
+ * prepares next data while the device is busy with the previous one
+ */
+struct write_behind
+{
+    const struct write_behind_ops *ops; //! Device operations
+    void *dev;                          //! Device passed to the operations
+    uint8_t *buffer[WRITE_BEHIND_BUFFERS]; //! Transfer buffers
+    size_t buffer_size;                 //! Single buffer size
+    size_t sector_size;                 //! Device sector size
+    int current;                        //! Buffer used by the next write
+    bool pending;                       //! Transfer in progress
+};
+
+/** Initialize the write behind
+ * @param wb Write behind object
+ * @param ops Device operations
+ * @param dev Device passed to the operations
+ * @param buffer_size Single buffer size, multiply of the sector size
+ * @param sector_size Device sector size
+ * @return 0 otherwise errno when error
+ */
+int write_behind_init(struct write_behind *wb,
+                      const struct write_behind_ops *ops,
+                      void *dev,
+                      size_t buffer_size,
+                      size_t sector_size);
+
+/** Write sectors, returns when the data is copied and the transfer started
+ * @param wb Write behind object
+ * @param lba Logical block address
+ * @param count Number of sectors
+ * @param buf Data to write, may be reused by the caller when the function returns
+ * @return 0 otherwise errno when error, also error of the previous transfer
+ */
+int write_behind_write(struct write_behind *wb, lba_t lba, blk_size_t count, const void *buf);
+
+/** Wait until the data is written
+ * @param wb Write behind object
+ * @return 0 otherwise errno of the transfer
+ */
+int write_behind_wait(struct write_behind *wb);
+
+/** Wait for the transfer in progress and free the buffers
+ * @param wb Write behind object
+ */
+void write_behind_free(struct write_behind *wb);
+
+//! Write behind is initialized
+static inline bool write_behind_enabled(const struct write_behind *wb)
+{
+    return wb->ops != NULL;
+}
+
+#ifdef __cplusplus
+}
+#endif
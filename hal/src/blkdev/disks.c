@@ -1,6 +1,7 @@
 #include <hal/blk_dev.h>
 #include <prv/blkdev/blk_dev.h>
 #include <prv/blkdev/partscan.h>
+#include <prv/blkdev/write_behind.h>
 #include <hal/emmc.h>
 #include <drivers/sdmmc/fsl_mmc.h>
 #include <drivers/sdmmc/fsl_sdmmc_host.h>
@@ -8,6 +9,7 @@
 #include <stdio.h>
 
 #define BLKDEV_FIRST_PART 1 //! First logical partition
+#define BLKDEV_WRITE_BEHIND_SIZE (64 * 1024) //! Single write behind buffer size
 
 struct blk_disk
 {
@@ -16,6 +18,7 @@ struct blk_disk
     void *hwdrv;                 //! Hardware driver pointer
     size_t sect_size;            //! Single sector size
     size_t erase_group_blks;     //! Erase group blocks
+    struct write_behind wb;      //! Multi sector writes buffered in background
 };
 
 //! Partitions on disc table
@@ -68,6 +71,42 @@ static void *disk_hardware_init(int idisk, blk_partition_t *part, size_t *sect_s
     return card;
 }
 
+// Start the write, completed by emmc_write_wait or the next command
+static int emmc_write_start(void *dev, lba_t lba, blk_size_t count, const void *buf)
+{
+    SDMMCHOST_DeferWriteCompletion(true);
+    const status_t ret = MMC_WriteBlocks((mmc_card_t *)dev, (const uint8_t *)buf, lba, count);
+    SDMMCHOST_DeferWriteCompletion(false);
+    return (ret == kStatus_Success) ? (0) : (-EIO);
+}
+
+// Wait for the write in progress
+static int emmc_write_wait(void *dev)
+{
+    mmc_card_t *card = (mmc_card_t *)dev;
+    const status_t ret = SDMMCHOST_WaitTransferComplete(card->host.base, card->relativeAddress);
+    return (ret == kStatus_Success) ? (0) : (-EIO);
+}
+
+static const struct write_behind_ops emmc_write_behind_ops = {
+    .start = emmc_write_start,
+    .wait = emmc_write_wait,
+};
+
+// Complete background writes before other commands, all disks share the same card
+static int disks_write_wait(void)
+{
+    for (int i = 0; i < _blkdev_eot_; ++i)
+    {
+        const int err = write_behind_wait(&ctx.disks[i].wb);
+        if (err)
+        {
+            return err;
+        }
+    }
+    return 0;
+}
+
 //! Return disk device
 int blk_disk_handle(uint16_t hwdisk, uint8_t partition)
 {
@@ -97,6 +136,13 @@ int blk_initialize(void)
                 return nparts;
             }
             disk->n_parts = nparts;
+            // Boot partition is written rarely and requires the partition switch, user one only
+            int err = write_behind_init(
+                &disk->wb, &emmc_write_behind_ops, disk->hwdrv, BLKDEV_WRITE_BEHIND_SIZE, disk->sect_size);
+            if (err)
+            {
+                printf("blkdev: Write behind disabled errno %i\n", err);
+            }
         }
     }
     return 0;
@@ -144,6 +190,11 @@ int blk_read(int device, lba_t lba, blk_size_t lba_count, void *buf)
         return -ENXIO;
     }
 
+    ret = disks_write_wait();
+    if (ret)
+    {
+        return ret;
+    }
     if (idisk == blkdev_emmc_boot1)
     {
         ret = MMC_SelectPartition((mmc_card_t *)disk->hwdrv, kMMC_AccessPartitionBoot1);
@@ -182,13 +233,29 @@ int blk_write(int device, lba_t lba, blk_size_t lba_count, const void *buf)
     {
         return -ENXIO;
     }
-    const struct blk_disk *disk = &ctx.disks[idisk];
+    struct blk_disk *disk = &ctx.disks[idisk];
     size_t ipart = blk_hwpart(device);
     if (ipart > disk->n_parts)
     {
         return -ENXIO;
     }
 
+    ret = part_lba_to_disc_lba(idisk, ipart, &lba, lba_count);
+    if (ret)
+    {
+        return ret;
+    }
+    // Single sectors are mostly filesystem metadata, not worth the copy
+    if (lba_count > 1 && write_behind_enabled(&disk->wb))
+    {
+        return write_behind_write(&disk->wb, lba, lba_count, buf);
+    }
+
+    ret = disks_write_wait();
+    if (ret)
+    {
+        return ret;
+    }
     if (idisk == blkdev_emmc_boot1)
     {
         ret = MMC_SelectPartition((mmc_card_t *)disk->hwdrv, kMMC_AccessPartitionBoot1);
@@ -198,12 +265,6 @@ int blk_write(int device, lba_t lba, blk_size_t lba_count, const void *buf)
         }
     }
 
-    ret = part_lba_to_disc_lba(idisk, ipart, &lba, lba_count);
-    if (ret)
-    {
-        return ret;
-    }
-
     ret = MMC_WriteBlocks((mmc_card_t *)disk->hwdrv, (const uint8_t *)buf, lba, lba_count);
     if (ret != kStatus_Success)
     {
@@ -221,6 +282,16 @@ int blk_write(int device, lba_t lba, blk_size_t lba_count, const void *buf)
     return ret;
 }
 
+int blk_write_wait(int device)
+{
+    int idisk = blk_hwdisk(device);
+    if (idisk >= _blkdev_eot_)
+    {
+        return -ENXIO;
+    }
+    return write_behind_wait(&ctx.disks[idisk].wb);
+}
+
 int blk_info(int device, blk_dev_info_t *info)
 {
     if (!info)
@@ -0,0 +1,84 @@
+#include <prv/blkdev/write_behind.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+int write_behind_init(struct write_behind *wb,
+                      const struct write_behind_ops *ops,
+                      void *dev,
+                      size_t buffer_size,
+                      size_t sector_size)
+{
+    memset(wb, 0, sizeof(*wb));
+    if (!ops || sector_size == 0 || buffer_size < sector_size || buffer_size % sector_size)
+    {
+        return -EINVAL;
+    }
+    for (int i = 0; i < WRITE_BEHIND_BUFFERS; ++i)
+    {
+        wb->buffer[i] = malloc(buffer_size);
+        if (!wb->buffer[i])
+        {
+            write_behind_free(wb);
+            return -ENOMEM;
+        }
+    }
+    wb->ops = ops;
+    wb->dev = dev;
+    wb->buffer_size = buffer_size;
+    wb->sector_size = sector_size;
+    return 0;
+}
+
+int write_behind_write(struct write_behind *wb, lba_t lba, blk_size_t count, const void *buf)
+{
+    const uint8_t *data = buf;
+    const blk_size_t max_count = wb->buffer_size / wb->sector_size;
+    while (count > 0)
+    {
+        const blk_size_t chunk = (count < max_count) ? (count) : (max_count);
+        const size_t bytes = chunk * wb->sector_size;
+        uint8_t *buffer = wb->buffer[wb->current];
+        // The other buffer is being transferred meanwhile
+        memcpy(buffer, data, bytes);
+        int err = write_behind_wait(wb);
+        if (err)
+        {
+            return err;
+        }
+        err = wb->ops->start(wb->dev, lba, chunk, buffer);
+        if (err)
+        {
+            return err;
+        }
+        wb->pending = true;
+        wb->current = (wb->current + 1) % WRITE_BEHIND_BUFFERS;
+        data += bytes;
+        lba += chunk;
+        count -= chunk;
+    }
+    return 0;
+}
+
+int write_behind_wait(struct write_behind *wb)
+{
+    if (!wb->pending)
+    {
+        return 0;
+    }
+    wb->pending = false;
+    return wb->ops->wait(wb->dev);
+}
+
+void write_behind_free(struct write_behind *wb)
+{
+    if (wb->ops)
+    {
+        write_behind_wait(wb);
+    }
+    for (int i = 0; i < WRITE_BEHIND_BUFFERS; ++i)
+    {
+        free(wb->buffer[i]);
+    }
+    memset(wb, 0, sizeof(*wb));
+}
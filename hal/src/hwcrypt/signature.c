@@ -159,20 +159,26 @@ int sec_verify_file(const char *file, const char *signature_file)
         printf("%s: Unable to calculate checksum errno %i\n", __PRETTY_FUNCTION__, -err);
         return sec_verify_ioerror;
     }
+    return sec_verify_hash(&sha, signature_file);
+}
+
+//! Verify signature for the already calculated hash
+int sec_verify_hash(const struct sha256_hash *sha, const char *signature_file)
+{
     uint8_t *buf;
-    err = verify_sig_bin_blob(signature_file, &buf);
+    int err = verify_sig_bin_blob(signature_file, &buf);
     if (err)
     {
         return err;
     }
-    if (memcmp(buf + SHA_OFFSET, sha.value, sizeof sha.value) == 0)
+    if (memcmp(buf + SHA_OFFSET, sha->value, sizeof sha->value) == 0)
     {
         return sec_verify_ok;
     }
     else
     {
         printf("%s: SHA mismatch in the signature\n", __PRETTY_FUNCTION__);
-        sha256_print_hash("Calculated hash", &sha);
+        sha256_print_hash("Calculated hash", sha);
         sha256_print_hash("Signature hash", (struct sha256_hash *)(buf + SHA_OFFSET));
         return sec_verify_invalid_sha;
     }
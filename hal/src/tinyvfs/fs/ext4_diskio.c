@@ -23,8 +23,11 @@ static int io_open(struct ext4_blockdev *bdev)
 //! Ext4 close blockdev
 static int io_close(struct ext4_blockdev *bdev)
 {
-    (void)(bdev);
-    return 0;
+    struct io_context* ctx = bdev->bdif->p_user;
+    if(!ctx) {
+        return EIO;
+    }
+    return -blk_write_wait(ctx->disk);
 }
 
 // Ext4 write sectors
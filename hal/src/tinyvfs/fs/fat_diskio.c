@@ -78,7 +78,12 @@ DRESULT disk_ioctl(BYTE pdrv, BYTE cmd, void *buff)
     switch (cmd)
     {
     case CTRL_SYNC:
-        res = RES_OK;
+        err = blk_write_wait(disk);
+        if (err < 0)
+        {
+            printf("vfat: Unable to write to the disc errno %i\n", err);
+        }
+        res = (err) ? (RES_ERROR) : (RES_OK);
         break;
     case GET_SECTOR_COUNT:
     case GET_SECTOR_SIZE:
@@ -146,11 +146,20 @@ static int lfs_erase(const struct lfs_config *lfsc, lfs_block_t block)
     return LFS_ERR_OK;
 }
 
-//! Sync is not supported we don't cache anything
+//! Wait for the sectors written in background
 static int lfs_sync(const struct lfs_config *lfsc)
 {
-    (void)lfsc;
-    return LFS_ERR_OK;
+    struct io_context *ctx = (struct io_context *)lfsc->context;
+    if (!ctx)
+    {
+        return LFS_ERR_IO;
+    }
+    const int err = blk_write_wait(ctx->disk);
+    if (err)
+    {
+        printf("vfs_lfs: Sector write error %i\n", err);
+    }
+    return errno_to_lfs(err);
 }
 
 /** Append volume to the selected partition block
@@ -2,6 +2,7 @@
 // For licensing, see https://github.com/mudita/MuditaOS/LICENSE.md
 
 #include <hal/tinyvfs.h>
+#include <hal/blk_dev.h>
 #include <prv/tinyvfs/vfs_priv_data.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -221,7 +222,8 @@ static int ext_truncate(struct vfs_file *fp, off_t length)
 static int ext_sync(struct vfs_file *fp)
 {
     AUTO_PATH(mnt_path) = normalize_mount_point(fp->mp);
-    return -ext4_cache_flush(mnt_path);
+    const int err = -ext4_cache_flush(mnt_path);
+    return (err) ? (err) : (blk_write_wait(fp->mp->storage_dev));
 }
 
 static int ext_opendir(struct vfs_dir *dp, const char *path)
@@ -386,6 +388,9 @@ static int ext_stat(struct vfs_mount *mountp, const char *path, struct stat *ent
     entry->st_size = ext4_inode_get_size(sb, &ino);
     entry->st_blksize = ext4_sb_get_block_size(sb);
     entry->st_dev = ext4_inode_get_dev(&ino);
+    entry->st_atime = ext4_inode_get_access_time(&ino);
+    entry->st_mtime = ext4_inode_get_modif_time(&ino);
+    entry->st_ctime = ext4_inode_get_change_inode_time(&ino);
     return -err;
 }
 
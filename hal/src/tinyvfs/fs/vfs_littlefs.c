@@ -14,6 +14,9 @@
 #include <sys/dirent.h>
 #include <lfs.h>
 
+//! Attribute with the modification time, seconds since the epoch
+#define LFS_ATTR_MTIME ((uint8_t)'t')
+
 //! Internal lfs configuration structure
 struct dlfs_ctx
 {
@@ -276,6 +279,12 @@ static int dlfs_stat(struct vfs_mount *mountp, const char *path, struct stat *en
     if (ret >= 0)
     {
         info_to_stat(&fs->cfg, &info, entry);
+        // Littlefs has no time, the os keeps it in an attribute - without it the time stays 0
+        uint32_t mtime;
+        if (lfs_getattr(&fs->lfs, path, LFS_ATTR_MTIME, &mtime, sizeof mtime) == (lfs_ssize_t)sizeof mtime)
+        {
+            entry->st_mtime = mtime;
+        }
         ret = 0;
     }
     return lfs_to_errno(ret);
@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <string.h>
+#include <time.h>
 #include <sys/statvfs.h>
 #include <prv/tinyvfs/vfs_device.h>
 #define DIRENT_NO_DIR_STRUCTURE 1
@@ -111,6 +112,27 @@ static mode_t translate_fat_attrib_to_mode(BYTE fattrib)
 	return mode;
 }
 
+/** Translate FAT timestamp to seconds since the epoch
+ * Timestamp is local time of the writer, it's only compared with itself
+ */
+static time_t translate_fat_time(WORD fdate, WORD ftime)
+{
+	static const unsigned short month_days[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
+	const unsigned year = 1980 + (fdate >> 9);
+	const unsigned month = ((fdate >> 5) & 15) ? ((fdate >> 5) & 15) : 1;
+	const unsigned day = (fdate & 31) ? (fdate & 31) : 1;
+	if (fdate == 0 || month > 12)
+	{
+		return 0;
+	}
+	unsigned long days = (year - 1970) * 365UL + (year - 1969) / 4 + month_days[month - 1] + day - 1;
+	if (month > 2 && year % 4 == 0)
+	{
+		days++;
+	}
+	return (time_t)(days * 86400UL + (ftime >> 11) * 3600UL + ((ftime >> 5) & 63) * 60UL + (ftime & 31) * 2UL);
+}
+
 static void translate_filinfo_to_stat(const FILINFO *fs, struct stat *st)
 {
 	st->st_dev = 0;
@@ -127,11 +149,11 @@ static void translate_filinfo_to_stat(const FILINFO *fs, struct stat *st)
 #else
 	st->st_blksize = FF_MIN_SS;
 #endif
-	// TODO: Time is currently not supported
 	st->st_blocks = fs->fsize / st->st_blksize;
-	st->st_atime = 0;
-	st->st_mtime = 0;
-	st->st_ctime = 0;
+	// FAT keeps only the modification time
+	st->st_mtime = translate_fat_time(fs->fdate, fs->ftime);
+	st->st_atime = st->st_mtime;
+	st->st_ctime = st->st_mtime;
 }
 
 /** Translate FS path to FF fat path
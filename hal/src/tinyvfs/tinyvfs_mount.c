@@ -124,9 +124,66 @@ int vfs_unmount_deinit()
             return err;
         }
     }
+    const int err = blk_write_wait(blk_disk_handle(blkdev_emmc_user, 0));
+    if (err)
+    {
+        printf("vfs: Unable to complete writes errno %i\n", err);
+        return err;
+    }
     free(ctx.mps);
     ctx.num_mps = 0;
     ctx.mps = NULL;
     vfs_unregister_all_filesystems();
     return 0;
 }
+
+// Unmount filesystems of the single device
+int vfs_unmount_device(int device)
+{
+    int count = 0;
+    for (size_t n = 0; n < ctx.num_mps; ++n)
+    {
+        struct vfs_mount *mp = &ctx.mps[n];
+        if (mp->storage_dev != device || mp->fs == NULL)
+        {
+            continue;
+        }
+        const int err = vfs_unmount(mp);
+        if (err)
+        {
+            printf("vfs: Unable to unmount %s errno %i\n", mp->mnt_point, err);
+            return err;
+        }
+        ++count;
+    }
+    if (count > 0)
+    {
+        const int err = blk_write_wait(device);
+        if (err)
+        {
+            printf("vfs: Unable to complete writes errno %i\n", err);
+            return err;
+        }
+    }
+    return count;
+}
+
+// Mount again filesystems of the single device
+int vfs_remount_device(int device)
+{
+    for (size_t n = 0; n < ctx.num_mps; ++n)
+    {
+        struct vfs_mount *mp = &ctx.mps[n];
+        if (mp->storage_dev != device || mp->fs != NULL)
+        {
+            continue;
+        }
+        const int err = vfs_mount(mp, device);
+        if (err)
+        {
+            printf("vfs: Unable to mount %s again error %i\n", mp->mnt_point, err);
+            return err;
+        }
+    }
+    return 0;
+}
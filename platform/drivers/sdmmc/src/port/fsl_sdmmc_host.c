@@ -33,6 +33,7 @@
  */
 
 #include "drivers/sdmmc/fsl_sdmmc_host.h"
+#include "drivers/sdmmc/fsl_sdmmc_spec.h"
 #include "fsl_sdmmc_event.h"
 #include "fsl_gpio.h"
 #ifdef BOARD_USDHC_CD_PORT_BASE
@@ -73,6 +74,13 @@ static void SDMMCHOST_TransferCompleteCallback(SDMMCHOST_TYPE *base,
 */
 static void SDMMCHOST_ReTuningCallback(SDMMCHOST_TYPE *base, void *userData);
 
+/*!
+ * @brief Wait for the transfer complete event and handle the transfer error.
+ * @param base host base address.
+ * @param error transfer start status.
+ */
+static status_t SDMMCHOST_TransferComplete(SDMMCHOST_TYPE *base, status_t error);
+
 /*******************************************************************************
  * Variables
  ******************************************************************************/
@@ -83,6 +91,16 @@ usdhc_handle_t g_usdhcHandle;
 volatile bool g_usdhcTransferSuccessFlag = true;
 static volatile bool s_sdInsertedFlag = false;
 volatile status_t g_reTuningFlag = false;
+/* Write transfers return when started, see SDMMCHOST_DeferWriteCompletion */
+static bool s_deferWriteCompletion = false;
+/* Write transfer started and not completed yet */
+static bool s_transferPending = false;
+/* First error of the deferred transfers, reported by SDMMCHOST_WaitTransferComplete */
+static status_t s_deferredError = kStatus_Success;
+/* Descriptors of the deferred transfer, the ones of the caller are gone before it completes */
+static SDMMCHOST_TRANSFER s_deferredContent;
+static SDMMCHOST_COMMAND s_deferredCommand;
+static SDMMCHOST_DATA s_deferredData;
 
 /*******************************************************************************
  * Code
@@ -112,12 +130,80 @@ static void SDMMCHOST_ReTuningCallback(SDMMCHOST_TYPE *base, void *userData)
     SDMMCEVENT_Notify(kSDMMCEVENT_TransferComplete);
 }
 
+static status_t SDMMCHOST_TransferComplete(SDMMCHOST_TYPE *base, status_t error)
+{
+    if ((error != kStatus_Success) ||
+        (false == SDMMCEVENT_Wait(kSDMMCEVENT_TransferComplete, SDMMCHOST_TRANSFER_COMPLETE_TIMEOUT)) ||
+        (g_reTuningFlag) || (!g_usdhcTransferSuccessFlag))
+    {
+        if (g_reTuningFlag || (error == kStatus_USDHC_ReTuningRequest))
+        {
+            if (g_reTuningFlag)
+            {
+                g_reTuningFlag = false;
+                error = kStatus_USDHC_TuningError;
+            }
+        }
+        else
+        {
+            error = kStatus_Fail;
+            /* host error recovery */
+            SDMMCHOST_ErrorRecovery(base);
+        }
+    }
+
+    SDMMCEVENT_Delete(kSDMMCEVENT_TransferComplete);
+
+    return error;
+}
+
+/*!
+ * @brief Complete the deferred transfer, its error is kept for SDMMCHOST_WaitTransferComplete.
+ * @param base host base address.
+ */
+static void SDMMCHOST_DeferredComplete(SDMMCHOST_TYPE *base)
+{
+    status_t error = SDMMCHOST_TransferComplete(base, kStatus_Success);
+    /* card status of the write command */
+    if ((error == kStatus_Success) &&
+        ((s_deferredCommand.responseErrorFlags & s_deferredCommand.response[0U]) != 0U))
+    {
+        error = kStatus_USDHC_SendCommandFailed;
+    }
+    if ((error != kStatus_Success) && (s_deferredError == kStatus_Success))
+    {
+        s_deferredError = error;
+    }
+    s_transferPending = false;
+}
+
 static status_t SDMMCHOST_TransferFunction(SDMMCHOST_TYPE *base, SDMMCHOST_TRANSFER *content)
 {
     status_t error = kStatus_Success;
 
     usdhc_adma_config_t dmaConfig;
 
+    /* deferred write has to be completed before the next command */
+    if (s_transferPending)
+    {
+        SDMMCHOST_DeferredComplete(base);
+    }
+
+    /* the handle keeps the descriptors until the transfer completes, the deferred one outlives the caller */
+    const bool defer = s_deferWriteCompletion && (content->data != NULL) && (content->data->txData != NULL);
+    if (defer)
+    {
+        memset(&s_deferredCommand, 0, sizeof(s_deferredCommand));
+        if (content->command != NULL)
+        {
+            s_deferredCommand = *content->command;
+        }
+        s_deferredData = *content->data;
+        s_deferredContent.command = (content->command != NULL) ? &s_deferredCommand : NULL;
+        s_deferredContent.data = &s_deferredData;
+        content = &s_deferredContent;
+    }
+
     if (content->data != NULL)
     {
         memset(&dmaConfig, 0, sizeof(usdhc_adma_config_t));
@@ -133,28 +219,57 @@ static status_t SDMMCHOST_TransferFunction(SDMMCHOST_TYPE *base, SDMMCHOST_TRANS
         error = USDHC_TransferNonBlocking(base, &g_usdhcHandle, &dmaConfig, content);
     } while (error == kStatus_USDHC_BusyTransferring);
 
-    if ((error != kStatus_Success) ||
-        (false == SDMMCEVENT_Wait(kSDMMCEVENT_TransferComplete, SDMMCHOST_TRANSFER_COMPLETE_TIMEOUT)) ||
-        (g_reTuningFlag) || (!g_usdhcTransferSuccessFlag))
+    /* the data is sent by ADMA in background, completion is checked later */
+    if ((error == kStatus_Success) && defer)
     {
-        if (g_reTuningFlag || (error == kStatus_USDHC_ReTuningRequest))
+        s_transferPending = true;
+        return kStatus_Success;
+    }
+
+    return SDMMCHOST_TransferComplete(base, error);
+}
+
+void SDMMCHOST_DeferWriteCompletion(bool enable)
+{
+    s_deferWriteCompletion = enable;
+}
+
+status_t SDMMCHOST_WaitTransferComplete(SDMMCHOST_TYPE *base, uint32_t relativeAddress)
+{
+    status_t error = kStatus_Success;
+    SDMMCHOST_TRANSFER content = {0};
+    SDMMCHOST_COMMAND command = {0};
+    bool written = s_transferPending;
+
+    if (s_transferPending)
+    {
+        SDMMCHOST_DeferredComplete(base);
+    }
+    /* the card reports programming errors in its status, the next write checks it otherwise */
+    command.index = kSDMMC_SendStatus;
+    command.argument = relativeAddress << 16U;
+    command.responseType = kCARD_ResponseTypeR1;
+    content.command = &command;
+    while (written && (s_deferredError == kStatus_Success))
+    {
+        error = SDMMCHOST_TransferFunction(base, &content);
+        if ((error == kStatus_Success) &&
+            ((command.response[0U] & (kSDMMC_R1ErrorAllFlag | kSDMMC_R1SwitchErrorFlag)) != 0U))
         {
-            if (g_reTuningFlag)
-            {
-                g_reTuningFlag = false;
-                error = kStatus_USDHC_TuningError;
-            }
+            error = kStatus_USDHC_SendCommandFailed;
         }
-        else
+        if (error != kStatus_Success)
         {
-            error = kStatus_Fail;
-            /* host error recovery */
-            SDMMCHOST_ErrorRecovery(base);
+            s_deferredError = error;
+        }
+        else if ((command.response[0U] & kSDMMC_R1ReadyForDataFlag) &&
+                 (SDMMC_R1_CURRENT_STATE(command.response[0U]) != kSDMMC_R1StateProgram))
+        {
+            written = false;
         }
     }
-
-    SDMMCEVENT_Delete(kSDMMCEVENT_TransferComplete);
-
+    error = s_deferredError;
+    s_deferredError = kStatus_Success;
     return error;
 }
 
@@ -750,6 +750,23 @@ void SDMMCHOST_PowerOnCard(SDMMCHOST_TYPE *base, const sdmmchost_pwr_card_t *pwr
  */
 void SDMMCHOST_Delay(uint32_t milliseconds);
 
+/*!
+ * @brief Return from write transfers when the data transfer is started.
+ * The transfer is completed by the next transfer or by SDMMCHOST_WaitTransferComplete,
+ * the data buffer must not be changed until then.
+ * @param enable true - deferred write completion, false - blocking transfers
+ */
+void SDMMCHOST_DeferWriteCompletion(bool enable);
+
+/*!
+ * @brief Wait for the deferred write transfer and for the card to program it.
+ * @param base host base address.
+ * @param relativeAddress card address for the status of the written data.
+ * @retval kStatus_Success all deferred transfers completed
+ * @retval other error of the first failed deferred transfer or of the card status
+ */
+status_t SDMMCHOST_WaitTransferComplete(SDMMCHOST_TYPE *base, uint32_t relativeAddress);
+
 /* @} */
 
 #if defined(__cplusplus)
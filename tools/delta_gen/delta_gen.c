@@ -0,0 +1,166 @@
+/// Host tool: create delta of a file for the updater package, format described in common/delta.h
+/// usage: delta_gen <installed file> <new file> <delta>
+/// put the delta to the package as "<new file name>.delta" instead of the new file
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <md5/md5.h>
+#include <common/delta.h>
+
+/// shortest match worth a COPY op, shorter matches are sent as literals
+#define MIN_COPY 24
+/// bytes hashed to find match candidates
+#define HASH_BYTES 8
+
+struct buffer_s {
+    unsigned char *data;
+    size_t size;
+};
+
+static int read_file(const char *path, struct buffer_s *buf) {
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "unable to open %s\n", path);
+        return -1;
+    }
+    fseek(f, 0, SEEK_END);
+    const long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf->size = size > 0 ? (size_t) size : 0;
+    buf->data = malloc(buf->size + 1);
+    if (buf->data == NULL || fread(buf->data, 1, buf->size, f) != buf->size) {
+        fprintf(stderr, "unable to read %s\n", path);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    return 0;
+}
+
+static void put_le32(FILE *out, uint32_t value) {
+    const unsigned char bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+    fwrite(bytes, 1, sizeof bytes, out);
+}
+
+static uint32_t hash_at(const unsigned char *p, unsigned bits) {
+    uint64_t v;
+    memcpy(&v, p, sizeof v);
+    return (uint32_t) ((v * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+static void emit_add(FILE *out, const unsigned char *data, size_t size, size_t *ops_size) {
+    if (size == 0) {
+        return;
+    }
+    fputc(DeltaOpAdd, out);
+    put_le32(out, size);
+    fwrite(data, 1, size, out);
+    *ops_size += 5 + size;
+}
+
+static void emit_copy(FILE *out, size_t offset, size_t size, size_t *ops_size) {
+    fputc(DeltaOpCopy, out);
+    put_le32(out, offset);
+    put_le32(out, size);
+    *ops_size += 9;
+}
+
+static size_t match_forward(const struct buffer_s *src, size_t s, const struct buffer_s *tgt, size_t t) {
+    size_t len = 0;
+    while (s + len < src->size && t + len < tgt->size && src->data[s + len] == tgt->data[t + len]) {
+        ++len;
+    }
+    return len;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 4) {
+        fprintf(stderr, "usage: %s <installed file> <new file> <delta>\n", argv[0]);
+        return 1;
+    }
+    struct buffer_s src, tgt;
+    if (read_file(argv[1], &src) || read_file(argv[2], &tgt)) {
+        return 1;
+    }
+    if (src.size > UINT32_MAX || tgt.size > UINT32_MAX) {
+        fprintf(stderr, "files above 4GiB are not supported\n");
+        return 1;
+    }
+
+    /// last source position of every hashed HASH_BYTES sequence
+    unsigned bits = 16;
+    while (bits < 28 && ((size_t) 1 << bits) < 2 * src.size) {
+        ++bits;
+    }
+    int64_t *table = malloc(sizeof(int64_t) << bits);
+    if (table == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+    memset(table, 0xff, sizeof(int64_t) << bits);
+    for (size_t i = 0; i + HASH_BYTES <= src.size; ++i) {
+        table[hash_at(src.data + i, bits)] = i;
+    }
+
+    FILE *out = fopen(argv[3], "wb");
+    if (out == NULL) {
+        fprintf(stderr, "unable to create %s\n", argv[3]);
+        return 1;
+    }
+    unsigned char digest[DELTA_MD5_SIZE];
+    MD5_CTX md5;
+    MD5_Init(&md5);
+    MD5_Update(&md5, src.data, src.size);
+    MD5_Final(digest, &md5);
+    fwrite(DELTA_MAGIC, 1, DELTA_MAGIC_SIZE, out);
+    put_le32(out, src.size);
+    put_le32(out, tgt.size);
+    fwrite(digest, 1, sizeof digest, out);
+
+    size_t ops_size = 0;
+    size_t copied = 0;
+    size_t literal = 0;
+    size_t next_src = 0; /// source position following the last copy - patched files keep the layout
+    size_t t = 0;
+    while (t + HASH_BYTES <= tgt.size) {
+        const int64_t candidates[2] = {(int64_t) next_src + (int64_t) (t - literal), table[hash_at(tgt.data + t, bits)]};
+        size_t best_len = 0, best_src = 0;
+        for (size_t c = 0; c < 2; ++c) {
+            if (candidates[c] < 0 || (size_t) candidates[c] >= src.size) {
+                continue;
+            }
+            const size_t len = match_forward(&src, candidates[c], &tgt, t);
+            if (len > best_len) {
+                best_len = len;
+                best_src = candidates[c];
+            }
+        }
+        if (best_len < MIN_COPY) {
+            ++t;
+            continue;
+        }
+        /// take back literals matching the source in front of the copy
+        while (best_src > 0 && t > literal && src.data[best_src - 1] == tgt.data[t - 1]) {
+            --best_src;
+            --t;
+            ++best_len;
+        }
+        emit_add(out, tgt.data + literal, t - literal, &ops_size);
+        emit_copy(out, best_src, best_len, &ops_size);
+        copied += best_len;
+        t += best_len;
+        literal = t;
+        next_src = best_src + best_len;
+    }
+    emit_add(out, tgt.data + literal, tgt.size - literal, &ops_size);
+    fputc(DeltaOpEnd, out);
+    fclose(out);
+
+    printf("%s: %zu bytes, %zu copied from %s, delta %zu bytes\n", argv[2], tgt.size, copied, argv[1],
+           DELTA_HEADER_SIZE + ops_size + 1);
+    free(table);
+    free(src.data);
+    free(tgt.data);
+    return 0;
+}
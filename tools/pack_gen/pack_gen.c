@@ -0,0 +1,249 @@
+/// Host tool: create sector aligned update package, format described in common/pack.h
+/// usage: pack_gen <catalog> <package>
+/// every catalog and file below <catalog> is put to the package, named relative to it
+#include <dirent.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <md5/md5.h>
+#include <common/pack.h>
+
+/// tar entry types
+#define TYPE_FILE '0'
+#define TYPE_DIR '5'
+
+struct entry_s {
+    char *name;
+    char *path;
+    uint32_t type;
+    uint32_t size;
+    uint32_t offset;
+    unsigned char md5[PACK_MD5_SIZE];
+};
+
+struct entries_s {
+    struct entry_s *items;
+    size_t count;
+    size_t capacity;
+};
+
+static void put_le32(unsigned char *out, uint32_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+}
+
+static uint64_t align(uint64_t value) {
+    return (value + PACK_ALIGNMENT - 1) / PACK_ALIGNMENT * PACK_ALIGNMENT;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+static struct entry_s *add_entry(struct entries_s *entries) {
+    if (entries->count == entries->capacity) {
+        entries->capacity = entries->capacity ? entries->capacity * 2 : 64;
+        entries->items = realloc(entries->items, entries->capacity * sizeof *entries->items);
+        if (entries->items == NULL) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    struct entry_s *entry = &entries->items[entries->count++];
+    memset(entry, 0, sizeof *entry);
+    return entry;
+}
+
+static char *join(const char *a, const char *b, const char *c) {
+    char *out = malloc(strlen(a) + strlen(b) + strlen(c) + 1);
+    if (out == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    sprintf(out, "%s%s%s", a, b, c);
+    return out;
+}
+
+/// catalogs go before their content, names sorted - the same catalog gives the same package
+static int walk(const char *path, const char *prefix, struct entries_s *entries) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "unable to open %s\n", path);
+        return -1;
+    }
+    char **names = NULL;
+    size_t count = 0;
+    struct dirent *item;
+    while ((item = readdir(dir)) != NULL) {
+        if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0) {
+            continue;
+        }
+        names = realloc(names, (count + 1) * sizeof *names);
+        names[count++] = strdup(item->d_name);
+    }
+    closedir(dir);
+    qsort(names, count, sizeof *names, compare_names);
+
+    int ret = 0;
+    for (size_t i = 0; i < count && ret == 0; ++i) {
+        char *child = join(path, "/", names[i]);
+        struct stat st;
+        if (stat(child, &st) != 0) {
+            fprintf(stderr, "unable to stat %s\n", child);
+            ret = -1;
+        } else if (S_ISDIR(st.st_mode)) {
+            struct entry_s *entry = add_entry(entries);
+            entry->name = join(prefix, names[i], "/");
+            entry->type = TYPE_DIR;
+            char *child_prefix = strdup(entry->name);
+            ret = walk(child, child_prefix, entries);
+            free(child_prefix);
+        } else if (S_ISREG(st.st_mode)) {
+            if ((uint64_t) st.st_size > UINT32_MAX) {
+                fprintf(stderr, "%s: files above 4GiB are not supported\n", child);
+                ret = -1;
+            }
+            struct entry_s *entry = add_entry(entries);
+            entry->name = join(prefix, names[i], "");
+            entry->path = strdup(child);
+            entry->type = TYPE_FILE;
+            entry->size = st.st_size;
+        } else {
+            fprintf(stderr, "%s: not a file nor catalog, skipped\n", child);
+        }
+        free(child);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        free(names[i]);
+    }
+    free(names);
+    return ret;
+}
+
+/// copy file to the package at its offset, md5 calculated on the way
+static int write_data(FILE *out, struct entry_s *entry) {
+    FILE *in = fopen(entry->path, "rb");
+    if (in == NULL) {
+        fprintf(stderr, "unable to open %s\n", entry->path);
+        return -1;
+    }
+    static unsigned char buffer[64 * 1024];
+    MD5_CTX md5;
+    MD5_Init(&md5);
+    size_t copied = 0;
+    size_t bytes;
+    fseek(out, entry->offset, SEEK_SET);
+    while ((bytes = fread(buffer, 1, sizeof buffer, in)) > 0) {
+        MD5_Update(&md5, buffer, bytes);
+        if (fwrite(buffer, 1, bytes, out) != bytes) {
+            fclose(in);
+            fprintf(stderr, "unable to write %s\n", entry->name);
+            return -1;
+        }
+        copied += bytes;
+    }
+    fclose(in);
+    MD5_Final(entry->md5, &md5);
+    if (copied != entry->size) {
+        fprintf(stderr, "%s changed while packing\n", entry->path);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 3) {
+        fprintf(stderr, "usage: %s <catalog> <package>\n", argv[0]);
+        return 1;
+    }
+    struct entries_s entries = {0};
+    if (walk(argv[1], "", &entries) != 0) {
+        return 1;
+    }
+    if (entries.count == 0) {
+        fprintf(stderr, "nothing to pack in %s\n", argv[1]);
+        return 1;
+    }
+
+    size_t names_size = 0;
+    for (size_t i = 0; i < entries.count; ++i) {
+        if (strlen(entries.items[i].name) > PACK_NAME_MAX) {
+            fprintf(stderr, "%s: names above %d characters are not supported\n", entries.items[i].name,
+                    PACK_NAME_MAX);
+            return 1;
+        }
+        names_size += strlen(entries.items[i].name) + 1;
+    }
+    const size_t index_size = entries.count * PACK_ENTRY_SIZE + names_size;
+    const uint64_t data_offset = align(PACK_HEADER_SIZE + index_size);
+    uint64_t cursor = data_offset;
+    for (size_t i = 0; i < entries.count; ++i) {
+        entries.items[i].offset = cursor;
+        cursor = align(cursor + entries.items[i].size);
+    }
+    if (cursor > UINT32_MAX) {
+        fprintf(stderr, "packages above 4GiB are not supported\n");
+        return 1;
+    }
+
+    FILE *out = fopen(argv[2], "wb");
+    if (out == NULL) {
+        fprintf(stderr, "unable to create %s\n", argv[2]);
+        return 1;
+    }
+    size_t data_size = 0;
+    for (size_t i = 0; i < entries.count; ++i) {
+        if (entries.items[i].type == TYPE_FILE && write_data(out, &entries.items[i]) != 0) {
+            fclose(out);
+            return 1;
+        }
+        data_size += entries.items[i].size;
+    }
+
+    /// index is written last - it holds the digests of the data
+    unsigned char *index = calloc(1, index_size + 1);
+    unsigned char *names = index + entries.count * PACK_ENTRY_SIZE;
+    size_t name_offset = 0;
+    for (size_t i = 0; i < entries.count; ++i) {
+        const struct entry_s *entry = &entries.items[i];
+        unsigned char *p = index + i * PACK_ENTRY_SIZE;
+        put_le32(p, name_offset);
+        put_le32(p + 4, entry->offset);
+        put_le32(p + 8, entry->size);
+        put_le32(p + 12, entry->type);
+        memcpy(p + 16, entry->md5, PACK_MD5_SIZE);
+        strcpy((char *) names + name_offset, entry->name);
+        name_offset += strlen(entry->name) + 1;
+    }
+    unsigned char header[PACK_HEADER_SIZE];
+    memcpy(header, PACK_MAGIC, PACK_MAGIC_SIZE);
+    put_le32(header + PACK_MAGIC_SIZE, entries.count);
+    put_le32(header + PACK_MAGIC_SIZE + 4, names_size);
+    put_le32(header + PACK_MAGIC_SIZE + 8, data_offset);
+    put_le32(header + PACK_MAGIC_SIZE + 12, PACK_ALIGNMENT);
+    MD5_CTX md5;
+    MD5_Init(&md5);
+    MD5_Update(&md5, index, index_size);
+    MD5_Final(header + PACK_MAGIC_SIZE + 16, &md5);
+
+    fseek(out, 0, SEEK_SET);
+    const int ret = fwrite(header, 1, sizeof header, out) == sizeof header &&
+                    fwrite(index, 1, index_size, out) == index_size;
+    if (fclose(out) != 0 || !ret) {
+        fprintf(stderr, "unable to write %s\n", argv[2]);
+        return 1;
+    }
+    printf("%s: %zu entries, %zu bytes of files, data from %llu\n", argv[2], entries.count, data_size,
+           (unsigned long long) data_offset);
+    free(index);
+    for (size_t i = 0; i < entries.count; ++i) {
+        free(entries.items[i].name);
+        free(entries.items[i].path);
+    }
+    free(entries.items);
+    return 0;
+}
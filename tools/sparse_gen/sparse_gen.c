@@ -0,0 +1,159 @@
+/// Host tool: create sparse partition image, format described in common/sparse.h
+/// usage: sparse_gen [-b block_size] [-z] <raw image> <sparse image>
+/// -z: zero blocks are don't care (free space of a freshly made filesystem), otherwise they're zeroed
+/// raw image not ending on a block is padded with zeros
+/// put the result to the package as partition<N>.img
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <md5/md5.h>
+#include <common/sparse.h>
+
+#define DEFAULT_BLOCK_SIZE 4096
+
+static void put_le32(unsigned char *out, uint32_t value) {
+    out[0] = value;
+    out[1] = value >> 8;
+    out[2] = value >> 16;
+    out[3] = value >> 24;
+}
+
+static int is_zero(const unsigned char *data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (data[i] != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int write_chunk(FILE *out, unsigned char type, uint32_t blocks) {
+    unsigned char chunk[SPARSE_CHUNK_SIZE];
+    chunk[0] = type;
+    put_le32(chunk + 1, blocks);
+    return fwrite(chunk, 1, sizeof chunk, out) == sizeof chunk ? 0 : -1;
+}
+
+/// blocks of one kind go to a single chunk, RAW data is copied from the raw image again
+static int write_run(FILE *out, FILE *in, unsigned char type, uint32_t first, uint32_t blocks, size_t block_size,
+                     unsigned char *buffer) {
+    if (blocks == 0) {
+        return 0;
+    }
+    if (write_chunk(out, type, blocks) != 0) {
+        return -1;
+    }
+    if (type != SparseChunkRaw) {
+        return 0;
+    }
+    fseek(in, (long) first * block_size, SEEK_SET);
+    for (uint32_t i = 0; i < blocks; ++i) {
+        memset(buffer, 0, block_size);
+        if (fread(buffer, 1, block_size, in) == 0 && ferror(in)) {
+            return -1;
+        }
+        if (fwrite(buffer, 1, block_size, out) != block_size) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    size_t block_size = DEFAULT_BLOCK_SIZE;
+    int zero_dont_care = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:z")) != -1) {
+        if (opt == 'b') {
+            block_size = strtoul(optarg, NULL, 0);
+        } else if (opt == 'z') {
+            zero_dont_care = 1;
+        } else {
+            optind = argc;
+            break;
+        }
+    }
+    if (argc - optind != 2 || block_size == 0 || block_size % 512 != 0) {
+        fprintf(stderr, "usage: %s [-b block_size] [-z] <raw image> <sparse image>\n", argv[0]);
+        fprintf(stderr, "block size is a multiple of 512, %d by default\n", DEFAULT_BLOCK_SIZE);
+        return 1;
+    }
+    FILE *in = fopen(argv[optind], "rb");
+    if (in == NULL) {
+        fprintf(stderr, "unable to open %s\n", argv[optind]);
+        return 1;
+    }
+    FILE *out = fopen(argv[optind + 1], "wb");
+    if (out == NULL) {
+        fprintf(stderr, "unable to create %s\n", argv[optind + 1]);
+        fclose(in);
+        return 1;
+    }
+    unsigned char *block = malloc(block_size);
+    unsigned char *buffer = malloc(block_size);
+    if (block == NULL || buffer == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return 1;
+    }
+
+    /// header is written again with the block count and md5 at the end
+    unsigned char header[SPARSE_HEADER_SIZE] = {0};
+    fwrite(header, 1, sizeof header, out);
+
+    MD5_CTX md5;
+    MD5_Init(&md5);
+    const unsigned char zero_type = zero_dont_care ? SparseChunkDontCare : SparseChunkZero;
+    unsigned char run_type = SparseChunkEnd;
+    uint32_t run_first = 0;
+    uint32_t blocks = 0;
+    uint32_t counts[4] = {0};
+    int ret = 0;
+    size_t bytes;
+    while (ret == 0) {
+        memset(block, 0, block_size);
+        bytes = fread(block, 1, block_size, in);
+        if (bytes == 0) {
+            break;
+        }
+        const unsigned char type = is_zero(block, block_size) ? zero_type : SparseChunkRaw;
+        if (type != SparseChunkDontCare) {
+            MD5_Update(&md5, block, block_size);
+        }
+        if (type != run_type) {
+            ret = write_run(out, in, run_type, run_first, blocks - run_first, block_size, buffer);
+            fseek(in, (long) (blocks + 1) * block_size, SEEK_SET);
+            run_type = type;
+            run_first = blocks;
+        }
+        counts[type]++;
+        blocks++;
+    }
+    if (ret == 0) {
+        ret = write_run(out, in, run_type, run_first, blocks - run_first, block_size, buffer);
+    }
+    if (ret == 0) {
+        ret = write_chunk(out, SparseChunkEnd, 0);
+    }
+
+    memcpy(header, SPARSE_MAGIC, SPARSE_MAGIC_SIZE);
+    put_le32(header + SPARSE_MAGIC_SIZE, block_size);
+    put_le32(header + SPARSE_MAGIC_SIZE + 4, blocks);
+    MD5_Final(header + SPARSE_MAGIC_SIZE + 8, &md5);
+    fseek(out, 0, SEEK_SET);
+    if (ret == 0 && fwrite(header, 1, sizeof header, out) != sizeof header) {
+        ret = -1;
+    }
+    if (fclose(out) != 0 || ret != 0 || ferror(in)) {
+        fprintf(stderr, "unable to write %s\n", argv[optind + 1]);
+        fclose(in);
+        return 1;
+    }
+    fclose(in);
+    printf("%s: %u blocks of %zu bytes: %u raw, %u zero, %u don't care\n", argv[optind + 1], blocks, block_size,
+           counts[SparseChunkRaw], counts[SparseChunkZero], counts[SparseChunkDontCare]);
+    free(block);
+    free(buffer);
+    return 0;
+}
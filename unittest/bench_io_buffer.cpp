@@ -0,0 +1,162 @@
+/// Host benchmark: archive write and read throughput against the session buffer size (see io_buffer.h)
+/// usage: ./bench_io_buffer [megabytes=64] [runs=3]
+/// the archive is dropped from the page cache before every read, so reads hit the disk like on the phone
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include <common/io_buffer.h>
+#include <common/tar.h>
+
+#ifndef BUILD_DIR
+#error Requires build dir to put benchmark files
+#endif
+
+namespace
+{
+    using clock_type = std::chrono::steady_clock;
+
+    const std::filesystem::path root{std::string(BUILD_DIR) + "/bench_io_buffer"};
+
+    /// a database sized file and a few small ones, like the user data backup
+    std::vector<std::string> make_files(size_t megabytes)
+    {
+        std::filesystem::remove_all(root);
+        std::filesystem::create_directories(root / "data");
+        std::vector<std::string> files;
+        std::mt19937 gen(megabytes);
+        std::vector<char> data(1024 * 1024);
+        for (size_t i = 0; i < 5; ++i) {
+            const auto path = (root / "data" / ("file_" + std::to_string(i) + ".db")).string();
+            std::ofstream out(path, std::ios::binary);
+            const size_t size = i == 0 ? megabytes : 1;
+            for (size_t mb = 0; mb < size; ++mb) {
+                for (auto &c : data) {
+                    c = static_cast<char>(gen());
+                }
+                out.write(data.data(), static_cast<std::streamsize>(data.size()));
+            }
+            files.push_back(path);
+        }
+        return files;
+    }
+
+    void drop_cache(const std::string &path)
+    {
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            fsync(fd);
+            posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+            close(fd);
+        }
+    }
+
+    size_t write_archive(const std::string &archive, const std::vector<std::string> &files)
+    {
+        struct tar_ctx ctx;
+        size_t bytes = 0;
+        std::filesystem::remove(archive);
+        if (tar_init(&ctx, archive.c_str(), "w") != 0) {
+            tar_deinit(&ctx);
+            return 0;
+        }
+        for (const auto &file : files) {
+            const auto name = std::filesystem::path(file).filename().string();
+            if (tar_file(&ctx, file.c_str(), name.c_str()) != 0) {
+                tar_deinit(&ctx);
+                return 0;
+            }
+            bytes += std::filesystem::file_size(file);
+        }
+        tar_deinit(&ctx);
+        return bytes;
+    }
+
+    size_t read_archive(const std::string &archive)
+    {
+        struct tar_ctx ctx;
+        mtar_header_t header;
+        size_t bytes = 0;
+        if (tar_init(&ctx, archive.c_str(), "r") != ErrorTarOk) {
+            tar_deinit(&ctx);
+            return 0;
+        }
+        while (tar_read_header(&ctx, &header) == ErrorTarOk) {
+            while (header.type == MTAR_TREG && ctx.remaining_data > 0) {
+                const void *data = nullptr;
+                size_t size      = 0;
+                if (tar_read_data(&ctx, &data, &size) != ErrorTarOk) {
+                    tar_deinit(&ctx);
+                    return 0;
+                }
+                bytes += size;
+            }
+        }
+        tar_deinit(&ctx);
+        return bytes;
+    }
+
+    /// best throughput of the runs in MB/s
+    template <typename Fn> double measure(size_t runs, Fn fn)
+    {
+        double best = 0;
+        for (size_t i = 0; i < runs; ++i) {
+            const auto start                            = clock_type::now();
+            const size_t bytes                          = fn();
+            const std::chrono::duration<double> elapsed = clock_type::now() - start;
+            const double rate = elapsed.count() > 0 ? bytes / elapsed.count() / (1024 * 1024) : 0;
+            best              = rate > best ? rate : best;
+        }
+        return best;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const size_t megabytes = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 64;
+    const size_t runs      = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 3;
+
+    const auto files   = make_files(megabytes);
+    const auto archive = (root / "backup.tar").string();
+    std::printf("archive of %zu MB in %zu files, best of %zu runs\n", megabytes + files.size() - 1, files.size(),
+                runs);
+    std::printf("%10s %12s %12s\n", "buffer kB", "write MB/s", "read MB/s");
+
+    struct point
+    {
+        size_t size;
+        double write;
+        double read;
+    };
+    std::vector<point> curve;
+    double best_read = 0;
+    for (size_t size = 16 * 1024; size <= 4 * 1024 * 1024; size *= 2) {
+        if (io_buffer_init(size) != ErrorIoBufferOk) {
+            std::fprintf(stderr, "unable to allocate %zu bytes buffer\n", size);
+            return 1;
+        }
+        const double write = measure(runs, [&] { return write_archive(archive, files); });
+        const double read  = measure(runs, [&] {
+            drop_cache(archive);
+            return read_archive(archive);
+        });
+        curve.push_back({size, write, read});
+        best_read = read > best_read ? read : best_read;
+        std::printf("%10zu %12.1f %12.1f\n", size / 1024, write, read);
+    }
+    io_buffer_deinit();
+
+    std::printf("\nread throughput curve:\n");
+    for (const auto &p : curve) {
+        const int width = best_read > 0 ? static_cast<int>(p.read / best_read * 60) : 0;
+        std::printf("%6zu kB |%s\n", p.size / 1024, std::string(width, '#').c_str());
+    }
+    std::filesystem::remove_all(root);
+    return 0;
+}
@@ -0,0 +1,151 @@
+/// Host benchmark: microtar read path vs buffered tar reader, plain and LZ4 compressed
+/// usage: ./bench_tar [files=5000] [max_file_size=4096] [runs=5]
+#include <boost/process/system.hpp>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include <common/tar.h>
+
+#ifndef BUILD_DIR
+#error Requires build dir to put benchmark package
+#endif
+
+namespace
+{
+    using clock_type = std::chrono::steady_clock;
+
+    std::string make_package(size_t files, size_t max_size)
+    {
+        const std::filesystem::path root{std::string(BUILD_DIR) + "/bench_tar"};
+        const std::filesystem::path assets = root / "assets";
+        const std::string package = (root / "package.tar").string();
+
+        std::filesystem::remove_all(root);
+        std::filesystem::create_directories(assets);
+
+        std::mt19937 gen(files);
+        std::uniform_int_distribution<size_t> size_dist(1, max_size);
+        std::vector<char> data(max_size);
+        for (size_t i = 0; i < files; ++i) {
+            if (i % 100 == 0) {
+                std::filesystem::create_directories(assets / std::to_string(i / 100));
+            }
+            const auto size = size_dist(gen);
+            for (size_t j = 0; j < size; ++j) {
+                data[j] = static_cast<char>(gen());
+            }
+            std::ofstream out(assets / std::to_string(i / 100) / ("asset_" + std::to_string(i)), std::ios::binary);
+            out.write(data.data(), static_cast<std::streamsize>(size));
+        }
+
+        auto code = boost::process::system("tar -cf " + package + " -C " + root.string() + " assets");
+        if (code == 0) {
+            code = boost::process::system("lz4 -q -f -B5 -BD " + package + " " + package + TAR_LZ4_EXTENSION);
+        }
+        if (code != 0) {
+            std::fprintf(stderr, "unable to create package: %d\n", code);
+            std::exit(1);
+        }
+        return package;
+    }
+
+    /// the loop unpack() used before the buffered reader: double header read, data read, mtar_next
+    size_t read_microtar(const std::string &package, std::vector<char> &buffer)
+    {
+        mtar_t tar;
+        mtar_header_t header;
+        size_t bytes = 0;
+        if (mtar_open(&tar, package.c_str(), "r") != MTAR_ESUCCESS) {
+            return 0;
+        }
+        while (mtar_read_header(&tar, &header) != MTAR_ENULLRECORD) {
+            if (mtar_read_header(&tar, &header) != MTAR_ESUCCESS) {
+                break;
+            }
+            size_t yet_to_read = header.type == MTAR_TREG ? header.size : 0;
+            while (yet_to_read > 0) {
+                const size_t chunk = std::min(yet_to_read, buffer.size());
+                if (mtar_read_data(&tar, buffer.data(), chunk) != MTAR_ESUCCESS) {
+                    mtar_close(&tar);
+                    return 0;
+                }
+                yet_to_read -= chunk;
+                bytes += chunk;
+            }
+            if (mtar_next(&tar) != MTAR_ESUCCESS) {
+                break;
+            }
+        }
+        mtar_close(&tar);
+        return bytes;
+    }
+
+    size_t read_buffered(const std::string &package)
+    {
+        struct tar_ctx ctx;
+        mtar_header_t header;
+        size_t bytes = 0;
+        if (tar_init(&ctx, package.c_str(), "r") != ErrorTarOk) {
+            tar_deinit(&ctx);
+            return 0;
+        }
+        while (tar_read_header(&ctx, &header) == ErrorTarOk) {
+            while (header.type == MTAR_TREG && ctx.remaining_data > 0) {
+                const void *data = nullptr;
+                size_t size      = 0;
+                if (tar_read_data(&ctx, &data, &size) != ErrorTarOk) {
+                    tar_deinit(&ctx);
+                    return 0;
+                }
+                bytes += size;
+            }
+        }
+        tar_deinit(&ctx);
+        return bytes;
+    }
+
+    template <typename Fn> double measure(const char *name, size_t runs, Fn fn)
+    {
+        double best = 0;
+        size_t bytes = 0;
+        for (size_t i = 0; i < runs; ++i) {
+            const auto start = clock_type::now();
+            bytes            = fn();
+            const std::chrono::duration<double, std::milli> elapsed = clock_type::now() - start;
+            if (i == 0 || elapsed.count() < best) {
+                best = elapsed.count();
+            }
+        }
+        std::printf("%-10s best of %zu: %8.2f ms, %zu data bytes\n", name, runs, best, bytes);
+        return best;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const size_t files    = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 5000;
+    const size_t max_size = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 4096;
+    const size_t runs     = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 5;
+
+    const auto package = make_package(files, max_size);
+    std::printf("package: %s, %zu files up to %zu bytes, %ju bytes\n",
+                package.c_str(),
+                files,
+                max_size,
+                static_cast<uintmax_t>(std::filesystem::file_size(package)));
+
+    std::vector<char> buffer(1024 * 1024);
+    const auto microtar = measure("microtar", runs, [&] { return read_microtar(package, buffer); });
+    const auto buffered = measure("buffered", runs, [&] { return read_buffered(package); });
+    std::printf("speedup: %.2fx\n", buffered > 0 ? microtar / buffered : 0.0);
+
+    const auto compressed = package + TAR_LZ4_EXTENSION;
+    std::printf("compressed: %ju bytes\n", static_cast<uintmax_t>(std::filesystem::file_size(compressed)));
+    measure("lz4", runs, [&] { return read_buffered(compressed); });
+    return 0;
+}
@@ -0,0 +1,195 @@
+/// Host benchmark: blocking block writes vs write behind on a simulated DMA device
+/// usage: ./bench_write_behind [megabytes=16] [device_mbps=20] [cpu_mbps=25] [chunk_kb=16]
+/// cpu_mbps is the simulated rate of producing the data (reading and unpacking the package)
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <md5/md5.h>
+#include <prv/blkdev/write_behind.h>
+
+namespace
+{
+    using clock_type = std::chrono::steady_clock;
+    constexpr size_t sector_size = 512;
+
+    std::chrono::microseconds transfer_time(size_t bytes, double mbps)
+    {
+        return std::chrono::microseconds(static_cast<long long>(bytes / mbps));
+    }
+
+    /// device transferring the buffer in background like the uSDHC ADMA
+    class sim_device
+    {
+      public:
+        explicit sim_device(size_t sectors, double mbps) : storage(sectors * sector_size), mbps(mbps)
+        {
+            worker = std::thread([this] { run(); });
+        }
+
+        ~sim_device()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stop = true;
+            }
+            cond.notify_all();
+            worker.join();
+        }
+
+        int start(lba_t lba, blk_size_t count, const void *buf)
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this] { return !busy; });
+            if ((lba + count) * sector_size > storage.size()) {
+                return -ERANGE;
+            }
+            job_lba   = lba;
+            job_count = count;
+            job_buf   = static_cast<const uint8_t *>(buf);
+            busy      = true;
+            cond.notify_all();
+            return 0;
+        }
+
+        int wait()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cond.wait(lock, [this] { return !busy; });
+            return 0;
+        }
+
+        const std::vector<uint8_t> &data() const
+        {
+            return storage;
+        }
+
+        static int start_op(void *dev, lba_t lba, blk_size_t count, const void *buf)
+        {
+            return static_cast<sim_device *>(dev)->start(lba, count, buf);
+        }
+
+        static int wait_op(void *dev)
+        {
+            return static_cast<sim_device *>(dev)->wait();
+        }
+
+      private:
+        void run()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (true) {
+                cond.wait(lock, [this] { return busy || stop; });
+                if (stop) {
+                    return;
+                }
+                const size_t bytes = job_count * sector_size;
+                lock.unlock();
+                std::this_thread::sleep_for(transfer_time(bytes, mbps));
+                std::memcpy(&storage[job_lba * sector_size], job_buf, bytes);
+                lock.lock();
+                busy = false;
+                cond.notify_all();
+            }
+        }
+
+        std::vector<uint8_t> storage;
+        double mbps;
+        std::thread worker;
+        std::mutex mutex;
+        std::condition_variable cond;
+        bool busy = false;
+        bool stop = false;
+        lba_t job_lba = 0;
+        blk_size_t job_count = 0;
+        const uint8_t *job_buf = nullptr;
+    };
+
+    const struct write_behind_ops sim_ops = {sim_device::start_op, sim_device::wait_op};
+
+    /// unpack-like workload: produce the chunk, hash it and write it
+    template <typename Write> double run(size_t total, size_t chunk, double cpu_mbps, Write write, unsigned char md5[16])
+    {
+        std::vector<uint8_t> buffer(chunk);
+        MD5_CTX ctx;
+        MD5_Init(&ctx);
+        const auto start = clock_type::now();
+        for (size_t offset = 0; offset < total; offset += chunk) {
+            for (size_t i = 0; i < chunk; ++i) {
+                buffer[i] = static_cast<uint8_t>((offset + i) * 2654435761u >> 13);
+            }
+            std::this_thread::sleep_for(transfer_time(chunk, cpu_mbps));
+            if (write(offset / sector_size, chunk / sector_size, buffer.data()) != 0) {
+                std::fprintf(stderr, "write failed at %zu\n", offset);
+                std::exit(1);
+            }
+            MD5_Update(&ctx, buffer.data(), chunk);
+        }
+        const std::chrono::duration<double, std::milli> elapsed = clock_type::now() - start;
+        MD5_Final(md5, &ctx);
+        return elapsed.count();
+    }
+
+    void report(const char *name, double ms, size_t total)
+    {
+        std::printf("%-12s %8.2f ms, %6.2f MB/s\n", name, ms, total / ms / 1000.0);
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const size_t total      = (argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 16) * 1024 * 1024;
+    const double device_mbps = argc > 2 ? std::strtod(argv[2], nullptr) : 20;
+    const double cpu_mbps   = argc > 3 ? std::strtod(argv[3], nullptr) : 25;
+    const size_t chunk      = (argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 16) * 1024;
+    if (chunk == 0 || chunk % sector_size || total % chunk) {
+        std::fprintf(stderr, "chunk has to be a multiply of %zu dividing the total size\n", sector_size);
+        return 1;
+    }
+    std::printf("%zu bytes in %zu byte writes, device %.1f MB/s, producer %.1f MB/s\n",
+                total,
+                chunk,
+                device_mbps,
+                cpu_mbps);
+
+    unsigned char md5_blocking[16];
+    sim_device blocking_dev(total / sector_size, device_mbps);
+    const auto blocking = run(
+        total,
+        chunk,
+        cpu_mbps,
+        [&](lba_t lba, blk_size_t count, const void *buf) {
+            const int err = blocking_dev.start(lba, count, buf);
+            return err ? err : blocking_dev.wait();
+        },
+        md5_blocking);
+    report("blocking", blocking, total);
+
+    unsigned char md5_behind[16];
+    sim_device behind_dev(total / sector_size, device_mbps);
+    struct write_behind wb;
+    if (write_behind_init(&wb, &sim_ops, &behind_dev, 64 * 1024, sector_size) != 0) {
+        std::fprintf(stderr, "unable to allocate write behind buffers\n");
+        return 1;
+    }
+    const auto behind = run(
+        total,
+        chunk,
+        cpu_mbps,
+        [&](lba_t lba, blk_size_t count, const void *buf) { return write_behind_write(&wb, lba, count, buf); },
+        md5_behind);
+    const auto flushed = clock_type::now();
+    write_behind_free(&wb);
+    const std::chrono::duration<double, std::milli> flush = clock_type::now() - flushed;
+    report("write behind", behind + flush.count(), total);
+    std::printf("speedup: %.2fx\n", behind > 0 ? blocking / (behind + flush.count()) : 0.0);
+
+    const bool same = blocking_dev.data() == behind_dev.data() && std::memcmp(md5_blocking, md5_behind, 16) == 0;
+    std::printf("device content: %s\n", same ? "identical" : "DIFFERENT");
+    return same ? 0 : 1;
+}
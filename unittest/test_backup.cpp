@@ -2,8 +2,17 @@
 #include <boost/process/system.hpp>
 #include <boost/test/unit_test.hpp>
 #define BOOST_TEST_MODULE test backup boot partition
+#include <chrono>
+#include <fstream>
+#include <map>
+#include <set>
+#include <sstream>
+#include <vector>
 #include "helper.hpp"
 #include "dir_fixture.hpp"
+#include <common/tar.h>
+#include "backup_manifest.h"
+#include "backup_store.h"
 #include "priv_backup.h"
 
 BOOST_FIXTURE_TEST_CASE(backup_success, Firmware)
@@ -16,8 +25,11 @@ BOOST_FIXTURE_TEST_CASE(backup_success, Firmware)
     h.backup_from_user = from.c_str();
     h.backup_to = end_tar.c_str();
 
-    BOOST_TEST(backup_boot_partition(&h) == true, "we can write data from: "<<from<<" to: " << end_tar );
-    BOOST_TEST(backup_user_data(&h) == true, "we can append data from: "<<from<<" to: " << end_tar );
+    struct backup_session_s session;
+    BOOST_REQUIRE(backup_session_open(&session, end_tar.c_str()));
+    BOOST_TEST(backup_boot_partition(&h, &session) == true, "we can write data from: "<<from<<" to: " << end_tar );
+    BOOST_TEST(backup_user_data(&h, &session) == true, "we can append data from: "<<from<<" to: " << end_tar );
+    BOOST_TEST(backup_session_close(&session, true));
     BOOST_TEST(std::filesystem::exists(end_tar));
 
     unpack(end_tar, disk.drive);
@@ -25,3 +37,358 @@ BOOST_FIXTURE_TEST_CASE(backup_success, Firmware)
     BOOST_TEST(std::filesystem::exists(disk.drive + "version.json"));
     BOOST_TEST(std::filesystem::exists(disk.drive + "country-codes.db"));
 }
+
+namespace
+{
+    /// entry data read straight from the position of the index
+    std::string read_at(const std::string &archive, const struct backup_manifest_entry_s *entry, std::string &name)
+    {
+        struct tar_ctx ctx;
+        mtar_header_t header;
+        std::string data;
+        if (tar_init(&ctx, archive.c_str(), "r") == ErrorTarOk && tar_seek_position(&ctx, &entry->position) == ErrorTarOk &&
+            tar_read_header(&ctx, &header) == ErrorTarOk) {
+            name              = header.name;
+            const void *chunk = nullptr;
+            size_t size       = 0;
+            while (tar_read_data(&ctx, &chunk, &size) == ErrorTarOk && size > 0) {
+                data.append(static_cast<const char *>(chunk), size);
+            }
+        }
+        tar_deinit(&ctx);
+        return data;
+    }
+
+    void touch_later(const std::string &path)
+    {
+        std::filesystem::last_write_time(path, std::filesystem::last_write_time(path) + std::chrono::seconds(5));
+    }
+
+    std::set<std::filesystem::path> chunk_paths(const std::filesystem::path &store)
+    {
+        std::set<std::filesystem::path> paths;
+        for (const auto &entry : std::filesystem::recursive_directory_iterator(store / BACKUP_STORE_CHUNKS)) {
+            if (entry.is_regular_file()) {
+                paths.insert(entry.path());
+            }
+        }
+        return paths;
+    }
+
+    size_t chunk_files(const std::filesystem::path &store)
+    {
+        return chunk_paths(store).size();
+    }
+
+    std::string file_data(const std::string &path)
+    {
+        std::stringstream data;
+        data << std::ifstream(path, std::ios::binary).rdbuf();
+        return data.str();
+    }
+} // namespace
+
+BOOST_AUTO_TEST_CASE(backup_user_data_incremental)
+{
+    const std::filesystem::path root{std::string(BUILD_DIR) + "/backup_incremental"};
+    const auto user    = (root / "user").string();
+    const auto archive = (root / "backup.tar").string();
+    const auto out     = (root / "out").string();
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(user);
+    std::filesystem::create_directories(out);
+    std::ofstream(user + "/notes.db") << "old notes";
+    std::ofstream(user + "/updater.log") << "log";
+    std::ofstream(user + "/skipped.txt") << "not backed up";
+
+    struct backup_handle_s h {};
+    h.backup_from_os   = user.c_str();
+    h.backup_from_user = user.c_str();
+    h.backup_to        = archive.c_str();
+    h.boot_in_slot     = true;
+    unsigned long long estimate = 0;
+    BOOST_REQUIRE(backup_estimate_size(&h, &estimate));
+    BOOST_REQUIRE(backup_previous_firmware(&h));
+    /// 2 files, index, trailer and the end record
+    const auto full = std::filesystem::file_size(archive);
+    BOOST_TEST(full > 8 * TAR_RECORD_SIZE);
+    BOOST_TEST(full < 9 * TAR_RECORD_SIZE);
+    BOOST_TEST(estimate >= full);
+
+    struct backup_manifest_s manifest;
+    backup_manifest_init(&manifest);
+    BOOST_TEST(backup_manifest_read(&manifest, archive.c_str()) == 0);
+    BOOST_TEST(manifest.count == 2);
+    const auto *notes = backup_manifest_find(&manifest, "notes.db");
+    BOOST_REQUIRE(notes != nullptr);
+    BOOST_TEST(notes->size == 9);
+    std::string name;
+    BOOST_TEST(read_at(archive, notes, name) == "old notes");
+    BOOST_TEST(name == "notes.db");
+    BOOST_TEST(backup_manifest_find(&manifest, "skipped.txt") == nullptr);
+    backup_manifest_free(&manifest);
+
+    /// nothing changed - only the index is appended
+    unsigned long long unchanged = 0;
+    BOOST_REQUIRE(backup_estimate_size(&h, &unchanged));
+    BOOST_TEST(unchanged < estimate);
+    BOOST_REQUIRE(backup_previous_firmware(&h));
+    BOOST_TEST(std::filesystem::file_size(archive) == full + 2 * TAR_RECORD_SIZE);
+
+    /// only the changed file is appended, the last entry wins on unpack
+    std::ofstream(user + "/notes.db") << "new notes, longer";
+    touch_later(user + "/notes.db");
+    BOOST_REQUIRE(backup_previous_firmware(&h));
+    BOOST_TEST(std::filesystem::file_size(archive) == full + 6 * TAR_RECORD_SIZE);
+    unpack(archive, out);
+    std::stringstream notes_data;
+    notes_data << std::ifstream(out + "/notes.db").rdbuf();
+    BOOST_TEST(notes_data.str() == "new notes, longer");
+
+    backup_manifest_init(&manifest);
+    BOOST_TEST(backup_manifest_read(&manifest, archive.c_str()) == 0);
+    BOOST_TEST(manifest.count == 2);
+    notes = backup_manifest_find(&manifest, "notes.db");
+    BOOST_REQUIRE(notes != nullptr);
+    BOOST_TEST(read_at(archive, notes, name) == "new notes, longer");
+    backup_manifest_free(&manifest);
+
+    /// archive is gone with its index - everything is appended
+    std::filesystem::remove(archive);
+    BOOST_REQUIRE(backup_previous_firmware(&h));
+    BOOST_TEST(std::filesystem::file_size(archive) == full);
+
+    /// sessions only append - the archive grown over the bound is written anew with the files only
+    auto largest = full;
+    for (int session = 0; session < 20; ++session) {
+        BOOST_REQUIRE(backup_previous_firmware(&h));
+        if (std::filesystem::file_size(archive) < largest) {
+            break;
+        }
+        largest = std::filesystem::file_size(archive);
+    }
+    BOOST_TEST(std::filesystem::file_size(archive) == full);
+    BOOST_TEST(largest <= full * BACKUP_ARCHIVE_COMPACT_RATIO + 2 * TAR_RECORD_SIZE);
+    BOOST_TEST(!std::filesystem::exists(root / "compact_backup.tar"));
+    std::filesystem::remove_all(out);
+    std::filesystem::create_directories(out);
+    unpack(archive, out);
+    notes_data.str("");
+    notes_data << std::ifstream(out + "/notes.db").rdbuf();
+    BOOST_TEST(notes_data.str() == "new notes, longer");
+}
+
+BOOST_AUTO_TEST_CASE(backup_user_data_compressed)
+{
+    const std::filesystem::path root{std::string(BUILD_DIR) + "/backup_compressed"};
+    const auto user    = (root / "user").string();
+    const auto archive = (root / "backup.tar" TAR_LZ4_EXTENSION).string();
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(user);
+    std::ofstream(user + "/notes.db") << std::string(100000, 'n');
+    std::ofstream(user + "/updater.log") << "log";
+
+    struct backup_handle_s h {};
+    h.backup_from_os   = user.c_str();
+    h.backup_from_user = user.c_str();
+    h.backup_to        = archive.c_str();
+    h.boot_in_slot     = true;
+    BOOST_REQUIRE(backup_previous_firmware(&h));
+    const auto compressed = std::filesystem::file_size(archive);
+    BOOST_TEST(compressed < 10000);
+
+    /// unchanged files are found in the index of the compressed archive, only the index is appended
+    BOOST_REQUIRE(backup_previous_firmware(&h));
+    BOOST_TEST(std::filesystem::file_size(archive) < compressed + 1000);
+
+    std::ofstream(user + "/updater.log") << "new log";
+    touch_later(user + "/updater.log");
+    BOOST_REQUIRE(backup_previous_firmware(&h));
+
+    struct tar_ctx ctx;
+    mtar_header_t header;
+    std::map<std::string, std::string> entries;
+    BOOST_REQUIRE(tar_init(&ctx, archive.c_str(), "r") == ErrorTarOk);
+    while (tar_read_header(&ctx, &header) == ErrorTarOk) {
+        std::string data;
+        const void *chunk = nullptr;
+        size_t size       = 0;
+        while (tar_read_data(&ctx, &chunk, &size) == ErrorTarOk && size > 0) {
+            data.append(static_cast<const char *>(chunk), size);
+        }
+        entries[header.name] = data;
+    }
+    BOOST_TEST(tar_deinit(&ctx) == 0);
+    BOOST_TEST(entries.size() == 3);
+    BOOST_TEST(entries["notes.db"] == std::string(100000, 'n'));
+    BOOST_TEST(entries["updater.log"] == "new log");
+    BOOST_TEST(entries.count(BACKUP_INDEX_NAME) == 1);
+
+    /// every file of the index is read from its own frame
+    struct backup_manifest_s manifest;
+    backup_manifest_init(&manifest);
+    BOOST_TEST(backup_manifest_read(&manifest, archive.c_str()) == 0);
+    BOOST_TEST(manifest.count == 2);
+    for (size_t i = 0; i < manifest.count; ++i) {
+        std::string name;
+        const auto data = read_at(archive, &manifest.entries[i], name);
+        BOOST_TEST(name == backup_manifest_name(&manifest, &manifest.entries[i]));
+        BOOST_TEST(data == entries[name]);
+    }
+    backup_manifest_free(&manifest);
+}
+
+BOOST_AUTO_TEST_CASE(backup_restore_changed_files)
+{
+    const std::filesystem::path root{std::string(BUILD_DIR) + "/backup_restore"};
+    const auto os      = (root / "os").string();
+    const auto user    = (root / "user").string();
+    const auto archive = (root / "backup.tar" TAR_LZ4_EXTENSION).string();
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(os);
+    std::filesystem::create_directories(user);
+    std::ofstream(os + "/boot.bin") << std::string(70000, 'b');
+    std::ofstream(os + "/updater.bin") << "updater";
+    std::ofstream(os + "/version.json") << "{}";
+    std::ofstream(user + "/notes.db") << std::string(100000, 'n');
+    std::ofstream(user + "/updater.log") << "log";
+
+    struct backup_handle_s h {};
+    h.backup_from_os   = os.c_str();
+    h.backup_from_user = user.c_str();
+    h.backup_to        = archive.c_str();
+    struct backup_restore_result_s result;
+    BOOST_TEST(!backup_restore_changed(&h, &result), "no backup, no index");
+    BOOST_REQUIRE(backup_previous_firmware(&h));
+
+    /// nothing differs - files are hashed, nothing is read from the backup
+    BOOST_REQUIRE(backup_restore_changed(&h, &result));
+    BOOST_TEST(result.checked_files == 5);
+    BOOST_TEST(result.restored_files == 0);
+
+    /// same size different content and a missing file
+    std::ofstream(os + "/boot.bin") << std::string(69999, 'b') << 'x';
+    std::filesystem::remove(user + "/updater.log");
+    BOOST_REQUIRE(backup_restore_changed(&h, &result));
+    BOOST_TEST(result.restored_files == 2);
+    BOOST_TEST(result.restored_bytes == 70000 + 3);
+    std::stringstream boot;
+    boot << std::ifstream(os + "/boot.bin").rdbuf();
+    BOOST_TEST(boot.str() == std::string(70000, 'b'));
+    std::stringstream log;
+    log << std::ifstream(user + "/updater.log").rdbuf();
+    BOOST_TEST(log.str() == "log");
+    BOOST_TEST(!std::filesystem::exists(os + "/boot.bin.restore"));
+
+    BOOST_REQUIRE(backup_restore_changed(&h, &result));
+    BOOST_TEST(result.restored_files == 0);
+}
+
+BOOST_AUTO_TEST_CASE(backup_store_generations)
+{
+    const std::filesystem::path root{std::string(BUILD_DIR) + "/backup_store"};
+    const auto os      = (root / "os").string();
+    const auto user    = (root / "user").string();
+    const auto store   = (root / "store").string();
+    const auto archive = (root / "backup.tar").string();
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(os);
+    std::filesystem::create_directories(user);
+    std::string notes(4 * BACKUP_STORE_CHUNK_SIZE - 100, ' ');
+    for (size_t i = 0; i < notes.size(); ++i) {
+        notes[i] = static_cast<char>('a' + (i / 1000) % 26);
+    }
+    std::ofstream(user + "/notes.db", std::ios::binary) << notes;
+    std::ofstream(user + "/updater.log") << "log";
+    std::ofstream(os + "/boot.bin") << "boot";
+    std::ofstream(archive) << "previous archive";
+
+    struct backup_handle_s h {};
+    h.backup_from_os   = os.c_str();
+    h.backup_from_user = user.c_str();
+    h.backup_to        = archive.c_str();
+    h.backup_store     = store.c_str();
+    unsigned long long estimate = 0;
+    BOOST_REQUIRE(backup_estimate_size(&h, &estimate));
+    BOOST_TEST(estimate >= notes.size() + 7);
+    BOOST_REQUIRE(backup_previous_firmware(&h));
+    BOOST_TEST(!std::filesystem::exists(archive), "archive is superseded by the store");
+    unsigned latest = 0;
+    BOOST_REQUIRE(backup_store_latest(store.c_str(), &latest) == ErrorBackupStoreOk);
+    BOOST_TEST(latest == 1);
+    BOOST_TEST(chunk_files(store) == 4 + 2);
+
+    /// nothing changed - a generation without new chunks, nothing is read
+    BOOST_REQUIRE(backup_estimate_size(&h, &estimate));
+    BOOST_TEST(estimate < 1024);
+    BOOST_REQUIRE(backup_previous_firmware(&h));
+    BOOST_TEST(chunk_files(store) == 4 + 2);
+
+    /// one chunk of the database changed - one chunk is written
+    notes[BACKUP_STORE_CHUNK_SIZE + 10] = '!';
+    std::ofstream(user + "/notes.db", std::ios::binary) << notes;
+    touch_later(user + "/notes.db");
+    BOOST_REQUIRE(backup_previous_firmware(&h));
+    BOOST_TEST(chunk_files(store) == 4 + 2 + 1);
+
+    struct backup_store_generation_s generation;
+    backup_store_generation_init(&generation);
+    BOOST_REQUIRE(backup_store_generation_load(store.c_str(), 3, &generation) == ErrorBackupStoreOk);
+    BOOST_TEST(generation.count == 3);
+    const auto *file = backup_store_find(&generation, "notes.db");
+    BOOST_REQUIRE(file != nullptr);
+    BOOST_TEST(file->size == notes.size());
+    BOOST_TEST(file->chunk_count == 4);
+    backup_store_generation_free(&generation);
+
+    /// generations 1 and 2 go with the chunk only they had
+    BOOST_REQUIRE(backup_previous_firmware(&h));
+    BOOST_REQUIRE(backup_previous_firmware(&h));
+    BOOST_TEST(!std::filesystem::exists(root / "store" / BACKUP_STORE_GENERATION_LIST / "1.gen"));
+    BOOST_TEST(!std::filesystem::exists(root / "store" / BACKUP_STORE_GENERATION_LIST / "2.gen"));
+    BOOST_TEST(std::filesystem::exists(root / "store" / BACKUP_STORE_GENERATION_LIST / "3.gen"));
+    BOOST_TEST(chunk_files(store) == 4 + 2);
+
+    /// restore reads only the broken files from the latest generation
+    std::ofstream(user + "/notes.db", std::ios::binary) << notes.substr(0, 1000);
+    std::filesystem::remove(os + "/boot.bin");
+    struct backup_restore_result_s result;
+    BOOST_REQUIRE(backup_restore_changed(&h, &result));
+    BOOST_TEST(result.checked_files == 3);
+    BOOST_TEST(result.restored_files == 2);
+    BOOST_TEST(file_data(user + "/notes.db") == notes);
+    BOOST_TEST(file_data(os + "/boot.bin") == "boot");
+
+    /// chunk only the latest generation has is damaged - the previous generation is restored
+    const auto previous = notes;
+    const auto kept = chunk_paths(store);
+    notes[10] = '!';
+    std::ofstream(user + "/notes.db", std::ios::binary) << notes;
+    /// the last backup has the mtime of one touch_later
+    touch_later(user + "/notes.db");
+    touch_later(user + "/notes.db");
+    BOOST_REQUIRE(backup_previous_firmware(&h));
+    std::vector<std::filesystem::path> added;
+    for (const auto &path : chunk_paths(store)) {
+        if (kept.count(path) == 0) {
+            added.push_back(path);
+        }
+    }
+    BOOST_REQUIRE(added.size() == 1);
+    std::ofstream(added.front(), std::ios::binary | std::ios::in | std::ios::out) << "x";
+    std::ofstream(user + "/notes.db", std::ios::binary) << "broken";
+    BOOST_REQUIRE(backup_restore_changed(&h, &result));
+    BOOST_TEST(result.generation == 5);
+    BOOST_TEST(file_data(user + "/notes.db") == previous);
+    BOOST_TEST(!std::filesystem::exists(user + "/notes.db.restore"));
+
+    /// damaged chunk all the generations have isn't restored
+    std::ofstream(user + "/notes.db", std::ios::binary) << "broken";
+    for (const auto &entry : std::filesystem::recursive_directory_iterator(root / "store" / BACKUP_STORE_CHUNKS)) {
+        if (entry.is_regular_file()) {
+            std::ofstream(entry.path(), std::ios::binary | std::ios::in | std::ios::out) << "x";
+        }
+    }
+    BOOST_TEST(!backup_restore_changed(&h, &result));
+    BOOST_TEST(file_data(user + "/notes.db") == "broken");
+}
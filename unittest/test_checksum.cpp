@@ -16,6 +16,28 @@ BOOST_FIXTURE_TEST_CASE(checksum_verify_test, TestsConsts)
     BOOST_TEST(checksum_verify(&handle));
 }
 
+BOOST_FIXTURE_TEST_CASE(checksum_verify_digest_test, TestsConsts)
+{
+    verify_file_handle_s handle;
+    handle.file_to_verify = test_checksum_file_path.c_str();
+    handle.version_json = json_get_version_struct(test_json_path.c_str());
+
+    checksum_digests_s digests = {};
+    unsigned char checksum[CHECKSUM_MD5_SIZE];
+    MD5_File(checksum, test_checksum_file_path.c_str());
+    /// same name deeper in the package is another file
+    checksum_digest_store(&digests, "assets/updater.bin", checksum);
+    BOOST_TEST(!digests.valid[0]);
+    checksum_digest_store(&digests, "./updater.bin", checksum);
+    BOOST_TEST(digests.valid[0]);
+
+    BOOST_TEST(checksum_verify_digest(&handle, checksum));
+    BOOST_TEST(checksum_verify_all(&handle, &digests, "/nonexistent"));
+
+    checksum[0] ^= 0xff;
+    BOOST_TEST(checksum_verify_digest(&handle, checksum) == false);
+}
+
 BOOST_FIXTURE_TEST_CASE(checksum_compare_test, TestsConsts)
 {
     BOOST_TEST(checksum_compare(mock_checksum1.c_str(),mock_checksum1.c_str()) == true);
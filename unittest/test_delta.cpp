@@ -0,0 +1,107 @@
+#include <boost/process/system.hpp>
+#include <boost/test/unit_test.hpp>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <common/delta.h>
+#define BOOST_TEST_MODULE test delta
+
+#if !defined(BUILD_DIR) || !defined(DELTA_GEN)
+#error Requires build dir and delta generator
+#endif
+
+/// installed file and its patched version: changed, inserted and removed ranges
+struct DeltaFiles
+{
+    std::filesystem::path root{std::string(BUILD_DIR) + "/delta_files"};
+    std::string source = (root / "boot.bin").string();
+    std::string target = (root / "new" / "boot.bin").string();
+    std::string delta  = (root / "boot.bin.delta").string();
+    std::string output = (root / "out.bin").string();
+    std::string target_content;
+
+    DeltaFiles()
+    {
+        std::filesystem::remove_all(root);
+        std::filesystem::create_directories(root / "new");
+        std::mt19937 gen(8);
+        std::string content(2 * 1024 * 1024, '\0');
+        for (auto &c : content) {
+            c = static_cast<char>(gen());
+        }
+        target_content = content;
+        for (size_t i = 1000; i < 1100; ++i) {
+            target_content[i] = 'x';
+        }
+        target_content.insert(500000, std::string(3333, 'i'));
+        target_content.erase(1500000, 10000);
+        target_content += "appended";
+
+        std::ofstream(source, std::ios::binary) << content;
+        std::ofstream(target, std::ios::binary) << target_content;
+        const auto code = boost::process::system(std::string(DELTA_GEN) + " " + source + " " + target + " " + delta);
+        BOOST_ASSERT(code == 0);
+    }
+
+    ~DeltaFiles()
+    {
+        std::filesystem::remove_all(root);
+    }
+
+    static std::string read(const std::string &path)
+    {
+        std::ostringstream ss;
+        ss << std::ifstream(path, std::ios::binary).rdbuf();
+        return ss.str();
+    }
+
+    /// apply delta content fed in chunks of given size
+    int apply(const std::string &delta_content, const std::string &from, size_t chunk, unsigned char *md5)
+    {
+        struct delta_apply_s apply;
+        int ret = delta_apply_init(&apply, from.c_str(), output.c_str());
+        for (size_t i = 0; ret == ErrorDeltaOk && i < delta_content.size(); i += chunk) {
+            ret = delta_apply_feed(&apply, delta_content.data() + i, std::min(chunk, delta_content.size() - i));
+        }
+        if (ret == ErrorDeltaOk) {
+            ret = delta_apply_finish(&apply, md5);
+        }
+        delta_apply_deinit(&apply);
+        return ret;
+    }
+};
+
+BOOST_FIXTURE_TEST_CASE(delta_rebuilds_target, DeltaFiles)
+{
+    const auto delta_content = read(delta);
+    BOOST_TEST(delta_content.size() < target_content.size() / 100);
+
+    for (size_t chunk : {1UL, 7UL, 4096UL, delta_content.size()}) {
+        unsigned char md5[DELTA_MD5_SIZE];
+        unsigned char expected[DELTA_MD5_SIZE];
+        std::filesystem::remove(output);
+        BOOST_TEST(apply(delta_content, source, chunk, md5) == ErrorDeltaOk);
+        BOOST_TEST((read(output) == target_content));
+        MD5_CTX ctx;
+        MD5_Init(&ctx);
+        MD5_Update(&ctx, target_content.data(), target_content.size());
+        MD5_Final(expected, &ctx);
+        BOOST_TEST(memcmp(md5, expected, sizeof md5) == 0);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(delta_wrong_source, DeltaFiles)
+{
+    unsigned char md5[DELTA_MD5_SIZE];
+    BOOST_TEST(apply(read(delta), target, 4096, md5) == ErrorDeltaSource);
+}
+
+BOOST_FIXTURE_TEST_CASE(delta_truncated, DeltaFiles)
+{
+    unsigned char md5[DELTA_MD5_SIZE];
+    const auto delta_content = read(delta);
+    BOOST_TEST(apply(delta_content.substr(0, delta_content.size() - 1), source, 4096, md5) == ErrorDeltaFormat);
+    BOOST_TEST(apply(delta_content + "x", source, 4096, md5) == ErrorDeltaFormat);
+}
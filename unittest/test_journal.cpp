@@ -0,0 +1,170 @@
+#include <boost/process/system.hpp>
+#include <boost/test/unit_test.hpp>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include "priv_update.h"
+#include "priv_journal.h"
+#define BOOST_TEST_MODULE test journal
+
+#ifndef BUILD_DIR
+#error Requires build dir to create test files
+#endif
+
+/// package with files large enough to be journaled during unpack
+struct JournalPackage
+{
+    std::filesystem::path root{std::string(BUILD_DIR) + "/journal_package"};
+    std::string package = (root / "update.tar").string();
+    std::string journal_path = (root / "update.journal").string();
+    std::string user     = (root / "user").string();
+    std::string os       = (root / "os").string();
+    std::string tmp_user = (root / "user" / "tmp").string();
+    std::string tmp_os   = (root / "os" / "tmp").string();
+    struct tar_index_s index;
+
+    JournalPackage()
+    {
+        std::filesystem::remove_all(root);
+        std::filesystem::create_directories(root / "data" / "assets");
+        std::filesystem::create_directories(tmp_user);
+        std::filesystem::create_directories(tmp_os);
+        for (char c = 'a'; c <= 'h'; ++c) {
+            std::ofstream(root / "data" / "assets" / std::string(1, c)) << std::string(700 * 1024 + c, c);
+        }
+        build(index);
+        /// tmp files are resumed only for a package bound to its content
+        std::ofstream(package + ".sig") << "signature";
+    }
+
+    void build(struct tar_index_s &built)
+    {
+        const auto code = boost::process::system("tar -cf " + package + " -C " + (root / "data").string() + " .");
+        BOOST_ASSERT(code == 0);
+        BOOST_ASSERT(tar_index_build(&built, package.c_str(), unpack_destination) == ErrorTarOk);
+    }
+
+    ~JournalPackage()
+    {
+        tar_index_free(&index);
+        std::filesystem::remove_all(root);
+    }
+
+    struct update_handle_s handle()
+    {
+        struct update_handle_s h;
+        update_firmware_init(&h);
+        h.update_from = package.c_str();
+        h.update_os   = os.c_str();
+        h.update_user = user.c_str();
+        h.tmp_os      = tmp_os.c_str();
+        h.tmp_user    = tmp_user.c_str();
+        h.journal     = journal_path.c_str();
+        return h;
+    }
+};
+
+BOOST_FIXTURE_TEST_CASE(journal_phases, JournalPackage)
+{
+    struct journal_s journal;
+    journal_open(&journal, journal_path.c_str(), package.c_str(), &index);
+    BOOST_TEST(!journal_has(&journal, JournalBackup));
+    BOOST_TEST(journal_phase(&journal, JournalBackup));
+    BOOST_TEST(journal_phase(&journal, JournalCatalog));
+
+    journal_open(&journal, journal_path.c_str(), package.c_str(), &index);
+    BOOST_TEST(journal_has(&journal, JournalBackup));
+    BOOST_TEST(journal_has(&journal, JournalCatalog));
+    BOOST_TEST(!journal_has(&journal, JournalUnpacked));
+
+    /// journal of another package is dropped
+    struct tar_index_s other = index;
+    other.total_bytes += 1;
+    journal_open(&journal, journal_path.c_str(), package.c_str(), &other);
+    BOOST_TEST(!journal_has(&journal, JournalBackup));
+
+    /// package rebuilt with the same layout and sizes is another package
+    journal_open(&journal, journal_path.c_str(), package.c_str(), &index);
+    BOOST_TEST(journal_phase(&journal, JournalBackup));
+    const auto changed = root / "data" / "assets" / "a";
+    std::ofstream(changed, std::ios::binary | std::ios::in | std::ios::out) << "b";
+    std::filesystem::last_write_time(changed, std::filesystem::last_write_time(changed) + std::chrono::hours(1));
+    struct tar_index_s rebuilt;
+    build(rebuilt);
+    BOOST_TEST(tar_index_id(&rebuilt) == tar_index_id(&index));
+    journal_open(&journal, journal_path.c_str(), package.c_str(), &rebuilt);
+    BOOST_TEST(!journal_has(&journal, JournalBackup));
+    BOOST_TEST(!std::filesystem::exists(journal_path));
+
+    /// so is the package with another signature
+    BOOST_TEST(journal_phase(&journal, JournalBackup));
+    std::ofstream(package + ".sig") << "other signature";
+    journal_open(&journal, journal_path.c_str(), package.c_str(), &rebuilt);
+    BOOST_TEST(!journal_has(&journal, JournalBackup));
+    BOOST_TEST(journal_phase(&journal, JournalBackup));
+    journal_open(&journal, journal_path.c_str(), package.c_str(), &rebuilt);
+    BOOST_TEST(journal_has(&journal, JournalBackup));
+
+    /// package without signature and digests is never resumed
+    std::filesystem::remove(package + ".sig");
+    journal_open(&journal, journal_path.c_str(), package.c_str(), &rebuilt);
+    BOOST_TEST(!journal_has(&journal, JournalBackup));
+    BOOST_TEST(journal_phase(&journal, JournalBackup));
+    BOOST_TEST(!std::filesystem::exists(journal_path));
+    tar_index_free(&rebuilt);
+
+    std::ofstream(package + ".sig") << "other signature";
+    journal_open(&journal, journal_path.c_str(), package.c_str(), &index);
+    BOOST_TEST(journal_phase(&journal, JournalBackup));
+    /// corrupted journal is dropped
+    std::fstream(journal_path, std::ios::in | std::ios::out | std::ios::binary).write("X", 1);
+    journal_open(&journal, journal_path.c_str(), package.c_str(), &index);
+    BOOST_TEST(!journal_has(&journal, JournalBackup));
+
+    journal_remove(&journal);
+    BOOST_TEST(!std::filesystem::exists(journal_path));
+}
+
+BOOST_FIXTURE_TEST_CASE(unpack_resumed_from_journal, JournalPackage)
+{
+    auto h = handle();
+    struct journal_s journal;
+    struct unpack_result_s full;
+    journal_open(&journal, h.journal, h.update_from, &index);
+    journal_phase(&journal, JournalCatalog);
+    BOOST_TEST(unpack(&h, &index, nullptr, &journal, true, nullptr, &full));
+    BOOST_TEST(!full.resumed);
+
+    /// files after the journaled entry were not written before the power loss
+    journal_open(&journal, h.journal, h.update_from, &index);
+    const size_t resume = journal_resume(&journal, &h, &index);
+    BOOST_REQUIRE(resume > 0);
+    BOOST_REQUIRE(resume < index.count);
+    for (size_t i = resume; i < index.count; ++i) {
+        if (index.entries[i].type == MTAR_TREG) {
+            std::filesystem::remove(tmp_os + "/" + tar_index_name(&index, &index.entries[i]));
+        }
+    }
+
+    struct unpack_result_s resumed;
+    BOOST_TEST(unpack(&h, &index, nullptr, &journal, true, nullptr, &resumed));
+    BOOST_TEST(resumed.resumed);
+    for (char c = 'a'; c <= 'h'; ++c) {
+        BOOST_TEST(std::filesystem::file_size(tmp_os + "/assets/" + std::string(1, c)) == 700 * 1024 + c);
+    }
+    BOOST_TEST(resumed.package_hash_valid);
+    BOOST_TEST(memcmp(&resumed.package_hash, &full.package_hash, sizeof full.package_hash) == 0);
+
+    /// changed file in tmp - nothing is trusted, unpack starts over
+    journal_open(&journal, h.journal, h.update_from, &index);
+    BOOST_REQUIRE(journal_resume(&journal, &h, &index) > 0);
+    const std::string last = tmp_os + "/" + tar_index_name(&index, &index.entries[journal.record.last_file]);
+    std::ofstream(last, std::ios::binary | std::ios::in | std::ios::out).write("X", 1);
+    BOOST_TEST(journal_resume(&journal, &h, &index) == 0);
+
+    unpack_result_free(&full);
+    unpack_result_free(&resumed);
+}
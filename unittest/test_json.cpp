@@ -44,3 +44,14 @@ BOOST_FIXTURE_TEST_CASE(json_get_version_struct_test, TestsConsts)
 }
 
 
+
+BOOST_AUTO_TEST_CASE(json_get_version_struct_from_string_test)
+{
+    const char *json_str = R"({"boot": {"filename": "boot.bin", "md5sum": "123", "version": "1.0.12"}})";
+    version_json_s version_json = json_get_version_struct_from_string(json_str);
+
+    BOOST_TEST(version_json.boot.valid);
+    BOOST_TEST(strcmp(version_json.boot.name, "boot.bin") == 0);
+    BOOST_TEST(strcmp(version_json.boot.md5sum, "123") == 0);
+    BOOST_TEST(strcmp(version_json.boot.version, "1.0.12") == 0);
+}
@@ -0,0 +1,178 @@
+#include <boost/process/system.hpp>
+#include <boost/test/unit_test.hpp>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <algorithm>
+#include <iterator>
+#include <random>
+#include <string>
+#include <vector>
+#include <common/lz4_frame.h>
+#define BOOST_TEST_MODULE test lz4
+
+#ifndef BUILD_DIR
+#error Requires build dir to create compressed files
+#endif
+
+/// mix of compressible text and random data, compressed with the lz4 cli
+struct Lz4Files
+{
+    std::filesystem::path root{std::string(BUILD_DIR) + "/lz4_files"};
+    std::string plain = (root / "data").string();
+    std::string content;
+
+    Lz4Files()
+    {
+        std::filesystem::remove_all(root);
+        std::filesystem::create_directories(root);
+        std::mt19937 gen(4);
+        for (int i = 0; i < 40000; ++i) {
+            content += "line " + std::to_string(i) + " repeated text " + std::to_string(i % 97) + "\n";
+        }
+        for (int i = 0; i < 300000; ++i) {
+            content += static_cast<char>(gen());
+        }
+        std::ofstream(plain, std::ios::binary) << content;
+    }
+
+    ~Lz4Files()
+    {
+        std::filesystem::remove_all(root);
+    }
+
+    std::string compress(const std::string &options, const std::string &name)
+    {
+        const auto out  = (root / name).string();
+        const auto code = boost::process::system("lz4 -q -f " + options + " " + plain + " " + out);
+        BOOST_REQUIRE(code == 0);
+        return out;
+    }
+};
+
+struct FileSource
+{
+    FILE *file;
+    static ssize_t read(void *arg, void *buf, size_t size)
+    {
+        return std::fread(buf, 1, size, static_cast<FileSource *>(arg)->file);
+    }
+};
+
+/// decode the whole file with reads of odd size, returns false on decoder error
+static bool decode(const std::string &path, std::string &out, size_t chunk = 7777)
+{
+    FileSource source{std::fopen(path.c_str(), "rb")};
+    BOOST_REQUIRE(source.file != nullptr);
+    struct lz4_frame_s frame;
+    lz4_frame_init(&frame, FileSource::read, &source);
+    std::vector<char> buffer(chunk);
+    ssize_t ret = 0;
+    while ((ret = lz4_frame_read(&frame, buffer.data(), buffer.size())) > 0) {
+        out.append(buffer.data(), ret);
+    }
+    lz4_frame_deinit(&frame);
+    std::fclose(source.file);
+    return ret == 0;
+}
+
+BOOST_FIXTURE_TEST_CASE(lz4_frame_options, Lz4Files)
+{
+    const std::vector<std::string> options = {
+        "-B4", "-B4 -BD", "-B5 -BX", "-B6 -BD --content-size", "-B4 --no-frame-crc", "-9 -B4 -BD",
+    };
+    for (size_t i = 0; i < options.size(); ++i) {
+        std::string out;
+        BOOST_TEST(decode(compress(options[i], "data" + std::to_string(i) + ".lz4"), out), options[i]);
+        BOOST_TEST((out == content), options[i]);
+    }
+}
+
+BOOST_FIXTURE_TEST_CASE(lz4_concatenated_frames, Lz4Files)
+{
+    const auto first  = compress("-B4 -BD", "first.lz4");
+    const auto second = compress("-B5", "second.lz4");
+    const auto both   = (root / "both.lz4").string();
+    {
+        std::ofstream out(both, std::ios::binary);
+        out << std::ifstream(first, std::ios::binary).rdbuf() << std::ifstream(second, std::ios::binary).rdbuf();
+    }
+    std::string out;
+    BOOST_TEST(decode(both, out, 1));
+    BOOST_TEST((out == content + content));
+}
+
+BOOST_FIXTURE_TEST_CASE(lz4_corrupted, Lz4Files)
+{
+    const auto path = compress("-B4 -BD", "corrupted.lz4");
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(50000);
+        file.put('\xff');
+    }
+    std::string out;
+    BOOST_TEST(!decode(path, out));
+}
+
+BOOST_FIXTURE_TEST_CASE(lz4_large_blocks_refused, Lz4Files)
+{
+    std::string out;
+    BOOST_TEST(!decode(compress("-B7", "large.lz4"), out));
+    BOOST_TEST(out.empty());
+}
+
+struct FileSink
+{
+    FILE *file;
+    static int write(void *arg, const void *buf, size_t size)
+    {
+        return std::fwrite(buf, 1, size, static_cast<FileSink *>(arg)->file) == size ? 0 : -1;
+    }
+};
+
+/// compress with writes of the given size
+static void encode(const std::string &content, const std::string &path, size_t chunk)
+{
+    FileSink sink{std::fopen(path.c_str(), "wb")};
+    BOOST_REQUIRE(sink.file != nullptr);
+    struct lz4_encoder_s encoder;
+    BOOST_REQUIRE(lz4_encoder_init(&encoder, FileSink::write, &sink) == ErrorLz4Ok);
+    for (size_t i = 0; i < content.size(); i += chunk) {
+        BOOST_REQUIRE(lz4_encoder_write(&encoder, content.data() + i, std::min(chunk, content.size() - i)) ==
+                      ErrorLz4Ok);
+    }
+    BOOST_TEST(lz4_encoder_finish(&encoder) == ErrorLz4Ok);
+    lz4_encoder_deinit(&encoder);
+    std::fclose(sink.file);
+}
+
+BOOST_FIXTURE_TEST_CASE(lz4_encoder_round_trip, Lz4Files)
+{
+    const std::vector<std::string> contents = {content, "", "short", std::string(200000, 'z') + "tail"};
+    for (size_t i = 0; i < contents.size(); ++i) {
+        const auto path = (root / ("encoded" + std::to_string(i) + ".lz4")).string();
+        encode(contents[i], path, 1000 + i * 33333);
+        std::string out;
+        BOOST_TEST(decode(path, out), "content " << i);
+        BOOST_TEST((out == contents[i]), "content " << i);
+
+        /// readable by the lz4 cli
+        const auto plain = path + ".out";
+        BOOST_TEST(boost::process::system("lz4 -q -d -f " + path + " " + plain) == 0, "content " << i);
+        std::ifstream in(plain, std::ios::binary);
+        const std::string decoded{std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>()};
+        BOOST_TEST((decoded == contents[i]), "content " << i);
+    }
+    /// text compresses, random data doesn't grow beyond the block headers
+    BOOST_TEST(std::filesystem::file_size(root / "encoded0.lz4") < content.size() * 6 / 10);
+    BOOST_TEST(std::filesystem::file_size(root / "encoded3.lz4") < 2000);
+}
+
+BOOST_AUTO_TEST_CASE(lz4_xxh32_reference)
+{
+    /// reference values of xxHash32
+    BOOST_TEST(lz4_xxh32("", 0, 0) == 0x02CC5D05U);
+    BOOST_TEST(lz4_xxh32("abc", 3, 0) == 0x32D153FFU);
+    const std::string text = "Nobody inspects the spammish repetition";
+    BOOST_TEST(lz4_xxh32(text.data(), text.size(), 0) == 0xE2293B2FU);
+}
@@ -0,0 +1,187 @@
+#include <boost/process/system.hpp>
+#include <boost/test/unit_test.hpp>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstring>
+#include <common/manifest.h>
+#include "priv_update.h"
+#define BOOST_TEST_MODULE test manifest
+
+#ifndef BUILD_DIR
+#error Requires build dir to create test files
+#endif
+
+static const char md5_empty[] = "d41d8cd98f00b204e9800998ecf8427e";
+static const char md5_a[]     = "0cc175b9c0f1b6a831c399e269772661";
+
+static std::string hex(const unsigned char *md5)
+{
+    std::ostringstream ss;
+    for (size_t i = 0; i < MANIFEST_MD5_SIZE; ++i) {
+        ss << std::hex;
+        ss.width(2);
+        ss.fill('0');
+        ss << static_cast<unsigned>(md5[i]);
+    }
+    return ss.str();
+}
+
+BOOST_AUTO_TEST_CASE(manifest_parse_find)
+{
+    struct manifest_s manifest;
+    manifest_init(&manifest);
+    const std::string text = std::string(md5_a) + "  ./assets/a\n" + md5_empty + " *assets/empty\r\n" +
+                             "not a digest line\n" + md5_empty + "  assets/a\n" + md5_a + "  last";
+    BOOST_TEST(manifest_parse(&manifest, text.c_str()) == 0);
+    manifest_sort(&manifest);
+
+    BOOST_TEST(manifest.count == 3);
+    BOOST_REQUIRE(manifest_find(&manifest, "assets/a") != nullptr);
+    BOOST_TEST(hex(manifest_find(&manifest, "./assets/a")) == md5_empty);
+    BOOST_TEST(hex(manifest_find(&manifest, "assets/empty")) == md5_empty);
+    BOOST_TEST(hex(manifest_find(&manifest, "last")) == md5_a);
+    BOOST_TEST(manifest_find(&manifest, "assets") == nullptr);
+    manifest_free(&manifest);
+}
+
+BOOST_AUTO_TEST_CASE(manifest_merge_save_load)
+{
+    const std::string path = std::string(BUILD_DIR) + "/manifest.md5";
+    std::filesystem::remove(path);
+
+    struct manifest_s installed, unpacked, loaded;
+    manifest_init(&installed);
+    manifest_init(&unpacked);
+    manifest_init(&loaded);
+    BOOST_TEST(manifest_load(&installed, path.c_str()) == 0);
+    BOOST_TEST(installed.count == 0);
+
+    const std::string old_text = std::string(md5_a) + "  b\n" + md5_a + "  a\n";
+    const std::string new_text = std::string(md5_empty) + "  a\n" + md5_empty + "  c\n";
+    BOOST_TEST(manifest_parse(&installed, old_text.c_str()) == 0);
+    BOOST_TEST(manifest_parse(&unpacked, new_text.c_str()) == 0);
+    BOOST_TEST(manifest_merge(&installed, &unpacked) == 0);
+    BOOST_TEST(manifest_save(&installed, path.c_str()) == 0);
+    BOOST_TEST(!std::filesystem::exists(path + ".tmp"));
+
+    BOOST_TEST(manifest_load(&loaded, path.c_str()) == 0);
+    manifest_sort(&loaded);
+    BOOST_TEST(loaded.count == 3);
+    BOOST_TEST(hex(manifest_find(&loaded, "a")) == md5_empty);
+    BOOST_TEST(hex(manifest_find(&loaded, "b")) == md5_a);
+    BOOST_TEST(hex(manifest_find(&loaded, "c")) == md5_empty);
+
+    manifest_free(&installed);
+    manifest_free(&unpacked);
+    manifest_free(&loaded);
+    std::filesystem::remove(path);
+}
+
+/// package with one file equal to the installed one and one changed
+struct InstalledPackage
+{
+    std::filesystem::path root{std::string(BUILD_DIR) + "/installed_package"};
+    std::string package = (root / "update.tar").string();
+    std::string user    = (root / "user").string();
+    std::string os      = (root / "os").string();
+    std::string tmp_user = (root / "user" / "tmp").string();
+    std::string tmp_os   = (root / "os" / "tmp").string();
+    struct manifest_s installed;
+    struct manifest_s declared;
+
+    InstalledPackage()
+    {
+        std::filesystem::remove_all(root);
+        std::filesystem::create_directories(root / "data" / "assets");
+        std::filesystem::create_directories(tmp_user);
+        std::filesystem::create_directories(tmp_os);
+        std::filesystem::create_directories(root / "os" / "assets");
+        std::ofstream(root / "data" / "assets" / "same") << "a";
+        std::ofstream(root / "data" / "assets" / "changed") << "";
+        std::ofstream(root / "os" / "assets" / "same") << "a";
+        std::ofstream(root / "os" / "assets" / "changed") << "a";
+        std::ofstream(root / "data" / MANIFEST_PACKAGE_NAME)
+            << md5_a << "  assets/same\n" << md5_empty << "  assets/changed\n";
+
+        const auto code = boost::process::system("tar -cf " + package + " -C " + (root / "data").string() + " .");
+        BOOST_ASSERT(code == 0);
+
+        manifest_init(&installed);
+        manifest_init(&declared);
+        const std::string installed_text =
+            std::string(md5_a) + "  assets/same\n" + md5_a + "  assets/changed\n";
+        manifest_parse(&installed, installed_text.c_str());
+        manifest_sort(&installed);
+        std::ifstream in(root / "data" / MANIFEST_PACKAGE_NAME);
+        const std::string declared_text((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        manifest_parse(&declared, declared_text.c_str());
+        manifest_sort(&declared);
+    }
+
+    ~InstalledPackage()
+    {
+        manifest_free(&installed);
+        manifest_free(&declared);
+        std::filesystem::remove_all(root);
+    }
+
+    struct update_handle_s handle()
+    {
+        struct update_handle_s h;
+        update_firmware_init(&h);
+        h.update_from = package.c_str();
+        h.update_os   = os.c_str();
+        h.update_user = user.c_str();
+        h.tmp_os      = tmp_os.c_str();
+        h.tmp_user    = tmp_user.c_str();
+        return h;
+    }
+};
+
+BOOST_FIXTURE_TEST_CASE(unpack_skips_installed, InstalledPackage)
+{
+    auto h = handle();
+    const struct unpack_skip_s skip = {&installed, &declared};
+    struct unpack_result_s result;
+    BOOST_TEST(unpack(&h, nullptr, &skip, nullptr, false, nullptr, &result));
+
+    BOOST_TEST(result.skipped_files == 1);
+    BOOST_TEST(!std::filesystem::exists(tmp_os + "/assets/same"));
+    BOOST_TEST(std::filesystem::exists(tmp_os + "/assets/changed"));
+    BOOST_TEST(!std::filesystem::exists(tmp_user + "/" MANIFEST_PACKAGE_NAME));
+    manifest_sort(&result.unpacked);
+    BOOST_TEST(result.unpacked.count == 1);
+    BOOST_TEST(hex(manifest_find(&result.unpacked, "assets/changed")) == md5_empty);
+    unpack_result_free(&result);
+}
+
+BOOST_FIXTURE_TEST_CASE(unpack_to_slot_skips_nothing, InstalledPackage)
+{
+    /// os slot starts empty, installed files are in the other slot
+    auto h = handle();
+    const auto boot_json = (root / ".boot.json").string();
+    h.boot_json = boot_json.c_str();
+    const struct unpack_skip_s skip = {&installed, &declared};
+    struct unpack_result_s result;
+    BOOST_TEST(unpack(&h, nullptr, &skip, nullptr, false, nullptr, &result));
+
+    BOOST_TEST(result.skipped_files == 0);
+    BOOST_TEST(std::filesystem::exists(tmp_os + "/assets/same"));
+    BOOST_TEST(std::filesystem::exists(tmp_os + "/assets/changed"));
+    unpack_result_free(&result);
+}
+
+BOOST_FIXTURE_TEST_CASE(unpack_rejects_declared_mismatch, InstalledPackage)
+{
+    auto h = handle();
+    const std::string wrong = std::string(md5_a) + "  assets/changed\n";
+    manifest_free(&declared);
+    manifest_parse(&declared, wrong.c_str());
+    manifest_sort(&declared);
+    const struct unpack_skip_s skip = {&installed, &declared};
+    struct unpack_result_s result;
+    BOOST_TEST(!unpack(&h, nullptr, &skip, nullptr, false, nullptr, &result));
+    unpack_result_free(&result);
+}
@@ -0,0 +1,164 @@
+#include <boost/process/system.hpp>
+#include <boost/test/unit_test.hpp>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <common/stream.h>
+#include <common/tar.h>
+#define BOOST_TEST_MODULE test stream
+
+#ifndef BUILD_DIR
+#error Requires build dir to create test files
+#endif
+
+struct StreamFiles
+{
+    std::filesystem::path root{std::string(BUILD_DIR) + "/stream_files"};
+    std::string input = (root / "input").string();
+    std::string content;
+
+    StreamFiles()
+    {
+        std::filesystem::remove_all(root);
+        std::filesystem::create_directories(root);
+        std::mt19937 gen(12);
+        for (int i = 0; i < 200000 + 123; ++i) {
+            content += static_cast<char>(gen() % 16 ? 'a' + i % 26 : gen());
+        }
+        std::ofstream(input, std::ios::binary) << content;
+    }
+
+    ~StreamFiles()
+    {
+        std::filesystem::remove_all(root);
+    }
+
+    std::string read(const std::string &path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::stringstream data;
+        data << file.rdbuf();
+        return data.str();
+    }
+
+    static void md5(const std::string &data, unsigned char digest[16])
+    {
+        MD5_CTX ctx;
+        MD5_Init(&ctx);
+        MD5_Update(&ctx, data.data(), data.size());
+        MD5_Final(digest, &ctx);
+    }
+};
+
+BOOST_FIXTURE_TEST_CASE(copy_and_hash_in_single_read, StreamFiles)
+{
+    const auto output = (root / "output").string();
+    struct stream_source_s source;
+    struct stream_stage_s stages[2];
+    unsigned char digest[16];
+    unsigned char expected[16];
+    size_t bytes = 0;
+
+    BOOST_REQUIRE(stream_file_source(&source, input.c_str(), nullptr, 4000) == ErrorStreamOk);
+    BOOST_REQUIRE(stream_file_sink(&stages[0], output.c_str()) == ErrorStreamOk);
+    stream_md5_stage(&stages[1], digest);
+    BOOST_TEST(stream_run(&source, stages, 2, &bytes) == ErrorStreamOk);
+    stream_stage_close(&stages[0]);
+    stream_stage_close(&stages[1]);
+    stream_source_close(&source);
+
+    md5(content, expected);
+    BOOST_TEST(bytes == content.size());
+    BOOST_TEST(read(output) == content);
+    BOOST_TEST(std::memcmp(digest, expected, sizeof digest) == 0);
+
+    unsigned char file_digest[16];
+    BOOST_TEST(stream_file_md5(output.c_str(), file_digest) == ErrorStreamOk);
+    BOOST_TEST(std::memcmp(file_digest, expected, sizeof file_digest) == 0);
+    BOOST_TEST(stream_file_md5((root / "missing").c_str(), file_digest) == ErrorStreamRead);
+}
+
+BOOST_FIXTURE_TEST_CASE(compare_with_other_source, StreamFiles)
+{
+    const auto compare = [&](const std::string &other_content) {
+        const auto other_path = (root / "other").string();
+        std::ofstream(other_path, std::ios::binary | std::ios::trunc) << other_content;
+        struct stream_source_s source;
+        struct stream_source_s other;
+        struct stream_stage_s stage;
+        /// different chunk sizes on both sides
+        stream_file_source(&source, input.c_str(), nullptr, 3000);
+        stream_file_source(&other, other_path.c_str(), nullptr, 7001);
+        stream_compare_stage(&stage, &other);
+        const int ret = stream_run(&source, &stage, 1, nullptr);
+        stream_stage_close(&stage);
+        stream_source_close(&other);
+        stream_source_close(&source);
+        return ret;
+    };
+
+    BOOST_TEST(compare(content) == ErrorStreamOk);
+    auto changed = content;
+    changed[150000] ^= 1;
+    BOOST_TEST(compare(changed) == ErrorStreamMismatch);
+    BOOST_TEST(compare(content.substr(0, 100000)) == ErrorStreamSize);
+    BOOST_TEST(compare(content + "x") == ErrorStreamSize);
+}
+
+BOOST_FIXTURE_TEST_CASE(tar_entry_to_tar_and_lz4_source, StreamFiles)
+{
+    /// file appended with tar_file and read back through the tar entry source
+    const auto package = (root / "package.tar").string();
+    struct tar_ctx tar;
+    BOOST_REQUIRE(tar_init(&tar, package.c_str(), "w") == 0);
+    BOOST_TEST(tar_file(&tar, input.c_str(), "input") == 0);
+    BOOST_TEST(tar_file(&tar, (root / "missing").c_str(), "missing") == 0);
+    mtar_finalize(&tar.tar);
+    tar_deinit(&tar);
+
+    BOOST_REQUIRE(tar_init(&tar, package.c_str(), "r") == ErrorTarOk);
+    mtar_header_t header;
+    BOOST_REQUIRE(tar_read_header(&tar, &header) == ErrorTarOk);
+    BOOST_TEST(header.size == content.size());
+    struct stream_source_s source;
+    struct stream_stage_s md5_stage;
+    unsigned char digest[16];
+    unsigned char expected[16];
+    stream_tar_source(&source, &tar);
+    stream_md5_stage(&md5_stage, digest);
+    BOOST_TEST(stream_run(&source, &md5_stage, 1, nullptr) == ErrorStreamOk);
+    stream_source_close(&source);
+    BOOST_TEST(tar_read_header(&tar, &header) == ErrorTarEnd);
+    tar_deinit(&tar);
+    md5(content, expected);
+    BOOST_TEST(std::memcmp(digest, expected, sizeof digest) == 0);
+
+    /// tar sink refuses data not matching the declared entry size
+    BOOST_REQUIRE(tar_init(&tar, package.c_str(), "w") == 0);
+    BOOST_REQUIRE(mtar_write_file_header(&tar.tar, "short", content.size() + 1) == MTAR_ESUCCESS);
+    struct stream_stage_s sink;
+    stream_file_source(&source, input.c_str(), nullptr, 4096);
+    stream_tar_sink(&sink, &tar.tar, content.size() + 1);
+    BOOST_TEST(stream_run(&source, &sink, 1, nullptr) == ErrorStreamSize);
+    stream_stage_close(&sink);
+    stream_source_close(&source);
+    tar_deinit(&tar);
+
+    /// decoded on the fly from the compressed file
+    const auto compressed = (root / "input.lz4").string();
+    BOOST_REQUIRE(boost::process::system("lz4 -q -f -B4 " + input + " " + compressed) == 0);
+    struct stream_source_s file;
+    struct stream_source_s decoded;
+    stream_file_source(&file, compressed.c_str(), nullptr, 1000);
+    BOOST_REQUIRE(stream_lz4_source(&decoded, &file, 16384) == ErrorStreamOk);
+    stream_md5_stage(&md5_stage, digest);
+    size_t bytes = 0;
+    BOOST_TEST(stream_run(&decoded, &md5_stage, 1, &bytes) == ErrorStreamOk);
+    stream_source_close(&decoded);
+    stream_source_close(&file);
+    BOOST_TEST(bytes == content.size());
+    BOOST_TEST(std::memcmp(digest, expected, sizeof digest) == 0);
+}
@@ -0,0 +1,382 @@
+#include <boost/process/system.hpp>
+#include <boost/test/unit_test.hpp>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <cstring>
+#include <string>
+#include <common/tar.h>
+#include <common/pack.h>
+#include <common/io_buffer.h>
+#include <md5/md5.h>
+#define BOOST_TEST_MODULE test tar
+
+#if !defined(BUILD_DIR) || !defined(PACK_GEN)
+#error Requires build dir to create test archives and package generator
+#endif
+
+/// archive with a few catalogs and files of sizes around record boundaries
+struct TarArchive
+{
+    std::filesystem::path root{std::string(BUILD_DIR) + "/tar_archive"};
+    std::string archive = (root / "archive.tar").string();
+    std::string compressed = archive + TAR_LZ4_EXTENSION;
+    std::map<std::string, std::string> files{
+        {"version.json", "{}"},
+        {"assets/empty", ""},
+        {"assets/record", std::string(512, 'r')},
+        {"assets/odd", std::string(513, 'o')},
+        {"assets/deep/big", std::string(3 * 1024 * 1024 + 7, 'b')},
+    };
+
+    TarArchive()
+    {
+        std::filesystem::remove_all(root);
+        for (const auto &[name, content] : files) {
+            const auto path = root / "data" / name;
+            std::filesystem::create_directories(path.parent_path());
+            std::ofstream(path, std::ios::binary) << content;
+        }
+        auto code = boost::process::system("tar -cf " + archive + " -C " + (root / "data").string() + " .");
+        BOOST_ASSERT(code == 0);
+        code = boost::process::system("lz4 -q -f -B5 -BD " + archive + " " + compressed);
+        BOOST_ASSERT(code == 0);
+    }
+
+    ~TarArchive()
+    {
+        std::filesystem::remove_all(root);
+    }
+};
+
+static std::string read_entry(struct tar_ctx *ctx)
+{
+    std::string content;
+    const void *data = nullptr;
+    size_t size      = 0;
+    do {
+        BOOST_REQUIRE(tar_read_data(ctx, &data, &size) == ErrorTarOk);
+        content.append(static_cast<const char *>(data), size);
+    } while (size > 0);
+    return content;
+}
+
+static unsigned char test_destination(const char *name)
+{
+    return std::string(name).rfind("assets", 0) == 0 ? 1 : 0;
+}
+
+BOOST_FIXTURE_TEST_CASE(tar_read_all_entries, TarArchive)
+{
+    struct tar_ctx ctx;
+    mtar_header_t header;
+    int ret = 0;
+    size_t found = 0;
+
+    BOOST_REQUIRE(tar_init(&ctx, archive.c_str(), "r") == ErrorTarOk);
+    while ((ret = tar_read_header(&ctx, &header)) == ErrorTarOk) {
+        std::string name = header.name;
+        name             = name.rfind("./", 0) == 0 ? name.substr(2) : name;
+        if (header.type == MTAR_TREG) {
+            BOOST_TEST(read_entry(&ctx) == files.at(name), "content of " << name);
+            ++found;
+        }
+    }
+    BOOST_TEST(ret == ErrorTarEnd);
+    BOOST_TEST(found == files.size());
+    BOOST_TEST(tar_deinit(&ctx) == 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(tar_hash_whole_archive, TarArchive)
+{
+    struct tar_ctx ctx;
+    mtar_header_t header;
+    struct sha256_hash streamed;
+    struct sha256_hash expected;
+
+    BOOST_REQUIRE(tar_init(&ctx, archive.c_str(), "r") == ErrorTarOk);
+    BOOST_REQUIRE(tar_hash_enable(&ctx) == ErrorTarOk);
+    /// skip data of every other entry to check skipped data is hashed as well
+    bool read = false;
+    while (tar_read_header(&ctx, &header) == ErrorTarOk) {
+        if (header.type == MTAR_TREG && (read = !read)) {
+            read_entry(&ctx);
+        }
+    }
+    BOOST_TEST(tar_hash_finish(&ctx, &streamed) == ErrorTarOk);
+    BOOST_TEST(tar_deinit(&ctx) == 0);
+
+    BOOST_REQUIRE(sha256_file(archive.c_str(), &expected) == 0);
+    BOOST_TEST(memcmp(streamed.value, expected.value, sizeof expected.value) == 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(tar_index_and_seek, TarArchive)
+{
+    struct tar_index_s index;
+    BOOST_REQUIRE(tar_index_build(&index, archive.c_str(), test_destination) == ErrorTarOk);
+
+    size_t regular = 0;
+    for (size_t i = 0; i < index.count; ++i) {
+        regular += index.entries[i].type == MTAR_TREG;
+    }
+    BOOST_TEST(regular == files.size());
+    BOOST_TEST(index.dest_bytes[0] == files.at("version.json").size());
+    BOOST_TEST(index.total_bytes == 2 + 512 + 513 + 3 * 1024 * 1024 + 7);
+
+    const auto entry = tar_index_find(&index, "assets/odd");
+    BOOST_REQUIRE(entry != nullptr);
+    BOOST_TEST(entry->size == 513);
+    BOOST_TEST(entry->dest == 1);
+    BOOST_TEST(tar_index_find(&index, "not/there") == nullptr);
+
+    struct tar_ctx ctx;
+    mtar_header_t header;
+    BOOST_REQUIRE(tar_init(&ctx, archive.c_str(), "r") == ErrorTarOk);
+    BOOST_REQUIRE(tar_seek_entry(&ctx, entry) == ErrorTarOk);
+    BOOST_REQUIRE(tar_read_header(&ctx, &header) == ErrorTarOk);
+    BOOST_TEST(read_entry(&ctx) == files.at("assets/odd"));
+    BOOST_TEST(tar_deinit(&ctx) == 0);
+
+    char *data = nullptr;
+    BOOST_REQUIRE(tar_read_entry(archive.c_str(), entry, 1024, &data) == ErrorTarOk);
+    BOOST_TEST(std::string(data) == files.at("assets/odd"));
+    free(data);
+    BOOST_TEST(tar_read_entry(archive.c_str(), entry, 512, &data) != ErrorTarOk);
+    BOOST_TEST(data == nullptr);
+
+    tar_index_free(&index);
+    BOOST_TEST(index.count == 0);
+}
+
+BOOST_FIXTURE_TEST_CASE(tar_compressed_archive, TarArchive)
+{
+    struct tar_index_s index;
+    BOOST_REQUIRE(tar_index_build(&index, compressed.c_str(), test_destination) == ErrorTarOk);
+    BOOST_TEST(index.total_bytes == 2 + 512 + 513 + 3 * 1024 * 1024 + 7);
+
+    char *data = nullptr;
+    BOOST_REQUIRE(tar_read_entry(compressed.c_str(), tar_index_find(&index, "version.json"), 1024, &data) ==
+                  ErrorTarOk);
+    BOOST_TEST(std::string(data) == files.at("version.json"));
+    free(data);
+
+    struct tar_ctx ctx;
+    mtar_header_t header;
+    struct sha256_hash streamed;
+    struct sha256_hash expected;
+    size_t found = 0;
+
+    BOOST_REQUIRE(tar_init(&ctx, compressed.c_str(), "r") == ErrorTarOk);
+    BOOST_REQUIRE(tar_hash_enable(&ctx) == ErrorTarOk);
+    while (tar_read_header(&ctx, &header) == ErrorTarOk) {
+        std::string name = header.name;
+        name             = name.rfind("./", 0) == 0 ? name.substr(2) : name;
+        if (header.type == MTAR_TREG) {
+            BOOST_TEST(read_entry(&ctx) == files.at(name), "content of " << name);
+            ++found;
+        }
+    }
+    BOOST_TEST(found == files.size());
+    /// signature covers the package file - compressed bytes are hashed
+    BOOST_TEST(tar_hash_finish(&ctx, &streamed) == ErrorTarOk);
+    BOOST_TEST(tar_deinit(&ctx) == 0);
+    BOOST_REQUIRE(sha256_file(compressed.c_str(), &expected) == 0);
+    BOOST_TEST(memcmp(streamed.value, expected.value, sizeof expected.value) == 0);
+
+    tar_index_free(&index);
+}
+
+/// the same files in a sector aligned package
+/// archives opened one after another take the session buffer, one opened meanwhile allocates its own
+BOOST_FIXTURE_TEST_CASE(tar_session_buffer, TarArchive)
+{
+    struct tar_ctx ctx;
+    struct tar_ctx other;
+    mtar_header_t header;
+    BOOST_REQUIRE(io_buffer_init(IO_BUFFER_MIN_SIZE) == ErrorIoBufferOk);
+
+    for (const auto &name : {archive, compressed}) {
+        size_t found = 0;
+        BOOST_REQUIRE(tar_init(&ctx, name.c_str(), "r") == ErrorTarOk);
+        BOOST_TEST(ctx.shared_buffer);
+        BOOST_TEST(ctx.size == IO_BUFFER_MIN_SIZE);
+        BOOST_REQUIRE(tar_init(&other, name.c_str(), "r") == ErrorTarOk);
+        BOOST_TEST(!other.shared_buffer);
+        BOOST_TEST(io_buffer_init(IO_BUFFER_DEFAULT_SIZE) == ErrorIoBufferBusy);
+        while (tar_read_header(&ctx, &header) == ErrorTarOk) {
+            std::string entry = header.name;
+            entry             = entry.rfind("./", 0) == 0 ? entry.substr(2) : entry;
+            if (header.type == MTAR_TREG) {
+                BOOST_TEST(read_entry(&ctx) == files.at(entry), "content of " << entry);
+                ++found;
+            }
+        }
+        BOOST_TEST(found == files.size());
+        BOOST_TEST(tar_deinit(&other) == 0);
+        BOOST_TEST(tar_deinit(&ctx) == 0);
+    }
+
+    const auto written = (root / "written.tar").string();
+    BOOST_REQUIRE(tar_init(&ctx, written.c_str(), "w") == ErrorTarOk);
+    BOOST_TEST(ctx.shared_buffer);
+    BOOST_TEST(tar_file(&ctx, (root / "data" / "assets/deep/big").c_str(), "big") == 0);
+    BOOST_TEST(tar_deinit(&ctx) == 0);
+    BOOST_REQUIRE(tar_init(&ctx, written.c_str(), "r") == ErrorTarOk);
+    BOOST_TEST(ctx.shared_buffer);
+    BOOST_REQUIRE(tar_read_header(&ctx, &header) == ErrorTarOk);
+    BOOST_TEST(read_entry(&ctx) == files.at("assets/deep/big"));
+    BOOST_TEST(tar_deinit(&ctx) == 0);
+    io_buffer_deinit();
+}
+
+BOOST_FIXTURE_TEST_CASE(tar_compressed_append, TarArchive)
+{
+    struct tar_ctx ctx;
+    mtar_header_t header;
+    struct tar_position_s big;
+    struct tar_position_s mark;
+    const auto written = (root / "appended.tar" TAR_LZ4_EXTENSION).string();
+    const auto data    = root / "data";
+
+    /// sessions continue the tar stream, the trailer of the previous one is cut off
+    BOOST_REQUIRE(tar_init(&ctx, written.c_str(), "a") == ErrorTarOk);
+    BOOST_TEST(tar_write_offset(&ctx) == 0);
+    BOOST_TEST(tar_file(&ctx, (data / "assets/odd").c_str(), "odd") == 0);
+    BOOST_TEST(tar_deinit(&ctx) == 0);
+    BOOST_TEST(tar_read_mark(written.c_str(), &mark) == ErrorTarEnd);
+    BOOST_REQUIRE(tar_init(&ctx, written.c_str(), "a") == ErrorTarOk);
+    BOOST_TEST(tar_deinit(&ctx) == 0);
+    BOOST_REQUIRE(tar_init(&ctx, written.c_str(), "a") == ErrorTarOk);
+    BOOST_TEST(tar_write_position(&ctx, &big) == ErrorTarOk);
+    BOOST_TEST(big.offset == 3 * TAR_RECORD_SIZE);
+    BOOST_TEST(tar_write_mark(&ctx) == ErrorTarOk);
+    BOOST_TEST(tar_file(&ctx, (data / "assets/deep/big").c_str(), "big") == 0);
+    BOOST_TEST(tar_deinit(&ctx) == 0);
+    BOOST_TEST(std::filesystem::file_size(written) < files.at("assets/deep/big").size() / 10);
+
+    BOOST_REQUIRE(tar_init(&ctx, written.c_str(), "r") == ErrorTarOk);
+    BOOST_REQUIRE(tar_read_header(&ctx, &header) == ErrorTarOk);
+    BOOST_TEST(read_entry(&ctx) == files.at("assets/odd"));
+    BOOST_REQUIRE(tar_read_header(&ctx, &header) == ErrorTarOk);
+    BOOST_TEST(std::string(header.name) == "big");
+    BOOST_TEST(read_entry(&ctx) == files.at("assets/deep/big"));
+    BOOST_TEST(tar_read_header(&ctx, &header) == ErrorTarEnd);
+
+    /// the marked entry is read without decoding anything before it
+    BOOST_REQUIRE(tar_read_mark(written.c_str(), &mark) == ErrorTarOk);
+    BOOST_TEST(mark.offset == big.offset);
+    BOOST_TEST(mark.file_offset == big.file_offset);
+    BOOST_TEST(mark.file_offset > 0);
+    BOOST_REQUIRE(tar_seek_position(&ctx, &mark) == ErrorTarOk);
+    BOOST_REQUIRE(tar_read_header(&ctx, &header) == ErrorTarOk);
+    BOOST_TEST(std::string(header.name) == "big");
+    BOOST_TEST(read_entry(&ctx) == files.at("assets/deep/big"));
+    BOOST_TEST(tar_deinit(&ctx) == 0);
+
+    /// the lz4 cli reads it too: one trailer closes the tar stream
+    const auto code = boost::process::system("lz4 -q -d -f " + written + " " + (root / "decoded.tar").string());
+    BOOST_TEST(code == 0);
+    BOOST_TEST(std::filesystem::file_size(root / "decoded.tar") ==
+               4 * TAR_RECORD_SIZE + files.at("assets/deep/big").size() + 505 + 2 * TAR_RECORD_SIZE);
+}
+
+BOOST_FIXTURE_TEST_CASE(tar_plain_append, TarArchive)
+{
+    struct tar_ctx ctx;
+    struct tar_position_s mark;
+    const auto written = (root / "appended.tar").string();
+    const auto data    = root / "data";
+
+    for (const auto *name : {"odd", "record"}) {
+        BOOST_REQUIRE(tar_init(&ctx, written.c_str(), "a") == ErrorTarOk);
+        BOOST_TEST(tar_write_mark(&ctx) == ErrorTarOk);
+        BOOST_TEST(tar_file(&ctx, (data / "assets" / name).c_str(), name) == 0);
+        BOOST_TEST(tar_deinit(&ctx) == 0);
+    }
+    BOOST_REQUIRE(tar_read_mark(written.c_str(), &mark) == ErrorTarOk);
+    BOOST_TEST(mark.offset == 3 * TAR_RECORD_SIZE);
+    BOOST_TEST(mark.file_offset == mark.offset);
+
+    /// finalized archive is a valid tar for other tools
+    std::filesystem::create_directories(root / "extracted");
+    const auto code =
+        boost::process::system("tar -xf " + written + " -C " + (root / "extracted").string());
+    BOOST_TEST(code == 0);
+    BOOST_TEST(std::filesystem::file_size(root / "extracted" / "odd") == files.at("assets/odd").size());
+    BOOST_TEST(std::filesystem::file_size(root / "extracted" / "record") == files.at("assets/record").size());
+}
+
+struct PackArchive : TarArchive
+{
+    std::string package = (root / "archive.pack").string();
+
+    PackArchive()
+    {
+        const auto code = boost::process::system(std::string(PACK_GEN) + " " + (root / "data").string() + " " + package);
+        BOOST_ASSERT(code == 0);
+    }
+};
+
+BOOST_FIXTURE_TEST_CASE(pack_read_as_tar, PackArchive)
+{
+    struct tar_index_s index;
+    BOOST_REQUIRE(tar_index_build(&index, package.c_str(), test_destination) == ErrorTarOk);
+    BOOST_TEST(index.total_bytes == 2 + 512 + 513 + 3 * 1024 * 1024 + 7);
+    BOOST_TEST(index.dest_bytes[0] == files.at("version.json").size());
+    BOOST_REQUIRE(tar_index_find(&index, "assets/deep/") != nullptr);
+    BOOST_TEST(tar_index_find(&index, "assets/deep/")->type == MTAR_TDIR);
+
+    /// random access from the index
+    char *data = nullptr;
+    BOOST_REQUIRE(tar_read_entry(package.c_str(), tar_index_find(&index, "assets/odd"), 1024, &data) == ErrorTarOk);
+    BOOST_TEST(std::string(data) == files.at("assets/odd"));
+    free(data);
+
+    struct tar_ctx ctx;
+    mtar_header_t header;
+    struct sha256_hash streamed;
+    struct sha256_hash expected;
+    size_t found = 0;
+    BOOST_REQUIRE(tar_init(&ctx, package.c_str(), "r") == ErrorTarOk);
+    BOOST_REQUIRE(tar_hash_enable(&ctx) == ErrorTarOk);
+    bool read = false;
+    while (tar_read_header(&ctx, &header) == ErrorTarOk) {
+        if (header.type != MTAR_TREG) {
+            continue;
+        }
+        const auto &content = files.at(header.name);
+        unsigned char md5[PACK_MD5_SIZE];
+        MD5_CTX md5_ctx;
+        MD5_Init(&md5_ctx);
+        MD5_Update(&md5_ctx, content.data(), content.size());
+        MD5_Final(md5, &md5_ctx);
+        BOOST_REQUIRE(tar_entry_md5(&ctx) != nullptr);
+        BOOST_TEST(memcmp(tar_entry_md5(&ctx), md5, sizeof md5) == 0, "digest of " << header.name);
+        /// skipped entries are hashed as well
+        if ((read = !read)) {
+            BOOST_TEST(read_entry(&ctx) == content, "content of " << header.name);
+        }
+        ++found;
+    }
+    BOOST_TEST(found == files.size());
+    BOOST_TEST(tar_hash_finish(&ctx, &streamed) == ErrorTarOk);
+    BOOST_TEST(tar_deinit(&ctx) == 0);
+    BOOST_REQUIRE(sha256_file(package.c_str(), &expected) == 0);
+    BOOST_TEST(memcmp(streamed.value, expected.value, sizeof expected.value) == 0);
+
+    /// tar has no declared digests
+    BOOST_REQUIRE(tar_init(&ctx, archive.c_str(), "r") == ErrorTarOk);
+    BOOST_REQUIRE(tar_read_header(&ctx, &header) == ErrorTarOk);
+    BOOST_TEST(tar_entry_md5(&ctx) == nullptr);
+    BOOST_TEST(tar_deinit(&ctx) == 0);
+
+    /// corrupted index is refused
+    {
+        std::fstream file(package, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(PACK_HEADER_SIZE + 1);
+        file.put('\x7f');
+    }
+    BOOST_TEST(tar_init(&ctx, package.c_str(), "r") != ErrorTarOk);
+    tar_deinit(&ctx);
+    tar_index_free(&index);
+}
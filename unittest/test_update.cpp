@@ -7,6 +7,17 @@
 #include "helper.hpp"
 #include "dir_fixture.hpp"
 #include "priv_update.h"
+#include "priv_space.h"
+#include "priv_ram_stage.h"
+#include "priv_slot.h"
+#include "priv_direct.h"
+#include "priv_fingerprint.h"
+#include "update_ecoboot.h"
+#include "priv_partition.h"
+#include <common/boot_slot.h>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
 
 /// this test wont work fill catalogs will work
 BOOST_FIXTURE_TEST_CASE(unpack_success, UpdateAsset)
@@ -21,7 +32,9 @@ BOOST_FIXTURE_TEST_CASE(unpack_success, UpdateAsset)
     handle.tmp_user    = (disk_user.drive + "/tmp").c_str();
 
     create_temp_catalog(&handle);
-    BOOST_TEST(unpack(&handle));
+    struct unpack_result_s result;
+    BOOST_TEST(unpack(&handle, nullptr, nullptr, nullptr, false, nullptr, &result));
+    unpack_result_free(&result);
 
 
     BOOST_TEST(std::filesystem::exists(disk_os.drive + "boot.bin"));
@@ -45,6 +58,487 @@ BOOST_FIXTURE_TEST_CASE(unpack_no_tar, UpdateEmptyAsset)
 
 
     create_temp_catalog(&handle);
-    BOOST_TEST(unpack(&handle));
+    struct unpack_result_s result;
+    BOOST_TEST(unpack(&handle, nullptr, nullptr, nullptr, false, nullptr, &result));
+    unpack_result_free(&result);
 
-}
\ No newline at end of file
+}
+BOOST_AUTO_TEST_CASE(space_required_whole_clusters)
+{
+    /// raw partition image takes no space on the filesystems
+    char names[] = "file\0partition4.img";
+    struct tar_index_entry_s entries[] = {
+        {0, 0, 1, MTAR_TREG, UnpackDestOs},
+        {0, 0, 4097, MTAR_TREG, UnpackDestOs},
+        {0, 0, 0, MTAR_TDIR, UnpackDestOs},
+        {0, 0, 100, MTAR_TREG, UnpackDestUser},
+        {5, 0, 1 << 20, MTAR_TREG, UnpackDestUser},
+    };
+    struct tar_index_s index;
+    memset(&index, 0, sizeof index);
+    index.entries = entries;
+    index.count   = sizeof entries / sizeof entries[0];
+    index.names   = names;
+
+    BOOST_TEST(space_required(&index, UnpackDestOs, 4096) == 4096 + 2 * 4096 + 4096);
+    BOOST_TEST(space_required(&index, UnpackDestUser, 4096) == 4096);
+    BOOST_TEST(space_required(&index, UnpackDestOs, 0) == 1 + 4097 + 1);
+
+    struct update_handle_s handle;
+    update_firmware_init(&handle);
+    const std::string backup = std::string(BUILD_DIR) + "/backup.tar";
+    handle.update_os         = BUILD_DIR;
+    handle.update_user       = BUILD_DIR;
+    handle.backup_full_path  = backup.c_str();
+    BOOST_TEST(space_check(&handle, &index, 1024));
+    BOOST_TEST(!space_check(&handle, &index, 1ULL << 62));
+}
+
+BOOST_AUTO_TEST_CASE(partition_image_names)
+{
+    unsigned partition = 0;
+    BOOST_TEST(partition_image_name("partition4.img", &partition));
+    BOOST_TEST(partition == 4);
+    BOOST_TEST(partition_image_name("./partition12.img", &partition));
+    BOOST_TEST(partition == 12);
+    BOOST_TEST(!partition_image_name("partition.img", &partition));
+    BOOST_TEST(!partition_image_name("partition+1.img", &partition));
+    BOOST_TEST(!partition_image_name("partition4.img.delta", &partition));
+    BOOST_TEST(!partition_image_name("partition99.img", &partition));
+    BOOST_TEST(!partition_image_name("assets/partition4.img", &partition));
+}
+
+BOOST_AUTO_TEST_CASE(partition_image_deferred)
+{
+    const std::filesystem::path root{std::string(BUILD_DIR) + "/partition_image"};
+    const auto package = (root / "update.tar").string();
+    const auto tmp     = (root / "tmp").string();
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root / "data");
+    std::filesystem::create_directories(tmp);
+    std::ofstream(root / "data" / "partition4.img") << std::string(4096, 'i');
+    const auto code = boost::process::system("tar -cf " + package + " -C " + (root / "data").string() + " .");
+    BOOST_REQUIRE(code == 0);
+    struct tar_index_s index;
+    BOOST_REQUIRE(tar_index_build(&index, package.c_str(), unpack_destination) == ErrorTarOk);
+
+    struct update_handle_s h;
+    update_firmware_init(&h);
+    h.update_from = package.c_str();
+    h.update_os   = tmp.c_str();
+    h.update_user = tmp.c_str();
+    h.tmp_os      = tmp.c_str();
+    h.tmp_user    = tmp.c_str();
+
+    /// partition not allowed - rejected by the unpack
+    struct unpack_result_s result;
+    BOOST_TEST(!unpack(&h, &index, nullptr, nullptr, false, nullptr, &result));
+    unpack_result_free(&result);
+
+    /// unpack only hashes the image, nothing is written to the partition
+    h.image_partitions = 1u << 4;
+    BOOST_TEST(unpack(&h, &index, nullptr, nullptr, false, nullptr, &result));
+    manifest_sort(&result.images);
+    BOOST_TEST(manifest_find(&result.images, "partition4.img") != nullptr);
+
+    /// image of unsigned package or not matching the declared digest isn't written
+    h.unsigned_tar = true;
+    BOOST_TEST(!partition_images_write(&h, &index, nullptr, &result.images));
+    h.unsigned_tar = false;
+    struct manifest_s declared;
+    manifest_init(&declared);
+    const unsigned char other[MANIFEST_MD5_SIZE] = {1};
+    BOOST_REQUIRE(manifest_add(&declared, "partition4.img", other) == 0);
+    manifest_sort(&declared);
+    BOOST_TEST(!partition_images_write(&h, &index, &declared, &result.images));
+
+    /// rejected by the unpack already
+    const struct unpack_skip_s skip = {.installed = nullptr, .package = &declared};
+    unpack_result_free(&result);
+    BOOST_TEST(!unpack(&h, &index, &skip, nullptr, false, nullptr, &result));
+    unpack_result_free(&result);
+
+    manifest_free(&declared);
+    tar_index_free(&index);
+    std::filesystem::remove_all(root);
+}
+
+/// small package unpacked to RAM and written to the destinations without the tmp catalogs
+struct StagePackage
+{
+    std::filesystem::path root{std::string(BUILD_DIR) + "/stage_package"};
+    std::string package = (root / "update.tar").string();
+    std::string os      = (root / "os").string();
+    std::string user    = (root / "user").string();
+    std::string tmp_os   = (root / "no_tmp_os").string();
+    std::string tmp_user = (root / "no_tmp_user").string();
+    struct tar_index_s index;
+
+    StagePackage()
+    {
+        std::filesystem::remove_all(root);
+        std::filesystem::create_directories(root / "data" / "assets" / "fonts");
+        std::filesystem::create_directories(os + "/assets");
+        std::filesystem::create_directories(user);
+        std::ofstream(root / "data" / "updater.bin") << std::string(300 * 1024, 'u');
+        std::ofstream(root / "data" / "assets" / "fonts" / "font") << std::string(100 * 1024 + 7, 'f');
+        std::ofstream(root / "data" / "assets" / "lang") << "new";
+        std::ofstream(os + "/assets/lang") << "old content";
+        const auto code = boost::process::system("tar -cf " + package + " -C " + (root / "data").string() + " .");
+        BOOST_ASSERT(code == 0);
+        BOOST_ASSERT(tar_index_build(&index, package.c_str(), unpack_destination) == ErrorTarOk);
+    }
+
+    ~StagePackage()
+    {
+        tar_index_free(&index);
+        std::filesystem::remove_all(root);
+    }
+
+    struct update_handle_s handle()
+    {
+        struct update_handle_s h;
+        update_firmware_init(&h);
+        h.update_from  = package.c_str();
+        h.update_os    = os.c_str();
+        h.update_user  = user.c_str();
+        h.tmp_os       = tmp_os.c_str();
+        h.tmp_user     = tmp_user.c_str();
+        h.stage_budget = UPDATE_STAGE_BUDGET;
+        return h;
+    }
+
+    static std::string read(const std::string &path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        std::stringstream data;
+        data << file.rdbuf();
+        return data.str();
+    }
+};
+
+BOOST_FIXTURE_TEST_CASE(unpack_to_ram_stage, StagePackage)
+{
+    auto h = handle();
+    struct journal_s journal;
+    journal_open(&journal, nullptr, package.c_str(), &index);
+    BOOST_TEST(ram_stage_eligible(&h, &index, &journal));
+    h.stage_budget = index.total_bytes - 1;
+    BOOST_TEST(!ram_stage_eligible(&h, &index, &journal));
+    h.stage_budget = 0;
+    BOOST_TEST(!ram_stage_eligible(&h, &index, &journal));
+    h.stage_budget = UPDATE_STAGE_BUDGET;
+
+    struct ram_stage_s stage;
+    struct unpack_result_s result;
+    ram_stage_init(&stage, h.stage_budget);
+    BOOST_TEST(unpack(&h, &index, nullptr, nullptr, true, &stage, &result));
+    BOOST_TEST(result.package_hash_valid);
+    BOOST_TEST(stage.bytes == index.total_bytes);
+    BOOST_TEST(result.unpacked.count == 3);
+    unpack_result_free(&result);
+
+    /// nothing is written before the install
+    BOOST_TEST(!std::filesystem::exists(tmp_os));
+    BOOST_TEST(!std::filesystem::exists(tmp_user));
+    BOOST_TEST(!std::filesystem::exists(os + "/updater.bin"));
+    const auto *lang = ram_stage_find(&stage, "assets/lang");
+    BOOST_REQUIRE(lang != nullptr);
+    BOOST_TEST(std::string(reinterpret_cast<const char *>(lang->data)) == "new");
+
+    BOOST_TEST(ram_stage_install(&stage, os.c_str(), user.c_str()));
+    ram_stage_free(&stage);
+    BOOST_TEST(std::filesystem::file_size(os + "/updater.bin") == 300 * 1024);
+    BOOST_TEST(read(os + "/assets/fonts/font") == std::string(100 * 1024 + 7, 'f'));
+    BOOST_TEST(read(os + "/assets/lang") == "new");
+    BOOST_TEST(!std::filesystem::exists(os + "/assets/lang.new"));
+}
+
+BOOST_FIXTURE_TEST_CASE(ram_stage_over_budget, StagePackage)
+{
+    auto h = handle();
+    struct ram_stage_s stage;
+    struct unpack_result_s result;
+    ram_stage_init(&stage, 200 * 1024);
+    BOOST_TEST(!unpack(&h, &index, nullptr, nullptr, false, &stage, &result));
+    BOOST_TEST(stage.out_of_memory);
+    unpack_result_free(&result);
+    ram_stage_free(&stage);
+
+    /// unpack to tmp is continued from the journal, it's never staged
+    const auto journal_path = (root / "update.journal").string();
+    std::ofstream(package + ".sig") << "signature";
+    struct journal_s journal;
+    journal_open(&journal, journal_path.c_str(), package.c_str(), &index);
+    journal_phase(&journal, JournalCatalog);
+    BOOST_TEST(!ram_stage_eligible(&h, &index, &journal));
+    journal_remove(&journal);
+}
+
+BOOST_FIXTURE_TEST_CASE(package_fingerprint, StagePackage)
+{
+    const auto fingerprint = (root / "update.sha256").string();
+    struct sha256_hash hash;
+    BOOST_REQUIRE(sha256_file(package.c_str(), &hash) == 0);
+    BOOST_TEST(!fingerprint_applied(fingerprint.c_str(), package.c_str(), &index));
+    BOOST_TEST(fingerprint_record(fingerprint.c_str(), package.c_str(), &index, &hash));
+    BOOST_TEST(fingerprint_applied(fingerprint.c_str(), package.c_str(), &index));
+
+    /// same files and size, other content
+    {
+        std::fstream file(package, std::ios::in | std::ios::out | std::ios::binary);
+        const auto *entry = tar_index_find(&index, "updater.bin");
+        BOOST_REQUIRE(entry != nullptr);
+        file.seekp(static_cast<std::streamoff>(entry->offset) + 512);
+        file.put('x');
+    }
+    BOOST_TEST(!fingerprint_applied(fingerprint.c_str(), package.c_str(), &index));
+
+    fingerprint_remove(fingerprint.c_str());
+    BOOST_TEST(!std::filesystem::exists(fingerprint));
+    BOOST_TEST(!fingerprint_applied(fingerprint.c_str(), package.c_str(), &index));
+}
+
+BOOST_FIXTURE_TEST_CASE(fingerprint_after_ecoboot, StagePackage)
+{
+    const auto fingerprint = (root / "update.sha256").string();
+    const auto ecoboot     = os + "/" + ecoboot_filename;
+    auto h        = handle();
+    h.fingerprint = fingerprint.c_str();
+    struct unpack_result_s result = {};
+    BOOST_REQUIRE(sha256_file(package.c_str(), &result.package_hash) == 0);
+    result.package_hash_valid = true;
+
+    /// bootloader too small to be flashed - the update failed, the package isn't applied
+    std::ofstream(ecoboot) << "boot";
+    errno = 0;
+    BOOST_TEST(!update_finish(&h, &index, &result));
+    BOOST_TEST(!fingerprint_applied(fingerprint.c_str(), package.c_str(), &index));
+
+    std::filesystem::remove(ecoboot);
+    BOOST_TEST(update_finish(&h, &index, &result));
+    BOOST_TEST(fingerprint_applied(fingerprint.c_str(), package.c_str(), &index));
+}
+
+BOOST_AUTO_TEST_CASE(tmp_move_renames_new_catalogs)
+{
+    const std::filesystem::path root{std::string(BUILD_DIR) + "/tmp_move"};
+    const auto user     = (root / "user").string();
+    const auto tmp_user = (root / "tmp_user").string();
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root / "tmp_user" / "fonts" / "bold");
+    std::filesystem::create_directories(root / "tmp_user" / "lang");
+    std::filesystem::create_directories(root / "user" / "lang");
+    std::ofstream(tmp_user + "/fonts/regular") << "regular";
+    std::ofstream(tmp_user + "/fonts/bold/bold") << "bold";
+    std::ofstream(tmp_user + "/lang/en") << "new en";
+    std::ofstream(user + "/lang/en") << "old en";
+    std::ofstream(user + "/lang/pl") << "pl";
+
+    struct update_handle_s h;
+    update_firmware_init(&h);
+    const auto no_tmp_os = (root / "no_tmp_os").string();
+    h.tmp_os      = no_tmp_os.c_str();
+    h.update_os   = no_tmp_os.c_str();
+    h.tmp_user    = tmp_user.c_str();
+    h.update_user = user.c_str();
+    BOOST_TEST(tmp_files_move(&h));
+
+    BOOST_TEST(StagePackage::read(user + "/fonts/regular") == "regular");
+    BOOST_TEST(StagePackage::read(user + "/fonts/bold/bold") == "bold");
+    BOOST_TEST(StagePackage::read(user + "/lang/en") == "new en");
+    BOOST_TEST(StagePackage::read(user + "/lang/pl") == "pl");
+    BOOST_TEST(std::filesystem::is_empty(tmp_user));
+    std::filesystem::remove_all(root);
+}
+
+BOOST_AUTO_TEST_CASE(direct_user_install)
+{
+    const std::filesystem::path root{std::string(BUILD_DIR) + "/direct_user"};
+    const auto package  = (root / "update.tar").string();
+    const auto user     = (root / "user").string();
+    const auto tmp_os   = (root / "tmp_os").string();
+    const auto tmp_user = (root / "tmp_user").string();
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root / "data" / "user" / "db");
+    std::filesystem::create_directories(user + "/user/db");
+    std::ofstream(root / "data" / "user" / "db" / "notes.db") << "new notes";
+    std::ofstream(root / "data" / "user" / "db" / "calllog.db") << "new calllog";
+    std::ofstream(user + "/user/db/notes.db") << "old notes";
+    const auto code = boost::process::system("tar -cf " + package + " -C " + (root / "data").string() + " user");
+    BOOST_REQUIRE(code == 0);
+    struct tar_index_s index;
+    BOOST_REQUIRE(tar_index_build(&index, package.c_str(), unpack_destination) == ErrorTarOk);
+    BOOST_TEST(index.dest_bytes[UnpackDestUser] == index.total_bytes);
+
+    struct update_handle_s h;
+    update_firmware_init(&h);
+    h.update_from = package.c_str();
+    h.update_os   = tmp_os.c_str();
+    h.update_user = user.c_str();
+    h.tmp_os      = tmp_os.c_str();
+    h.tmp_user    = tmp_user.c_str();
+    h.direct_user = true;
+    BOOST_REQUIRE(tmp_create_catalog(&h));
+
+    /// written next to the destination, nothing goes through tmp
+    struct unpack_result_s result;
+    BOOST_TEST(unpack(&h, &index, nullptr, nullptr, false, nullptr, &result));
+    BOOST_TEST(result.unpacked.count == 2);
+    unpack_result_free(&result);
+    BOOST_TEST(std::filesystem::is_empty(tmp_user));
+    BOOST_TEST(StagePackage::read(user + "/user/db/notes.db") == "old notes");
+    BOOST_TEST(StagePackage::read(user + "/user/db/notes.db" DIRECT_NEW_EXTENSION) == "new notes");
+
+    /// failed update leaves the installed files
+    direct_rollback(&h, &index);
+    BOOST_TEST(!std::filesystem::exists(user + "/user/db/notes.db" DIRECT_NEW_EXTENSION));
+    BOOST_TEST(!std::filesystem::exists(user + "/user/db/calllog.db" DIRECT_NEW_EXTENSION));
+    BOOST_TEST(StagePackage::read(user + "/user/db/notes.db") == "old notes");
+
+    BOOST_TEST(unpack(&h, &index, nullptr, nullptr, false, nullptr, &result));
+    unpack_result_free(&result);
+    BOOST_TEST(direct_commit(&h, &index));
+    BOOST_TEST(StagePackage::read(user + "/user/db/notes.db") == "new notes");
+    BOOST_TEST(StagePackage::read(user + "/user/db/calllog.db") == "new calllog");
+    BOOST_TEST(!std::filesystem::exists(user + "/user/db/notes.db" DIRECT_NEW_EXTENSION));
+    /// resumed commit skips the renamed files
+    BOOST_TEST(direct_commit(&h, &index));
+    BOOST_TEST(StagePackage::read(user + "/user/db/notes.db") == "new notes");
+    BOOST_TEST(!std::filesystem::exists(user + "/user/db/notes.db" DIRECT_OLD_EXTENSION));
+
+    tar_index_free(&index);
+    std::filesystem::remove_all(root);
+}
+
+BOOST_AUTO_TEST_CASE(direct_user_commit_rolled_back)
+{
+    const std::filesystem::path root{std::string(BUILD_DIR) + "/direct_user_rollback"};
+    const auto package = (root / "update.tar").string();
+    const auto user    = (root / "user").string();
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root / "data" / "user" / "db");
+    std::ofstream(root / "data" / "user" / "db" / "notes.db") << "new notes";
+    std::ofstream(root / "data" / "user" / "db" / "calllog.db") << "new calllog";
+    /// calllog.db can't be replaced - the commit fails after notes.db is renamed
+    std::filesystem::create_directories(user + "/user/db/calllog.db/locked");
+    std::filesystem::create_directories(user + "/user/db/calllog.db" DIRECT_OLD_EXTENSION "/locked");
+    std::ofstream(user + "/user/db/notes.db") << "old notes";
+    const auto code = boost::process::system("tar -cf " + package + " -C " + (root / "data").string() +
+                                             " user/db/notes.db user/db/calllog.db");
+    BOOST_REQUIRE(code == 0);
+    struct tar_index_s index;
+    BOOST_REQUIRE(tar_index_build(&index, package.c_str(), unpack_destination) == ErrorTarOk);
+
+    struct update_handle_s h;
+    update_firmware_init(&h);
+    h.update_from = package.c_str();
+    h.update_os   = user.c_str();
+    h.update_user = user.c_str();
+    h.tmp_os      = user.c_str();
+    h.tmp_user    = user.c_str();
+    h.direct_user = true;
+
+    struct unpack_result_s result;
+    BOOST_TEST(unpack(&h, &index, nullptr, nullptr, false, nullptr, &result));
+    unpack_result_free(&result);
+    BOOST_TEST(!direct_commit(&h, &index));
+    BOOST_TEST(StagePackage::read(user + "/user/db/notes.db") == "new notes");
+    BOOST_TEST(StagePackage::read(user + "/user/db/notes.db" DIRECT_OLD_EXTENSION) == "old notes");
+
+    /// installed files are back, nothing of the package is left
+    direct_rollback(&h, &index);
+    BOOST_TEST(StagePackage::read(user + "/user/db/notes.db") == "old notes");
+    BOOST_TEST(!std::filesystem::exists(user + "/user/db/notes.db" DIRECT_OLD_EXTENSION));
+    BOOST_TEST(!std::filesystem::exists(user + "/user/db/notes.db" DIRECT_NEW_EXTENSION));
+    BOOST_TEST(!std::filesystem::exists(user + "/user/db/calllog.db" DIRECT_NEW_EXTENSION));
+    BOOST_TEST(std::filesystem::is_directory(user + "/user/db/calllog.db"));
+
+    tar_index_free(&index);
+    std::filesystem::remove_all(root);
+}
+
+BOOST_AUTO_TEST_CASE(os_slot_activated)
+{
+    const std::filesystem::path root{std::string(BUILD_DIR) + "/os_slots"};
+    const auto active    = (root / "current").string();
+    const auto inactive  = (root / "previous").string();
+    const auto boot_json = (root / ".boot.json").string();
+    std::filesystem::remove_all(root);
+    std::filesystem::create_directories(root / "current" / "assets");
+    std::filesystem::create_directories(root / "previous");
+    std::ofstream(active + "/boot.bin") << "old boot";
+    std::ofstream(active + "/updater.bin") << "old updater";
+    std::ofstream(active + "/assets/font") << "font";
+    /// unpacked by the update
+    std::ofstream(inactive + "/boot.bin") << "new boot";
+
+    /// never switched - the first slot is active
+    char slot[BOOT_SLOT_NAME_MAX];
+    BOOST_TEST(boot_slot_active(boot_json.c_str(), slot) == ErrorBootSlotOk);
+    BOOST_TEST(std::string(slot) == "current");
+    BOOST_TEST(std::string(boot_slot_other(slot)) == "previous");
+
+    struct update_handle_s h;
+    update_firmware_init(&h);
+    h.update_os = active.c_str();
+    h.tmp_os    = inactive.c_str();
+    h.boot_json = boot_json.c_str();
+    BOOST_TEST(slot_activate(&h));
+
+    BOOST_TEST(StagePackage::read(inactive + "/boot.bin") == "new boot");
+    BOOST_TEST(StagePackage::read(inactive + "/updater.bin") == "old updater");
+    BOOST_TEST(StagePackage::read(inactive + "/assets/font") == "font");
+    BOOST_TEST(StagePackage::read(active + "/boot.bin") == "old boot");
+    BOOST_TEST(boot_slot_active(boot_json.c_str(), slot) == ErrorBootSlotOk);
+    BOOST_TEST(std::string(slot) == "previous");
+
+    /// crc is in the json itself - the switch is a single file
+    auto json = StagePackage::read(boot_json);
+    const auto digits = json.rfind("\"" BOOT_SLOT_CRC_KEY "\"");
+    BOOST_REQUIRE(digits != std::string::npos);
+    const auto value = json.find('"', digits + sizeof(BOOT_SLOT_CRC_KEY) + 1) + 1;
+    const auto crc = json.substr(value, 8);
+    json.replace(value, 8, "00000000");
+    BOOST_TEST(std::stoul(crc, nullptr, 16) == boot_slot_crc32(0, json.data(), json.size()));
+    BOOST_TEST(!std::filesystem::exists(boot_json + BOOT_SLOT_CRC_EXTENSION));
+    BOOST_TEST(boot_slot_crc32(0, "123456789", 9) == 0xCBF43926u);
+
+    /// power loss between the unlink and the rename of the switch on FAT
+    std::filesystem::rename(boot_json, boot_json + ".new");
+    BOOST_TEST(boot_slot_active(boot_json.c_str(), slot) == ErrorBootSlotOk);
+    BOOST_TEST(std::string(slot) == "previous");
+    /// incomplete one isn't taken
+    std::ofstream(boot_json + ".new", std::ios::app) << " ";
+    BOOST_TEST(boot_slot_active(boot_json.c_str(), slot) == ErrorBootSlotOk);
+    BOOST_TEST(std::string(slot) == "current");
+    std::filesystem::remove(boot_json + ".new");
+
+    /// json of older updaters is guarded by the crc file, it's gone after the switch
+    const std::string legacy = R"({"main": {"ostype": "previous"}, "timestamp": "1"})";
+    char legacy_crc[9];
+    snprintf(legacy_crc, sizeof legacy_crc, "%08lx",
+             static_cast<unsigned long>(boot_slot_crc32(0, legacy.data(), legacy.size())));
+    std::ofstream(boot_json) << legacy;
+    std::ofstream(boot_json + BOOT_SLOT_CRC_EXTENSION) << legacy_crc;
+    BOOST_TEST(boot_slot_active(boot_json.c_str(), slot) == ErrorBootSlotOk);
+    BOOST_TEST(std::string(slot) == "previous");
+    BOOST_TEST(boot_slot_switch(boot_json.c_str(), nullptr, "current") == ErrorBootSlotOk);
+    BOOST_TEST(!std::filesystem::exists(boot_json + BOOT_SLOT_CRC_EXTENSION));
+    BOOST_TEST(!std::filesystem::exists(boot_json + ".new"));
+    BOOST_TEST(StagePackage::read(boot_json).find("\"timestamp\"") != std::string::npos);
+    BOOST_TEST(boot_slot_active(boot_json.c_str(), slot) == ErrorBootSlotOk);
+    BOOST_TEST(std::string(slot) == "current");
+
+    /// json not matching its crc is refused
+    std::ofstream(boot_json, std::ios::app) << " ";
+    BOOST_TEST(boot_slot_active(boot_json.c_str(), slot) == ErrorBootSlotFormat);
+
+    /// partial os of a failed update is cleared as a whole
+    h.tmp_os = active.c_str();
+    slot_discard(&h);
+    BOOST_TEST(std::filesystem::is_directory(active));
+    BOOST_TEST(std::filesystem::is_empty(active));
+    BOOST_TEST(StagePackage::read(inactive + "/boot.bin") == "new boot");
+    std::filesystem::remove_all(root);
+}
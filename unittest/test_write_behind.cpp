@@ -0,0 +1,127 @@
+#include <boost/test/unit_test.hpp>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <prv/blkdev/write_behind.h>
+#define BOOST_TEST_MODULE test write behind
+
+namespace
+{
+    constexpr size_t sector_size = 512;
+
+    /// device reading the buffer only when the transfer is waited for, like the ADMA running in background
+    struct FakeDevice
+    {
+        std::vector<uint8_t> storage = std::vector<uint8_t>(64 * sector_size);
+        std::string log;
+        const void *in_flight = nullptr;
+        lba_t lba             = 0;
+        blk_size_t count      = 0;
+        int start_error       = 0;
+        std::vector<int> wait_errors;
+
+        static int start(void *dev, lba_t lba, blk_size_t count, const void *buf)
+        {
+            auto *d = static_cast<FakeDevice *>(dev);
+            d->log += d->in_flight ? "!" : "s";
+            if (d->start_error) {
+                return d->start_error;
+            }
+            d->in_flight = buf;
+            d->lba       = lba;
+            d->count     = count;
+            return 0;
+        }
+
+        static int wait(void *dev)
+        {
+            auto *d = static_cast<FakeDevice *>(dev);
+            d->log += "w";
+            if (d->in_flight) {
+                memcpy(&d->storage[d->lba * sector_size], d->in_flight, d->count * sector_size);
+                d->in_flight = nullptr;
+            }
+            if (d->wait_errors.empty()) {
+                return 0;
+            }
+            const int err = d->wait_errors.front();
+            d->wait_errors.erase(d->wait_errors.begin());
+            return err;
+        }
+    };
+
+    const struct write_behind_ops fake_ops = {FakeDevice::start, FakeDevice::wait};
+} // namespace
+
+BOOST_AUTO_TEST_CASE(write_behind_invalid_config)
+{
+    struct write_behind wb;
+    FakeDevice dev;
+    BOOST_TEST(write_behind_init(&wb, nullptr, &dev, 4 * sector_size, sector_size) == -EINVAL);
+    BOOST_TEST(write_behind_init(&wb, &fake_ops, &dev, sector_size / 2, sector_size) == -EINVAL);
+    BOOST_TEST(write_behind_init(&wb, &fake_ops, &dev, 3 * sector_size + 1, sector_size) == -EINVAL);
+    BOOST_TEST(!write_behind_enabled(&wb));
+}
+
+BOOST_AUTO_TEST_CASE(write_behind_ordering)
+{
+    struct write_behind wb;
+    FakeDevice dev;
+    BOOST_REQUIRE(write_behind_init(&wb, &fake_ops, &dev, 4 * sector_size, sector_size) == 0);
+
+    /// caller reuses its buffer as soon as the write returns
+    std::vector<uint8_t> expected(dev.storage.size());
+    std::vector<uint8_t> data(10 * sector_size);
+    lba_t lba = 0;
+    for (int round = 0; round < 3; ++round) {
+        for (size_t i = 0; i < data.size(); ++i) {
+            data[i] = static_cast<uint8_t>(round * 31 + i / sector_size);
+        }
+        memcpy(&expected[lba * sector_size], data.data(), data.size());
+        BOOST_TEST(write_behind_write(&wb, lba, data.size() / sector_size, data.data()) == 0);
+        std::fill(data.begin(), data.end(), 0xff);
+        lba += data.size() / sector_size;
+    }
+    /// last chunk is still in flight
+    BOOST_TEST(dev.in_flight != nullptr);
+    BOOST_TEST(write_behind_wait(&wb) == 0);
+    BOOST_TEST(dev.storage == expected);
+
+    /// every start waits for the previous transfer, chunks of the buffer size, nothing waited twice
+    BOOST_TEST(dev.log.find('!') == std::string::npos);
+    BOOST_TEST(dev.log == "swswswswswswswswsw");
+    BOOST_TEST(write_behind_wait(&wb) == 0);
+    BOOST_TEST(dev.log.back() == 'w');
+    BOOST_TEST(dev.log.size() == 18);
+    write_behind_free(&wb);
+}
+
+BOOST_AUTO_TEST_CASE(write_behind_errors)
+{
+    struct write_behind wb;
+    FakeDevice dev;
+    BOOST_REQUIRE(write_behind_init(&wb, &fake_ops, &dev, 4 * sector_size, sector_size) == 0);
+    std::vector<uint8_t> data(4 * sector_size, 'a');
+
+    /// failed transfer is reported by the next write, its data isn't started
+    dev.wait_errors = {-EIO};
+    BOOST_TEST(write_behind_write(&wb, 0, 4, data.data()) == 0);
+    BOOST_TEST(write_behind_write(&wb, 4, 4, data.data()) == -EIO);
+    BOOST_TEST(dev.log == "sw");
+    BOOST_TEST(write_behind_wait(&wb) == 0);
+
+    /// or by the wait when it was the last one
+    BOOST_TEST(write_behind_write(&wb, 4, 4, data.data()) == 0);
+    dev.wait_errors = {-EIO};
+    BOOST_TEST(write_behind_wait(&wb) == -EIO);
+    BOOST_TEST(write_behind_wait(&wb) == 0);
+
+    /// transfer that didn't start isn't waited for
+    dev.log.clear();
+    dev.start_error = -EBUSY;
+    BOOST_TEST(write_behind_write(&wb, 8, 4, data.data()) == -EBUSY);
+    BOOST_TEST(write_behind_wait(&wb) == 0);
+    BOOST_TEST(dev.log == "s");
+    write_behind_free(&wb);
+}
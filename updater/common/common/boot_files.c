@@ -8,7 +8,7 @@ const char *backup_boot_files[] =
                 "version.json",
         };
 
-const size_t verify_files_list_size = 3;
+const size_t verify_files_list_size = VERIFY_FILES_LIST_SIZE;
 const char *verify_files[] =
         {
                 "updater.bin",
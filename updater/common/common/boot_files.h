@@ -11,6 +11,9 @@ extern "C"
 extern const size_t backup_boot_files_list_size;
 extern const char *backup_boot_files[];
 
+/// number of entries in verify_files - usable for static tables
+#define VERIFY_FILES_LIST_SIZE 3
+
 extern const size_t verify_files_list_size;
 extern const char *verify_files[];
 
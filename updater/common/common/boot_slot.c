@@ -0,0 +1,302 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <cJSON/cJSON.h>
+#include "boot_slot.h"
+#include "log.h"
+
+/// .boot.json is a few hundred bytes
+#define BOOT_JSON_MAX_SIZE 4096
+#define BOOT_SLOT_NEW_EXTENSION ".new"
+
+const char *boot_slots[2] = {
+        "current",
+        "previous",
+};
+
+static void json_cleanup(cJSON **json) {
+    cJSON_Delete(*json);
+}
+
+static void str_cleanup(char **str) {
+    free(*str);
+}
+
+/// whole file in allocated zero terminated buffer
+static int read_file(const char *path, char **data, size_t *size) {
+    *data = NULL;
+    *size = 0;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -errno;
+    }
+    int ret = 0;
+    char *buffer = malloc(BOOT_JSON_MAX_SIZE + 1);
+    size_t fill = 0;
+    if (buffer == NULL) {
+        ret = -ENOMEM;
+    }
+    while (ret == 0) {
+        const ssize_t bytes = read(fd, buffer + fill, BOOT_JSON_MAX_SIZE + 1 - fill);
+        if (bytes < 0) {
+            ret = -errno;
+        } else if (bytes == 0) {
+            break;
+        } else if ((fill += bytes) > BOOT_JSON_MAX_SIZE) {
+            debug_log("Boot slot: %s exceeds %d bytes", path, BOOT_JSON_MAX_SIZE);
+            ret = -EFBIG;
+        }
+    }
+    close(fd);
+    if (ret != 0) {
+        free(buffer);
+        return ret;
+    }
+    buffer[fill] = '\0';
+    *data = buffer;
+    *size = fill;
+    return 0;
+}
+
+static int write_file(const char *path, const void *data, size_t size) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (fd < 0) {
+        return -errno;
+    }
+    int ret = write(fd, data, size) == (ssize_t) size ? 0 : -EIO;
+    if (close(fd) != 0 && ret == 0) {
+        ret = -errno;
+    }
+    return ret;
+}
+
+/// rename over the old file, FAT refuses to rename over an existing file
+static int replace_file(const char *from, const char *to) {
+    if (rename(from, to) == 0) {
+        return 0;
+    }
+    if (unlink(to) != 0 && errno != ENOENT) {
+        return -errno;
+    }
+    return rename(from, to) == 0 ? 0 : -errno;
+}
+
+static char *path_with(const char *path, const char *extension) {
+    char *out = malloc(strlen(path) + strlen(extension) + 1);
+    if (out != NULL) {
+        sprintf(out, "%s%s", path, extension);
+    }
+    return out;
+}
+
+/// position of the 8 hex digits of "crc32" in the json text, NULL when there is none
+/// it's the last member of the top object - the last key of that name in the text
+static char *embedded_crc(char *json) {
+    char *key = NULL;
+    for (char *next = json; (next = strstr(next, "\"" BOOT_SLOT_CRC_KEY "\"")) != NULL; ++next) {
+        key = next;
+    }
+    char *value = key ? strchr(key + sizeof(BOOT_SLOT_CRC_KEY) + 1, '"') : NULL;
+    if (value == NULL || strspn(value + 1, "0123456789abcdefABCDEF") != 8 || value[9] != '"') {
+        return NULL;
+    }
+    return value + 1;
+}
+
+/// crc of the json text with its crc digits zeroed
+static uint32_t embedded_crc_calculate(char *json, size_t size, char *digits) {
+    char saved[8];
+    memcpy(saved, digits, sizeof saved);
+    memset(digits, '0', sizeof saved);
+    const uint32_t crc = boot_slot_crc32(0, json, size);
+    memcpy(digits, saved, sizeof saved);
+    return crc;
+}
+
+/// json without the embedded crc is checked against the crc file of older updaters,
+/// crc file missing - json is taken as it is
+static int verify_crc(const char *boot_json, char *json, size_t size) {
+    char *crc_text __attribute__((__cleanup__(str_cleanup))) = NULL;
+    char *digits = embedded_crc(json);
+    uint32_t calculated;
+    if (digits != NULL) {
+        calculated = embedded_crc_calculate(json, size, digits);
+    } else {
+        char *crc_path __attribute__((__cleanup__(str_cleanup))) = path_with(boot_json, BOOT_SLOT_CRC_EXTENSION);
+        size_t crc_size = 0;
+        if (crc_path == NULL) {
+            return ErrorBootSlotMemory;
+        }
+        if (read_file(crc_path, &crc_text, &crc_size) != 0) {
+            return ErrorBootSlotOk;
+        }
+        digits = crc_text;
+        calculated = boot_slot_crc32(0, json, size);
+    }
+    const uint32_t expected = strtoul(digits, NULL, 16);
+    if (expected != calculated) {
+        debug_log("Boot slot: %s crc mismatch: %08lx vs %08lx", boot_json, (unsigned long) expected,
+                  (unsigned long) calculated);
+        return ErrorBootSlotFormat;
+    }
+    return ErrorBootSlotOk;
+}
+
+/// json written aside is complete once its crc matches - power loss between the unlink and
+/// the rename of replace_file leaves only that one
+static int read_json(const char *boot_json, char **text, size_t *size) {
+    int err = read_file(boot_json, text, size);
+    if (err != -ENOENT) {
+        return err;
+    }
+    char *json_new __attribute__((__cleanup__(str_cleanup))) = path_with(boot_json, BOOT_SLOT_NEW_EXTENSION);
+    if (json_new == NULL || read_file(json_new, text, size) != 0) {
+        return -ENOENT;
+    }
+    if (embedded_crc(*text) == NULL || verify_crc(json_new, *text, *size) != ErrorBootSlotOk) {
+        free(*text);
+        *text = NULL;
+        *size = 0;
+        return -ENOENT;
+    }
+    debug_log("Boot slot: %s is missing, %s is taken", boot_json, json_new);
+    return 0;
+}
+
+int boot_slot_active(const char *boot_json, char name[BOOT_SLOT_NAME_MAX]) {
+    char *text __attribute__((__cleanup__(str_cleanup))) = NULL;
+    size_t size = 0;
+    const int err = read_json(boot_json, &text, &size);
+    if (err == -ENOENT) {
+        strcpy(name, boot_slots[0]);
+        return ErrorBootSlotOk;
+    }
+    if (err != 0) {
+        debug_log("Boot slot: unable to read %s: %d", boot_json, err);
+        return ErrorBootSlotRead;
+    }
+    int ret = verify_crc(boot_json, text, size);
+    if (ret != ErrorBootSlotOk) {
+        return ret;
+    }
+
+    cJSON *json __attribute__((__cleanup__(json_cleanup))) = cJSON_Parse(text);
+    const cJSON *main_json = json ? cJSON_GetObjectItemCaseSensitive(json, "main") : NULL;
+    const cJSON *ostype = main_json ? cJSON_GetObjectItemCaseSensitive(main_json, "ostype") : NULL;
+    if (json == NULL || !cJSON_IsString(ostype) || ostype->valuestring == NULL) {
+        debug_log("Boot slot: no main.ostype in %s", boot_json);
+        return ErrorBootSlotFormat;
+    }
+    if (boot_slot_other(ostype->valuestring) == NULL) {
+        debug_log("Boot slot: %s is not a slot", ostype->valuestring);
+        return ErrorBootSlotName;
+    }
+    strcpy(name, ostype->valuestring);
+    return ErrorBootSlotOk;
+}
+
+const char *boot_slot_other(const char *name) {
+    if (name == NULL) {
+        return NULL;
+    }
+    if (strcmp(name, boot_slots[0]) == 0) {
+        return boot_slots[1];
+    }
+    if (strcmp(name, boot_slots[1]) == 0) {
+        return boot_slots[0];
+    }
+    return NULL;
+}
+
+int boot_slot_switch(const char *boot_json, const char *template_json, const char *name) {
+    if (boot_slot_other(name) == NULL) {
+        return ErrorBootSlotName;
+    }
+    char *text __attribute__((__cleanup__(str_cleanup))) = NULL;
+    size_t size = 0;
+    const int err = template_json ? read_file(template_json, &text, &size) : read_json(boot_json, &text, &size);
+    if (err != 0 && err != -ENOENT) {
+        debug_log("Boot slot: unable to read %s: %d", template_json ? template_json : boot_json, err);
+        return ErrorBootSlotRead;
+    }
+
+    cJSON *json __attribute__((__cleanup__(json_cleanup))) = text ? cJSON_Parse(text) : cJSON_CreateObject();
+    if (json == NULL) {
+        debug_log("Boot slot: %s is not valid json", template_json ? template_json : boot_json);
+        return ErrorBootSlotFormat;
+    }
+    cJSON *main_json = cJSON_GetObjectItemCaseSensitive(json, "main");
+    if (main_json == NULL) {
+        main_json = cJSON_AddObjectToObject(json, "main");
+    }
+    if (main_json == NULL) {
+        return ErrorBootSlotMemory;
+    }
+    cJSON_DeleteItemFromObjectCaseSensitive(main_json, "ostype");
+    if (cJSON_AddStringToObject(main_json, "ostype", name) == NULL) {
+        return ErrorBootSlotMemory;
+    }
+    /// digits are filled in the printed text, see embedded_crc
+    cJSON_DeleteItemFromObjectCaseSensitive(json, BOOT_SLOT_CRC_KEY);
+    if (cJSON_AddStringToObject(json, BOOT_SLOT_CRC_KEY, "00000000") == NULL) {
+        return ErrorBootSlotMemory;
+    }
+
+    char *out __attribute__((__cleanup__(str_cleanup))) = cJSON_Print(json);
+    char *crc_path __attribute__((__cleanup__(str_cleanup))) = path_with(boot_json, BOOT_SLOT_CRC_EXTENSION);
+    char *json_new __attribute__((__cleanup__(str_cleanup))) = path_with(boot_json, BOOT_SLOT_NEW_EXTENSION);
+    char *digits = out ? embedded_crc(out) : NULL;
+    if (out == NULL || crc_path == NULL || json_new == NULL || digits == NULL) {
+        return ErrorBootSlotMemory;
+    }
+    char crc_text[9];
+    snprintf(crc_text, sizeof crc_text, "%08lx", (unsigned long) boot_slot_crc32(0, out, strlen(out)));
+    memcpy(digits, crc_text, 8);
+
+    if (write_file(json_new, out, strlen(out)) != 0) {
+        debug_log("Boot slot: unable to write %s: %d", json_new, errno);
+        unlink(json_new);
+        return ErrorBootSlotWrite;
+    }
+    /// crc file of the old json goes first, the old json alone is still taken as it is;
+    /// then the switch is the single rename of the complete json
+    if ((unlink(crc_path) != 0 && errno != ENOENT) || replace_file(json_new, boot_json) != 0) {
+        debug_log("Boot slot: unable to replace %s: %d", boot_json, errno);
+        return ErrorBootSlotWrite;
+    }
+    debug_log("Boot slot: %s points at %s", boot_json, name);
+    return ErrorBootSlotOk;
+}
+
+uint32_t boot_slot_crc32(uint32_t crc, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    crc = ~crc;
+    for (size_t i = 0; i < size; ++i) {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1u));
+        }
+    }
+    return ~crc;
+}
+
+const char *boot_slot_strerror(int err) {
+    switch (err) {
+        case ErrorBootSlotOk:
+            return "ErrorBootSlotOk";
+        case ErrorBootSlotRead:
+            return "ErrorBootSlotRead";
+        case ErrorBootSlotFormat:
+            return "ErrorBootSlotFormat";
+        case ErrorBootSlotName:
+            return "ErrorBootSlotName";
+        case ErrorBootSlotWrite:
+            return "ErrorBootSlotWrite";
+        case ErrorBootSlotMemory:
+            return "ErrorBootSlotMemory";
+    }
+    return "";
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// A/B os slots: the os partition root has two os catalogs, ecoboot starts the one named by
+/// "main": {"ostype": ...} of .boot.json next to them
+///
+/// update unpacks into the inactive slot and switches .boot.json to it, the slot left behind is
+/// the backup of the previous os - no os files are copied to the backup and nothing is moved
+///
+/// .boot.json carries its own crc: "crc32" is crc32 of the json text with the 8 hex digits of
+/// its value zeroed, so the switch replaces a single file; json of older updaters without it is
+/// guarded by .boot.json.crc - crc32 of the json as 8 hex digits
+
+#define BOOT_SLOT_NAME_MAX 16
+#define BOOT_SLOT_CRC_EXTENSION ".crc"
+#define BOOT_SLOT_CRC_KEY "crc32"
+
+enum boot_slot_error_e {
+    ErrorBootSlotOk,
+    ErrorBootSlotRead,   /// .boot.json can't be read
+    ErrorBootSlotFormat, /// .boot.json is not valid json or its crc doesn't match
+    ErrorBootSlotName,   /// not a slot name
+    ErrorBootSlotWrite,
+    ErrorBootSlotMemory,
+};
+
+/// slot catalog names, first one is active when there is no .boot.json
+extern const char *boot_slots[2];
+
+/// name of the slot .boot.json points at
+/// missing .boot.json - the first slot, device never updated with slots
+int boot_slot_active(const char *boot_json, char name[BOOT_SLOT_NAME_MAX]);
+
+/// the other slot, NULL if name isn't a slot
+const char *boot_slot_other(const char *name);
+
+/// point .boot.json at the slot, other fields are kept
+/// template_json is the .boot.json to take the fields from (e.g. delivered with the new os), NULL - current one
+/// new json is written aside first and renamed over the old one, so it's replaced only by a complete one
+int boot_slot_switch(const char *boot_json, const char *template_json, const char *name);
+
+uint32_t boot_slot_crc32(uint32_t crc, const void *data, size_t size);
+
+const char *boot_slot_strerror(int err);
+
+#ifdef __cplusplus
+}
+#endif
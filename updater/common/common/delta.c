@@ -0,0 +1,215 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "delta.h"
+#include "log.h"
+
+enum delta_state_e {
+    DeltaStateHeader,
+    DeltaStateOp,
+    DeltaStateArgs,
+    DeltaStateAdd,
+    DeltaStateDone,
+};
+
+static uint32_t read_le32(const unsigned char *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static int write_target(struct delta_apply_s *delta, const void *data, size_t size) {
+    if (size > delta->target_size - delta->written) {
+        debug_log("Delta: target exceeds declared size %u", delta->target_size);
+        return ErrorDeltaFormat;
+    }
+    if (write(delta->target_fd, data, size) != (ssize_t) size) {
+        debug_log("Delta: failed to write target: %d", errno);
+        return ErrorDeltaIo;
+    }
+    MD5_Update(&delta->md5, data, size);
+    delta->written += size;
+    return ErrorDeltaOk;
+}
+
+/// installed file has to be exactly the one the delta was made against
+static int check_source(struct delta_apply_s *delta) {
+    if (memcmp(delta->header, DELTA_MAGIC, DELTA_MAGIC_SIZE) != 0) {
+        debug_log("Delta: invalid magic");
+        return ErrorDeltaFormat;
+    }
+    delta->source_size = read_le32(delta->header + DELTA_MAGIC_SIZE);
+    delta->target_size = read_le32(delta->header + DELTA_MAGIC_SIZE + 4);
+
+    MD5_CTX md5;
+    unsigned char digest[DELTA_MD5_SIZE];
+    uint32_t size = 0;
+    ssize_t bytes_read = 0;
+    MD5_Init(&md5);
+    while ((bytes_read = read(delta->source_fd, delta->buffer, DELTA_COPY_BUFFER_SIZE)) > 0) {
+        MD5_Update(&md5, delta->buffer, bytes_read);
+        size += bytes_read;
+    }
+    MD5_Final(digest, &md5);
+    if (bytes_read < 0) {
+        debug_log("Delta: failed to read source: %d", errno);
+        return ErrorDeltaIo;
+    }
+    if (size != delta->source_size || memcmp(digest, delta->header + DELTA_MAGIC_SIZE + 8, DELTA_MD5_SIZE) != 0) {
+        debug_log("Delta: installed file doesn't match delta source");
+        return ErrorDeltaSource;
+    }
+    return ErrorDeltaOk;
+}
+
+static int copy_source(struct delta_apply_s *delta, uint32_t offset, uint32_t length) {
+    if (offset > delta->source_size || length > delta->source_size - offset) {
+        debug_log("Delta: copy %u@%u out of source", length, offset);
+        return ErrorDeltaFormat;
+    }
+    if (lseek(delta->source_fd, offset, SEEK_SET) < 0) {
+        debug_log("Delta: failed to seek source: %d", errno);
+        return ErrorDeltaIo;
+    }
+    while (length > 0) {
+        const size_t chunk = length > DELTA_COPY_BUFFER_SIZE ? DELTA_COPY_BUFFER_SIZE : length;
+        if (read(delta->source_fd, delta->buffer, chunk) != (ssize_t) chunk) {
+            debug_log("Delta: failed to read source: %d", errno);
+            return ErrorDeltaIo;
+        }
+        int ret = write_target(delta, delta->buffer, chunk);
+        if (ret != ErrorDeltaOk) {
+            return ret;
+        }
+        length -= chunk;
+    }
+    return ErrorDeltaOk;
+}
+
+/// collect bytes of a fixed size field that may be split between chunks
+static size_t collect(unsigned char *field, size_t field_size, size_t *fill, const unsigned char *data, size_t size) {
+    size_t n = field_size - *fill;
+    n = n > size ? size : n;
+    memcpy(field + *fill, data, n);
+    *fill += n;
+    return n;
+}
+
+int delta_apply_init(struct delta_apply_s *delta, const char *source, const char *target) {
+    memset(delta, 0, sizeof *delta);
+    delta->source_fd = delta->target_fd = -1;
+    MD5_Init(&delta->md5);
+    delta->buffer = malloc(DELTA_COPY_BUFFER_SIZE);
+    if (delta->buffer == NULL) {
+        debug_log("Delta: unable to allocate buffer");
+        return delta->error = ErrorDeltaIo;
+    }
+    delta->source_fd = open(source, O_RDONLY);
+    if (delta->source_fd < 0) {
+        debug_log("Delta: unable to open source %s: %d", source, errno);
+        return delta->error = ErrorDeltaSource;
+    }
+    delta->target_fd = open(target, O_WRONLY | O_CREAT);
+    if (delta->target_fd < 0) {
+        debug_log("Delta: unable to create target %s: %d", target, errno);
+        return delta->error = ErrorDeltaIo;
+    }
+    return ErrorDeltaOk;
+}
+
+int delta_apply_feed(struct delta_apply_s *delta, const void *data, size_t size) {
+    const unsigned char *p = data;
+    while (size > 0 && delta->error == ErrorDeltaOk) {
+        size_t used = 0;
+        switch (delta->state) {
+            case DeltaStateHeader:
+                used = collect(delta->header, sizeof delta->header, &delta->fill, p, size);
+                if (delta->fill == sizeof delta->header) {
+                    delta->error = check_source(delta);
+                    delta->state = DeltaStateOp;
+                }
+                break;
+            case DeltaStateOp:
+                used = 1;
+                delta->op = *p;
+                delta->fill = 0;
+                if (delta->op == DeltaOpEnd) {
+                    delta->state = DeltaStateDone;
+                } else if (delta->op == DeltaOpCopy || delta->op == DeltaOpAdd) {
+                    delta->state = DeltaStateArgs;
+                } else {
+                    debug_log("Delta: invalid op %d", delta->op);
+                    delta->error = ErrorDeltaFormat;
+                }
+                break;
+            case DeltaStateArgs: {
+                const size_t args_size = delta->op == DeltaOpCopy ? 8 : 4;
+                used = collect(delta->args, args_size, &delta->fill, p, size);
+                if (delta->fill < args_size) {
+                    break;
+                }
+                delta->state = DeltaStateOp;
+                if (delta->op == DeltaOpCopy) {
+                    delta->error = copy_source(delta, read_le32(delta->args), read_le32(delta->args + 4));
+                } else {
+                    delta->remaining = read_le32(delta->args);
+                    delta->state = delta->remaining ? DeltaStateAdd : DeltaStateOp;
+                }
+                break;
+            }
+            case DeltaStateAdd:
+                used = size > delta->remaining ? delta->remaining : size;
+                delta->error = write_target(delta, p, used);
+                delta->remaining -= used;
+                if (delta->remaining == 0) {
+                    delta->state = DeltaStateOp;
+                }
+                break;
+            default:
+                debug_log("Delta: data after end of delta");
+                delta->error = ErrorDeltaFormat;
+                break;
+        }
+        p += used;
+        size -= used;
+    }
+    return delta->error;
+}
+
+int delta_apply_finish(struct delta_apply_s *delta, unsigned char md5[DELTA_MD5_SIZE]) {
+    if (delta->error != ErrorDeltaOk) {
+        return delta->error;
+    }
+    if (delta->state != DeltaStateDone || delta->written != delta->target_size) {
+        debug_log("Delta: truncated delta, %u of %u bytes built", delta->written, delta->target_size);
+        return delta->error = ErrorDeltaFormat;
+    }
+    MD5_Final(md5, &delta->md5);
+    return ErrorDeltaOk;
+}
+
+void delta_apply_deinit(struct delta_apply_s *delta) {
+    if (delta->source_fd >= 0) {
+        close(delta->source_fd);
+    }
+    if (delta->target_fd >= 0) {
+        close(delta->target_fd);
+    }
+    delta->source_fd = delta->target_fd = -1;
+    free(delta->buffer);
+    delta->buffer = NULL;
+}
+
+const char *delta_strerror(int err) {
+    switch (err) {
+        case ErrorDeltaOk:
+            return "ErrorDeltaOk";
+        case ErrorDeltaFormat:
+            return "ErrorDeltaFormat";
+        case ErrorDeltaSource:
+            return "ErrorDeltaSource";
+        case ErrorDeltaIo:
+            return "ErrorDeltaIo";
+    }
+    return "";
+}
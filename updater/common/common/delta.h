@@ -0,0 +1,75 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <md5/md5.h>
+
+/// binary delta of a single file: target is rebuilt from the installed source file and the delta
+///
+/// format, all numbers are little endian u32:
+///   header:  "PUDELTA1", source size, target size, source md5[16]
+///   ops:     COPY(1) offset length - copy from the source file
+///            ADD(2) length data    - literal data
+///            END(0)
+/// package entry "<name>.delta" is applied against installed <name>, result is unpacked as <name>
+
+#define DELTA_EXTENSION ".delta"
+#define DELTA_MAGIC "PUDELTA1"
+#define DELTA_MAGIC_SIZE 8
+#define DELTA_MD5_SIZE 16
+#define DELTA_HEADER_SIZE (DELTA_MAGIC_SIZE + 4 + 4 + DELTA_MD5_SIZE)
+#define DELTA_COPY_BUFFER_SIZE (32 * 1024)
+
+enum delta_error_e {
+    ErrorDeltaOk,
+    ErrorDeltaFormat, /// corrupted or truncated delta
+    ErrorDeltaSource, /// installed file doesn't match the delta source
+    ErrorDeltaIo,
+};
+
+enum delta_op_e {
+    DeltaOpEnd = 0,
+    DeltaOpCopy = 1,
+    DeltaOpAdd = 2,
+};
+
+/// streaming delta applier - delta data is fed in chunks of any size, target is written as it's built
+struct delta_apply_s {
+    int source_fd;
+    int target_fd;
+    unsigned char header[DELTA_HEADER_SIZE];
+    unsigned char args[8];   /// arguments of the current op
+    size_t fill;             /// bytes of header or args collected
+    int state;
+    unsigned char op;
+    uint32_t source_size;
+    uint32_t target_size;
+    uint32_t remaining;      /// literal bytes of the current ADD
+    uint32_t written;        /// target bytes written
+    unsigned char *buffer;   /// COPY data buffer
+    MD5_CTX md5;             /// md5 of the target
+    int error;               /// delta_error_e, sticky
+};
+
+/// open source for reading and create target
+int delta_apply_init(struct delta_apply_s *delta, const char *source, const char *target);
+
+/// apply next chunk of the delta
+int delta_apply_feed(struct delta_apply_s *delta, const void *data, size_t size);
+
+/// check the whole delta was applied and return md5 of the target
+int delta_apply_finish(struct delta_apply_s *delta, unsigned char md5[DELTA_MD5_SIZE]);
+
+void delta_apply_deinit(struct delta_apply_s *delta);
+
+const char *delta_strerror(int err);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,142 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <hal/blk_dev.h>
+#include <hal/delay.h>
+#include "io_buffer.h"
+#include "log.h"
+
+/// doubled sizes probed from the smallest erase group multiple
+#define PROBE_STEPS 8
+
+static struct {
+    void *buffer;
+    size_t size;
+    bool taken;
+} session;
+
+int io_buffer_init(size_t size) {
+    if (session.taken) {
+        debug_log("IO buffer: buffer is in use");
+        return ErrorIoBufferBusy;
+    }
+    if (size == 0) {
+        size = IO_BUFFER_DEFAULT_SIZE;
+    }
+    if (session.buffer != NULL && session.size == size) {
+        return ErrorIoBufferOk;
+    }
+    free(session.buffer);
+    session.size = 0;
+    session.buffer = malloc(size);
+    if (session.buffer == NULL) {
+        debug_log("IO buffer: unable to allocate %u bytes", size);
+        return ErrorIoBufferMemory;
+    }
+    session.size = size;
+    debug_log("IO buffer: %u kB", size / 1024);
+    return ErrorIoBufferOk;
+}
+
+/// read IO_BUFFER_PROBE_BYTES in reads of size bytes, lba continues where the previous probe ended so
+/// no probe reads data just read by another one
+static uint32_t probe_rate(int device, const blk_dev_info_t *info, size_t size, void *buffer, lba_t *lba) {
+    const blk_size_t count = size / info->sector_size;
+    const uint32_t start = get_jiffiess();
+    size_t bytes = 0;
+    while (bytes < IO_BUFFER_PROBE_BYTES) {
+        if (*lba + count > info->sector_count) {
+            *lba = 0;
+        }
+        int err = blk_read(device, *lba, count, buffer);
+        if (err) {
+            debug_log("IO buffer: probe read of %u sectors at %u failed: %d", count, *lba, err);
+            return 0;
+        }
+        *lba += count;
+        bytes += size;
+    }
+    uint32_t ms = get_jiffiess() - start;
+    ms = ms ? ms : 1;
+    /// bytes per ms is kB/s
+    const uint32_t rate = bytes / ms;
+    debug_log("IO buffer: %u kB reads: %u kB/s", size / 1024, rate);
+    return rate;
+}
+
+size_t io_buffer_probe(int device) {
+    blk_dev_info_t info;
+    int err = blk_info(device, &info);
+    if (err || info.sector_size == 0 || info.sector_count == 0) {
+        debug_log("IO buffer: no block device %d to probe: %d", device, err);
+        return IO_BUFFER_DEFAULT_SIZE;
+    }
+    const size_t group = (size_t) (info.erase_group ? info.erase_group : 1) * info.sector_size;
+    const size_t first = (IO_BUFFER_MIN_SIZE + group - 1) / group * group;
+    if (first >= IO_BUFFER_MAX_SIZE || (size_t) info.sector_count * info.sector_size < IO_BUFFER_MAX_SIZE) {
+        return first;
+    }
+
+    size_t sizes[PROBE_STEPS];
+    uint32_t rates[PROBE_STEPS];
+    size_t steps = 0;
+    for (size_t size = first; size <= IO_BUFFER_MAX_SIZE && steps < PROBE_STEPS; size *= 2) {
+        sizes[steps++] = size;
+    }
+    void *buffer = malloc(sizes[steps - 1]);
+    if (buffer == NULL) {
+        debug_log("IO buffer: unable to allocate probe buffer");
+        return first;
+    }
+    lba_t lba = 0;
+    uint32_t best = 0;
+    for (size_t i = 0; i < steps; ++i) {
+        rates[i] = probe_rate(device, &info, sizes[i], buffer, &lba);
+        best = rates[i] > best ? rates[i] : best;
+    }
+    free(buffer);
+    if (best == 0) {
+        return IO_BUFFER_DEFAULT_SIZE;
+    }
+    /// larger buffer past the knee of the curve is memory taken from the rest of the update for nothing
+    for (size_t i = 0; i < steps; ++i) {
+        if ((uint64_t) rates[i] * 10 >= (uint64_t) best * 9) {
+            return sizes[i];
+        }
+    }
+    return sizes[steps - 1];
+}
+
+void *io_buffer_acquire(size_t *size) {
+    if (session.buffer == NULL || session.taken) {
+        return NULL;
+    }
+    session.taken = true;
+    *size = session.size;
+    return session.buffer;
+}
+
+void io_buffer_release(void *buffer) {
+    if (buffer != NULL && buffer == session.buffer) {
+        session.taken = false;
+    }
+}
+
+void io_buffer_deinit(void) {
+    free(session.buffer);
+    session.buffer = NULL;
+    session.size = 0;
+    session.taken = false;
+}
+
+const char *io_buffer_strerror(int err) {
+    switch (err) {
+        case ErrorIoBufferOk:
+            return "ErrorIoBufferOk";
+        case ErrorIoBufferMemory:
+            return "ErrorIoBufferMemory";
+        case ErrorIoBufferBusy:
+            return "ErrorIoBufferBusy";
+    }
+    return "";
+}
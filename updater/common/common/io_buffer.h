@@ -0,0 +1,49 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stddef.h>
+
+/// session I/O buffer: the update opens archives one after another (backup of boot files, of user data,
+/// package index, unpack) - every archive takes this single buffer instead of allocating its own
+/// megabyte, it's allocated once and never zeroed
+///
+/// it's taken by one archive at a time, an archive opened while it's taken allocates its own buffer
+
+#define IO_BUFFER_DEFAULT_SIZE (1024 * 1024)
+#define IO_BUFFER_MIN_SIZE (64 * 1024)
+#define IO_BUFFER_MAX_SIZE (2 * 1024 * 1024)
+/// bytes read with every probed buffer size
+#define IO_BUFFER_PROBE_BYTES (2 * 1024 * 1024)
+
+enum io_buffer_error_e {
+    ErrorIoBufferOk,
+    ErrorIoBufferMemory,
+    ErrorIoBufferBusy, /// buffer is taken, it can't be resized
+};
+
+/// allocate the session buffer of size bytes, IO_BUFFER_DEFAULT_SIZE for 0
+/// called again resizes the buffer
+int io_buffer_init(size_t size);
+
+/// buffer size for the block device: multiple of its erase group, the smallest one reading within 10%
+/// of the best throughput measured with whole erase group multiples up to IO_BUFFER_MAX_SIZE
+/// IO_BUFFER_DEFAULT_SIZE when the device can't be read
+size_t io_buffer_probe(int device);
+
+/// take the session buffer, NULL when it's taken or not allocated
+void *io_buffer_acquire(size_t *size);
+
+/// give back the buffer taken with io_buffer_acquire
+void io_buffer_release(void *buffer);
+
+void io_buffer_deinit(void);
+
+const char *io_buffer_strerror(int err);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,609 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include "lz4_frame.h"
+#include "log.h"
+
+/// FLG byte of the frame descriptor
+#define LZ4_FLG_VERSION_MASK 0xC0
+#define LZ4_FLG_VERSION 0x40
+#define LZ4_FLG_BLOCK_INDEPENDENT 0x20
+#define LZ4_FLG_BLOCK_CHECKSUM 0x10
+#define LZ4_FLG_CONTENT_SIZE 0x08
+#define LZ4_FLG_CONTENT_CHECKSUM 0x04
+#define LZ4_FLG_RESERVED 0x02
+#define LZ4_FLG_DICT_ID 0x01
+
+#define LZ4_BLOCK_UNCOMPRESSED 0x80000000U
+#define LZ4_MIN_MATCH 4
+/// the last match starts at least LZ4_MATCH_LIMIT bytes before the block end,
+/// the last LZ4_LAST_LITERALS bytes are literals
+#define LZ4_MATCH_LIMIT 12
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MAX_OFFSET 65535
+#define LZ4_HASH_BITS 12
+/// BD byte of the encoder frames: 64KiB blocks
+#define LZ4_BD_64KB 0x40
+/// compressed block never exceeds its size plus the length bytes of a single literal run
+#define LZ4_COMPRESS_BOUND(size) ((size) + (size) / 255 + 16)
+
+#define XXH_PRIME1 2654435761U
+#define XXH_PRIME2 2246822519U
+#define XXH_PRIME3 3266489917U
+#define XXH_PRIME4 668265263U
+#define XXH_PRIME5 374761393U
+
+static uint32_t read_le32(const void *ptr) {
+    const uint8_t *p = ptr;
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+static uint32_t rotl32(uint32_t x, unsigned r) {
+    return (x << r) | (x >> (32 - r));
+}
+
+static uint32_t xxh32_round(uint32_t acc, uint32_t input) {
+    acc += input * XXH_PRIME2;
+    acc = rotl32(acc, 13);
+    return acc * XXH_PRIME1;
+}
+
+static void xxh32_init(struct lz4_xxh32_s *state, uint32_t seed) {
+    memset(state, 0, sizeof *state);
+    state->v[0] = seed + XXH_PRIME1 + XXH_PRIME2;
+    state->v[1] = seed + XXH_PRIME2;
+    state->v[2] = seed;
+    state->v[3] = seed - XXH_PRIME1;
+}
+
+static void xxh32_stripe(struct lz4_xxh32_s *state, const uint8_t *p) {
+    for (size_t i = 0; i < 4; ++i) {
+        state->v[i] = xxh32_round(state->v[i], read_le32(p + 4 * i));
+    }
+}
+
+static void xxh32_update(struct lz4_xxh32_s *state, const void *data, size_t size) {
+    const uint8_t *p = data;
+    state->total += size;
+
+    if (state->mem_size + size < sizeof state->mem) {
+        memcpy(state->mem + state->mem_size, p, size);
+        state->mem_size += size;
+        return;
+    }
+    if (state->mem_size > 0) {
+        const size_t fill = sizeof state->mem - state->mem_size;
+        memcpy(state->mem + state->mem_size, p, fill);
+        xxh32_stripe(state, state->mem);
+        p += fill;
+        size -= fill;
+        state->mem_size = 0;
+    }
+    for (; size >= sizeof state->mem; p += sizeof state->mem, size -= sizeof state->mem) {
+        xxh32_stripe(state, p);
+    }
+    memcpy(state->mem, p, size);
+    state->mem_size = size;
+}
+
+static uint32_t xxh32_digest(const struct lz4_xxh32_s *state) {
+    uint32_t h;
+    if (state->total >= sizeof state->mem) {
+        h = rotl32(state->v[0], 1) + rotl32(state->v[1], 7) + rotl32(state->v[2], 12) + rotl32(state->v[3], 18);
+    } else {
+        h = state->v[2] + XXH_PRIME5;
+    }
+    h += (uint32_t) state->total;
+
+    const uint8_t *p = state->mem;
+    const uint8_t *end = state->mem + state->mem_size;
+    for (; p + 4 <= end; p += 4) {
+        h += read_le32(p) * XXH_PRIME3;
+        h = rotl32(h, 17) * XXH_PRIME4;
+    }
+    for (; p < end; ++p) {
+        h += *p * XXH_PRIME5;
+        h = rotl32(h, 11) * XXH_PRIME1;
+    }
+
+    h ^= h >> 15;
+    h *= XXH_PRIME2;
+    h ^= h >> 13;
+    h *= XXH_PRIME3;
+    h ^= h >> 16;
+    return h;
+}
+
+uint32_t lz4_xxh32(const void *data, size_t size, uint32_t seed) {
+    struct lz4_xxh32_s state;
+    xxh32_init(&state, seed);
+    xxh32_update(&state, data, size);
+    return xxh32_digest(&state);
+}
+
+/// read exactly size bytes unless the source ends
+/// @return bytes read, negative on source error
+static ssize_t source_read_full(struct lz4_frame_s *frame, void *buf, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t ret = frame->source(frame->source_arg, (unsigned char *) buf + done, size - done);
+        if (ret < 0) {
+            return ret;
+        }
+        if (ret == 0) {
+            break;
+        }
+        done += ret;
+    }
+    return done;
+}
+
+static int source_skip(struct lz4_frame_s *frame, size_t size) {
+    unsigned char chunk[128];
+    while (size > 0) {
+        const size_t part = size > sizeof chunk ? sizeof chunk : size;
+        if (source_read_full(frame, chunk, part) != (ssize_t) part) {
+            return ErrorLz4Source;
+        }
+        size -= part;
+    }
+    return ErrorLz4Ok;
+}
+
+static int frame_alloc(struct lz4_frame_s *frame, size_t block_max) {
+    if (frame->block_max == block_max) {
+        return ErrorLz4Ok;
+    }
+    free(frame->in);
+    free(frame->out);
+    frame->block_max = block_max;
+    frame->in = malloc(block_max + sizeof(uint32_t));
+    frame->out = malloc(LZ4_HISTORY_SIZE + block_max);
+    if (frame->in == NULL || frame->out == NULL) {
+        debug_log("Lz4: unable to allocate buffers for %u bytes blocks", block_max);
+        free(frame->in);
+        free(frame->out);
+        frame->in = frame->out = NULL;
+        frame->block_max = 0;
+        return ErrorLz4Memory;
+    }
+    return ErrorLz4Ok;
+}
+
+/// parse the next frame header, skippable frames are passed over
+static int frame_header(struct lz4_frame_s *frame) {
+    unsigned char header[4 + 2 + 8 + 4 + 1];
+    uint32_t magic;
+
+    while (true) {
+        ssize_t ret = source_read_full(frame, header, 4);
+        if (ret == 0) {
+            frame->eof = true;
+            return ErrorLz4Ok;
+        }
+        if (ret != 4) {
+            return ErrorLz4Source;
+        }
+        magic = read_le32(header);
+        if ((magic & LZ4_SKIPPABLE_MASK) != LZ4_SKIPPABLE_MAGIC) {
+            break;
+        }
+        if (source_read_full(frame, header, 4) != 4) {
+            return ErrorLz4Source;
+        }
+        if (source_skip(frame, read_le32(header)) != ErrorLz4Ok) {
+            return ErrorLz4Source;
+        }
+    }
+    if (magic != LZ4_FRAME_MAGIC) {
+        debug_log("Lz4: invalid frame magic: %x", (unsigned) magic);
+        return ErrorLz4Format;
+    }
+
+    unsigned char *descriptor = header + 4;
+    if (source_read_full(frame, descriptor, 2) != 2) {
+        return ErrorLz4Source;
+    }
+    const unsigned char flg = descriptor[0];
+    const unsigned char bd = descriptor[1];
+    if ((flg & LZ4_FLG_VERSION_MASK) != LZ4_FLG_VERSION || (flg & LZ4_FLG_RESERVED) || (bd & 0x8F)) {
+        debug_log("Lz4: invalid frame descriptor: %x %x", flg, bd);
+        return ErrorLz4Format;
+    }
+    const size_t descriptor_size = 2 + ((flg & LZ4_FLG_CONTENT_SIZE) ? 8 : 0) + ((flg & LZ4_FLG_DICT_ID) ? 4 : 0);
+    if (source_read_full(frame, descriptor + 2, descriptor_size - 1) != (ssize_t) descriptor_size - 1) {
+        return ErrorLz4Source;
+    }
+    if (descriptor[descriptor_size] != ((lz4_xxh32(descriptor, descriptor_size, 0) >> 8) & 0xFF)) {
+        debug_log("Lz4: frame descriptor checksum mismatch");
+        return ErrorLz4Checksum;
+    }
+    if (flg & LZ4_FLG_DICT_ID) {
+        debug_log("Lz4: frames with dictionary are not supported");
+        return ErrorLz4Unsupported;
+    }
+
+    const unsigned block_id = (bd >> 4) & 0x07;
+    if (block_id < 4) {
+        debug_log("Lz4: invalid block size id: %u", block_id);
+        return ErrorLz4Format;
+    }
+    const size_t block_max = (size_t) 1 << (8 + 2 * block_id);
+    if (block_max > LZ4_BLOCK_SIZE_MAX) {
+        debug_log("Lz4: %u bytes blocks are not supported, compress with -B6 or lower", block_max);
+        return ErrorLz4Unsupported;
+    }
+    int ret = frame_alloc(frame, block_max);
+    if (ret != ErrorLz4Ok) {
+        return ret;
+    }
+
+    frame->flags = flg;
+    frame->in_frame = true;
+    frame->out_begin = frame->out_end = 0;
+    xxh32_init(&frame->content, 0);
+    return ErrorLz4Ok;
+}
+
+static size_t sequence_length(const uint8_t **ip, const uint8_t *iend, size_t length, bool *ok) {
+    if (length != 15) {
+        return length;
+    }
+    uint8_t b;
+    do {
+        if (*ip >= iend) {
+            *ok = false;
+            return 0;
+        }
+        b = *(*ip)++;
+        length += b;
+    } while (b == 255);
+    return length;
+}
+
+/// decode LZ4 block into dst[pos..cap), matches may reach back to dst[low]
+/// @return decoded bytes, negative on corrupted block
+static ssize_t block_decode(const uint8_t *src, size_t src_size, uint8_t *dst, size_t low, size_t pos, size_t cap) {
+    const uint8_t *ip = src;
+    const uint8_t *const iend = src + src_size;
+    uint8_t *op = dst + pos;
+    uint8_t *const oend = dst + cap;
+    bool ok = true;
+
+    while (true) {
+        if (ip >= iend) {
+            return -1;
+        }
+        const uint8_t token = *ip++;
+
+        const size_t literals = sequence_length(&ip, iend, token >> 4, &ok);
+        if (!ok || literals > (size_t) (iend - ip) || literals > (size_t) (oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, literals);
+        op += literals;
+        ip += literals;
+        /// last sequence has literals only
+        if (ip == iend) {
+            break;
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        const size_t offset = (size_t) ip[0] | ((size_t) ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (size_t) (op - (dst + low))) {
+            return -1;
+        }
+        const size_t match_length = sequence_length(&ip, iend, token & 0x0F, &ok) + LZ4_MIN_MATCH;
+        if (!ok || match_length > (size_t) (oend - op)) {
+            return -1;
+        }
+        const uint8_t *match = op - offset;
+        if (offset >= match_length) {
+            memcpy(op, match, match_length);
+            op += match_length;
+        } else {
+            /// overlapping match repeats the last offset bytes
+            for (size_t i = 0; i < match_length; ++i) {
+                *op++ = *match++;
+            }
+        }
+    }
+    return op - (dst + pos);
+}
+
+/// decode the next block of the current frame, the frame end mark finishes the frame
+static int frame_block(struct lz4_frame_s *frame) {
+    unsigned char word[4];
+    if (source_read_full(frame, word, sizeof word) != sizeof word) {
+        return ErrorLz4Source;
+    }
+    const uint32_t block = read_le32(word);
+    const size_t size = block & ~LZ4_BLOCK_UNCOMPRESSED;
+
+    if (block == 0) {
+        if (frame->flags & LZ4_FLG_CONTENT_CHECKSUM) {
+            if (source_read_full(frame, word, sizeof word) != sizeof word) {
+                return ErrorLz4Source;
+            }
+            if (read_le32(word) != xxh32_digest(&frame->content)) {
+                debug_log("Lz4: content checksum mismatch");
+                return ErrorLz4Checksum;
+            }
+        }
+        frame->in_frame = false;
+        return ErrorLz4Ok;
+    }
+    if (size > frame->block_max) {
+        debug_log("Lz4: block of %u bytes exceeds frame block size", size);
+        return ErrorLz4Format;
+    }
+
+    const size_t checksum_size = (frame->flags & LZ4_FLG_BLOCK_CHECKSUM) ? sizeof(uint32_t) : 0;
+    if (source_read_full(frame, frame->in, size + checksum_size) != (ssize_t) (size + checksum_size)) {
+        return ErrorLz4Source;
+    }
+    if (checksum_size && read_le32(frame->in + size) != lz4_xxh32(frame->in, size, 0)) {
+        debug_log("Lz4: block checksum mismatch");
+        return ErrorLz4Checksum;
+    }
+
+    /// linked blocks may reference 64KiB of data decoded before
+    size_t history = 0;
+    if (!(frame->flags & LZ4_FLG_BLOCK_INDEPENDENT)) {
+        history = frame->out_end > LZ4_HISTORY_SIZE ? LZ4_HISTORY_SIZE : frame->out_end;
+        memmove(frame->out, frame->out + frame->out_end - history, history);
+    }
+    frame->out_begin = frame->out_end = history;
+
+    ssize_t decoded = size;
+    if (block & LZ4_BLOCK_UNCOMPRESSED) {
+        memcpy(frame->out + history, frame->in, size);
+    } else {
+        decoded = block_decode(frame->in, size, frame->out, 0, history, history + frame->block_max);
+        if (decoded < 0) {
+            debug_log("Lz4: corrupted block");
+            return ErrorLz4Format;
+        }
+    }
+    if (frame->flags & LZ4_FLG_CONTENT_CHECKSUM) {
+        xxh32_update(&frame->content, frame->out + history, decoded);
+    }
+    frame->out_end += decoded;
+    return ErrorLz4Ok;
+}
+
+void lz4_frame_init(struct lz4_frame_s *frame, lz4_source_fn source, void *source_arg) {
+    memset(frame, 0, sizeof *frame);
+    frame->source = source;
+    frame->source_arg = source_arg;
+}
+
+ssize_t lz4_frame_read(struct lz4_frame_s *frame, void *buf, size_t size) {
+    size_t done = 0;
+    while (done < size && frame->error == ErrorLz4Ok) {
+        if (frame->out_begin < frame->out_end) {
+            size_t chunk = frame->out_end - frame->out_begin;
+            chunk = chunk > size - done ? size - done : chunk;
+            memcpy((unsigned char *) buf + done, frame->out + frame->out_begin, chunk);
+            frame->out_begin += chunk;
+            done += chunk;
+            continue;
+        }
+        if (frame->eof) {
+            break;
+        }
+        frame->error = frame->in_frame ? frame_block(frame) : frame_header(frame);
+    }
+    if (done == 0 && frame->error != ErrorLz4Ok) {
+        debug_log("Lz4: decoding failed: %s", lz4_strerror(frame->error));
+        return -frame->error;
+    }
+    return done;
+}
+
+void lz4_frame_deinit(struct lz4_frame_s *frame) {
+    free(frame->in);
+    free(frame->out);
+    frame->in = frame->out = NULL;
+    frame->block_max = 0;
+}
+
+static void write_le32(void *ptr, uint32_t value) {
+    uint8_t *p = ptr;
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static uint32_t hash_sequence(uint32_t sequence) {
+    return (sequence * XXH_PRIME1) >> (32 - LZ4_HASH_BITS);
+}
+
+static uint8_t *put_length(uint8_t *op, size_t length) {
+    for (; length >= 255; length -= 255) {
+        *op++ = 255;
+    }
+    *op++ = (uint8_t) length;
+    return op;
+}
+
+/// literals followed by a match, match_length 0 for the last literals of the block
+static uint8_t *put_sequence(uint8_t *op, const uint8_t *literals, size_t literal_length, size_t offset,
+                             size_t match_length) {
+    uint8_t *token = op++;
+    *token = (uint8_t) ((literal_length >= 15 ? 15 : literal_length) << 4);
+    if (literal_length >= 15) {
+        op = put_length(op, literal_length - 15);
+    }
+    memcpy(op, literals, literal_length);
+    op += literal_length;
+    if (match_length == 0) {
+        return op;
+    }
+    *op++ = (uint8_t) offset;
+    *op++ = (uint8_t) (offset >> 8);
+    const size_t length = match_length - LZ4_MIN_MATCH;
+    *token |= length >= 15 ? 15 : length;
+    if (length >= 15) {
+        op = put_length(op, length - 15);
+    }
+    return op;
+}
+
+/// compress independent block to dst of LZ4_COMPRESS_BOUND(size) bytes, returns compressed size
+/// positions skip faster the longer there's no match, incompressible data isn't searched byte by byte
+static size_t block_encode(const uint8_t *src, size_t size, uint8_t *dst, uint16_t *table) {
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *end = src + size;
+    uint8_t *op = dst;
+    memset(table, 0, sizeof(uint16_t) << LZ4_HASH_BITS);
+    if (size > LZ4_MATCH_LIMIT) {
+        const uint8_t *match_limit = end - LZ4_MATCH_LIMIT;
+        const uint8_t *copy_limit = end - LZ4_LAST_LITERALS;
+        while (ip < match_limit) {
+            const uint32_t sequence = read_le32(ip);
+            const uint32_t hash = hash_sequence(sequence);
+            const uint8_t *ref = src + table[hash];
+            table[hash] = (uint16_t) (ip - src);
+            if (ref >= ip || ip - ref > LZ4_MAX_OFFSET || read_le32(ref) != sequence) {
+                ip += 1 + ((ip - anchor) >> 6);
+                continue;
+            }
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                --ip;
+                --ref;
+            }
+            size_t length = LZ4_MIN_MATCH;
+            while (ip + length < copy_limit && ip[length] == ref[length]) {
+                ++length;
+            }
+            op = put_sequence(op, anchor, ip - anchor, ip - ref, length);
+            ip += length;
+            anchor = ip;
+        }
+    }
+    op = put_sequence(op, anchor, end - anchor, 0, 0);
+    return op - dst;
+}
+
+static int encoder_put(struct lz4_encoder_s *encoder, const void *data, size_t size) {
+    if (encoder->error == ErrorLz4Ok && encoder->sink(encoder->sink_arg, data, size) != 0) {
+        debug_log("LZ4: failed to write %u compressed bytes", (unsigned) size);
+        encoder->error = ErrorLz4Sink;
+    }
+    return encoder->error;
+}
+
+static int encoder_header(struct lz4_encoder_s *encoder) {
+    if (encoder->started) {
+        return encoder->error;
+    }
+    uint8_t header[7];
+    write_le32(header, LZ4_FRAME_MAGIC);
+    header[4] = LZ4_FLG_VERSION | LZ4_FLG_BLOCK_INDEPENDENT | LZ4_FLG_CONTENT_CHECKSUM;
+    header[5] = LZ4_BD_64KB;
+    header[6] = (lz4_xxh32(header + 4, 2, 0) >> 8) & 0xFF;
+    encoder->started = true;
+    return encoder_put(encoder, header, sizeof header);
+}
+
+/// block stored as it is when compression doesn't make it smaller
+static int encoder_block(struct lz4_encoder_s *encoder) {
+    if (encoder_header(encoder) != ErrorLz4Ok || encoder->in_size == 0) {
+        return encoder->error;
+    }
+    xxh32_update(&encoder->content, encoder->in, encoder->in_size);
+    const size_t size = block_encode(encoder->in, encoder->in_size, encoder->out + 4, encoder->table);
+    if (size < encoder->in_size) {
+        write_le32(encoder->out, size);
+        encoder_put(encoder, encoder->out, size + 4);
+    } else {
+        write_le32(encoder->out, encoder->in_size | LZ4_BLOCK_UNCOMPRESSED);
+        if (encoder_put(encoder, encoder->out, 4) == ErrorLz4Ok) {
+            encoder_put(encoder, encoder->in, encoder->in_size);
+        }
+    }
+    encoder->in_size = 0;
+    return encoder->error;
+}
+
+int lz4_encoder_init(struct lz4_encoder_s *encoder, lz4_sink_fn sink, void *sink_arg) {
+    memset(encoder, 0, sizeof *encoder);
+    encoder->sink = sink;
+    encoder->sink_arg = sink_arg;
+    xxh32_init(&encoder->content, 0);
+    encoder->in = malloc(LZ4_ENCODER_BLOCK_SIZE);
+    encoder->out = malloc(4 + LZ4_COMPRESS_BOUND(LZ4_ENCODER_BLOCK_SIZE));
+    encoder->table = malloc(sizeof(uint16_t) << LZ4_HASH_BITS);
+    if (encoder->in == NULL || encoder->out == NULL || encoder->table == NULL) {
+        debug_log("LZ4: unable to allocate encoder");
+        encoder->error = ErrorLz4Memory;
+    }
+    return encoder->error;
+}
+
+int lz4_encoder_write(struct lz4_encoder_s *encoder, const void *data, size_t size) {
+    const uint8_t *p = data;
+    while (size > 0 && encoder->error == ErrorLz4Ok) {
+        const size_t chunk = size < LZ4_ENCODER_BLOCK_SIZE - encoder->in_size ? size
+                                                                              : LZ4_ENCODER_BLOCK_SIZE - encoder->in_size;
+        memcpy(encoder->in + encoder->in_size, p, chunk);
+        encoder->in_size += chunk;
+        p += chunk;
+        size -= chunk;
+        if (encoder->in_size == LZ4_ENCODER_BLOCK_SIZE) {
+            encoder_block(encoder);
+        }
+    }
+    return encoder->error;
+}
+
+int lz4_encoder_finish(struct lz4_encoder_s *encoder) {
+    if (encoder->error != ErrorLz4Ok || (!encoder->started && encoder->in_size == 0)) {
+        return encoder->error;
+    }
+    if (encoder_block(encoder) != ErrorLz4Ok) {
+        return encoder->error;
+    }
+    uint8_t trailer[8];
+    write_le32(trailer, 0);
+    write_le32(trailer + 4, xxh32_digest(&encoder->content));
+    encoder_put(encoder, trailer, sizeof trailer);
+    encoder->started = false;
+    xxh32_init(&encoder->content, 0);
+    return encoder->error;
+}
+
+void lz4_encoder_deinit(struct lz4_encoder_s *encoder) {
+    free(encoder->in);
+    free(encoder->out);
+    free(encoder->table);
+    encoder->in = NULL;
+    encoder->out = NULL;
+    encoder->table = NULL;
+}
+
+const char *lz4_strerror(int err) {
+    switch (err) {
+        case ErrorLz4Ok:
+            return "ErrorLz4Ok";
+        case ErrorLz4Source:
+            return "ErrorLz4Source";
+        case ErrorLz4Format:
+            return "ErrorLz4Format";
+        case ErrorLz4Checksum:
+            return "ErrorLz4Checksum";
+        case ErrorLz4Memory:
+            return "ErrorLz4Memory";
+        case ErrorLz4Unsupported:
+            return "ErrorLz4Unsupported";
+        case ErrorLz4Sink:
+            return "ErrorLz4Sink";
+    }
+    return "";
+}
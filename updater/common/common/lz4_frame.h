@@ -0,0 +1,110 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/// streaming decoder of the LZ4 frame format (lz4 cli output)
+/// supports linked and independent blocks, block and content checksums, concatenated and skippable frames
+/// blocks are decoded whole: memory use is twice the frame block size plus 64KiB of history
+///
+/// streaming encoder writes a frame of independent LZ4_ENCODER_BLOCK_SIZE blocks with content checksum,
+/// greedy single match search: memory use is twice the block size plus the match table
+
+enum lz4_error_e {
+    ErrorLz4Ok,
+    ErrorLz4Source,   /// source read failed or ended in the middle of a frame
+    ErrorLz4Format,   /// not a frame or corrupted data
+    ErrorLz4Checksum, /// header, block or content checksum mismatch
+    ErrorLz4Memory,
+    ErrorLz4Unsupported,
+    ErrorLz4Sink,     /// compressed data write failed
+};
+
+#define LZ4_FRAME_MAGIC 0x184D2204U
+/// skippable frames are 0x184D2A50 - 0x184D2A5F, decoder skips them
+#define LZ4_SKIPPABLE_MAGIC 0x184D2A50U
+#define LZ4_SKIPPABLE_MASK 0xFFFFFFF0U
+#define LZ4_HISTORY_SIZE (64 * 1024)
+/// largest supported frame block: -B6 (1MiB), the 4MiB blocks lz4 uses by default don't fit in SDRAM next to the rest
+#define LZ4_BLOCK_SIZE_MAX (1024 * 1024)
+/// -B4, block offsets fit the 16 bit match table
+#define LZ4_ENCODER_BLOCK_SIZE (64 * 1024)
+
+/// compressed data source: returns bytes read, 0 at the end, negative on error
+typedef ssize_t (*lz4_source_fn)(void *arg, void *buf, size_t size);
+
+/// compressed data sink: returns 0 when all bytes were written
+typedef int (*lz4_sink_fn)(void *arg, const void *buf, size_t size);
+
+struct lz4_xxh32_s {
+    uint32_t v[4];
+    uint64_t total;
+    uint8_t mem[16];
+    uint32_t mem_size;
+};
+
+struct lz4_frame_s {
+    lz4_source_fn source;
+    void *source_arg;
+    unsigned char *in;          /// compressed block with its checksum
+    unsigned char *out;         /// history followed by decoded block
+    size_t block_max;           /// block size of the current frame
+    size_t out_begin;           /// first not delivered decoded byte
+    size_t out_end;             /// end of decoded data
+    unsigned char flags;        /// FLG byte of the current frame
+    bool in_frame;              /// frame header parsed, blocks follow
+    bool eof;                   /// source ended on frame boundary
+    int error;                  /// lz4_error_e, sticky
+    struct lz4_xxh32_s content; /// content checksum of the current frame
+};
+
+struct lz4_encoder_s {
+    lz4_sink_fn sink;
+    void *sink_arg;
+    unsigned char *in;          /// block being filled
+    size_t in_size;
+    unsigned char *out;         /// compressed block with its size
+    uint16_t *table;            /// last block position of every hashed 4 byte sequence
+    bool started;               /// frame header written
+    int error;                  /// lz4_error_e, sticky
+    struct lz4_xxh32_s content; /// content checksum of the frame
+};
+
+/// setup decoder, nothing is read until the first lz4_frame_read
+void lz4_frame_init(struct lz4_frame_s *frame, lz4_source_fn source, void *source_arg);
+
+/// decode up to size bytes
+/// @return bytes decoded, 0 at the end of the last frame, negative lz4_error_e on error
+ssize_t lz4_frame_read(struct lz4_frame_s *frame, void *buf, size_t size);
+
+void lz4_frame_deinit(struct lz4_frame_s *frame);
+
+/// setup encoder, nothing is written until there is data or lz4_encoder_finish is called
+/// @return lz4_error_e
+int lz4_encoder_init(struct lz4_encoder_s *encoder, lz4_sink_fn sink, void *sink_arg);
+
+/// compress data, full blocks are written to the sink
+/// @return lz4_error_e
+int lz4_encoder_write(struct lz4_encoder_s *encoder, const void *data, size_t size);
+
+/// write the last block, end mark and content checksum, frame without data isn't written at all
+/// @return lz4_error_e
+int lz4_encoder_finish(struct lz4_encoder_s *encoder);
+
+void lz4_encoder_deinit(struct lz4_encoder_s *encoder);
+
+/// xxHash32 used by frames for checksums
+uint32_t lz4_xxh32(const void *data, size_t size, uint32_t seed);
+
+const char *lz4_strerror(int err);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,239 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "manifest.h"
+#include "log.h"
+
+#define MANIFEST_MD5_HEX_SIZE (2 * MANIFEST_MD5_SIZE)
+
+/// string pool of the manifest being sorted - qsort has no context argument, updater is single threaded
+static const char *sort_names;
+
+static int grow(void **array, size_t *capacity, size_t needed, size_t item) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+    size_t new_capacity = *capacity ? *capacity : 64;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    void *tmp = realloc(*array, new_capacity * item);
+    if (tmp == NULL) {
+        return -1;
+    }
+    *array = tmp;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+void manifest_init(struct manifest_s *manifest) {
+    memset(manifest, 0, sizeof *manifest);
+    manifest->sorted = true;
+}
+
+void manifest_free(struct manifest_s *manifest) {
+    free(manifest->entries);
+    free(manifest->names);
+    manifest_init(manifest);
+}
+
+int manifest_add(struct manifest_s *manifest, const char *name, const unsigned char md5[MANIFEST_MD5_SIZE]) {
+    if (name[0] == '.' && name[1] == '/') {
+        name += 2;
+    }
+    const size_t name_len = strlen(name) + 1;
+    if (grow((void **) &manifest->entries, &manifest->capacity, manifest->count + 1,
+             sizeof(struct manifest_entry_s)) ||
+        grow((void **) &manifest->names, &manifest->names_capacity, manifest->names_size + name_len, 1)) {
+        debug_log("Manifest: unable to grow to %d entries", manifest->count + 1);
+        return -ENOMEM;
+    }
+    struct manifest_entry_s *entry = &manifest->entries[manifest->count];
+    entry->name = manifest->names_size;
+    entry->seq = manifest->count;
+    memcpy(entry->md5, md5, MANIFEST_MD5_SIZE);
+    memcpy(manifest->names + manifest->names_size, name, name_len);
+    manifest->names_size += name_len;
+    manifest->count++;
+    manifest->sorted = false;
+    return 0;
+}
+
+int manifest_parse(struct manifest_s *manifest, const char *text) {
+    const char *line = text;
+    while (*line != '\0') {
+        const char *end = strchr(line, '\n');
+        const size_t line_len = end ? (size_t) (end - line) : strlen(line);
+        unsigned char md5[MANIFEST_MD5_SIZE];
+        bool valid = line_len > MANIFEST_MD5_HEX_SIZE + 2 && line[MANIFEST_MD5_HEX_SIZE] == ' ' &&
+                     (line[MANIFEST_MD5_HEX_SIZE + 1] == ' ' || line[MANIFEST_MD5_HEX_SIZE + 1] == '*');
+        for (size_t i = 0; valid && i < MANIFEST_MD5_SIZE; ++i) {
+            const int hi = hex_value(line[2 * i]);
+            const int lo = hex_value(line[2 * i + 1]);
+            valid = hi >= 0 && lo >= 0;
+            md5[i] = (unsigned char) ((hi << 4) | lo);
+        }
+        if (valid) {
+            size_t name_len = line_len - MANIFEST_MD5_HEX_SIZE - 2;
+            if (line[line_len - 1] == '\r') {
+                --name_len;
+            }
+            char *name = strndup(line + MANIFEST_MD5_HEX_SIZE + 2, name_len);
+            const int ret = name ? manifest_add(manifest, name, md5) : -ENOMEM;
+            free(name);
+            if (ret != 0) {
+                return ret;
+            }
+        }
+        line += end ? line_len + 1 : line_len;
+    }
+    return 0;
+}
+
+int manifest_load(struct manifest_s *manifest, const char *path) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        return errno == ENOENT ? 0 : -errno;
+    }
+    int ret = 0;
+    char *text = NULL;
+    long size = 0;
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 || fseek(file, 0, SEEK_SET) != 0) {
+        ret = -EIO;
+    } else if ((text = malloc(size + 1)) == NULL) {
+        ret = -ENOMEM;
+    } else if (fread(text, 1, size, file) != (size_t) size) {
+        ret = -EIO;
+    } else {
+        text[size] = '\0';
+        ret = manifest_parse(manifest, text);
+    }
+    free(text);
+    fclose(file);
+    if (ret != 0) {
+        debug_log("Manifest: unable to load %s: %d", path, ret);
+    }
+    return ret;
+}
+
+int manifest_save(struct manifest_s *manifest, const char *path) {
+    static const char tmp_ext[] = ".tmp";
+    char *tmp_path = malloc(strlen(path) + sizeof tmp_ext);
+    if (tmp_path == NULL) {
+        return -ENOMEM;
+    }
+    strcpy(tmp_path, path);
+    strcat(tmp_path, tmp_ext);
+
+    manifest_sort(manifest);
+    int ret = 0;
+    FILE *file = fopen(tmp_path, "w");
+    if (file == NULL) {
+        ret = -errno;
+    }
+    for (size_t i = 0; ret == 0 && i < manifest->count; ++i) {
+        const struct manifest_entry_s *entry = &manifest->entries[i];
+        for (size_t j = 0; ret == 0 && j < MANIFEST_MD5_SIZE; ++j) {
+            ret = fprintf(file, "%02x", entry->md5[j]) < 0 ? -EIO : 0;
+        }
+        if (ret == 0 && fprintf(file, "  %s\n", manifest->names + entry->name) < 0) {
+            ret = -EIO;
+        }
+    }
+    if (file != NULL && fclose(file) != 0 && ret == 0) {
+        ret = -EIO;
+    }
+    if (ret == 0 && rename(tmp_path, path) != 0) {
+        ret = -errno;
+    }
+    if (ret != 0) {
+        debug_log("Manifest: unable to save %s: %d", path, ret);
+        unlink(tmp_path);
+    }
+    free(tmp_path);
+    return ret;
+}
+
+static int entry_compare(const void *lhs, const void *rhs) {
+    const struct manifest_entry_s *l = lhs;
+    const struct manifest_entry_s *r = rhs;
+    const int ret = strcmp(sort_names + l->name, sort_names + r->name);
+    if (ret != 0) {
+        return ret;
+    }
+    return l->seq < r->seq ? -1 : l->seq > r->seq;
+}
+
+void manifest_sort(struct manifest_s *manifest) {
+    if (manifest->sorted) {
+        return;
+    }
+    sort_names = manifest->names;
+    qsort(manifest->entries, manifest->count, sizeof(struct manifest_entry_s), entry_compare);
+    sort_names = NULL;
+
+    /// keep the last added entry of every name
+    size_t out = 0;
+    for (size_t i = 0; i < manifest->count; ++i) {
+        if (i + 1 < manifest->count &&
+            strcmp(manifest->names + manifest->entries[i].name, manifest->names + manifest->entries[i + 1].name) == 0) {
+            continue;
+        }
+        manifest->entries[out] = manifest->entries[i];
+        manifest->entries[out].seq = out;
+        ++out;
+    }
+    manifest->count = out;
+    manifest->sorted = true;
+}
+
+const unsigned char *manifest_find(const struct manifest_s *manifest, const char *name) {
+    if (!manifest->sorted) {
+        debug_log("Manifest: find in not sorted manifest");
+        return NULL;
+    }
+    if (name[0] == '.' && name[1] == '/') {
+        name += 2;
+    }
+    size_t lo = 0;
+    size_t hi = manifest->count;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        const int ret = strcmp(manifest->names + manifest->entries[mid].name, name);
+        if (ret == 0) {
+            return manifest->entries[mid].md5;
+        }
+        if (ret < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+int manifest_merge(struct manifest_s *manifest, const struct manifest_s *from) {
+    for (size_t i = 0; i < from->count; ++i) {
+        const int ret = manifest_add(manifest, from->names + from->entries[i].name, from->entries[i].md5);
+        if (ret != 0) {
+            return ret;
+        }
+    }
+    manifest_sort(manifest);
+    return 0;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/// list of file digests in md5sum format: "<md5 hex>  <name>" per line
+/// names are relative to the package root, without leading ./
+
+#define MANIFEST_MD5_SIZE 16
+/// digests of the package files, md5sum output put in the package root
+#define MANIFEST_PACKAGE_NAME "checksums.md5"
+
+struct manifest_entry_s {
+    unsigned name;                          /// offset of the name in the string pool
+    unsigned seq;                           /// insertion order - later entry wins
+    unsigned char md5[MANIFEST_MD5_SIZE];
+};
+
+/// entries sorted by name after manifest_sort, contiguous array and a string pool like tar_index_s
+struct manifest_s {
+    struct manifest_entry_s *entries;
+    size_t count;
+    size_t capacity;
+    char *names;
+    size_t names_size;
+    size_t names_capacity;
+    bool sorted;
+};
+
+void manifest_init(struct manifest_s *manifest);
+
+void manifest_free(struct manifest_s *manifest);
+
+/// add entry, replaces entry of the same name once sorted
+int manifest_add(struct manifest_s *manifest, const char *name, const unsigned char md5[MANIFEST_MD5_SIZE]);
+
+/// add entries of md5sum formatted text, invalid lines are ignored
+int manifest_parse(struct manifest_s *manifest, const char *text);
+
+/// load manifest file - not existing file gives empty manifest
+int manifest_load(struct manifest_s *manifest, const char *path);
+
+/// write manifest to path.tmp and rename it to path
+int manifest_save(struct manifest_s *manifest, const char *path);
+
+/// sort by name and drop replaced entries - required before manifest_find
+void manifest_sort(struct manifest_s *manifest);
+
+/// digest of the file, NULL if not in manifest
+const unsigned char *manifest_find(const struct manifest_s *manifest, const char *name);
+
+/// add all entries of `from`, they replace entries of the same name
+int manifest_merge(struct manifest_s *manifest, const struct manifest_s *from);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,35 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+/// sector aligned update package - alternative to tar with the whole table of contents up front
+/// and entry data starting on the storage sector / cluster boundaries
+///
+/// format, all numbers are little endian u32:
+///   header:  "PUPACK01", entry count, names size, data offset, alignment, index md5[16]
+///   entries: count * {name offset, data offset, data size, type, md5[16]}
+///   names:   zero terminated entry names without leading ./, catalogs end with /
+///   data:    entries data in the entries order, each at a multiple of the alignment, zero padded
+/// index md5 is md5 of the entries and the names, entry md5 is md5 of its data
+/// type is the tar type (MTAR_TREG, MTAR_TDIR), catalogs have no data
+///
+/// the tar reader (tar_init "r") reads it next to tar archives: indexed, unpacked, hashed and signed the same way,
+/// the package is recognised by the magic - its name doesn't matter
+/// created on the host with tools/pack_gen
+
+#define PACK_MAGIC "PUPACK01"
+#define PACK_MAGIC_SIZE 8
+#define PACK_MD5_SIZE 16
+#define PACK_HEADER_SIZE (PACK_MAGIC_SIZE + 4 * 4 + PACK_MD5_SIZE)
+#define PACK_ENTRY_SIZE (4 * 4 + PACK_MD5_SIZE)
+/// eMMC erase groups and FAT clusters of the user partition are multiples of it
+#define PACK_ALIGNMENT 4096
+/// entry names are handed out in mtar_header_t
+#define PACK_NAME_MAX 99
+
+#ifdef __cplusplus
+}
+#endif
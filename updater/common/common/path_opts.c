@@ -11,7 +11,7 @@ void path_remove_dup_slash(char *from) {
 
 void path_remove_cwd(char *from) {
     if (strlen(from) >= 2 && strncmp(from, "./", 2) == 0) {
-        memcpy(from, from + 2, strlen(from) + 1);
+        memmove(from, from + 2, strlen(from) + 1);
     }
 }
 
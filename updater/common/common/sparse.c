@@ -0,0 +1,342 @@
+#include <stdlib.h>
+#include <string.h>
+#include "sparse.h"
+#include "log.h"
+
+enum sparse_state_e {
+    SparseStateHeader,
+    SparseStateChunk,
+    SparseStateRaw,
+    SparseStateDone,
+};
+
+static uint32_t read_le32(const unsigned char *p) {
+    return (uint32_t) p[0] | ((uint32_t) p[1] << 8) | ((uint32_t) p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/// collect bytes of a fixed size field that may be split between chunks
+static size_t collect(unsigned char *field, size_t field_size, size_t *fill, const unsigned char *data, size_t size) {
+    size_t n = field_size - *fill;
+    n = n > size ? size : n;
+    memcpy(field + *fill, data, n);
+    *fill += n;
+    return n;
+}
+
+/// sectors from lba to the end of its transfer on the disk
+static blk_size_t transfer_left(const struct sparse_apply_s *sparse, lba_t lba) {
+    return sparse->transfer - (sparse->start + lba) % sparse->transfer;
+}
+
+static int add_run(struct sparse_apply_s *sparse, lba_t lba, blk_size_t count) {
+    if (sparse->runs_count > 0) {
+        struct sparse_run_s *last = &sparse->runs[sparse->runs_count - 1];
+        if (last->lba + last->count == lba) {
+            last->count += count;
+            return ErrorSparseOk;
+        }
+    }
+    if (sparse->runs_count == sparse->runs_capacity) {
+        const size_t capacity = sparse->runs_capacity ? sparse->runs_capacity * 2 : 16;
+        struct sparse_run_s *runs = realloc(sparse->runs, capacity * sizeof *runs);
+        if (runs == NULL) {
+            debug_log("Sparse: unable to allocate run list");
+            return ErrorSparseMemory;
+        }
+        sparse->runs = runs;
+        sparse->runs_capacity = capacity;
+    }
+    sparse->runs[sparse->runs_count].lba = lba;
+    sparse->runs[sparse->runs_count].count = count;
+    sparse->runs_count++;
+    return ErrorSparseOk;
+}
+
+static int write_sectors(struct sparse_apply_s *sparse, const void *data, blk_size_t count) {
+    int err = blk_write(sparse->device, sparse->lba, count, data);
+    if (err) {
+        debug_log("Sparse: failed to write %u sectors at %u: %d", count, sparse->lba, err);
+        return ErrorSparseIo;
+    }
+    const int ret = add_run(sparse, sparse->lba, count);
+    sparse->lba += count;
+    sparse->written += count;
+    return ret;
+}
+
+/// write buffered RAW data, it's always whole sectors outside of a RAW chunk
+static int flush(struct sparse_apply_s *sparse) {
+    if (sparse->buffer_fill == 0) {
+        return ErrorSparseOk;
+    }
+    const int ret = write_sectors(sparse, sparse->buffer, sparse->buffer_fill / sparse->sector_size);
+    sparse->buffer_fill = 0;
+    return ret;
+}
+
+static int write_raw(struct sparse_apply_s *sparse, const unsigned char *data, size_t size) {
+    const size_t sector_size = sparse->sector_size;
+    while (size > 0) {
+        const size_t window = (size_t) transfer_left(sparse, sparse->lba) * sector_size;
+        int ret = ErrorSparseOk;
+        if (sparse->buffer_fill == 0 && size >= window) {
+            // transfers which are whole in the chunk are written straight from it
+            const size_t transfers = (size - window) / ((size_t) sparse->transfer * sector_size);
+            const size_t bytes = window + transfers * sparse->transfer * sector_size;
+            ret = write_sectors(sparse, data, bytes / sector_size);
+            data += bytes;
+            size -= bytes;
+        } else {
+            size_t chunk = window - sparse->buffer_fill;
+            chunk = chunk < size ? chunk : size;
+            memcpy(sparse->buffer + sparse->buffer_fill, data, chunk);
+            sparse->buffer_fill += chunk;
+            data += chunk;
+            size -= chunk;
+            if (sparse->buffer_fill == window) {
+                ret = flush(sparse);
+            }
+        }
+        if (ret != ErrorSparseOk) {
+            return ret;
+        }
+    }
+    return ErrorSparseOk;
+}
+
+static bool is_zero(const unsigned char *data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        if (data[i] != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// transfers which already read zeros (erased or never used) are not written
+static int write_zero(struct sparse_apply_s *sparse, uint64_t sectors) {
+    while (sectors > 0) {
+        blk_size_t count = transfer_left(sparse, sparse->lba);
+        count = count < sectors ? count : (blk_size_t) sectors;
+        const size_t bytes = (size_t) count * sparse->sector_size;
+        int err = blk_read(sparse->device, sparse->lba, count, sparse->buffer);
+        if (err) {
+            debug_log("Sparse: failed to read %u sectors at %u: %d", count, sparse->lba, err);
+            return ErrorSparseIo;
+        }
+        int ret;
+        if (is_zero(sparse->buffer, bytes)) {
+            ret = add_run(sparse, sparse->lba, count);
+            sparse->lba += count;
+            sparse->skipped += count;
+        } else {
+            memset(sparse->buffer, 0, bytes);
+            ret = write_sectors(sparse, sparse->buffer, count);
+        }
+        if (ret != ErrorSparseOk) {
+            return ret;
+        }
+        sectors -= count;
+    }
+    return ErrorSparseOk;
+}
+
+static int check_header(struct sparse_apply_s *sparse) {
+    if (memcmp(sparse->header, SPARSE_MAGIC, SPARSE_MAGIC_SIZE) != 0) {
+        debug_log("Sparse: invalid magic");
+        return ErrorSparseFormat;
+    }
+    const uint32_t block_size = read_le32(sparse->header + SPARSE_MAGIC_SIZE);
+    sparse->blocks = read_le32(sparse->header + SPARSE_MAGIC_SIZE + 4);
+    if (block_size == 0 || block_size % sparse->sector_size != 0) {
+        debug_log("Sparse: block size %u is not a multiple of sector size %u", block_size, sparse->sector_size);
+        return ErrorSparseFormat;
+    }
+    sparse->block_sectors = block_size / sparse->sector_size;
+    if ((uint64_t) sparse->blocks * sparse->block_sectors > sparse->sector_count) {
+        debug_log("Sparse: image of %u blocks doesn't fit %u sectors", sparse->blocks, sparse->sector_count);
+        return ErrorSparseSize;
+    }
+    return ErrorSparseOk;
+}
+
+static int start_chunk(struct sparse_apply_s *sparse) {
+    const unsigned char type = sparse->chunk[0];
+    const uint32_t blocks = read_le32(sparse->chunk + 1);
+    const uint64_t sectors = (uint64_t) blocks * sparse->block_sectors;
+    if (type == SparseChunkEnd) {
+        sparse->state = SparseStateDone;
+        return flush(sparse);
+    }
+    if (blocks > sparse->blocks - sparse->done) {
+        debug_log("Sparse: chunk of %u blocks past the image end", blocks);
+        return ErrorSparseFormat;
+    }
+    int ret = ErrorSparseOk;
+    switch (type) {
+        case SparseChunkRaw:
+            sparse->chunk_blocks = blocks;
+            sparse->remaining = sectors * sparse->sector_size;
+            sparse->state = blocks ? SparseStateRaw : SparseStateChunk;
+            return ErrorSparseOk;
+        case SparseChunkZero:
+            ret = flush(sparse);
+            if (ret == ErrorSparseOk) {
+                ret = write_zero(sparse, sectors);
+            }
+            break;
+        case SparseChunkDontCare:
+            ret = flush(sparse);
+            sparse->lba += sectors;
+            sparse->skipped += sectors;
+            break;
+        default:
+            debug_log("Sparse: invalid chunk %d", type);
+            return ErrorSparseFormat;
+    }
+    sparse->done += blocks;
+    return ret;
+}
+
+int sparse_apply_init(struct sparse_apply_s *sparse, int device) {
+    memset(sparse, 0, sizeof *sparse);
+    sparse->device = device;
+    blk_dev_info_t info;
+    int err = blk_info(device, &info);
+    if (err || info.sector_size == 0) {
+        debug_log("Sparse: no block device %d: %d", device, err);
+        return sparse->error = ErrorSparseIo;
+    }
+    blk_partition_t partition;
+    if (blk_get_partition(device, &partition) == 0) {
+        sparse->start = partition.start_sector;
+    }
+    sparse->sector_size = info.sector_size;
+    sparse->sector_count = info.sector_count;
+    /// whole erase groups, at least the default transfer
+    const blk_size_t group = info.erase_group ? info.erase_group : 1;
+    const blk_size_t groups = (SPARSE_DEFAULT_TRANSFER / info.sector_size + group - 1) / group;
+    sparse->transfer = group * (groups ? groups : 1);
+    sparse->buffer = malloc((size_t) sparse->transfer * sparse->sector_size);
+    if (sparse->buffer == NULL) {
+        debug_log("Sparse: unable to allocate %u sectors buffer", sparse->transfer);
+        return sparse->error = ErrorSparseMemory;
+    }
+    return ErrorSparseOk;
+}
+
+int sparse_apply_feed(struct sparse_apply_s *sparse, const void *data, size_t size) {
+    const unsigned char *p = data;
+    while (size > 0 && sparse->error == ErrorSparseOk) {
+        size_t used = 0;
+        switch (sparse->state) {
+            case SparseStateHeader:
+                used = collect(sparse->header, sizeof sparse->header, &sparse->fill, p, size);
+                if (sparse->fill == sizeof sparse->header) {
+                    sparse->error = check_header(sparse);
+                    sparse->state = SparseStateChunk;
+                    sparse->fill = 0;
+                }
+                break;
+            case SparseStateChunk:
+                used = collect(sparse->chunk, sizeof sparse->chunk, &sparse->fill, p, size);
+                if (sparse->fill == sizeof sparse->chunk) {
+                    sparse->fill = 0;
+                    sparse->error = start_chunk(sparse);
+                }
+                break;
+            case SparseStateRaw:
+                used = size > sparse->remaining ? (size_t) sparse->remaining : size;
+                sparse->error = write_raw(sparse, p, used);
+                sparse->remaining -= used;
+                if (sparse->remaining == 0) {
+                    sparse->done += sparse->chunk_blocks;
+                    sparse->state = SparseStateChunk;
+                }
+                break;
+            default:
+                debug_log("Sparse: data after end of image");
+                sparse->error = ErrorSparseFormat;
+                break;
+        }
+        p += used;
+        size -= used;
+    }
+    return sparse->error;
+}
+
+int sparse_apply_finish(struct sparse_apply_s *sparse) {
+    if (sparse->error != ErrorSparseOk) {
+        return sparse->error;
+    }
+    if (sparse->state != SparseStateDone || sparse->done != sparse->blocks) {
+        debug_log("Sparse: truncated image, %u of %u blocks written", sparse->done, sparse->blocks);
+        return sparse->error = ErrorSparseFormat;
+    }
+    int err = blk_write_wait(sparse->device);
+    if (err) {
+        debug_log("Sparse: failed to complete block writes: %d", err);
+        return sparse->error = ErrorSparseIo;
+    }
+    debug_log("Sparse: %u kB written, %u kB skipped",
+              (unsigned) ((uint64_t) sparse->written * sparse->sector_size / 1024),
+              (unsigned) ((uint64_t) sparse->skipped * sparse->sector_size / 1024));
+    return ErrorSparseOk;
+}
+
+int sparse_apply_verify(struct sparse_apply_s *sparse) {
+    if (sparse->error != ErrorSparseOk) {
+        return sparse->error;
+    }
+    MD5_CTX md5;
+    unsigned char digest[SPARSE_MD5_SIZE];
+    MD5_Init(&md5);
+    for (size_t i = 0; i < sparse->runs_count; ++i) {
+        lba_t lba = sparse->runs[i].lba;
+        blk_size_t left = sparse->runs[i].count;
+        while (left > 0) {
+            blk_size_t count = transfer_left(sparse, lba);
+            count = count < left ? count : left;
+            int err = blk_read(sparse->device, lba, count, sparse->buffer);
+            if (err) {
+                debug_log("Sparse: failed to read %u sectors at %u: %d", count, lba, err);
+                return sparse->error = ErrorSparseIo;
+            }
+            MD5_Update(&md5, sparse->buffer, (size_t) count * sparse->sector_size);
+            lba += count;
+            left -= count;
+        }
+    }
+    MD5_Final(digest, &md5);
+    if (memcmp(digest, sparse->header + SPARSE_MAGIC_SIZE + 8, SPARSE_MD5_SIZE) != 0) {
+        debug_log("Sparse: partition content doesn't match the image");
+        return sparse->error = ErrorSparseVerify;
+    }
+    return ErrorSparseOk;
+}
+
+void sparse_apply_deinit(struct sparse_apply_s *sparse) {
+    free(sparse->buffer);
+    sparse->buffer = NULL;
+    free(sparse->runs);
+    sparse->runs = NULL;
+    sparse->runs_count = sparse->runs_capacity = 0;
+}
+
+const char *sparse_strerror(int err) {
+    switch (err) {
+        case ErrorSparseOk:
+            return "ErrorSparseOk";
+        case ErrorSparseFormat:
+            return "ErrorSparseFormat";
+        case ErrorSparseSize:
+            return "ErrorSparseSize";
+        case ErrorSparseIo:
+            return "ErrorSparseIo";
+        case ErrorSparseVerify:
+            return "ErrorSparseVerify";
+        case ErrorSparseMemory:
+            return "ErrorSparseMemory";
+    }
+    return "";
+}
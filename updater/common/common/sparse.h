@@ -0,0 +1,103 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <md5/md5.h>
+#include <hal/blk_dev.h>
+
+/// sparse partition image: raw content of a whole partition with the runs of blocks which don't matter left out
+///
+/// format, all numbers are little endian u32:
+///   header:  "PUSPARS1", block size, image blocks, md5[16] of the image without don't care blocks
+///   chunks:  RAW(1) blocks data   - blocks * block size of data
+///            ZERO(2) blocks       - zero filled blocks
+///            DONT_CARE(3) blocks  - the partition content is left as it is
+///            END(0)
+/// chunks cover exactly the image blocks, block size is a multiple of the device sector size
+///
+/// data is written straight to the block device in erase group aligned transfers, don't care runs are not
+/// written at all and zero runs only where the device doesn't read zeros already
+/// created on the host with tools/sparse_gen
+
+#define SPARSE_MAGIC "PUSPARS1"
+#define SPARSE_MAGIC_SIZE 8
+#define SPARSE_MD5_SIZE 16
+#define SPARSE_HEADER_SIZE (SPARSE_MAGIC_SIZE + 4 + 4 + SPARSE_MD5_SIZE)
+#define SPARSE_CHUNK_SIZE (1 + 4)
+/// transfer size when the device doesn't report its erase group
+#define SPARSE_DEFAULT_TRANSFER (64 * 1024)
+
+enum sparse_error_e {
+    ErrorSparseOk,
+    ErrorSparseFormat, /// corrupted or truncated image
+    ErrorSparseSize,   /// image doesn't fit the partition
+    ErrorSparseIo,
+    ErrorSparseVerify, /// partition content differs from the image
+    ErrorSparseMemory,
+};
+
+enum sparse_chunk_e {
+    SparseChunkEnd = 0,
+    SparseChunkRaw = 1,
+    SparseChunkZero = 2,
+    SparseChunkDontCare = 3,
+};
+
+/// written range of the partition, kept for the verification
+struct sparse_run_s {
+    lba_t lba;
+    blk_size_t count;
+};
+
+/// streaming image writer - image data is fed in chunks of any size, the partition is written as it's parsed
+struct sparse_apply_s {
+    int device;
+    blk_size_t sector_size;
+    blk_size_t sector_count;
+    blk_size_t transfer;           /// sectors per transfer, erase group multiple
+    unsigned char header[SPARSE_HEADER_SIZE];
+    unsigned char chunk[SPARSE_CHUNK_SIZE];
+    size_t fill;                   /// bytes of header or chunk collected
+    int state;
+    uint32_t block_sectors;        /// sectors per image block
+    uint32_t blocks;               /// image blocks
+    uint32_t done;                 /// image blocks handled
+    uint32_t chunk_blocks;         /// blocks of the current RAW chunk
+    uint64_t remaining;            /// bytes left of the current RAW chunk
+    lba_t lba;                     /// next sector of the partition
+    lba_t start;                   /// first sector of the partition on the disk, transfers are aligned on the disk
+    unsigned char *buffer;         /// transfer buffer
+    size_t buffer_fill;            /// bytes of RAW data in the buffer, written to lba
+    struct sparse_run_s *runs;     /// written ranges in the partition order
+    size_t runs_count;
+    size_t runs_capacity;
+    uint32_t written;              /// sectors written
+    uint32_t skipped;              /// sectors left as they were
+    int error;                     /// sparse_error_e, sticky
+};
+
+/// prepare writing the image to the block device, transfers are multiples of the device erase group
+int sparse_apply_init(struct sparse_apply_s *sparse, int device);
+
+/// write next chunk of the image
+int sparse_apply_feed(struct sparse_apply_s *sparse, const void *data, size_t size);
+
+/// check the whole image was written and wait for the device to complete the writes
+int sparse_apply_finish(struct sparse_apply_s *sparse);
+
+/// read the written ranges back and compare them with the image md5
+int sparse_apply_verify(struct sparse_apply_s *sparse);
+
+void sparse_apply_deinit(struct sparse_apply_s *sparse);
+
+const char *sparse_strerror(int err);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,501 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "stream.h"
+#include "tar.h"
+#include "log.h"
+
+static int source_buffer(struct stream_source_s *source, void *buffer, size_t buffer_size) {
+    source->buffer_size = buffer_size;
+    source->buffer = buffer;
+    if (buffer == NULL) {
+        source->buffer = malloc(buffer_size);
+        source->own_buffer = true;
+    }
+    if (source->buffer == NULL || buffer_size == 0) {
+        debug_log("Stream: unable to allocate %d bytes buffer", buffer_size);
+        return ErrorStreamMemory;
+    }
+    return ErrorStreamOk;
+}
+
+static int file_read(struct stream_source_s *source, const void **data, size_t *size) {
+    ssize_t bytes_read = read(source->u.fd, source->buffer, source->buffer_size);
+    if (bytes_read < 0) {
+        debug_log("Stream: failed to read file: %d", errno);
+        return ErrorStreamRead;
+    }
+    *data = source->buffer;
+    *size = bytes_read;
+    return ErrorStreamOk;
+}
+
+int stream_file_source(struct stream_source_s *source, const char *path, void *buffer, size_t buffer_size) {
+    memset(source, 0, sizeof *source);
+    source->read = file_read;
+    source->u.fd = open(path, O_RDONLY);
+    if (source->u.fd < 0) {
+        debug_log("Stream: unable to open %s: %d", path, errno);
+        return ErrorStreamRead;
+    }
+    return source_buffer(source, buffer, buffer_size);
+}
+
+static int tar_read(struct stream_source_s *source, const void **data, size_t *size) {
+    return tar_read_data(source->u.tar, data, size) == ErrorTarOk ? ErrorStreamOk : ErrorStreamRead;
+}
+
+int stream_tar_source(struct stream_source_s *source, struct tar_ctx *tar) {
+    memset(source, 0, sizeof *source);
+    source->read = tar_read;
+    source->u.tar = tar;
+    return ErrorStreamOk;
+}
+
+static int blk_source_read(struct stream_source_s *source, const void **data, size_t *size) {
+    *data = source->buffer;
+    *size = 0;
+    if (source->u.blk.remaining == 0) {
+        return ErrorStreamOk;
+    }
+    const size_t sector_size = source->u.blk.sector_size;
+    size_t chunk = source->buffer_size / sector_size * sector_size;
+    if (chunk > source->u.blk.remaining) {
+        chunk = source->u.blk.remaining;
+    }
+    const blk_size_t sectors = (chunk + sector_size - 1) / sector_size;
+    int err = blk_read(source->u.blk.device, source->u.blk.lba, sectors, source->buffer);
+    if (err) {
+        debug_log("Stream: failed to read %u sectors at %u: %d", sectors, source->u.blk.lba, err);
+        return ErrorStreamRead;
+    }
+    source->u.blk.lba += sectors;
+    source->u.blk.remaining -= chunk;
+    *size = chunk;
+    return ErrorStreamOk;
+}
+
+int stream_blk_source(struct stream_source_s *source, int device, lba_t lba, size_t size, size_t buffer_size) {
+    memset(source, 0, sizeof *source);
+    source->read = blk_source_read;
+    blk_dev_info_t info;
+    int err = blk_info(device, &info);
+    if (err) {
+        debug_log("Stream: no block device %d: %d", device, err);
+        return ErrorStreamRead;
+    }
+    if (buffer_size < info.sector_size) {
+        buffer_size = info.sector_size;
+    }
+    source->u.blk.device = device;
+    source->u.blk.lba = lba;
+    source->u.blk.remaining = size;
+    source->u.blk.sector_size = info.sector_size;
+    return source_buffer(source, NULL, buffer_size / info.sector_size * info.sector_size);
+}
+
+static int memory_read(struct stream_source_s *source, const void **data, size_t *size) {
+    *data = source->u.memory.data;
+    *size = source->u.memory.remaining < source->buffer_size ? source->u.memory.remaining : source->buffer_size;
+    source->u.memory.data += *size;
+    source->u.memory.remaining -= *size;
+    return ErrorStreamOk;
+}
+
+int stream_memory_source(struct stream_source_s *source, const void *data, size_t size, size_t chunk_size) {
+    memset(source, 0, sizeof *source);
+    source->read = memory_read;
+    source->buffer_size = chunk_size;
+    source->u.memory.data = data;
+    source->u.memory.remaining = size;
+    return chunk_size > 0 ? ErrorStreamOk : ErrorStreamSize;
+}
+
+/// decoder input - copies out of the compressed source chunks
+static ssize_t lz4_input(void *arg, void *buf, size_t size) {
+    struct stream_source_s *source = arg;
+    if (source->u.lz4.pending_size == 0) {
+        const void *data = NULL;
+        if (source->u.lz4.compressed->read(source->u.lz4.compressed, &data, &source->u.lz4.pending_size) !=
+            ErrorStreamOk) {
+            return -1;
+        }
+        source->u.lz4.pending = data;
+    }
+    const size_t chunk = size < source->u.lz4.pending_size ? size : source->u.lz4.pending_size;
+    memcpy(buf, source->u.lz4.pending, chunk);
+    source->u.lz4.pending += chunk;
+    source->u.lz4.pending_size -= chunk;
+    return chunk;
+}
+
+static int lz4_read(struct stream_source_s *source, const void **data, size_t *size) {
+    ssize_t bytes_read = lz4_frame_read(&source->u.lz4.frame, source->buffer, source->buffer_size);
+    if (bytes_read < 0) {
+        debug_log("Stream: failed to decode: %s", lz4_strerror(-bytes_read));
+        return ErrorStreamRead;
+    }
+    *data = source->buffer;
+    *size = bytes_read;
+    return ErrorStreamOk;
+}
+
+int stream_lz4_source(struct stream_source_s *source, struct stream_source_s *compressed, size_t buffer_size) {
+    memset(source, 0, sizeof *source);
+    source->read = lz4_read;
+    source->u.lz4.compressed = compressed;
+    lz4_frame_init(&source->u.lz4.frame, lz4_input, source);
+    return source_buffer(source, NULL, buffer_size);
+}
+
+void stream_source_close(struct stream_source_s *source) {
+    if (source->read == file_read && source->u.fd >= 0) {
+        close(source->u.fd);
+        source->u.fd = -1;
+    }
+    if (source->read == lz4_read) {
+        lz4_frame_deinit(&source->u.lz4.frame);
+    }
+    if (source->own_buffer) {
+        free(source->buffer);
+    }
+    source->buffer = NULL;
+    source->own_buffer = false;
+}
+
+static int md5_write(struct stream_stage_s *stage, const void *data, size_t size) {
+    MD5_Update(&stage->u.md5.ctx, data, size);
+    return ErrorStreamOk;
+}
+
+static int md5_finish(struct stream_stage_s *stage) {
+    MD5_Final(stage->u.md5.digest, &stage->u.md5.ctx);
+    return ErrorStreamOk;
+}
+
+int stream_md5_stage(struct stream_stage_s *stage, unsigned char digest[16]) {
+    memset(stage, 0, sizeof *stage);
+    stage->write = md5_write;
+    stage->finish = md5_finish;
+    stage->u.md5.digest = digest;
+    MD5_Init(&stage->u.md5.ctx);
+    return ErrorStreamOk;
+}
+
+static int sha256_write(struct stream_stage_s *stage, const void *data, size_t size) {
+    return sha256_update(stage->u.sha256.ctx, data, size) == 0 ? ErrorStreamOk : ErrorStreamCallback;
+}
+
+static int sha256_stage_finish(struct stream_stage_s *stage) {
+    int err = sha256_finish(stage->u.sha256.ctx, stage->u.sha256.hash);
+    stage->u.sha256.ctx = NULL;
+    return err == 0 ? ErrorStreamOk : ErrorStreamCallback;
+}
+
+int stream_sha256_stage(struct stream_stage_s *stage, struct sha256_hash *hash) {
+    memset(stage, 0, sizeof *stage);
+    stage->write = sha256_write;
+    stage->finish = sha256_stage_finish;
+    stage->u.sha256.hash = hash;
+    stage->u.sha256.ctx = sha256_init();
+    if (stage->u.sha256.ctx == NULL) {
+        debug_log("Stream: unable to init sha256");
+        return ErrorStreamMemory;
+    }
+    return ErrorStreamOk;
+}
+
+static int compare_write(struct stream_stage_s *stage, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    while (size > 0) {
+        if (stage->u.compare.size == 0) {
+            const void *other = NULL;
+            struct stream_source_s *source = stage->u.compare.other;
+            if (source->read(source, &other, &stage->u.compare.size) != ErrorStreamOk) {
+                return ErrorStreamRead;
+            }
+            if (stage->u.compare.size == 0) {
+                debug_log("Stream: compared data is shorter");
+                return ErrorStreamSize;
+            }
+            stage->u.compare.data = other;
+        }
+        const size_t chunk = size < stage->u.compare.size ? size : stage->u.compare.size;
+        if (memcmp(bytes, stage->u.compare.data, chunk) != 0) {
+            return ErrorStreamMismatch;
+        }
+        bytes += chunk;
+        size -= chunk;
+        stage->u.compare.data += chunk;
+        stage->u.compare.size -= chunk;
+    }
+    return ErrorStreamOk;
+}
+
+static int compare_finish(struct stream_stage_s *stage) {
+    const void *other = NULL;
+    struct stream_source_s *source = stage->u.compare.other;
+    if (stage->u.compare.size == 0 && source->read(source, &other, &stage->u.compare.size) != ErrorStreamOk) {
+        return ErrorStreamRead;
+    }
+    if (stage->u.compare.size != 0) {
+        debug_log("Stream: compared data is longer");
+        return ErrorStreamSize;
+    }
+    return ErrorStreamOk;
+}
+
+int stream_compare_stage(struct stream_stage_s *stage, struct stream_source_s *other) {
+    memset(stage, 0, sizeof *stage);
+    stage->write = compare_write;
+    stage->finish = compare_finish;
+    stage->u.compare.other = other;
+    return ErrorStreamOk;
+}
+
+static int callback_write(struct stream_stage_s *stage, const void *data, size_t size) {
+    return stage->u.callback.fn(stage->u.callback.arg, data, size) == 0 ? ErrorStreamOk : ErrorStreamCallback;
+}
+
+int stream_callback_stage(struct stream_stage_s *stage, stream_callback_fn fn, void *arg) {
+    memset(stage, 0, sizeof *stage);
+    stage->write = callback_write;
+    stage->u.callback.fn = fn;
+    stage->u.callback.arg = arg;
+    return ErrorStreamOk;
+}
+
+static int file_write(struct stream_stage_s *stage, const void *data, size_t size) {
+    if (write(stage->u.file.fd, data, size) != (ssize_t) size) {
+        debug_log("Stream: failed to write file (%d bytes): %d", size, errno);
+        return ErrorStreamWrite;
+    }
+    return ErrorStreamOk;
+}
+
+int stream_file_sink(struct stream_stage_s *stage, const char *path) {
+    memset(stage, 0, sizeof *stage);
+    stage->write = file_write;
+    stage->u.file.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (stage->u.file.fd < 0) {
+        debug_log("Stream: unable to create %s: %d", path, errno);
+        return ErrorStreamWrite;
+    }
+    return ErrorStreamOk;
+}
+
+static int tar_write(struct stream_stage_s *stage, const void *data, size_t size) {
+    if (size > stage->u.tar.remaining) {
+        debug_log("Stream: data exceeds tar entry size");
+        return ErrorStreamSize;
+    }
+    int ret = mtar_write_data(stage->u.tar.tar, data, size);
+    if (ret != MTAR_ESUCCESS) {
+        debug_log("Stream: data write (%d bytes) to archive failed: %d", size, ret);
+        return ErrorStreamWrite;
+    }
+    stage->u.tar.remaining -= size;
+    return ErrorStreamOk;
+}
+
+static int tar_finish(struct stream_stage_s *stage) {
+    if (stage->u.tar.remaining != 0) {
+        debug_log("Stream: tar entry is %d bytes short", stage->u.tar.remaining);
+        return ErrorStreamSize;
+    }
+    return ErrorStreamOk;
+}
+
+int stream_tar_sink(struct stream_stage_s *stage, mtar_t *tar, size_t size) {
+    memset(stage, 0, sizeof *stage);
+    stage->write = tar_write;
+    stage->finish = tar_finish;
+    stage->u.tar.tar = tar;
+    stage->u.tar.remaining = size;
+    return ErrorStreamOk;
+}
+
+static int memory_write(struct stream_stage_s *stage, const void *data, size_t size) {
+    if (size > stage->u.memory.size - stage->u.memory.fill) {
+        debug_log("Stream: data exceeds %d bytes buffer", stage->u.memory.size);
+        return ErrorStreamSize;
+    }
+    memcpy(stage->u.memory.data + stage->u.memory.fill, data, size);
+    stage->u.memory.fill += size;
+    return ErrorStreamOk;
+}
+
+static int memory_finish(struct stream_stage_s *stage) {
+    if (stage->u.memory.fill != stage->u.memory.size) {
+        debug_log("Stream: buffer is %d bytes short", stage->u.memory.size - stage->u.memory.fill);
+        return ErrorStreamSize;
+    }
+    return ErrorStreamOk;
+}
+
+int stream_memory_sink(struct stream_stage_s *stage, void *data, size_t size) {
+    memset(stage, 0, sizeof *stage);
+    stage->write = memory_write;
+    stage->finish = memory_finish;
+    stage->u.memory.data = data;
+    stage->u.memory.size = size;
+    return ErrorStreamOk;
+}
+
+static int blk_sink_flush(struct stream_stage_s *stage, const void *data, blk_size_t sectors) {
+    int err = blk_write(stage->u.blk.device, stage->u.blk.lba, sectors, data);
+    if (err) {
+        debug_log("Stream: failed to write %u sectors at %u: %d", sectors, stage->u.blk.lba, err);
+        return ErrorStreamWrite;
+    }
+    stage->u.blk.lba += sectors;
+    return ErrorStreamOk;
+}
+
+static int blk_sink_write(struct stream_stage_s *stage, const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    const size_t sector_size = stage->u.blk.sector_size;
+    const size_t buffer_size = stage->u.blk.buffer_sectors * sector_size;
+    while (size > 0) {
+        int ret;
+        if (stage->u.blk.fill == 0 && size >= sector_size) {
+            // whole sectors are written straight from the chunk
+            size_t sectors = size / sector_size;
+            ret = blk_sink_flush(stage, bytes, sectors);
+            bytes += sectors * sector_size;
+            size -= sectors * sector_size;
+        } else {
+            size_t chunk = buffer_size - stage->u.blk.fill;
+            chunk = chunk < size ? chunk : size;
+            memcpy((unsigned char *) stage->buffer + stage->u.blk.fill, bytes, chunk);
+            stage->u.blk.fill += chunk;
+            bytes += chunk;
+            size -= chunk;
+            if (stage->u.blk.fill < buffer_size) {
+                continue;
+            }
+            ret = blk_sink_flush(stage, stage->buffer, stage->u.blk.buffer_sectors);
+            stage->u.blk.fill = 0;
+        }
+        if (ret != ErrorStreamOk) {
+            return ret;
+        }
+    }
+    return ErrorStreamOk;
+}
+
+static int blk_sink_finish(struct stream_stage_s *stage) {
+    const size_t sector_size = stage->u.blk.sector_size;
+    if (stage->u.blk.fill > 0) {
+        const size_t sectors = (stage->u.blk.fill + sector_size - 1) / sector_size;
+        memset((unsigned char *) stage->buffer + stage->u.blk.fill, 0, sectors * sector_size - stage->u.blk.fill);
+        int ret = blk_sink_flush(stage, stage->buffer, sectors);
+        stage->u.blk.fill = 0;
+        if (ret != ErrorStreamOk) {
+            return ret;
+        }
+    }
+    int err = blk_write_wait(stage->u.blk.device);
+    if (err) {
+        debug_log("Stream: failed to complete block writes: %d", err);
+        return ErrorStreamWrite;
+    }
+    return ErrorStreamOk;
+}
+
+int stream_blk_sink(struct stream_stage_s *stage, int device, lba_t lba, size_t buffer_size) {
+    memset(stage, 0, sizeof *stage);
+    stage->write = blk_sink_write;
+    stage->finish = blk_sink_finish;
+    blk_dev_info_t info;
+    int err = blk_info(device, &info);
+    if (err) {
+        debug_log("Stream: no block device %d: %d", device, err);
+        return ErrorStreamWrite;
+    }
+    stage->u.blk.device = device;
+    stage->u.blk.lba = lba;
+    stage->u.blk.sector_size = info.sector_size;
+    stage->u.blk.buffer_sectors = buffer_size > info.sector_size ? buffer_size / info.sector_size : 1;
+    stage->buffer = malloc(stage->u.blk.buffer_sectors * info.sector_size);
+    if (stage->buffer == NULL) {
+        debug_log("Stream: unable to allocate sector buffer");
+        return ErrorStreamMemory;
+    }
+    return ErrorStreamOk;
+}
+
+void stream_stage_close(struct stream_stage_s *stage) {
+    if (stage->write == file_write && stage->u.file.fd >= 0) {
+        close(stage->u.file.fd);
+        stage->u.file.fd = -1;
+    }
+    if (stage->write == sha256_write && stage->u.sha256.ctx != NULL) {
+        struct sha256_hash unused;
+        sha256_finish(stage->u.sha256.ctx, &unused);
+        stage->u.sha256.ctx = NULL;
+    }
+    free(stage->buffer);
+    stage->buffer = NULL;
+}
+
+int stream_run(struct stream_source_s *source, struct stream_stage_s *stages, size_t count, size_t *bytes) {
+    size_t total = 0;
+    int ret = ErrorStreamOk;
+    while (ret == ErrorStreamOk) {
+        const void *data = NULL;
+        size_t size = 0;
+        ret = source->read(source, &data, &size);
+        if (ret != ErrorStreamOk || size == 0) {
+            break;
+        }
+        for (size_t i = 0; i < count && ret == ErrorStreamOk; ++i) {
+            ret = stages[i].write(&stages[i], data, size);
+        }
+        total += size;
+    }
+    for (size_t i = 0; i < count && ret == ErrorStreamOk; ++i) {
+        if (stages[i].finish != NULL) {
+            ret = stages[i].finish(&stages[i]);
+        }
+    }
+    if (bytes != NULL) {
+        *bytes = total;
+    }
+    return ret;
+}
+
+int stream_file_md5(const char *path, unsigned char digest[16]) {
+    struct stream_source_s source;
+    struct stream_stage_s md5;
+    stream_md5_stage(&md5, digest);
+    int ret = stream_file_source(&source, path, NULL, STREAM_BUFFER_SIZE);
+    if (ret == ErrorStreamOk) {
+        ret = stream_run(&source, &md5, 1, NULL);
+    }
+    stream_source_close(&source);
+    stream_stage_close(&md5);
+    return ret;
+}
+
+const char *stream_strerror(int err) {
+    switch (err) {
+        case ErrorStreamOk:
+            return "ErrorStreamOk";
+        case ErrorStreamRead:
+            return "ErrorStreamRead";
+        case ErrorStreamWrite:
+            return "ErrorStreamWrite";
+        case ErrorStreamSize:
+            return "ErrorStreamSize";
+        case ErrorStreamMismatch:
+            return "ErrorStreamMismatch";
+        case ErrorStreamMemory:
+            return "ErrorStreamMemory";
+        case ErrorStreamCallback:
+            return "ErrorStreamCallback";
+    }
+    return "";
+}
@@ -0,0 +1,179 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <md5/md5.h>
+#include <microtar/microtar.h>
+#include <hal/blk_dev.h>
+#include <hal/hwcrypt/sha256.h>
+#include "lz4_frame.h"
+
+/// streaming pipeline: a source hands out chunks of data, stages see every chunk in order
+///
+///   file | tar entry | block range | memory | lz4 (of another source)
+///       ->  md5, sha256, compare, callback  ->  file, tar, block, memory
+///
+/// a chunk points into the buffer of the source and is valid until the next read from the source,
+/// it's never copied between stages - hash and write of the same data is a single read
+///
+/// sources and stages are set up by their init functions and released with stream_source_close / stream_stage_close,
+/// results of the stages (digests, written data) are complete after stream_run succeeds
+
+enum stream_error_e {
+    ErrorStreamOk,
+    ErrorStreamRead,     /// source failed to read
+    ErrorStreamWrite,    /// sink failed to write
+    ErrorStreamSize,     /// data size is not the declared one
+    ErrorStreamMismatch, /// compared data differs
+    ErrorStreamMemory,
+    ErrorStreamCallback, /// callback stage failed
+};
+
+#define STREAM_BUFFER_SIZE (64 * 1024)
+
+struct tar_ctx;
+struct stream_source_s;
+
+/// next chunk of data, size 0 at the end of the source
+typedef int (*stream_read_fn)(struct stream_source_s *source, const void **data, size_t *size);
+
+struct stream_source_s {
+    stream_read_fn read;
+    void *buffer;       /// chunk buffer, NULL for sources handing out chunks of other buffers
+    size_t buffer_size;
+    bool own_buffer;    /// buffer is freed on close
+    union {
+        int fd;
+        struct tar_ctx *tar;
+        struct {
+            int device;
+            lba_t lba;
+            size_t remaining;
+            size_t sector_size;
+        } blk;
+        struct {
+            const unsigned char *data;
+            size_t remaining;
+        } memory;
+        struct {
+            struct stream_source_s *compressed;
+            const unsigned char *pending; /// not decoded part of the compressed chunk
+            size_t pending_size;
+            struct lz4_frame_s frame;
+        } lz4;
+    } u;
+};
+
+struct stream_stage_s;
+
+typedef int (*stream_write_fn)(struct stream_stage_s *stage, const void *data, size_t size);
+typedef int (*stream_finish_fn)(struct stream_stage_s *stage);
+/// callback stage function, non zero return stops the stream
+typedef int (*stream_callback_fn)(void *arg, const void *data, size_t size);
+
+struct stream_stage_s {
+    stream_write_fn write;
+    stream_finish_fn finish; /// called at the end of the stream, can be NULL
+    void *buffer;            /// sector buffer of the block sink
+    union {
+        struct {
+            MD5_CTX ctx;
+            unsigned char *digest;
+        } md5;
+        struct {
+            struct sha256_context *ctx;
+            struct sha256_hash *hash;
+        } sha256;
+        struct {
+            int fd;
+        } file;
+        struct {
+            mtar_t *tar;
+            size_t remaining;
+        } tar;
+        struct {
+            int device;
+            lba_t lba;
+            size_t sector_size;
+            size_t buffer_sectors;
+            size_t fill;
+        } blk;
+        struct {
+            unsigned char *data;
+            size_t size;
+            size_t fill;
+        } memory;
+        struct {
+            struct stream_source_s *other;
+            const unsigned char *data; /// not compared part of the other source chunk
+            size_t size;
+        } compare;
+        struct {
+            stream_callback_fn fn;
+            void *arg;
+        } callback;
+    } u;
+};
+
+/// file opened for reading, buffer NULL - allocate a buffer of buffer_size
+int stream_file_source(struct stream_source_s *source, const char *path, void *buffer, size_t buffer_size);
+
+/// data of the current entry of archive opened with tar_init "r", chunks point into the tar read ahead window
+int stream_tar_source(struct stream_source_s *source, struct tar_ctx *tar);
+
+/// size bytes of the block device from lba
+int stream_blk_source(struct stream_source_s *source, int device, lba_t lba, size_t size, size_t buffer_size);
+
+/// size bytes of memory handed out in chunks of at most chunk_size, nothing is copied
+int stream_memory_source(struct stream_source_s *source, const void *data, size_t size, size_t chunk_size);
+
+/// data decoded from LZ4 frames read from the compressed source, see lz4_frame.h
+int stream_lz4_source(struct stream_source_s *source, struct stream_source_s *compressed, size_t buffer_size);
+
+void stream_source_close(struct stream_source_s *source);
+
+/// md5 of the stream stored in digest when the stream ends
+int stream_md5_stage(struct stream_stage_s *stage, unsigned char digest[16]);
+
+/// sha256 of the stream stored in hash when the stream ends
+int stream_sha256_stage(struct stream_stage_s *stage, struct sha256_hash *hash);
+
+/// fails unless the stream is identical to the other source, also in size
+int stream_compare_stage(struct stream_stage_s *stage, struct stream_source_s *other);
+
+/// every chunk passed to the function
+int stream_callback_stage(struct stream_stage_s *stage, stream_callback_fn fn, void *arg);
+
+/// file created or truncated
+int stream_file_sink(struct stream_stage_s *stage, const char *path);
+
+/// data of the archive entry which header declaring size bytes was just written with microtar
+int stream_tar_sink(struct stream_stage_s *stage, mtar_t *tar, size_t size);
+
+/// block device from lba, last sector is padded with zeros, the data is on the device when the stream ends
+int stream_blk_sink(struct stream_stage_s *stage, int device, lba_t lba, size_t buffer_size);
+
+/// memory buffer of size bytes, the stream has to fill it exactly
+int stream_memory_sink(struct stream_stage_s *stage, void *data, size_t size);
+
+void stream_stage_close(struct stream_stage_s *stage);
+
+/// read the source to its end passing every chunk to the stages in order, stages are finished at the end
+/// @param bytes streamed data size, can be NULL
+int stream_run(struct stream_source_s *source, struct stream_stage_s *stages, size_t count, size_t *bytes);
+
+/// md5 of the file
+int stream_file_md5(const char *path, unsigned char digest[16]);
+
+const char *stream_strerror(int err);
+
+#ifdef __cplusplus
+}
+#endif
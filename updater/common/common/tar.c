@@ -1,12 +1,20 @@
 #include <errno.h>
 #include <microtar/microtar.h>
+#include <md5/md5.h>
 #include <stdio.h>
 #include <string.h>
 #include <fcntl.h>
 #include <sys/stat.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <stddef.h>
 #include "path_opts.h"
+#include "match.h"
+#include "lz4_frame.h"
+#include "delta.h"
+#include "io_buffer.h"
+#include "pack.h"
+#include "stream.h"
 #include "tar.h"
 #include "log.h"
 
@@ -16,57 +24,487 @@
 #define log_unpack(...)
 #endif
 
-static void _autoclose(int *f) {
-    if (*f > 0) {
-        close(*f);
-    }
-}
-
 static void _autofree(char **f) {
     free(*f);
 }
 
-#define AUTOCLOSE(var) int var __attribute__((__cleanup__(_autoclose)))
 #define AUTOFREE(var) char* var __attribute__((__cleanup__(_autofree)))
 
 
+/// raw ustar header as stored in the archive
+struct tar_raw_header_s {
+    char name[100];
+    char mode[8];
+    char owner[8];
+    char group[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char type;
+    char linkname[100];
+    char padding[255];
+};
+
+/// read raw archive bytes, everything read is hashed when hashing is enabled
+static ssize_t archive_read(struct tar_ctx *ctx, void *buf, size_t size) {
+    ssize_t bytes_read = read(ctx->fd, buf, size);
+    if (bytes_read < 0) {
+        debug_log("Tar: failed to read archive: %d", errno);
+        return -1;
+    }
+    if (ctx->sha && bytes_read > 0) {
+        sha256_update(ctx->sha, buf, bytes_read);
+    }
+    return bytes_read;
+}
+
+static ssize_t archive_source(void *arg, void *buf, size_t size) {
+    return archive_read((struct tar_ctx *) arg, buf, size);
+}
+
+/// entry of sector aligned package, see pack.h
+struct tar_pack_entry_s {
+    uint32_t name;   /// offset of the name in names
+    uint32_t offset; /// archive offset of the data
+    uint32_t size;
+    uint32_t type;
+    unsigned char md5[PACK_MD5_SIZE];
+};
+
+struct tar_pack_s {
+    struct tar_pack_entry_s *entries;
+    uint32_t count;
+    char *names;
+    uint32_t names_size;
+    uint32_t alignment;
+    uint32_t next;                          /// entry returned by the next tar_read_header
+    const struct tar_pack_entry_s *current; /// entry returned by the last tar_read_header
+};
+
+static uint32_t le32(const unsigned char *p) {
+    return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+static void pack_free(struct tar_pack_s *pack) {
+    if (pack != NULL) {
+        free(pack->entries);
+        free(pack->names);
+        free(pack);
+    }
+}
+
+static bool read_all(int fd, void *buf, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        const ssize_t bytes = read(fd, (unsigned char *) buf + done, size - done);
+        if (bytes <= 0) {
+            return false;
+        }
+        done += bytes;
+    }
+    return true;
+}
+
+/// entries are in the data order and point inside the names
+static bool pack_entries_valid(const struct tar_pack_s *pack, uint32_t data_offset) {
+    uint32_t data_end = data_offset;
+    if (pack->names_size == 0 || pack->names[pack->names_size - 1] != '\0') {
+        return false;
+    }
+    for (uint32_t i = 0; i < pack->count; ++i) {
+        const struct tar_pack_entry_s *entry = &pack->entries[i];
+        if (entry->name >= pack->names_size || strlen(pack->names + entry->name) > PACK_NAME_MAX ||
+            entry->offset < data_end || entry->offset % pack->alignment != 0 ||
+            entry->size > UINT32_MAX - entry->offset) {
+            debug_log("Tar: invalid package entry %u", i);
+            return false;
+        }
+        data_end = entry->offset + entry->size;
+    }
+    return true;
+}
+
+/// load index of sector aligned package, archive of other format is left for the tar reader
+/// the index is read aside of the stream - it's hashed with the rest when the package is read
+static int pack_open(struct tar_ctx *ctx) {
+    unsigned char header[PACK_HEADER_SIZE];
+    unsigned char *raw = NULL;
+    int ret = ErrorTarOk;
+
+    if (!read_all(ctx->fd, header, sizeof header) || memcmp(header, PACK_MAGIC, PACK_MAGIC_SIZE) != 0) {
+        goto rewind;
+    }
+    struct tar_pack_s *pack = calloc(1, sizeof *pack);
+    if (pack == NULL) {
+        ret = ErrorTarStd;
+        goto rewind;
+    }
+    ctx->pack = pack;
+    pack->count = le32(header + PACK_MAGIC_SIZE);
+    pack->names_size = le32(header + PACK_MAGIC_SIZE + 4);
+    const uint32_t data_offset = le32(header + PACK_MAGIC_SIZE + 8);
+    pack->alignment = le32(header + PACK_MAGIC_SIZE + 12);
+    const unsigned char *index_md5 = header + PACK_MAGIC_SIZE + 16;
+    if (pack->alignment == 0 || pack->alignment % TAR_RECORD_SIZE != 0 || data_offset < PACK_HEADER_SIZE ||
+        pack->count > (data_offset - PACK_HEADER_SIZE) / PACK_ENTRY_SIZE ||
+        pack->names_size > data_offset - PACK_HEADER_SIZE - pack->count * PACK_ENTRY_SIZE) {
+        debug_log("Tar: invalid package header");
+        ret = ErrorTarLib;
+        goto rewind;
+    }
+
+    const size_t entries_size = pack->count * PACK_ENTRY_SIZE;
+    raw = malloc(entries_size + pack->names_size);
+    pack->entries = malloc(pack->count * sizeof(struct tar_pack_entry_s) + 1);
+    pack->names = malloc(pack->names_size);
+    if (raw == NULL || pack->entries == NULL || pack->names == NULL) {
+        debug_log("Tar: unable to allocate index of %u entries", pack->count);
+        ret = ErrorTarStd;
+        goto rewind;
+    }
+    if (!read_all(ctx->fd, raw, entries_size + pack->names_size)) {
+        debug_log("Tar: package truncated in index");
+        ret = ErrorTarLib;
+        goto rewind;
+    }
+    unsigned char md5[PACK_MD5_SIZE];
+    MD5_CTX md5_ctx;
+    MD5_Init(&md5_ctx);
+    MD5_Update(&md5_ctx, raw, entries_size + pack->names_size);
+    MD5_Final(md5, &md5_ctx);
+    if (memcmp(md5, index_md5, PACK_MD5_SIZE) != 0) {
+        debug_log("Tar: package index is corrupted");
+        ret = ErrorTarLib;
+        goto rewind;
+    }
+
+    for (uint32_t i = 0; i < pack->count; ++i) {
+        const unsigned char *p = raw + i * PACK_ENTRY_SIZE;
+        pack->entries[i].name = le32(p);
+        pack->entries[i].offset = le32(p + 4);
+        pack->entries[i].size = le32(p + 8);
+        pack->entries[i].type = le32(p + 12);
+        memcpy(pack->entries[i].md5, p + 16, PACK_MD5_SIZE);
+    }
+    memcpy(pack->names, raw + entries_size, pack->names_size);
+    if (!pack_entries_valid(pack, data_offset)) {
+        ret = ErrorTarLib;
+        goto rewind;
+    }
+
+    rewind:
+    free(raw);
+    if (lseek(ctx->fd, 0, SEEK_SET) < 0) {
+        debug_log("Tar: failed to rewind archive: %d", errno);
+        ret = ErrorTarStd;
+    }
+    return ret;
+}
+
+static bool archive_is_compressed(const char *name) {
+    const char ext[] = TAR_LZ4_EXTENSION;
+    const size_t len = strlen(name);
+    return len >= sizeof(ext) - 1 && strcmp(name + len - (sizeof(ext) - 1), ext) == 0;
+}
+
+/// session buffer (see io_buffer.h) for size 0, when it's taken or for another size the buffer is allocated
+/// the buffer is never zeroed - it's only read to after it's written
+static int ctx_buffer(struct tar_ctx *ctx, size_t size) {
+    if (size == 0) {
+        ctx->buffer = io_buffer_acquire(&ctx->size);
+        if (ctx->buffer != NULL) {
+            ctx->shared_buffer = true;
+            return ErrorTarOk;
+        }
+        size = IO_BUFFER_DEFAULT_SIZE;
+    }
+    ctx->size = size;
+    ctx->buffer = malloc(ctx->size);
+    if (ctx->buffer == NULL) {
+        debug_log("Tar: unable to allocate %d bytes buffer", size);
+        return ErrorTarStd;
+    }
+    return ErrorTarOk;
+}
+
+/// open archive for the buffered reader with a read ahead window of the given size, 0 for the session buffer
+static int reader_init(struct tar_ctx *ctx, const char *name, size_t window_size) {
+    memset(ctx, 0, sizeof(struct tar_ctx));
+    ctx->fd = -1;
+    if (ctx_buffer(ctx, window_size) != ErrorTarOk) {
+        return ErrorTarStd;
+    }
+
+    ctx->fd = open(name, O_RDONLY);
+    if (ctx->fd < 0) {
+        debug_log("Tar: unable to open tar archive: %s for reading: %d", name, errno);
+        return ErrorTarStd;
+    }
+
+    if (archive_is_compressed(name)) {
+        ctx->lz4 = malloc(sizeof(struct lz4_frame_s));
+        if (ctx->lz4 == NULL) {
+            debug_log("Tar: unable to allocate decoder");
+            return ErrorTarStd;
+        }
+        lz4_frame_init(ctx->lz4, archive_source, ctx);
+        return ErrorTarOk;
+    }
+    return pack_open(ctx);
+}
+
+/// record past the trailer of every archive closed by the writer - LZ4 skippable frame, so the decoder of a
+/// compressed archive passes over it, readers of a plain archive stop at the trailer before it
+#define TAR_END_MAGIC (LZ4_SKIPPABLE_MAGIC | 0x7)
+#define TAR_END_RECORD_SIZE 28
+#define TAR_END_NO_MARK 0xFFFFFFFFU
+
+struct tar_end_record_s {
+    unsigned stream_end;           /// tar stream size without the trailer
+    unsigned trailer;              /// archive file offset of the trailer, a compressed trailer is a frame of its own
+    struct tar_position_s mark;    /// see tar_write_mark
+    bool marked;
+};
+
+static void put_le32(unsigned char *p, uint32_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+    p[2] = value >> 16;
+    p[3] = value >> 24;
+}
+
+static int end_record_read(const char *name, struct tar_end_record_s *record) {
+    unsigned char raw[TAR_END_RECORD_SIZE];
+    struct stat st;
+    if (stat(name, &st) != 0 || st.st_size < TAR_END_RECORD_SIZE) {
+        return ErrorTarEnd;
+    }
+    int fd = open(name, O_RDONLY);
+    if (fd < 0) {
+        return ErrorTarStd;
+    }
+    const bool read_whole = lseek(fd, st.st_size - TAR_END_RECORD_SIZE, SEEK_SET) >= 0 &&
+                            read(fd, raw, sizeof raw) == (ssize_t) sizeof raw;
+    close(fd);
+    if (!read_whole || le32(raw) != TAR_END_MAGIC || le32(raw + 4) != TAR_END_RECORD_SIZE - 8) {
+        return ErrorTarEnd;
+    }
+    record->stream_end = le32(raw + 8);
+    record->trailer = le32(raw + 12);
+    record->mark.offset = le32(raw + 16);
+    record->mark.file_offset = le32(raw + 20);
+    record->marked = le32(raw + 24) != TAR_END_NO_MARK;
+    return record->trailer <= st.st_size - TAR_END_RECORD_SIZE ? ErrorTarOk : ErrorTarEnd;
+}
+
+/// tar stream size of a compressed archive without end record, decoded whole to count it
+static int compressed_stream_end(const char *name, unsigned *end) {
+    struct tar_ctx reader;
+    *end = 0;
+    int ret = reader_init(&reader, name, TAR_INDEX_WINDOW_SIZE);
+    ssize_t size = 0;
+    while (ret == ErrorTarOk && (size = lz4_frame_read(reader.lz4, reader.buffer, reader.size)) > 0) {
+        *end += size;
+    }
+    if (ret == ErrorTarOk && size < 0) {
+        debug_log("Tar: unable to decode %s: %s", name, lz4_strerror(-size));
+        ret = ErrorTarLib;
+    }
+    tar_deinit(&reader);
+    return ret;
+}
+
+/// archive opened with "a" continues where its data ends: the trailer and the end record written by
+/// the previous writer are cut off, they're written again by tar_deinit
+/// archive without end record is appended past its last byte
+static int writer_resume(struct tar_ctx *ctx, const char *name, bool compressed) {
+    struct tar_end_record_s record;
+    struct stat st;
+    if (end_record_read(name, &record) == ErrorTarOk) {
+        if (truncate(name, record.trailer) != 0) {
+            debug_log("Tar: unable to cut the trailer of %s: %d", name, errno);
+            return ErrorTarStd;
+        }
+        ctx->append_offset = record.stream_end;
+        ctx->file_offset = record.trailer;
+        /// session without a mark of its own keeps the previous one, the entries before it aren't touched
+        ctx->mark = record.mark;
+        ctx->marked = record.marked;
+        return ErrorTarOk;
+    }
+    if (stat(name, &st) != 0 || st.st_size == 0) {
+        return ErrorTarOk;
+    }
+    ctx->file_offset = st.st_size;
+    if (!compressed) {
+        ctx->append_offset = st.st_size;
+        return ErrorTarOk;
+    }
+    debug_log("Tar: no end record in %s, decoding it to append", name);
+    return compressed_stream_end(name, &ctx->append_offset);
+}
+
+/// microtar writes through the encoder
+static int compressed_write(mtar_t *tar, const void *data, unsigned size) {
+    struct tar_ctx *ctx = (struct tar_ctx *) ((char *) tar - offsetof(struct tar_ctx, tar));
+    return lz4_encoder_write(ctx->encoder, data, size) == ErrorLz4Ok ? MTAR_ESUCCESS : MTAR_EWRITEFAIL;
+}
+
+static int compressed_sink(void *arg, const void *buf, size_t size) {
+    struct tar_ctx *ctx = arg;
+    if (fwrite(buf, 1, size, ctx->tar.stream) != size) {
+        return -1;
+    }
+    ctx->file_offset += size;
+    return 0;
+}
+
+/// close the frame written so far, the next write starts a new one
+static int compressed_frame_end(struct tar_ctx *ctx) {
+    if (lz4_encoder_finish(ctx->encoder) != ErrorLz4Ok) {
+        debug_log("Tar: unable to finish compressed frame: %s", lz4_strerror(ctx->encoder->error));
+        return ErrorTarLib;
+    }
+    return ErrorTarOk;
+}
+
+/// write the trailer and the end record after it
+static int writer_finalize(struct tar_ctx *ctx) {
+    unsigned char raw[TAR_END_RECORD_SIZE];
+    const unsigned stream_end = tar_write_offset(ctx);
+    if (ctx->encoder && compressed_frame_end(ctx) != ErrorTarOk) {
+        return ErrorTarLib;
+    }
+    const unsigned trailer = ctx->encoder ? ctx->file_offset : stream_end;
+    if (mtar_finalize(&ctx->tar) != MTAR_ESUCCESS || (ctx->encoder && compressed_frame_end(ctx) != ErrorTarOk)) {
+        debug_log("Tar: unable to write archive trailer");
+        return ErrorTarLib;
+    }
+    put_le32(raw, TAR_END_MAGIC);
+    put_le32(raw + 4, TAR_END_RECORD_SIZE - 8);
+    put_le32(raw + 8, stream_end);
+    put_le32(raw + 12, trailer);
+    put_le32(raw + 16, ctx->mark.offset);
+    put_le32(raw + 20, ctx->mark.file_offset);
+    put_le32(raw + 24, ctx->marked ? 0 : TAR_END_NO_MARK);
+    if (fwrite(raw, 1, sizeof raw, ctx->tar.stream) != sizeof raw) {
+        debug_log("Tar: unable to write archive end record");
+        return ErrorTarStd;
+    }
+    return ErrorTarOk;
+}
+
 int tar_init(struct tar_ctx *ctx, const char *name, const char *operation_mode) {
+    if (operation_mode != NULL && operation_mode[0] == 'r') {
+        return reader_init(ctx, name, 0);
+    }
+
     memset(ctx, 0, sizeof(struct tar_ctx));
-    ctx->size = 1024 * 1024;
-    ctx->buffer = calloc(1, ctx->size);
+    ctx->fd = -1;
+    if (ctx_buffer(ctx, 0) != ErrorTarOk) {
+        return ErrorTarStd;
+    }
+
+    const bool compressed = archive_is_compressed(name);
+    if (operation_mode != NULL && operation_mode[0] == 'a' && writer_resume(ctx, name, compressed) != ErrorTarOk) {
+        return ErrorTarStd;
+    }
 
     int ret = mtar_open(&ctx->tar, name, operation_mode);
     if (ret != 0) {
         debug_log("Tar: unable to open tar archive: %s in mode %s: %d", name, operation_mode, ret);
         return ret;
     }
-
-// TODO: implement some tar header rewind to use flush with: mtar_finalize
-//    if (operation_mode != NULL && operation_mode[0] == 'a') {
-//        printf("-------------------- pos %lu\n",ftell(ctx->tar.stream));
-//        fseek( ctx->tar.stream, -1024, SEEK_CUR);
-//        printf("-------------------- pos %lu\n",ftell(ctx->tar.stream));
-//    }
-
+    if (compressed) {
+        ctx->encoder = malloc(sizeof(struct lz4_encoder_s));
+        if (ctx->encoder == NULL || lz4_encoder_init(ctx->encoder, compressed_sink, ctx) != ErrorLz4Ok) {
+            debug_log("Tar: unable to allocate encoder");
+            /// nothing is finalized - the archive isn't written to
+            mtar_close(&ctx->tar);
+            ctx->tar.stream = NULL;
+            return ErrorTarStd;
+        }
+        ctx->tar.write = compressed_write;
+    }
     return ret;
 }
 
 int tar_deinit(struct tar_ctx *ctx) {
     int ret = 0;
-    free(ctx->buffer);
+    if (ctx->shared_buffer) {
+        io_buffer_release(ctx->buffer);
+    } else {
+        free(ctx->buffer);
+    }
+    ctx->buffer = NULL;
+    ctx->shared_buffer = false;
+    pack_free(ctx->pack);
+    ctx->pack = NULL;
+    if (ctx->lz4) {
+        lz4_frame_deinit(ctx->lz4);
+        free(ctx->lz4);
+        ctx->lz4 = NULL;
+    }
+    if (ctx->sha) {
+        struct sha256_hash unused;
+        sha256_finish(ctx->sha, &unused);
+        ctx->sha = NULL;
+    }
+    if (ctx->fd >= 0) {
+        close(ctx->fd);
+        ctx->fd = -1;
+    }
     if (ctx->tar.stream) {
-//        ret = mtar_finalize(&ctx->tar);
-//        if (ret != 0) {
-//            trace_write(ctx->t, ErrorTarLib, ret);
-//        }
-
-        ret = mtar_close(&ctx->tar);
-        if (ret != 0) {
-            debug_log("Tar: unable to close archive: %d", ret);
-            return ret;
+        ret = writer_finalize(ctx);
+    }
+    if (ctx->encoder) {
+        lz4_encoder_deinit(ctx->encoder);
+        free(ctx->encoder);
+        ctx->encoder = NULL;
+    }
+    if (ctx->tar.stream) {
+        const int err = mtar_close(&ctx->tar);
+        if (err != 0) {
+            debug_log("Tar: unable to close archive: %d", err);
+            return err;
         }
     }
-    return 0;
+    return ret;
+}
+
+unsigned tar_write_offset(const struct tar_ctx *ctx) {
+    return ctx->append_offset + ctx->tar.pos;
+}
+
+int tar_write_position(struct tar_ctx *ctx, struct tar_position_s *position) {
+    if (ctx->tar.stream == NULL) {
+        return ErrorTarAny;
+    }
+    if (ctx->encoder && compressed_frame_end(ctx) != ErrorTarOk) {
+        return ErrorTarLib;
+    }
+    position->offset = tar_write_offset(ctx);
+    position->file_offset = ctx->encoder ? ctx->file_offset : position->offset;
+    return ErrorTarOk;
+}
+
+int tar_write_mark(struct tar_ctx *ctx) {
+    const int ret = tar_write_position(ctx, &ctx->mark);
+    ctx->marked = ret == ErrorTarOk;
+    return ret;
+}
+
+int tar_read_mark(const char *name, struct tar_position_s *position) {
+    struct tar_end_record_s record;
+    const int ret = end_record_read(name, &record);
+    if (ret != ErrorTarOk) {
+        return ret;
+    }
+    if (!record.marked) {
+        return ErrorTarEnd;
+    }
+    *position = record.mark;
+    return ErrorTarOk;
 }
 
 int tar_catalog(struct tar_ctx *ctx, const char *sanitized_name) {
@@ -82,104 +520,148 @@ int tar_catalog(struct tar_ctx *ctx, const char *sanitized_name) {
 
 int tar_file(struct tar_ctx *ctx, const char *path, const char *sanitized_name) {
     int ret = 0;
-    off_t file_size = 0;
-    off_t yet_to_write = 0;
-    int bytes_read = 0;
+    struct stream_source_s source;
+    struct stream_stage_s stages[2];
 
     debug_log("Tar: appending file %s", path);
 
-    AUTOCLOSE(f) = open(path, O_RDONLY);
-    if (f <= 0 && errno == ENOENT) {
+    memset(ctx->md5, 0, sizeof ctx->md5);
+    memset(&source, 0, sizeof source);
+    struct stat buf;
+    ret = stat(path, &buf);
+    if (ret != 0 && errno == ENOENT) {
         debug_log("Tar: ignored non existing file: %s", path);
         ret = 0;
         goto exit;
     }
-    if (f <= 0) {
-        debug_log("Tar: failed to open file: %s", sanitized_name);
+    if (ret != 0) {
+        debug_log("Tar: can't get stat info from file: %s : %d", sanitized_name, ret);
         ret = ErrorTarStd;
         goto exit;
     }
 
-    struct stat buf;
-    ret = stat(path, &buf);
-    if (ret != 0) {
-        debug_log("Tar: can't get stat info from file: %s : %d", sanitized_name, ret);
+    ret = stream_file_source(&source, path, ctx->buffer, ctx->size);
+    if (ret != ErrorStreamOk) {
+        debug_log("Tar: failed to open file: %s", sanitized_name);
         ret = ErrorTarStd;
         goto exit;
     }
 
-    file_size = buf.st_size;
-    yet_to_write = buf.st_size;
-
-    ret = mtar_write_file_header(&(*ctx).tar, sanitized_name, file_size);
+    ret = mtar_write_file_header(&(*ctx).tar, sanitized_name, buf.st_size);
     if (ret != 0) {
-        debug_log("Tar: unable to write file header for file %s, file size: %d : %d", sanitized_name, file_size, ret);
+        debug_log("Tar: unable to write file header for file %s, file size: %d : %d", sanitized_name, buf.st_size, ret);
         ret = ErrorTarLib;
         goto exit;
     }
 
-    do {
-        memset(ctx->buffer, 0, ctx->size);
-        bytes_read = read(f, ctx->buffer, ctx->size);
-        ret = mtar_write_data(&(ctx->tar), ctx->buffer, bytes_read);
-        if (ret != 0) {
-            debug_log("Tar: data write (%d bytes) to archive failed: %d", bytes_read, ret);
-            ret = ErrorTarLib;
-            goto exit;
-        }
-        if (yet_to_write < bytes_read) {
-            debug_log("Tar: remaining data size is lower than read");
-            ret = ErrorTarLib;
-            goto exit;
-        }
-        yet_to_write -= bytes_read;
-    } while (bytes_read > 0 && yet_to_write);
+    stream_tar_sink(&stages[0], &ctx->tar, buf.st_size);
+    stream_md5_stage(&stages[1], ctx->md5);
+    ret = stream_run(&source, stages, 2, NULL);
+    stream_stage_close(&stages[0]);
+    stream_stage_close(&stages[1]);
+    if (ret != ErrorStreamOk) {
+        debug_log("Tar: unable to append %s: %s", sanitized_name, stream_strerror(ret));
+        memset(ctx->md5, 0, sizeof ctx->md5);
+        ret = ErrorTarLib;
+        goto exit;
+    }
 
     exit:
+    stream_source_close(&source);
     return ret;
 }
 
+int tar_data(struct tar_ctx *ctx, const char *sanitized_name, const void *data, size_t size) {
+    int ret = mtar_write_file_header(&ctx->tar, sanitized_name, size);
+    if (ret == 0 && size > 0) {
+        ret = mtar_write_data(&ctx->tar, data, size);
+    }
+    if (ret != 0) {
+        debug_log("Tar: unable to append %s: %d", sanitized_name, ret);
+        return ErrorTarLib;
+    }
+    return ErrorTarOk;
+}
+
 // TODO check path with double // if requires sanitization
 // TODO check path with ./ and /
 int un_tar_file(struct tar_ctx *ctx, mtar_header_t *header, const char *where) {
     int ret = 0;
     char *name = header->name;
-    size_t yet_to_write = header->size;
+    struct stream_source_s source;
+    struct stream_stage_s stages[2];
 
+    memset(ctx->md5, 0, sizeof ctx->md5);
     path_remove_cwd(name);
     AUTOFREE(out) = calloc(1, strlen(name) + strlen(where) + 2);
     sprintf(out, "%s/%s", where, name);
 
     debug_log("Tar: unpacking file (%d.%dkb) to %s", header->size / 1024, header->size % 1024, out);
 
-    AUTOCLOSE(f) = open(out, O_WRONLY | O_CREAT);
-    if (f <= 0) {
-        debug_log("Tar: failed to open archive: %s : %d", out, f);
-        ret = f;
-        goto exit;
+    stream_tar_source(&source, ctx);
+    /// hashed after the write - full sectors are being written in background meanwhile
+    stream_md5_stage(&stages[1], ctx->md5);
+    ret = stream_file_sink(&stages[0], out);
+    if (ret == ErrorStreamOk) {
+        ret = stream_run(&source, stages, 2, NULL);
     }
+    stream_stage_close(&stages[0]);
+    stream_stage_close(&stages[1]);
+    stream_source_close(&source);
 
-    do {
-        size_t read_size = yet_to_write > ctx->size ? ctx->size : yet_to_write;
-        memset(ctx->buffer, 0, ctx->size);
-        ret = mtar_read_data(&ctx->tar, ctx->buffer, read_size);
-        if (ret != 0) {
-            debug_log("Tar: failed to read data (%d bytes) from archive: %d", read_size, ret);
-            goto exit;
-        }
+    if (ret != ErrorStreamOk) {
+        debug_log("Tar: failed to unpack %s: %s", out, stream_strerror(ret));
+        memset(ctx->md5, 0, sizeof ctx->md5);
+        return ret == ErrorStreamRead ? ErrorTarStd : ErrorTarAny;
+    }
+    return ErrorTarOk;
+}
 
-        ret = write(f, ctx->buffer, read_size);
-        if (0 > ret) {
-            debug_log("Tar: failed to write file (%d bytes) from archive to disk: %d", ret);
-            goto exit;
-        } else {
-            ret = 0;
+static int delta_feed(void *arg, const void *data, size_t size) {
+    return delta_apply_feed(arg, data, size);
+}
+
+int un_tar_delta(struct tar_ctx *ctx, mtar_header_t *header, const char *source_dir, const char *where) {
+    int ret = 0;
+    char *name = header->name;
+    struct delta_apply_s delta;
+
+    memset(ctx->md5, 0, sizeof ctx->md5);
+    path_remove_cwd(name);
+    if (!string_match_end(name, DELTA_EXTENSION)) {
+        return ErrorTarAny;
+    }
+    name[strlen(name) - strlen(DELTA_EXTENSION)] = '\0';
+    AUTOFREE(source) = calloc(1, strlen(name) + strlen(source_dir) + 2);
+    AUTOFREE(out) = calloc(1, strlen(name) + strlen(where) + 2);
+    sprintf(source, "%s/%s", source_dir, name);
+    sprintf(out, "%s/%s", where, name);
+
+    debug_log("Tar: applying delta (%d.%dkb) to %s as %s", header->size / 1024, header->size % 1024, source, out);
+
+    ret = delta_apply_init(&delta, source, out);
+    if (ret == ErrorDeltaOk) {
+        struct stream_source_s data;
+        struct stream_stage_s apply;
+        stream_tar_source(&data, ctx);
+        stream_callback_stage(&apply, delta_feed, &delta);
+        if (stream_run(&data, &apply, 1, NULL) == ErrorStreamRead) {
+            debug_log("Tar: failed to read delta from archive");
+            delta_apply_deinit(&delta);
+            return ErrorTarStd;
         }
-        yet_to_write = ctx->tar.remaining_data;
-    } while (yet_to_write);
+        ret = delta.error;
+    }
+    if (ret == ErrorDeltaOk) {
+        ret = delta_apply_finish(&delta, ctx->md5);
+    }
+    delta_apply_deinit(&delta);
 
-    exit:
-    return ret;
+    if (ret != ErrorDeltaOk) {
+        debug_log("Tar: delta of %s failed: %s", name, delta_strerror(ret));
+        return ErrorTarAny;
+    }
+    return ErrorTarOk;
 }
 
 int un_tar_catalog(struct tar_ctx *ctx, mtar_header_t *header, const char *where) {
@@ -230,15 +712,547 @@ int un_tar_catalog(struct tar_ctx *ctx, mtar_header_t *header, const char *where
     return ret;
 }
 
+/// make at least `need` bytes available in the read ahead window
+/// window is refilled with as much data as fits, so the archive is read in large chunks
+/// @return bytes available in the window - less than `need` only at the archive end, negative on error
+static ssize_t window_fill(struct tar_ctx *ctx, size_t need) {
+    unsigned char *window = ctx->buffer;
+    size_t avail = ctx->end - ctx->begin;
+    if (avail >= need) {
+        return avail;
+    }
+
+    if (ctx->begin > 0) {
+        memmove(window, window + ctx->begin, avail);
+        ctx->begin = 0;
+        ctx->end = avail;
+    }
+
+    while (ctx->end - ctx->begin < need && ctx->end < ctx->size) {
+        size_t want = ctx->size - ctx->end;
+        if (ctx->pack) {
+            /// reads end on the alignment, so the following ones start on a sector and need no bounce buffer
+            const size_t tail = (ctx->offset + ctx->end - ctx->begin + want) % ctx->pack->alignment;
+            want -= want > tail ? tail : 0;
+        }
+        ssize_t bytes_read = ctx->lz4 ? lz4_frame_read(ctx->lz4, window + ctx->end, want)
+                                      : archive_read(ctx, window + ctx->end, want);
+        if (bytes_read < 0) {
+            return -1;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        ctx->end += bytes_read;
+    }
+    return ctx->end - ctx->begin;
+}
+
+static void window_consume(struct tar_ctx *ctx, size_t n) {
+    ctx->begin += n;
+    ctx->offset += n;
+}
+
+/// skip n archive bytes - seek forward when past the window, read through when hashing or decompressing
+static int window_skip(struct tar_ctx *ctx, size_t n) {
+    size_t avail = ctx->end - ctx->begin;
+    if (n <= avail) {
+        window_consume(ctx, n);
+        return ErrorTarOk;
+    }
+
+    window_consume(ctx, avail);
+    n -= avail;
+    ctx->begin = ctx->end = 0;
+
+    if (ctx->sha == NULL && ctx->lz4 == NULL) {
+        if (lseek(ctx->fd, n, SEEK_CUR) < 0) {
+            debug_log("Tar: failed to seek archive: %d", errno);
+            return ErrorTarStd;
+        }
+        ctx->offset += n;
+        return ErrorTarOk;
+    }
+
+    while (n > 0) {
+        ssize_t bytes = window_fill(ctx, 1);
+        if (bytes <= 0) {
+            debug_log("Tar: archive truncated while skipping data");
+            return ErrorTarStd;
+        }
+        size_t chunk = (size_t) bytes > n ? n : (size_t) bytes;
+        window_consume(ctx, chunk);
+        n -= chunk;
+    }
+    return ErrorTarOk;
+}
+
+static unsigned raw_header_checksum(const struct tar_raw_header_s *raw) {
+    const unsigned char *p = (const unsigned char *) raw;
+    unsigned sum = 256;
+    for (size_t i = 0; i < offsetof(struct tar_raw_header_s, checksum); ++i) {
+        sum += p[i];
+    }
+    for (size_t i = offsetof(struct tar_raw_header_s, type); i < sizeof(*raw); ++i) {
+        sum += p[i];
+    }
+    return sum;
+}
+
+/// same rules as microtar raw_to_header
+static int raw_to_header(const struct tar_raw_header_s *raw, mtar_header_t *header) {
+    unsigned checksum = 0;
+
+    if (raw->checksum[0] == '\0') {
+        return MTAR_ENULLRECORD;
+    }
+    sscanf(raw->checksum, "%o", &checksum);
+    if (checksum != raw_header_checksum(raw)) {
+        return MTAR_EBADCHKSUM;
+    }
+
+    memset(header, 0, sizeof *header);
+    sscanf(raw->mode, "%o", &header->mode);
+    sscanf(raw->owner, "%o", &header->owner);
+    sscanf(raw->size, "%o", &header->size);
+    sscanf(raw->mtime, "%o", &header->mtime);
+    header->type = raw->type;
+    memcpy(header->name, raw->name, sizeof raw->name);
+    header->name[sizeof header->name - 1] = '\0';
+    memcpy(header->linkname, raw->linkname, sizeof raw->linkname);
+    header->linkname[sizeof header->linkname - 1] = '\0';
+    return MTAR_ESUCCESS;
+}
+
+/// next entry from the package index, its data is reached on the first tar_read_data
+static int pack_read_header(struct tar_ctx *ctx, mtar_header_t *header) {
+    struct tar_pack_s *pack = ctx->pack;
+    ctx->remaining_data = 0;
+    ctx->padding = 0;
+    if (pack->next >= pack->count) {
+        pack->current = NULL;
+        return ErrorTarEnd;
+    }
+    const struct tar_pack_entry_s *entry = &pack->entries[pack->next];
+    memset(header, 0, sizeof *header);
+    strcpy(header->name, pack->names + entry->name);
+    header->size = entry->size;
+    header->type = entry->type;
+    header->mode = 0644;
+    ctx->header_offset = pack->next++;
+    ctx->remaining_data = entry->size;
+    pack->current = entry;
+    return ErrorTarOk;
+}
+
+int tar_read_header(struct tar_ctx *ctx, mtar_header_t *header) {
+    if (ctx->pack) {
+        return pack_read_header(ctx, header);
+    }
+    int ret = tar_next(ctx);
+    if (ret != ErrorTarOk) {
+        return ret;
+    }
+
+    ssize_t avail = window_fill(ctx, TAR_RECORD_SIZE);
+    if (avail < 0) {
+        return ErrorTarStd;
+    }
+    if (avail == 0) {
+        debug_log("Tar: archive ended without trailer");
+        return ErrorTarEnd;
+    }
+    if (avail < TAR_RECORD_SIZE) {
+        debug_log("Tar: archive truncated in header");
+        return ErrorTarLib;
+    }
+
+    const unsigned header_offset = ctx->offset;
+    ret = raw_to_header((const struct tar_raw_header_s *) ((unsigned char *) ctx->buffer + ctx->begin), header);
+    if (ret == MTAR_ENULLRECORD) {
+        return ErrorTarEnd;
+    }
+    if (ret != MTAR_ESUCCESS) {
+        debug_log("Tar: invalid header at %u: %s", header_offset, mtar_strerror(ret));
+        return ErrorTarLib;
+    }
+
+    window_consume(ctx, TAR_RECORD_SIZE);
+    ctx->header_offset = header_offset;
+    ctx->remaining_data = header->size;
+    ctx->padding = (TAR_RECORD_SIZE - header->size % TAR_RECORD_SIZE) % TAR_RECORD_SIZE;
+    return ErrorTarOk;
+}
+
+int tar_read_data(struct tar_ctx *ctx, const void **data, size_t *size) {
+    *data = NULL;
+    *size = 0;
+    if (ctx->remaining_data == 0) {
+        return ErrorTarOk;
+    }
+
+    if (ctx->pack) {
+        /// padding and data of skipped entries are seeked over, or read through when hashing
+        const unsigned position = ctx->pack->current->offset + (ctx->pack->current->size - ctx->remaining_data);
+        if (position < ctx->offset || window_skip(ctx, position - ctx->offset) != ErrorTarOk) {
+            debug_log("Tar: unable to reach package data at %u", position);
+            return ErrorTarStd;
+        }
+    }
+
+    ssize_t avail = window_fill(ctx, 1);
+    if (avail <= 0) {
+        debug_log("Tar: archive truncated in data, %u bytes missing", ctx->remaining_data);
+        return ErrorTarStd;
+    }
+
+    size_t chunk = (size_t) avail > ctx->remaining_data ? ctx->remaining_data : (size_t) avail;
+    *data = (unsigned char *) ctx->buffer + ctx->begin;
+    *size = chunk;
+    window_consume(ctx, chunk);
+    ctx->remaining_data -= chunk;
+    return ErrorTarOk;
+}
+
 int tar_next(struct tar_ctx *ctx) {
-    int lib_error = mtar_next(&ctx->tar);
-    if (lib_error) {
-        debug_log("Tar: can't move on to next file: %d", lib_error);
+    if (ctx->pack) {
+        /// data positions are known from the index
+        ctx->remaining_data = 0;
+        return ErrorTarOk;
+    }
+    int ret = window_skip(ctx, ctx->remaining_data + ctx->padding);
+    if (ret != ErrorTarOk) {
+        debug_log("Tar: can't move on to next file: %d", ret);
+        return ret;
+    }
+    ctx->remaining_data = 0;
+    ctx->padding = 0;
+    return ErrorTarOk;
+}
+
+const unsigned char *tar_entry_md5(const struct tar_ctx *ctx) {
+    return ctx->pack && ctx->pack->current ? ctx->pack->current->md5 : NULL;
+}
+
+/// entry is picked from the package index, its data is seeked to right away
+static int pack_seek_entry(struct tar_ctx *ctx, const struct tar_index_entry_s *entry) {
+    if (entry->offset >= ctx->pack->count) {
+        return ErrorTarAny;
+    }
+    const struct tar_pack_entry_s *pack_entry = &ctx->pack->entries[entry->offset];
+    if (ctx->sha != NULL && pack_entry->offset < ctx->offset) {
+        debug_log("Tar: seek is possible only forward when hashing");
+        return ErrorTarAny;
+    }
+    ctx->pack->next = entry->offset;
+    ctx->remaining_data = 0;
+    if (ctx->sha) {
+        return ErrorTarOk;
+    }
+    if (lseek(ctx->fd, pack_entry->offset, SEEK_SET) < 0) {
+        debug_log("Tar: failed to seek archive to %u: %d", pack_entry->offset, errno);
         return ErrorTarStd;
     }
+    ctx->begin = ctx->end = 0;
+    ctx->offset = pack_entry->offset;
     return ErrorTarOk;
 }
 
+int tar_seek_entry(struct tar_ctx *ctx, const struct tar_index_entry_s *entry) {
+    if (ctx->fd >= 0 && ctx->pack) {
+        return pack_seek_entry(ctx, entry);
+    }
+    if (ctx->fd < 0 || (ctx->sha != NULL && entry->offset < ctx->offset)) {
+        debug_log("Tar: seek is possible only in read mode, forward when hashing");
+        return ErrorTarAny;
+    }
+    ctx->remaining_data = 0;
+    ctx->padding = 0;
+    if (ctx->sha) {
+        /// every byte has to be hashed - read through
+        return window_skip(ctx, entry->offset - ctx->offset);
+    }
+    if (ctx->lz4) {
+        /// compressed stream can only be decoded forward - restart it when the entry is behind
+        if (entry->offset < ctx->offset) {
+            if (lseek(ctx->fd, 0, SEEK_SET) < 0) {
+                debug_log("Tar: failed to rewind archive: %d", errno);
+                return ErrorTarStd;
+            }
+            lz4_frame_deinit(ctx->lz4);
+            lz4_frame_init(ctx->lz4, archive_source, ctx);
+            ctx->begin = ctx->end = 0;
+            ctx->offset = 0;
+        }
+        return window_skip(ctx, entry->offset - ctx->offset);
+    }
+    if (lseek(ctx->fd, entry->offset, SEEK_SET) < 0) {
+        debug_log("Tar: failed to seek archive to %u: %d", entry->offset, errno);
+        return ErrorTarStd;
+    }
+    ctx->begin = ctx->end = 0;
+    ctx->offset = entry->offset;
+    return ErrorTarOk;
+}
+
+int tar_seek_position(struct tar_ctx *ctx, const struct tar_position_s *position) {
+    if (ctx->fd < 0 || ctx->pack || ctx->sha) {
+        debug_log("Tar: seek to position is possible only in a tar read without hashing");
+        return ErrorTarAny;
+    }
+    if (ctx->lz4 == NULL) {
+        const struct tar_index_entry_s entry = {.offset = position->offset};
+        return tar_seek_entry(ctx, &entry);
+    }
+    /// the entry starts a frame - decoding starts there
+    if (lseek(ctx->fd, position->file_offset, SEEK_SET) < 0) {
+        debug_log("Tar: failed to seek archive to frame at %u: %d", position->file_offset, errno);
+        return ErrorTarStd;
+    }
+    lz4_frame_deinit(ctx->lz4);
+    lz4_frame_init(ctx->lz4, archive_source, ctx);
+    ctx->remaining_data = 0;
+    ctx->padding = 0;
+    ctx->begin = ctx->end = 0;
+    ctx->offset = position->offset;
+    return ErrorTarOk;
+}
+
+/// read the data of the entry whose header was just read into allocated zero terminated buffer
+static int read_entry_data(struct tar_ctx *ctx, size_t entry_size, char **data) {
+    char *buffer = malloc(entry_size + 1);
+    size_t read = 0;
+    int ret = buffer == NULL ? ErrorTarStd : ErrorTarOk;
+    while (ret == ErrorTarOk && read < entry_size) {
+        const void *chunk = NULL;
+        size_t size = 0;
+        ret = tar_read_data(ctx, &chunk, &size);
+        if (ret == ErrorTarOk && size == 0) {
+            ret = ErrorTarAny;
+        }
+        if (ret == ErrorTarOk) {
+            memcpy(buffer + read, chunk, size);
+            read += size;
+        }
+    }
+    if (ret != ErrorTarOk) {
+        free(buffer);
+        return ret;
+    }
+    buffer[read] = '\0';
+    *data = buffer;
+    return ErrorTarOk;
+}
+
+int tar_read_entry(const char *name, const struct tar_index_entry_s *entry, size_t max_size, char **data) {
+    struct tar_ctx ctx;
+    mtar_header_t header;
+
+    *data = NULL;
+    if (entry->type != MTAR_TREG || entry->size > max_size) {
+        debug_log("Tar: entry is not a file or is too big: %u bytes", entry->size);
+        return ErrorTarAny;
+    }
+    int ret = reader_init(&ctx, name, TAR_INDEX_WINDOW_SIZE);
+    if (ret == ErrorTarOk) {
+        ret = tar_seek_entry(&ctx, entry);
+    }
+    if (ret == ErrorTarOk) {
+        ret = tar_read_header(&ctx, &header);
+    }
+    if (ret == ErrorTarOk) {
+        ret = read_entry_data(&ctx, entry->size, data);
+    }
+    tar_deinit(&ctx);
+    if (ret != ErrorTarOk) {
+        debug_log("Tar: unable to read entry at %u: %d", entry->offset, ret);
+    }
+    return ret;
+}
+
+int tar_read_mark_entry(const char *name, const char *entry_name, size_t max_size, char **data) {
+    struct tar_ctx ctx;
+    struct tar_position_s mark;
+    mtar_header_t header;
+
+    *data = NULL;
+    int ret = tar_read_mark(name, &mark);
+    if (ret != ErrorTarOk) {
+        return ret;
+    }
+    ret = reader_init(&ctx, name, TAR_INDEX_WINDOW_SIZE);
+    if (ret == ErrorTarOk) {
+        ret = tar_seek_position(&ctx, &mark);
+    }
+    if (ret == ErrorTarOk) {
+        ret = tar_read_header(&ctx, &header);
+    }
+    if (ret == ErrorTarOk &&
+        (header.type != MTAR_TREG || strcmp(header.name, entry_name) != 0 || header.size > max_size)) {
+        debug_log("Tar: marked entry of %s isn't %s", name, entry_name);
+        ret = ErrorTarEnd;
+    }
+    if (ret == ErrorTarOk) {
+        ret = read_entry_data(&ctx, header.size, data);
+    }
+    tar_deinit(&ctx);
+    if (ret != ErrorTarOk && ret != ErrorTarEnd) {
+        debug_log("Tar: unable to read marked entry at %u: %d", mark.offset, ret);
+    }
+    return ret;
+}
+
+/// grow array of `item` sized elements to fit `needed` elements
+static int grow(void **array, size_t *capacity, size_t needed, size_t item) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+    size_t new_capacity = *capacity ? *capacity : 64;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    void *tmp = realloc(*array, new_capacity * item);
+    if (tmp == NULL) {
+        return -1;
+    }
+    *array = tmp;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static int index_append(struct tar_index_s *index, const mtar_header_t *header, unsigned offset, unsigned char dest) {
+    const size_t name_len = strlen(header->name) + 1;
+    if (grow((void **) &index->entries, &index->capacity, index->count + 1, sizeof(struct tar_index_entry_s)) ||
+        grow((void **) &index->names, &index->names_capacity, index->names_size + name_len, 1)) {
+        debug_log("Tar: unable to grow index to %d entries", index->count + 1);
+        return ErrorTarStd;
+    }
+
+    struct tar_index_entry_s *entry = &index->entries[index->count++];
+    entry->name = index->names_size;
+    entry->offset = offset;
+    entry->size = header->size;
+    entry->type = header->type;
+    entry->dest = dest;
+    memcpy(index->names + index->names_size, header->name, name_len);
+    index->names_size += name_len;
+
+    if (header->type == MTAR_TREG) {
+        index->dest_bytes[dest] += header->size;
+        index->total_bytes += header->size;
+    }
+    return ErrorTarOk;
+}
+
+/// headers carry the modification times, a sector aligned package the md5 of every file as well
+static void index_content(struct tar_index_s *index, const mtar_header_t *header, const unsigned char *md5) {
+    const uint32_t fields[] = {header->size, header->mtime, header->mode, header->type};
+    index->content_id = lz4_xxh32(fields, sizeof fields, index->content_id);
+    if (md5 != NULL) {
+        index->content_id = lz4_xxh32(md5, TAR_MD5_SIZE, index->content_id);
+    } else if (header->type == MTAR_TREG) {
+        index->digests = false;
+    }
+}
+
+int tar_index_build(struct tar_index_s *index, const char *name, unsigned char (*destination)(const char *name)) {
+    struct tar_ctx ctx;
+    mtar_header_t header;
+    int ret = ErrorTarOk;
+
+    memset(index, 0, sizeof *index);
+    index->digests = true;
+    /// only headers are needed - small window, data of larger entries is seeked over
+    ret = reader_init(&ctx, name, TAR_INDEX_WINDOW_SIZE);
+    if (ret != ErrorTarOk) {
+        goto exit;
+    }
+
+    while ((ret = tar_read_header(&ctx, &header)) == ErrorTarOk) {
+        path_remove_cwd(header.name);
+        unsigned char dest = destination ? destination(header.name) : 0;
+        if (dest >= TAR_INDEX_DEST_MAX) {
+            debug_log("Tar: invalid destination %d for %s", dest, header.name);
+            ret = ErrorTarAny;
+            goto exit;
+        }
+        ret = index_append(index, &header, ctx.header_offset, dest);
+        if (ret != ErrorTarOk) {
+            goto exit;
+        }
+        index_content(index, &header, tar_entry_md5(&ctx));
+    }
+    if (ret == ErrorTarEnd) {
+        ret = ErrorTarOk;
+    }
+    debug_log("Tar: indexed %d entries, %d bytes of files", index->count, index->total_bytes);
+
+    exit:
+    tar_deinit(&ctx);
+    if (ret != ErrorTarOk) {
+        tar_index_free(index);
+    }
+    return ret;
+}
+
+void tar_index_free(struct tar_index_s *index) {
+    free(index->entries);
+    free(index->names);
+    memset(index, 0, sizeof *index);
+}
+
+const char *tar_index_name(const struct tar_index_s *index, const struct tar_index_entry_s *entry) {
+    return index->names + entry->name;
+}
+
+const struct tar_index_entry_s *tar_index_find(const struct tar_index_s *index, const char *name) {
+    for (size_t i = 0; i < index->count; ++i) {
+        if (strcmp(tar_index_name(index, &index->entries[i]), name) == 0) {
+            return &index->entries[i];
+        }
+    }
+    return NULL;
+}
+
+uint32_t tar_index_id(const struct tar_index_s *index) {
+    return lz4_xxh32(index->names, index->names_size, (uint32_t) (index->count ^ index->total_bytes));
+}
+
+int tar_hash_enable(struct tar_ctx *ctx) {
+    if (ctx->fd < 0 || ctx->offset != 0 || ctx->end != 0 || ctx->sha != NULL) {
+        return ErrorTarAny;
+    }
+    ctx->sha = sha256_init();
+    if (ctx->sha == NULL) {
+        debug_log("Tar: unable to allocate hash context");
+        return ErrorTarStd;
+    }
+    return ErrorTarOk;
+}
+
+int tar_hash_finish(struct tar_ctx *ctx, struct sha256_hash *hash) {
+    if (ctx->sha == NULL) {
+        return ErrorTarAny;
+    }
+
+    int ret = ErrorTarOk;
+    ssize_t bytes_read = 0;
+    /// window content is already hashed - hash everything after it
+    ctx->begin = ctx->end = 0;
+    ctx->remaining_data = ctx->padding = 0;
+    /// raw bytes are hashed - for compressed archive it's the package file, not the decoded tar
+    while ((bytes_read = archive_read(ctx, ctx->buffer, ctx->size)) > 0) {
+    }
+    if (bytes_read < 0) {
+        debug_log("Tar: unable to hash archive tail");
+        ret = ErrorTarStd;
+    }
+
+    sha256_finish(ctx->sha, hash);
+    ctx->sha = NULL;
+    return ret;
+}
+
 const char *tar_strerror(int err) {
     switch (err) {
         case ErrorTarOk:
@@ -249,6 +1263,8 @@ const char *tar_strerror(int err) {
             return "ErrorTarStd";
         case ErrorTarLib:
             return "ErrorTarLib";
+        case ErrorTarEnd:
+            return "ErrorTarEnd";
     }
     return "";
 }
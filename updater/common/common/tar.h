@@ -5,7 +5,9 @@ extern "C"
 {
 #endif
 
+#include <stdbool.h>
 #include <microtar/microtar.h>
+#include <hal/hwcrypt/sha256.h>
 #include "log.h"
 
 enum tar_error_e {
@@ -13,37 +15,178 @@ enum tar_error_e {
     ErrorTarAny,
     ErrorTarStd,
     ErrorTarLib,
+    ErrorTarEnd,
 };
 
+#define TAR_MD5_SIZE 16
+#define TAR_RECORD_SIZE 512
+/// archive read with this extension is a tar compressed to LZ4 frames, decoded on the fly, and compressed when
+/// it's written
+#define TAR_LZ4_EXTENSION ".lz4"
+
+struct lz4_frame_s;
+struct lz4_encoder_s;
+struct tar_pack_s;
+
+/// where an entry starts: offset in the tar stream and in the archive file - the same for a plain archive,
+/// LZ4 frame the entry starts for a compressed one
+struct tar_position_s {
+    unsigned offset;
+    unsigned file_offset;
+};
+
+/// archive opened for reading ("r") is parsed by the buffered reader:
+/// headers and data are taken straight from the read ahead window in buffer, the archive is never rewound
+/// offsets are offsets in the tar stream, also for a compressed archive
+/// sector aligned package (see pack.h) is read with the same calls, its entries are taken from its index
+/// archive opened for writing ("w", "a") is handled by microtar, compressed on the way for TAR_LZ4_EXTENSION
+/// tar_deinit finalizes it: trailer and an end record past it - where the data ends and the mark of the session
+/// the next "a" session cuts them off and continues the archive
 struct tar_ctx {
-    mtar_t tar;
-    void *buffer;
+    mtar_t tar;                      /// archive opened for writing
+    int fd;                          /// archive opened for reading
+    void *buffer;                    /// read ahead window when reading, data buffer when writing
     size_t size;
+    bool shared_buffer;              /// buffer is the session buffer, see io_buffer.h
+    size_t begin;                    /// first not consumed byte in the window
+    size_t end;                      /// end of valid data in the window
+    unsigned offset;                 /// archive offset of buffer[begin]
+    unsigned header_offset;          /// archive offset of the current entry header
+    unsigned remaining_data;         /// not read data of the current entry
+    unsigned padding;                /// record padding after data of the current entry
+    unsigned char md5[TAR_MD5_SIZE]; /// md5 of the last file unpacked with un_tar_file or appended with tar_file
+    struct sha256_context *sha;      /// hash of the whole archive stream, see tar_hash_enable
+    struct lz4_frame_s *lz4;         /// decoder of compressed archive, see TAR_LZ4_EXTENSION
+    struct lz4_encoder_s *encoder;   /// encoder of compressed archive opened for writing
+    unsigned append_offset;          /// tar stream size of the archive opened with "a"
+    unsigned file_offset;            /// size of the compressed archive file being written
+    struct tar_position_s mark;      /// see tar_write_mark
+    bool marked;
+    struct tar_pack_s *pack;         /// index of sector aligned package, see pack.h
 };
 
+#define TAR_INDEX_DEST_MAX 4
+#define TAR_INDEX_WINDOW_SIZE (16 * 1024)
+
+/// single archive entry in the index
+struct tar_index_entry_s {
+    unsigned name;      /// offset of the entry name in the index string pool
+    unsigned offset;    /// archive offset of the entry header, entry number in a sector aligned package
+    unsigned size;      /// entry data size
+    unsigned char type; /// MTAR_T* entry type
+    unsigned char dest; /// destination assigned by the index builder callback
+};
+
+/// table of contents of an archive - contiguous entries array and a string pool with names
+struct tar_index_s {
+    struct tar_index_entry_s *entries;
+    size_t count;
+    size_t capacity;
+    char *names;
+    size_t names_size;
+    size_t names_capacity;
+    size_t dest_bytes[TAR_INDEX_DEST_MAX]; /// size of regular files per destination
+    size_t total_bytes;                    /// size of all regular files
+    uint32_t content_id;                   /// hash of the entry headers and of the digests the package declares
+    bool digests;                          /// every file entry has its md5 declared, see tar_entry_md5
+};
+
+/// open archive, "r" for the buffered reader, other modes go to microtar
 int tar_init(struct tar_ctx *ctx, const char *name, const char *operation_mode);
 
 int tar_deinit(struct tar_ctx *ctx);
 
-/// append file to opened tar
+/// append file to opened tar, md5 of the appended data is stored in ctx->md5
 int tar_file(struct tar_ctx *ctx, const char *path, const char *sanitized_name);
 
+/// append file entry with data from memory
+int tar_data(struct tar_ctx *ctx, const char *sanitized_name, const void *data, size_t size);
+
+/// archive offset of the next appended entry, offset in the tar stream also for a compressed archive
+unsigned tar_write_offset(const struct tar_ctx *ctx);
+
+/// position of the next appended entry, compressed archive ends its frame so the entry starts a new one
+int tar_write_position(struct tar_ctx *ctx, struct tar_position_s *position);
+
+/// the next appended entry is the mark of the session - its position is kept in the end record, see tar_read_mark
+/// session without a mark keeps the mark of the previous one
+int tar_write_mark(struct tar_ctx *ctx);
+
+/// position of the mark of the last writer session, ErrorTarEnd when the archive has none
+int tar_read_mark(const char *name, struct tar_position_s *position);
+
 /// append catalog to opened tar
 int tar_catalog(struct tar_ctx *ctx, const char *sanitized_name);
 
 /// overwrite file if exists
+/// md5 of unpacked data is calculated on the fly and stored in ctx->md5
 int un_tar_file(struct tar_ctx *ctx, mtar_header_t *header, const char *where);
 
+/// rebuild file from "<name>.delta" entry and installed source_dir/<name> to where/<name>, see delta.h
+/// header name is changed to <name>, md5 of the rebuilt file is stored in ctx->md5
+int un_tar_delta(struct tar_ctx *ctx, mtar_header_t *header, const char *source_dir, const char *where);
+
 /// create catalog if not exists
 int un_tar_catalog(struct tar_ctx *ctx, mtar_header_t *header, const char *where);
 
+/// read next entry header, not read data of the previous entry is skipped
+/// @return ErrorTarEnd on the archive trailer
+int tar_read_header(struct tar_ctx *ctx, mtar_header_t *header);
+
+/// get next chunk of the current entry data - points into the read ahead window
+/// and is valid until the next reader call, size is 0 when the whole entry was read
+int tar_read_data(struct tar_ctx *ctx, const void **data, size_t *size);
+
+/// skip the rest of the current entry
 int tar_next(struct tar_ctx *);
 
+/// md5 of the current entry data declared by a sector aligned package, NULL for tar archives
+const unsigned char *tar_entry_md5(const struct tar_ctx *ctx);
+
+/// build index of archive in a single header sweep, entry names are stored without leading ./
+/// destination callback returns destination below TAR_INDEX_DEST_MAX for the entry name, can be NULL
+int tar_index_build(struct tar_index_s *index, const char *name, unsigned char (*destination)(const char *name));
+
+void tar_index_free(struct tar_index_s *index);
+
+const char *tar_index_name(const struct tar_index_s *index, const struct tar_index_entry_s *entry);
+
+/// find entry by name (without leading ./), NULL if not found
+const struct tar_index_entry_s *tar_index_find(const struct tar_index_s *index, const char *name);
+
+/// identity of the archive layout - hash of the entry names, their count and size
+/// equal for archives with the same files, not proof of the same content - see content_id for that
+uint32_t tar_index_id(const struct tar_index_s *index);
+
+/// move reader to the entry - next tar_read_header returns it
+/// when hashing only forward, skipped data is read through and hashed
+/// compressed archive is decoded up to the entry, from its beginning when the entry is behind
+int tar_seek_entry(struct tar_ctx *ctx, const struct tar_index_entry_s *entry);
+
+/// move reader to the entry taken with tar_write_position - next tar_read_header returns it
+/// a compressed archive is decoded from the frame the entry starts, nothing before it is read
+int tar_seek_position(struct tar_ctx *ctx, const struct tar_position_s *position);
+
+/// read whole file entry of the archive into allocated zero terminated buffer, entries above max_size are refused
+/// caller frees *data
+int tar_read_entry(const char *name, const struct tar_index_entry_s *entry, size_t max_size, char **data);
+
+/// read the marked file entry (see tar_write_mark) like tar_read_entry, without reading the archive before it
+/// ErrorTarEnd when the archive has no mark or the marked entry isn't entry_name
+int tar_read_mark_entry(const char *name, const char *entry_name, size_t max_size, char **data);
+
+/// calculate sha256 of every archive byte read - has to be called right after tar_init in "r" mode
+/// skipped data is read through instead of seeking over it
+int tar_hash_enable(struct tar_ctx *ctx);
+
+/// hash the rest of the archive up to its end and return sha256 of the whole archive
+/// the archive can't be read any more afterwards
+int tar_hash_finish(struct tar_ctx *ctx, struct sha256_hash *hash);
+
 const char *tar_strerror(int err);
 
 const char *tar_strerror_ext(int err, int ext_err);
 
 #ifdef __cplusplus
-extern "C"
 }
 #endif
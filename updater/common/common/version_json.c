@@ -7,12 +7,10 @@
 
 #define UNUSED(expr) do { (void)(expr); } while (0)
 
-version_json_s json_get_version_struct(const char *json_path) {
-    cJSON *json = NULL;
+static version_json_s json_to_version_struct(cJSON *json) {
     version_json_s version_json;
     version_json.valid = true;
 
-    json = json_get(json_path);
     if (json == NULL) {
         goto exit;
     }
@@ -26,6 +24,14 @@ version_json_s json_get_version_struct(const char *json_path) {
     return version_json;
 }
 
+version_json_s json_get_version_struct(const char *json_path) {
+    return json_to_version_struct(json_get(json_path));
+}
+
+version_json_s json_get_version_struct_from_string(const char *json_str) {
+    return json_to_version_struct(json_parse(json_str));
+}
+
 version_json_file_s json_get_file_from_version(const version_json_s *version_json, const char *name) {
     version_json_file_s failure_return = {.valid = false};
 
@@ -49,10 +55,20 @@ version_json_s json_get_fallback() {
     return j;
 }
 
+static version_json_s json_get_current_version(const char *current_version) {
+    return path_check_if_exists(current_version) ? json_get_version_struct(current_version) : json_get_fallback();
+}
+
 verify_file_handle_s json_get_verify_files(const char *new_version, const char *current_version) {
     verify_file_handle_s verify_handle;
     verify_handle.version_json = json_get_version_struct(new_version);
-    verify_handle.current_version_json =
-            path_check_if_exists(current_version) ? json_get_version_struct(current_version) : json_get_fallback();
+    verify_handle.current_version_json = json_get_current_version(current_version);
+    return verify_handle;
+}
+
+verify_file_handle_s json_get_verify_files_from_string(const char *new_version_str, const char *current_version) {
+    verify_file_handle_s verify_handle;
+    verify_handle.version_json = json_get_version_struct_from_string(new_version_str);
+    verify_handle.current_version_json = json_get_current_version(current_version);
     return verify_handle;
 }
\ No newline at end of file
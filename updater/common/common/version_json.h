@@ -12,6 +12,9 @@ extern "C"
 
 version_json_s json_get_version_struct(const char *json_path);
 
+/// same as json_get_version_struct, for version.json content already in memory
+version_json_s json_get_version_struct_from_string(const char *json_str);
+
 version_json_file_s json_get_file_from_version(const version_json_s *version_json, const char *name);
 
 /// get version json for current file and for curent release in use
@@ -19,6 +22,9 @@ version_json_file_s json_get_file_from_version(const version_json_s *version_jso
 /// if any of values in return struct are set valid = false - user should fail procedure
 verify_file_handle_s json_get_verify_files(const char *new_version, const char *current_version);
 
+/// same as json_get_verify_files, new version.json content is already in memory - e.g. read from the package
+verify_file_handle_s json_get_verify_files_from_string(const char *new_version_str, const char *current_version);
+
 #ifdef __cplusplus
 }
 #endif
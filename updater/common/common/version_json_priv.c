@@ -45,7 +45,14 @@ cJSON *json_get(const char *json_path) {
         goto exit;
     }
 
-    ret = cJSON_Parse(buffer);
+    ret = json_parse(buffer);
+
+    exit:
+    return ret;
+}
+
+cJSON *json_parse(const char *json_str) {
+    cJSON *ret = cJSON_Parse(json_str);
 
     if (ret == NULL) {
         const char *err = cJSON_GetErrorPtr();
@@ -53,8 +60,6 @@ cJSON *json_get(const char *json_path) {
             debug_log("JSON: parsing failed: %s", err);
         }
     }
-
-    exit:
     return ret;
 }
 
@@ -9,6 +9,8 @@ extern "C"
 
 cJSON *json_get(const char *json_path);
 
+cJSON *json_parse(const char *json_str);
+
 cJSON *json_get_item_from(const cJSON *json, const char *name);
 
 version_json_file_s json_get_file_struct(const cJSON *json, const char *filename_arg);
@@ -1,7 +1,11 @@
 #include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "backup.h"
 #include "dir_walker.h"
 #include "priv_backup.h"
+#include "priv_restore.h"
 
 bool backup_previous_firmware(struct backup_handle_s *handle) {
     if (handle == NULL) {
@@ -13,13 +17,57 @@ bool backup_previous_firmware(struct backup_handle_s *handle) {
         return false;
     }
 
-    if (!backup_boot_partition(handle)) {
+    struct backup_session_s session;
+    const bool opened = handle->backup_store ? backup_session_open_store(&session, handle->backup_store)
+                                             : backup_session_open(&session, handle->backup_to);
+    if (!opened) {
         return false;
     }
 
-    if (!backup_user_data(handle)) {
+    bool success = handle->boot_in_slot || backup_boot_partition(handle, &session);
+    success = success && backup_user_data(handle, &session);
+
+    success = backup_session_close(&session, success);
+    /// archive of the previous backups is superseded by the store
+    if (success && handle->backup_store != NULL && unlink(handle->backup_to) == 0) {
+        debug_log("Backup: %s removed, backups are kept in %s", handle->backup_to, handle->backup_store);
+    }
+    return success;
+}
+
+bool backup_estimate_size(struct backup_handle_s *handle, unsigned long long *bytes) {
+    if (handle == NULL || bytes == NULL) {
+        debug_log("Backup: no handle");
         return false;
     }
 
+    if (!check_backup_entries(handle)) {
+        return false;
+    }
+
+    struct backup_manifest_s previous;
+    backup_manifest_init(&previous);
+    backup_session_previous(handle, &previous);
+    *bytes = (handle->boot_in_slot ? 0 : backup_boot_partition_size(handle, &previous)) +
+             backup_user_data_size(handle, &previous) + backup_session_size(handle);
+    backup_manifest_free(&previous);
     return true;
 }
+
+bool backup_restore_changed(struct backup_handle_s *handle, struct backup_restore_result_s *result) {
+    if (handle == NULL || result == NULL) {
+        debug_log("Backup: no handle");
+        return false;
+    }
+    memset(result, 0, sizeof *result);
+
+    if (!check_backup_entries(handle)) {
+        return false;
+    }
+
+    unsigned latest = 0;
+    if (handle->backup_store != NULL && backup_store_latest(handle->backup_store, &latest) == ErrorBackupStoreOk) {
+        return restore_store_changed(handle, result);
+    }
+    return restore_archive_changed(handle, result);
+}
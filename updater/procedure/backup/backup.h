@@ -6,6 +6,7 @@ extern "C"
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <common/log.h>
 
 enum backup_error_e {
@@ -19,11 +20,35 @@ enum backup_error_e {
 struct backup_handle_s {
     const char *backup_from_os;   /// os location we want to tar
     const char *backup_from_user; /// user location we want to tar
-    const char *backup_to;        /// tar file to put backup in
+    const char *backup_to;        /// tar file to put backup in, compressed when it ends with TAR_LZ4_EXTENSION
+    const char *backup_store;     /// chunk store catalog (see backup_store.h) used instead of backup_to, NULL for
+                                  /// none - backup_to is removed once a generation is stored
+    bool boot_in_slot;            /// previous os stays in its A/B slot, boot files aren't archived
 };
 
 bool backup_previous_firmware(struct backup_handle_s *handle);
 
+/// estimate how many bytes backup_previous_firmware will write, without writing anything
+/// uncompressed size - upper bound for a compressed archive
+bool backup_estimate_size(struct backup_handle_s *handle, unsigned long long *bytes);
+
+/// what backup_restore_changed did
+struct backup_restore_result_s {
+    size_t checked_files;  /// files of the backup index compared with the installed ones
+    size_t restored_files; /// missing or different files read from the backup
+    size_t restored_bytes;
+    unsigned generation;   /// store generation the files were restored from, 0 for backup_to
+};
+
+/// restore only the files which differ from the backup: every file of the latest generation of backup_store,
+/// or of the index of backup_to when the store has none, is compared with the installed one - size first,
+/// the digest for the same size - and a missing or different file is read straight from the backup,
+/// boot files go to backup_from_os, the rest to backup_from_user
+/// generation which can't be restored is followed by the older kept ones - they are the whole backup of the
+/// store, backup_to is removed once a generation is stored
+/// false when there is no index or a file can't be restored - full restore of backup_to is required then
+bool backup_restore_changed(struct backup_handle_s *handle, struct backup_restore_result_s *result);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,184 @@
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <common/log.h>
+#include "backup_manifest.h"
+
+#define BACKUP_MANIFEST_MD5_HEX_SIZE (2 * BACKUP_MANIFEST_MD5_SIZE)
+
+static int grow(void **array, size_t *capacity, size_t needed, size_t item) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+    size_t new_capacity = *capacity ? *capacity : 16;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    void *tmp = realloc(*array, new_capacity * item);
+    if (tmp == NULL) {
+        return -1;
+    }
+    *array = tmp;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    return -1;
+}
+
+void backup_manifest_init(struct backup_manifest_s *manifest) {
+    memset(manifest, 0, sizeof *manifest);
+}
+
+void backup_manifest_free(struct backup_manifest_s *manifest) {
+    free(manifest->entries);
+    free(manifest->names);
+    backup_manifest_init(manifest);
+}
+
+int backup_manifest_add(struct backup_manifest_s *manifest,
+                        const char *name,
+                        const struct tar_position_s *position,
+                        uint32_t size,
+                        uint32_t mtime,
+                        const unsigned char md5[BACKUP_MANIFEST_MD5_SIZE]) {
+    if (name[0] == '.' && name[1] == '/') {
+        name += 2;
+    }
+    const size_t name_len = strlen(name) + 1;
+    if (grow((void **) &manifest->entries, &manifest->capacity, manifest->count + 1,
+             sizeof(struct backup_manifest_entry_s)) ||
+        grow((void **) &manifest->names, &manifest->names_capacity, manifest->names_size + name_len, 1)) {
+        debug_log("Backup manifest: unable to grow to %d entries", manifest->count + 1);
+        return -ENOMEM;
+    }
+    struct backup_manifest_entry_s *entry = &manifest->entries[manifest->count];
+    entry->name = manifest->names_size;
+    entry->position = *position;
+    entry->size = size;
+    entry->mtime = mtime;
+    memcpy(entry->md5, md5, BACKUP_MANIFEST_MD5_SIZE);
+    memcpy(manifest->names + manifest->names_size, name, name_len);
+    manifest->names_size += name_len;
+    manifest->count++;
+    return 0;
+}
+
+/// "<md5 hex> <offset> <file offset> <size> <mtime> <name>", false for anything else
+static bool parse_line(char *line, unsigned char md5[BACKUP_MANIFEST_MD5_SIZE], struct tar_position_s *position,
+                       unsigned *size, unsigned *mtime, char **name) {
+    int name_at = 0;
+    if (strlen(line) <= BACKUP_MANIFEST_MD5_HEX_SIZE || line[BACKUP_MANIFEST_MD5_HEX_SIZE] != ' ' ||
+        sscanf(line + BACKUP_MANIFEST_MD5_HEX_SIZE, " %u %u %u %u %n", &position->offset, &position->file_offset,
+               size, mtime, &name_at) != 4 ||
+        line[BACKUP_MANIFEST_MD5_HEX_SIZE + name_at] == '\0') {
+        return false;
+    }
+    for (size_t i = 0; i < BACKUP_MANIFEST_MD5_SIZE; ++i) {
+        const int hi = hex_value(line[2 * i]);
+        const int lo = hex_value(line[2 * i + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        md5[i] = (unsigned char) ((hi << 4) | lo);
+    }
+    *name = line + BACKUP_MANIFEST_MD5_HEX_SIZE + name_at;
+    return true;
+}
+
+int backup_manifest_parse(struct backup_manifest_s *manifest, char *text) {
+    int ret = 0;
+    char *line = text;
+    while (ret == 0 && line != NULL && *line != '\0') {
+        char *next = strchr(line, '\n');
+        if (next != NULL) {
+            *next++ = '\0';
+        }
+        line[strcspn(line, "\r")] = '\0';
+        unsigned char md5[BACKUP_MANIFEST_MD5_SIZE];
+        struct tar_position_s position;
+        unsigned size, mtime;
+        char *name = NULL;
+        if (parse_line(line, md5, &position, &size, &mtime, &name)) {
+            ret = backup_manifest_add(manifest, name, &position, size, mtime, md5);
+        }
+        line = next;
+    }
+    return ret;
+}
+
+size_t backup_manifest_line_size(const char *name) {
+    /// md5, 4 numbers of at most 10 digits, separators and new line
+    return BACKUP_MANIFEST_MD5_HEX_SIZE + 4 * 11 + 2 + strlen(name);
+}
+
+int backup_manifest_format(const struct backup_manifest_s *manifest, char **text, size_t *size) {
+    size_t capacity = 1;
+    for (size_t i = 0; i < manifest->count; ++i) {
+        capacity += backup_manifest_line_size(manifest->names + manifest->entries[i].name);
+    }
+    char *buffer = malloc(capacity);
+    if (buffer == NULL) {
+        return -ENOMEM;
+    }
+    size_t used = 0;
+    for (size_t i = 0; i < manifest->count; ++i) {
+        const struct backup_manifest_entry_s *entry = &manifest->entries[i];
+        for (size_t j = 0; j < BACKUP_MANIFEST_MD5_SIZE; ++j) {
+            used += sprintf(buffer + used, "%02x", entry->md5[j]);
+        }
+        used += sprintf(buffer + used, " %u %u %u %u %s\n", entry->position.offset, entry->position.file_offset,
+                        (unsigned) entry->size, (unsigned) entry->mtime, manifest->names + entry->name);
+    }
+    buffer[used] = '\0';
+    *text = buffer;
+    *size = used;
+    return 0;
+}
+
+int backup_manifest_read(struct backup_manifest_s *manifest, const char *archive) {
+    char *text = NULL;
+    int ret = tar_read_mark_entry(archive, BACKUP_INDEX_NAME, BACKUP_INDEX_MAX_SIZE, &text);
+    if (ret == ErrorTarEnd) {
+        debug_log("Backup manifest: no index in %s", archive);
+        return 0;
+    }
+    if (ret != ErrorTarOk) {
+        debug_log("Backup manifest: unable to read index of %s: %s", archive, tar_strerror(ret));
+        return -EIO;
+    }
+    ret = backup_manifest_parse(manifest, text);
+    free(text);
+    return ret;
+}
+
+const struct backup_manifest_entry_s *backup_manifest_find(const struct backup_manifest_s *manifest,
+                                                           const char *name) {
+    if (name[0] == '.' && name[1] == '/') {
+        name += 2;
+    }
+    /// a few user files - no sorting
+    for (size_t i = 0; i < manifest->count; ++i) {
+        if (strcmp(manifest->names + manifest->entries[i].name, name) == 0) {
+            return &manifest->entries[i];
+        }
+    }
+    return NULL;
+}
+
+const char *backup_manifest_name(const struct backup_manifest_s *manifest,
+                                 const struct backup_manifest_entry_s *entry) {
+    return manifest->names + entry->name;
+}
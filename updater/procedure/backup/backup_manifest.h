@@ -0,0 +1,73 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdint.h>
+#include <stddef.h>
+#include <common/tar.h>
+
+/// index of the append only backup archive: where the last entry of every backed up file is
+/// and what it was backed up from - file with the same size and mtime isn't appended again
+/// it's the last entry of every backup session, marked (see tar_write_mark) so it's found without reading
+/// the archive, one line per file: "<md5 hex> <entry offset> <entry file offset> <size> <mtime> <name>"
+
+#define BACKUP_INDEX_NAME "backup.index"
+/// index of a few hundred files, anything bigger isn't an index
+#define BACKUP_INDEX_MAX_SIZE (256 * 1024)
+#define BACKUP_MANIFEST_MD5_SIZE 16
+
+struct backup_manifest_entry_s {
+    unsigned name;     /// offset of the name in the string pool
+    struct tar_position_s position; /// where the entry header is, see tar_seek_position
+    uint32_t size;     /// size of the file and of the entry data
+    uint32_t mtime;    /// modification time of the backed up file
+    unsigned char md5[BACKUP_MANIFEST_MD5_SIZE]; /// md5 of the entry data
+};
+
+/// contiguous entries array and a string pool like tar_index_s
+struct backup_manifest_s {
+    struct backup_manifest_entry_s *entries;
+    size_t count;
+    size_t capacity;
+    char *names;
+    size_t names_size;
+    size_t names_capacity;
+};
+
+void backup_manifest_init(struct backup_manifest_s *manifest);
+
+void backup_manifest_free(struct backup_manifest_s *manifest);
+
+/// add entry, name is stored without leading ./
+int backup_manifest_add(struct backup_manifest_s *manifest,
+                        const char *name,
+                        const struct tar_position_s *position,
+                        uint32_t size,
+                        uint32_t mtime,
+                        const unsigned char md5[BACKUP_MANIFEST_MD5_SIZE]);
+
+/// add entries from the index text, invalid lines are ignored, text is modified
+int backup_manifest_parse(struct backup_manifest_s *manifest, char *text);
+
+/// index text of the manifest, caller frees *text
+int backup_manifest_format(const struct backup_manifest_s *manifest, char **text, size_t *size);
+
+/// bytes the line of the file takes in the index text, at most
+size_t backup_manifest_line_size(const char *name);
+
+/// load the index of the archive - archive without one gives empty manifest
+int backup_manifest_read(struct backup_manifest_s *manifest, const char *archive);
+
+/// entry of the file, NULL if not in manifest
+const struct backup_manifest_entry_s *backup_manifest_find(const struct backup_manifest_s *manifest,
+                                                           const char *name);
+
+const char *backup_manifest_name(const struct backup_manifest_s *manifest,
+                                 const struct backup_manifest_entry_s *entry);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,567 @@
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <common/log.h>
+#include "backup_store.h"
+
+#define HASH_HEX_SIZE (2 * sizeof(((struct sha256_hash *) 0)->value))
+/// chunks/<2 hex>/<62 hex>
+#define CHUNK_DIR_HEX 2
+
+static int grow(void **array, size_t *capacity, size_t needed, size_t item) {
+    if (needed <= *capacity) {
+        return 0;
+    }
+    size_t new_capacity = *capacity ? *capacity : 16;
+    while (new_capacity < needed) {
+        new_capacity *= 2;
+    }
+    void *tmp = realloc(*array, new_capacity * item);
+    if (tmp == NULL) {
+        return -1;
+    }
+    *array = tmp;
+    *capacity = new_capacity;
+    return 0;
+}
+
+static int hex_value(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+static void hash_hex(const struct sha256_hash *hash, char hex[HASH_HEX_SIZE + 1]) {
+    for (size_t i = 0; i < sizeof hash->value; ++i) {
+        sprintf(hex + 2 * i, "%02x", hash->value[i]);
+    }
+}
+
+/// exactly count hex digits, lower case like hash_hex writes them
+static bool hex_parse(const char *hex, size_t count, uint8_t *out) {
+    for (size_t i = 0; i < count; i += 2) {
+        const int hi = hex_value(hex[i]);
+        const int lo = hex_value(hex[i + 1]);
+        if (hi < 0 || lo < 0) {
+            return false;
+        }
+        out[i / 2] = (uint8_t) ((hi << 4) | lo);
+    }
+    return hex[count] == '\0';
+}
+
+static int make_dir(const char *path) {
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        debug_log("Backup store: unable to create %s: %d", path, errno);
+        return ErrorBackupStoreIo;
+    }
+    return ErrorBackupStoreOk;
+}
+
+/// <store>/<catalog>, caller frees
+static char *store_path(const char *store, const char *catalog) {
+    char *path = malloc(strlen(store) + strlen(catalog) + 2);
+    if (path != NULL) {
+        sprintf(path, "%s/%s", store, catalog);
+    }
+    return path;
+}
+
+/// <store>/chunks/<2 hex>[/<62 hex>], caller frees
+static char *chunk_path(const char *store, const struct sha256_hash *hash, bool dir_only) {
+    char hex[HASH_HEX_SIZE + 1];
+    hash_hex(hash, hex);
+    char *path = malloc(strlen(store) + sizeof BACKUP_STORE_CHUNKS + HASH_HEX_SIZE + 4);
+    if (path != NULL && dir_only) {
+        sprintf(path, "%s/%s/%.*s", store, BACKUP_STORE_CHUNKS, CHUNK_DIR_HEX, hex);
+    } else if (path != NULL) {
+        sprintf(path, "%s/%s/%.*s/%s", store, BACKUP_STORE_CHUNKS, CHUNK_DIR_HEX, hex, hex + CHUNK_DIR_HEX);
+    }
+    return path;
+}
+
+/// <store>/generations/<number>.gen[.tmp], caller frees
+static char *generation_path(const char *store, unsigned number, bool tmp) {
+    char *path = malloc(strlen(store) + sizeof BACKUP_STORE_GENERATION_LIST + sizeof BACKUP_STORE_GENERATION_EXTENSION +
+                        sizeof ".tmp" + 12);
+    if (path != NULL) {
+        sprintf(path, "%s/%s/%u%s%s", store, BACKUP_STORE_GENERATION_LIST, number, BACKUP_STORE_GENERATION_EXTENSION,
+                tmp ? ".tmp" : "");
+    }
+    return path;
+}
+
+/// number of the generation list file name, false for anything else
+static bool generation_number(const char *file_name, unsigned *number) {
+    char *end = NULL;
+    const unsigned long value = strtoul(file_name, &end, 10);
+    if (end == file_name || strcmp(end, BACKUP_STORE_GENERATION_EXTENSION) != 0 || value == 0 || value > UINT32_MAX) {
+        return false;
+    }
+    *number = (unsigned) value;
+    return true;
+}
+
+void backup_store_generation_init(struct backup_store_generation_s *generation) {
+    memset(generation, 0, sizeof *generation);
+}
+
+void backup_store_generation_free(struct backup_store_generation_s *generation) {
+    free(generation->files);
+    free(generation->chunks);
+    free(generation->names);
+    backup_store_generation_init(generation);
+}
+
+static int add_file(struct backup_store_generation_s *generation, const char *name, uint32_t size, uint32_t mtime) {
+    if (name[0] == '.' && name[1] == '/') {
+        name += 2;
+    }
+    const size_t name_len = strlen(name) + 1;
+    if (grow((void **) &generation->files, &generation->capacity, generation->count + 1,
+             sizeof(struct backup_store_file_s)) ||
+        grow((void **) &generation->names, &generation->names_capacity, generation->names_size + name_len, 1)) {
+        return ErrorBackupStoreMemory;
+    }
+    struct backup_store_file_s *file = &generation->files[generation->count++];
+    file->name = generation->names_size;
+    file->size = size;
+    file->mtime = mtime;
+    file->chunk = generation->chunk_count;
+    file->chunk_count = 0;
+    memcpy(generation->names + generation->names_size, name, name_len);
+    generation->names_size += name_len;
+    return ErrorBackupStoreOk;
+}
+
+/// chunk of the last added file
+static int add_chunk(struct backup_store_generation_s *generation, const struct sha256_hash *hash) {
+    if (grow((void **) &generation->chunks, &generation->chunk_capacity, generation->chunk_count + 1,
+             sizeof(struct sha256_hash))) {
+        return ErrorBackupStoreMemory;
+    }
+    generation->chunks[generation->chunk_count++] = *hash;
+    generation->files[generation->count - 1].chunk_count++;
+    return ErrorBackupStoreOk;
+}
+
+int backup_store_latest(const char *store, unsigned *number) {
+    char *path = store_path(store, BACKUP_STORE_GENERATION_LIST);
+    DIR *dir = path ? opendir(path) : NULL;
+    free(path);
+    if (dir == NULL) {
+        return ErrorBackupStoreEmpty;
+    }
+    *number = 0;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        unsigned found;
+        if (generation_number(entry->d_name, &found) && found > *number) {
+            *number = found;
+        }
+    }
+    closedir(dir);
+    return *number ? ErrorBackupStoreOk : ErrorBackupStoreEmpty;
+}
+
+/// generation list is appended to generation - generations loaded one after another give all their chunks
+int backup_store_generation_load(const char *store, unsigned number, struct backup_store_generation_s *generation) {
+    char *path = generation_path(store, number, false);
+    FILE *file = path ? fopen(path, "r") : NULL;
+    if (file == NULL) {
+        debug_log("Backup store: unable to open generation %u", number);
+        free(path);
+        return ErrorBackupStoreIo;
+    }
+    int ret = ErrorBackupStoreOk;
+    size_t expected = 0; /// chunk lines of the last file still to be read
+    char line[320];
+    while (ret == ErrorBackupStoreOk && fgets(line, sizeof line, file) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (expected > 0) {
+            struct sha256_hash hash;
+            ret = hex_parse(line, HASH_HEX_SIZE, hash.value) ? add_chunk(generation, &hash) : ErrorBackupStoreFormat;
+            --expected;
+            continue;
+        }
+        unsigned size, mtime, chunks;
+        int name_at = 0;
+        if (sscanf(line, "%u %u %u %n", &size, &mtime, &chunks, &name_at) != 3 || line[name_at] == '\0' ||
+            chunks != (size + BACKUP_STORE_CHUNK_SIZE - 1) / BACKUP_STORE_CHUNK_SIZE) {
+            ret = ErrorBackupStoreFormat;
+            break;
+        }
+        ret = add_file(generation, line + name_at, size, mtime);
+        expected = chunks;
+    }
+    if (ret == ErrorBackupStoreOk && (ferror(file) || expected > 0)) {
+        ret = ferror(file) ? ErrorBackupStoreIo : ErrorBackupStoreFormat;
+    }
+    fclose(file);
+    if (ret != ErrorBackupStoreOk) {
+        debug_log("Backup store: unable to load %s: %s", path, backup_store_strerror(ret));
+    }
+    generation->number = number;
+    free(path);
+    return ret;
+}
+
+const struct backup_store_file_s *backup_store_find(const struct backup_store_generation_s *generation,
+                                                    const char *name) {
+    if (name[0] == '.' && name[1] == '/') {
+        name += 2;
+    }
+    /// a few files - no sorting
+    for (size_t i = 0; i < generation->count; ++i) {
+        if (strcmp(generation->names + generation->files[i].name, name) == 0) {
+            return &generation->files[i];
+        }
+    }
+    return NULL;
+}
+
+const char *backup_store_name(const struct backup_store_generation_s *generation,
+                              const struct backup_store_file_s *file) {
+    return generation->names + file->name;
+}
+
+int backup_store_open(struct backup_store_writer_s *writer, const char *store) {
+    memset(writer, 0, sizeof *writer);
+    backup_store_generation_init(&writer->previous);
+    backup_store_generation_init(&writer->generation);
+    writer->store = strdup(store);
+    writer->buffer = malloc(BACKUP_STORE_CHUNK_SIZE);
+    if (writer->store == NULL || writer->buffer == NULL) {
+        return ErrorBackupStoreMemory;
+    }
+    char *chunks = store_path(store, BACKUP_STORE_CHUNKS);
+    char *generations = store_path(store, BACKUP_STORE_GENERATION_LIST);
+    int ret = chunks && generations ? ErrorBackupStoreOk : ErrorBackupStoreMemory;
+    if (ret == ErrorBackupStoreOk) {
+        ret = make_dir(store);
+    }
+    if (ret == ErrorBackupStoreOk) {
+        ret = make_dir(chunks);
+    }
+    if (ret == ErrorBackupStoreOk) {
+        ret = make_dir(generations);
+    }
+    free(chunks);
+    free(generations);
+    if (ret != ErrorBackupStoreOk) {
+        return ret;
+    }
+
+    unsigned latest = 0;
+    if (backup_store_latest(store, &latest) == ErrorBackupStoreOk &&
+        backup_store_generation_load(store, latest, &writer->previous) != ErrorBackupStoreOk) {
+        debug_log("Backup store: generation %u unreadable, all files are stored", latest);
+        backup_store_generation_free(&writer->previous);
+    }
+    writer->generation.number = latest + 1;
+    debug_log("Backup store: writing generation %u to %s", writer->generation.number, store);
+    return ErrorBackupStoreOk;
+}
+
+/// write the chunk unless the store has it
+static int chunk_write(struct backup_store_writer_s *writer, const struct sha256_hash *hash, size_t size) {
+    char *path = chunk_path(writer->store, hash, false);
+    char *dir = chunk_path(writer->store, hash, true);
+    char *tmp = path ? malloc(strlen(path) + sizeof ".tmp") : NULL;
+    struct stat st;
+    int ret = tmp && dir ? ErrorBackupStoreOk : ErrorBackupStoreMemory;
+    if (ret == ErrorBackupStoreOk && stat(path, &st) == 0 && (size_t) st.st_size == size) {
+        goto exit;
+    }
+    if (ret == ErrorBackupStoreOk) {
+        ret = make_dir(dir);
+    }
+    if (ret == ErrorBackupStoreOk) {
+        sprintf(tmp, "%s.tmp", path);
+        FILE *file = fopen(tmp, "wb");
+        const bool written = file != NULL && fwrite(writer->buffer, 1, size, file) == size;
+        if (file == NULL || fclose(file) != 0 || !written || rename(tmp, path) != 0) {
+            debug_log("Backup store: unable to write chunk %s: %d", path, errno);
+            unlink(tmp);
+            ret = ErrorBackupStoreIo;
+        }
+    }
+    if (ret == ErrorBackupStoreOk) {
+        writer->written_chunks++;
+        writer->written_bytes += size;
+    }
+
+    exit:
+    free(tmp);
+    free(dir);
+    free(path);
+    return ret;
+}
+
+int backup_store_file(struct backup_store_writer_s *writer, const char *path, const char *name) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        debug_log("Backup store: ignored non existing file: %s", path);
+        return ErrorBackupStoreOk;
+    }
+    /// file system without mtime (0) gets every file read
+    const struct backup_store_file_s *previous = backup_store_find(&writer->previous, name);
+    if (previous != NULL && st.st_mtime != 0 && previous->size == (uint32_t) st.st_size &&
+        previous->mtime == (uint32_t) st.st_mtime) {
+        debug_log("Backup store: %s not changed since generation %u", name, writer->previous.number);
+        int ret = add_file(&writer->generation, name, previous->size, previous->mtime);
+        for (size_t i = 0; ret == ErrorBackupStoreOk && i < previous->chunk_count; ++i) {
+            ret = add_chunk(&writer->generation, &writer->previous.chunks[previous->chunk + i]);
+        }
+        return ret;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        debug_log("Backup store: unable to open %s: %d", path, errno);
+        return ErrorBackupStoreIo;
+    }
+    int ret = add_file(&writer->generation, name, st.st_size, st.st_mtime);
+    size_t total = 0;
+    size_t size = 0;
+    while (ret == ErrorBackupStoreOk && (size = fread(writer->buffer, 1, BACKUP_STORE_CHUNK_SIZE, file)) > 0) {
+        struct sha256_hash hash;
+        ret = sha256_mem(writer->buffer, size, &hash) == 0 ? ErrorBackupStoreOk : ErrorBackupStoreIo;
+        if (ret == ErrorBackupStoreOk) {
+            ret = chunk_write(writer, &hash, size);
+        }
+        if (ret == ErrorBackupStoreOk) {
+            ret = add_chunk(&writer->generation, &hash);
+        }
+        total += size;
+    }
+    /// file written meanwhile - its chunks aren't the size it was stored with
+    if (ret == ErrorBackupStoreOk && (ferror(file) || total != (size_t) st.st_size)) {
+        debug_log("Backup store: %s changed while stored", path);
+        ret = ErrorBackupStoreIo;
+    }
+    fclose(file);
+    return ret;
+}
+
+static int generation_write(const struct backup_store_writer_s *writer) {
+    const struct backup_store_generation_s *generation = &writer->generation;
+    char *tmp = generation_path(writer->store, generation->number, true);
+    char *path = generation_path(writer->store, generation->number, false);
+    FILE *file = tmp ? fopen(tmp, "w") : NULL;
+    int ret = file ? ErrorBackupStoreOk : ErrorBackupStoreIo;
+    for (size_t i = 0; ret == ErrorBackupStoreOk && i < generation->count; ++i) {
+        const struct backup_store_file_s *entry = &generation->files[i];
+        if (fprintf(file, "%u %u %u %s\n", (unsigned) entry->size, (unsigned) entry->mtime,
+                    (unsigned) entry->chunk_count, generation->names + entry->name) < 0) {
+            ret = ErrorBackupStoreIo;
+        }
+        for (size_t j = 0; ret == ErrorBackupStoreOk && j < entry->chunk_count; ++j) {
+            char hex[HASH_HEX_SIZE + 1];
+            hash_hex(&generation->chunks[entry->chunk + j], hex);
+            ret = fprintf(file, "%s\n", hex) < 0 ? ErrorBackupStoreIo : ErrorBackupStoreOk;
+        }
+    }
+    if (file != NULL && fclose(file) != 0) {
+        ret = ErrorBackupStoreIo;
+    }
+    if (ret == ErrorBackupStoreOk && rename(tmp, path) != 0) {
+        ret = ErrorBackupStoreIo;
+    }
+    if (ret != ErrorBackupStoreOk && tmp != NULL) {
+        debug_log("Backup store: unable to write %s", path);
+        unlink(tmp);
+    }
+    free(tmp);
+    free(path);
+    return ret;
+}
+
+static int hash_compare(const void *lhs, const void *rhs) {
+    return memcmp(lhs, rhs, sizeof(struct sha256_hash));
+}
+
+/// remove generations older than the kept ones, chunks of all kept generations are loaded into referenced
+static int generations_prune(const struct backup_store_writer_s *writer, struct backup_store_generation_s *referenced) {
+    char *list = store_path(writer->store, BACKUP_STORE_GENERATION_LIST);
+    DIR *dir = list ? opendir(list) : NULL;
+    if (dir == NULL) {
+        free(list);
+        return ErrorBackupStoreIo;
+    }
+    const unsigned newest = writer->generation.number;
+    int ret = ErrorBackupStoreOk;
+    struct dirent *entry;
+    while (ret == ErrorBackupStoreOk && (entry = readdir(dir)) != NULL) {
+        unsigned number;
+        const bool is_generation = generation_number(entry->d_name, &number);
+        if (is_generation && number + BACKUP_STORE_GENERATIONS > newest) {
+            ret = backup_store_generation_load(writer->store, number, referenced);
+            continue;
+        }
+        /// generations past the limit, lists of interrupted commits
+        const size_t len = strlen(entry->d_name);
+        if (is_generation || (len > 4 && strcmp(entry->d_name + len - 4, ".tmp") == 0)) {
+            char *path = store_path(list, entry->d_name);
+            if (path != NULL && unlink(path) == 0) {
+                debug_log("Backup store: removed %s", entry->d_name);
+            }
+            free(path);
+        }
+    }
+    closedir(dir);
+    free(list);
+    return ret;
+}
+
+/// remove chunks not referenced by any kept generation, chunks left by an interrupted backup with them
+static void chunks_sweep(const char *store, const struct backup_store_generation_s *referenced) {
+    char *chunks = store_path(store, BACKUP_STORE_CHUNKS);
+    DIR *dir = chunks ? opendir(chunks) : NULL;
+    size_t removed = 0;
+    struct dirent *sub;
+    while (dir != NULL && (sub = readdir(dir)) != NULL) {
+        if (strlen(sub->d_name) != CHUNK_DIR_HEX) {
+            continue;
+        }
+        char *sub_path = store_path(chunks, sub->d_name);
+        DIR *sub_dir = sub_path ? opendir(sub_path) : NULL;
+        struct dirent *entry;
+        while (sub_dir != NULL && (entry = readdir(sub_dir)) != NULL) {
+            char hex[HASH_HEX_SIZE + 1];
+            struct sha256_hash hash;
+            const size_t len = strlen(entry->d_name);
+            /// chunks and their tmp files, nothing else
+            if (entry->d_name[0] == '.' || len > HASH_HEX_SIZE - CHUNK_DIR_HEX + 4) {
+                continue;
+            }
+            bool chunk = len == HASH_HEX_SIZE - CHUNK_DIR_HEX;
+            if (chunk) {
+                memcpy(hex, sub->d_name, CHUNK_DIR_HEX);
+                memcpy(hex + CHUNK_DIR_HEX, entry->d_name, len + 1);
+                chunk = hex_parse(hex, HASH_HEX_SIZE, hash.value);
+            }
+            if (chunk && bsearch(&hash, referenced->chunks, referenced->chunk_count, sizeof(struct sha256_hash),
+                                 hash_compare) != NULL) {
+                continue;
+            }
+            char *path = store_path(sub_path, entry->d_name);
+            if (path != NULL && unlink(path) == 0) {
+                ++removed;
+            }
+            free(path);
+        }
+        if (sub_dir != NULL) {
+            closedir(sub_dir);
+        }
+        free(sub_path);
+    }
+    if (dir != NULL) {
+        closedir(dir);
+    }
+    free(chunks);
+    debug_log("Backup store: %u unreferenced chunks removed", removed);
+}
+
+int backup_store_commit(struct backup_store_writer_s *writer) {
+    int ret = generation_write(writer);
+    if (ret != ErrorBackupStoreOk) {
+        return ret;
+    }
+    debug_log("Backup store: generation %u: %u files, %u new chunks (%u kB)", writer->generation.number,
+              writer->generation.count, writer->written_chunks, writer->written_bytes / 1024);
+
+    /// the generation is stored - failed cleanup only leaves more on the storage than needed
+    struct backup_store_generation_s referenced;
+    backup_store_generation_init(&referenced);
+    if (generations_prune(writer, &referenced) == ErrorBackupStoreOk) {
+        qsort(referenced.chunks, referenced.chunk_count, sizeof(struct sha256_hash), hash_compare);
+        chunks_sweep(writer->store, &referenced);
+    } else {
+        debug_log("Backup store: kept generations unreadable, no chunk is removed");
+    }
+    backup_store_generation_free(&referenced);
+    return ErrorBackupStoreOk;
+}
+
+void backup_store_close(struct backup_store_writer_s *writer) {
+    backup_store_generation_free(&writer->previous);
+    backup_store_generation_free(&writer->generation);
+    free(writer->buffer);
+    free(writer->store);
+    writer->buffer = NULL;
+    writer->store = NULL;
+}
+
+unsigned long long backup_store_file_bytes(const char *name, uint32_t size) {
+    const unsigned long long chunks = (size + BACKUP_STORE_CHUNK_SIZE - 1) / BACKUP_STORE_CHUNK_SIZE;
+    /// data, its chunk lines and the file line of the generation list
+    return size + chunks * (HASH_HEX_SIZE + 1) + 3 * 11 + strlen(name) + 1;
+}
+
+int backup_store_chunk_read(const char *store, const struct sha256_hash *hash, void *buffer, size_t *size) {
+    char *path = chunk_path(store, hash, false);
+    FILE *file = path ? fopen(path, "rb") : NULL;
+    free(path);
+    if (file == NULL) {
+        return ErrorBackupStoreChunk;
+    }
+    *size = fread(buffer, 1, BACKUP_STORE_CHUNK_SIZE, file);
+    const bool read_whole = !ferror(file) && fgetc(file) == EOF;
+    fclose(file);
+    struct sha256_hash read_hash;
+    if (!read_whole || sha256_mem(buffer, *size, &read_hash) != 0 ||
+        memcmp(read_hash.value, hash->value, sizeof hash->value) != 0) {
+        return ErrorBackupStoreChunk;
+    }
+    return ErrorBackupStoreOk;
+}
+
+bool backup_store_file_matches(const char *path,
+                               const struct backup_store_generation_s *generation,
+                               const struct backup_store_file_s *file,
+                               void *buffer) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || (uint32_t) st.st_size != file->size) {
+        return false;
+    }
+    FILE *installed = fopen(path, "rb");
+    if (installed == NULL) {
+        return false;
+    }
+    bool same = true;
+    for (size_t i = 0; same && i < file->chunk_count; ++i) {
+        struct sha256_hash hash;
+        const size_t size = fread(buffer, 1, BACKUP_STORE_CHUNK_SIZE, installed);
+        same = size > 0 && sha256_mem(buffer, size, &hash) == 0 &&
+               memcmp(hash.value, generation->chunks[file->chunk + i].value, sizeof hash.value) == 0;
+    }
+    fclose(installed);
+    return same;
+}
+
+const char *backup_store_strerror(int err) {
+    switch (err) {
+        case ErrorBackupStoreOk:
+            return "ErrorBackupStoreOk";
+        case ErrorBackupStoreIo:
+            return "ErrorBackupStoreIo";
+        case ErrorBackupStoreMemory:
+            return "ErrorBackupStoreMemory";
+        case ErrorBackupStoreFormat:
+            return "ErrorBackupStoreFormat";
+        case ErrorBackupStoreEmpty:
+            return "ErrorBackupStoreEmpty";
+        case ErrorBackupStoreChunk:
+            return "ErrorBackupStoreChunk";
+    }
+    return "";
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <hal/hwcrypt/sha256.h>
+
+/// content addressed backup store: file contents are split into BACKUP_STORE_CHUNK_SIZE chunks, every chunk
+/// is kept once in <store>/chunks/<first 2 hex digits>/<rest of sha256 hex>, no matter how many files and
+/// generations have it
+/// every backup is a generation - <store>/generations/<number>.gen lists the files and their chunks:
+///   "<size> <mtime> <chunk count> <name>" followed by a line with sha256 hex of every chunk
+/// a chunk already in the store isn't written again, a file with the size and mtime it had in the previous
+/// generation isn't even read - a backup writes what changed since the last one
+/// the generation list is written last, next to the previous ones: interrupted backup leaves the previous
+/// generations as they were, its chunks are removed by the next commit
+/// fixed size chunks fit the databases - sqlite changes whole pages in place
+
+#define BACKUP_STORE_CHUNK_SIZE (64 * 1024)
+/// generations kept, older ones and chunks only they have are removed by the commit of a new one
+#define BACKUP_STORE_GENERATIONS 3
+#define BACKUP_STORE_CHUNKS "chunks"
+#define BACKUP_STORE_GENERATION_LIST "generations"
+#define BACKUP_STORE_GENERATION_EXTENSION ".gen"
+
+enum backup_store_error_e {
+    ErrorBackupStoreOk,
+    ErrorBackupStoreIo,
+    ErrorBackupStoreMemory,
+    ErrorBackupStoreFormat,   /// generation list can't be parsed
+    ErrorBackupStoreEmpty,    /// store has no generation
+    ErrorBackupStoreChunk,    /// chunk is missing or doesn't match its hash
+};
+
+struct backup_store_file_s {
+    unsigned name;      /// offset of the name in the string pool
+    uint32_t size;
+    uint32_t mtime;     /// modification time of the backed up file
+    size_t chunk;       /// first chunk of the file in the chunks array
+    size_t chunk_count;
+};
+
+/// files of a generation, chunks of all the files in one array and a string pool like tar_index_s
+struct backup_store_generation_s {
+    unsigned number;
+    struct backup_store_file_s *files;
+    size_t count;
+    size_t capacity;
+    struct sha256_hash *chunks;
+    size_t chunk_count;
+    size_t chunk_capacity;
+    char *names;
+    size_t names_size;
+    size_t names_capacity;
+};
+
+/// new generation being written
+struct backup_store_writer_s {
+    char *store;
+    struct backup_store_generation_s previous;   /// latest generation when the writer was opened, empty for none
+    struct backup_store_generation_s generation;
+    void *buffer;                                /// one chunk
+    size_t written_chunks;                       /// chunks the store didn't have
+    size_t written_bytes;
+};
+
+void backup_store_generation_init(struct backup_store_generation_s *generation);
+
+void backup_store_generation_free(struct backup_store_generation_s *generation);
+
+/// number of the latest generation, ErrorBackupStoreEmpty for none
+int backup_store_latest(const char *store, unsigned *number);
+
+int backup_store_generation_load(const char *store, unsigned number, struct backup_store_generation_s *generation);
+
+/// file of the generation, NULL if it's not there
+const struct backup_store_file_s *backup_store_find(const struct backup_store_generation_s *generation,
+                                                    const char *name);
+
+const char *backup_store_name(const struct backup_store_generation_s *generation,
+                              const struct backup_store_file_s *file);
+
+/// start a generation following the latest one, store catalogs are created
+int backup_store_open(struct backup_store_writer_s *writer, const char *store);
+
+/// add the file as name to the generation, not existing file is ignored
+int backup_store_file(struct backup_store_writer_s *writer, const char *path, const char *name);
+
+/// write the generation list, remove the generations past BACKUP_STORE_GENERATIONS and the chunks no kept
+/// generation has
+int backup_store_commit(struct backup_store_writer_s *writer);
+
+/// free the writer, generation not committed is dropped
+void backup_store_close(struct backup_store_writer_s *writer);
+
+/// bytes the changed file of that size takes in the store at most
+unsigned long long backup_store_file_bytes(const char *name, uint32_t size);
+
+/// read the chunk into buffer of BACKUP_STORE_CHUNK_SIZE, ErrorBackupStoreChunk when it's missing or its data
+/// doesn't match the hash
+int backup_store_chunk_read(const char *store, const struct sha256_hash *hash, void *buffer, size_t *size);
+
+/// file at path has the chunks of the generation file, buffer of BACKUP_STORE_CHUNK_SIZE
+bool backup_store_file_matches(const char *path,
+                               const struct backup_store_generation_s *generation,
+                               const struct backup_store_file_s *file,
+                               void *buffer);
+
+const char *backup_store_strerror(int err);
+
+#ifdef __cplusplus
+}
+#endif
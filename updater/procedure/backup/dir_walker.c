@@ -71,6 +71,10 @@ void recursive_dir_walker(const char *name, struct dir_handler_s *h, unsigned in
                     break;
                 }
             }
+            if (h->skip_dir) {
+                h->skip_dir = false;
+                continue;
+            }
             recursive_dir_walker(path, h, recursion_limit);
         } else {
             //printf("%s\n", entry->d_name);
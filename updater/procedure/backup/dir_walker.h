@@ -34,6 +34,7 @@ struct dir_handler_s {
     void *callback_data;                /// data passed to callback
     char *root_catalog;                 /// start catalog for recursion
     bool user_break;                    /// whether user requested stop in callback
+    bool skip_dir;                      /// set by callback on catalog to not walk into it, e.g. it was moved away
 };
 
 /// requires:
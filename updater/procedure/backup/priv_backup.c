@@ -3,11 +3,13 @@
 #include <stddef.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 #include <common/tar.h>
 #include <common/match.h>
 #include <common/path_opts.h>
 #include <common/boot_files.h>
 #include "dir_walker.h"
+#include "backup_manifest.h"
 #include "priv_backup.h"
 
 const char *user_file_types_to_backup[] =
@@ -16,47 +18,240 @@ const char *user_file_types_to_backup[] =
                 ".log"
         };
 
-bool backup_boot_partition(struct backup_handle_s *handle) {
-    bool success = true;
-    struct tar_ctx ctx;
-    debug_log("Backup: backing up boot partition to %s", handle->backup_to);
-    do {
-        if (0 != tar_init(&ctx, handle->backup_to, "a")) {
-            debug_log("Backup: unable to init tar archive: %s", handle->backup_to);
-            success = false;
-            break;
+/// entry of the previous backup still valid for the file: the file has the size and mtime it had when
+/// it was appended, file system without mtime (0) gets every file appended
+static const struct backup_manifest_entry_s *unchanged_entry(const struct backup_manifest_s *previous,
+                                                             const char *name,
+                                                             const struct stat *st) {
+    const struct backup_manifest_entry_s *entry = backup_manifest_find(previous, name);
+    if (entry == NULL || st->st_mtime == 0 || entry->size != (uint32_t) st->st_size ||
+        entry->mtime != (uint32_t) st->st_mtime) {
+        return NULL;
+    }
+    return entry;
+}
+
+/// archive bytes of the files the index points at and of one session, the rest are superseded entries
+static unsigned long long archive_live_size(const struct backup_manifest_s *index) {
+    unsigned long long bytes = TAR_RECORD_SIZE * 5;
+    for (size_t i = 0; i < index->count; ++i) {
+        bytes += TAR_RECORD_SIZE + ((unsigned long long) index->entries[i].size + TAR_RECORD_SIZE - 1) /
+                                           TAR_RECORD_SIZE * TAR_RECORD_SIZE;
+    }
+    return bytes;
+}
+
+/// every session appends to the archive and the superseded entries are never removed - archive grown
+/// over BACKUP_ARCHIVE_COMPACT_RATIO times of what it holds is written anew with the files only
+/// compressed archive is compared with the uncompressed files, it's compacted later
+static bool archive_compact_due(const char *archive, const struct backup_manifest_s *previous) {
+    struct stat st;
+    if (previous->count == 0 || stat(archive, &st) != 0) {
+        return false;
+    }
+    return (unsigned long long) st.st_size > archive_live_size(previous) * BACKUP_ARCHIVE_COMPACT_RATIO;
+}
+
+/// archive written aside by the compacting session, it keeps the extension of the archive
+static char *compact_path(const char *archive) {
+    const char prefix[] = "compact_";
+    const char *base = strrchr(archive, '/');
+    const size_t dir = base ? (size_t) (base - archive) + 1 : 0;
+    char *path = malloc(strlen(archive) + sizeof prefix);
+    if (path != NULL) {
+        sprintf(path, "%.*s%s%s", (int) dir, archive, prefix, archive + dir);
+    }
+    return path;
+}
+
+bool backup_session_open(struct backup_session_s *session, const char *archive) {
+    session->stored = false;
+    session->archive = NULL;
+    session->compacted = NULL;
+    backup_manifest_init(&session->previous);
+    backup_manifest_init(&session->index);
+    if (backup_manifest_read(&session->previous, archive) != 0) {
+        debug_log("Backup: unable to read index of %s, all files are appended", archive);
+        backup_manifest_free(&session->previous);
+    }
+    if (archive_compact_due(archive, &session->previous)) {
+        session->compacted = compact_path(archive);
+        session->archive = session->compacted ? strdup(archive) : NULL;
+        if (session->archive == NULL) {
+            free(session->compacted);
+            session->compacted = NULL;
+        } else {
+            debug_log("Backup: %s holds mostly superseded files, written anew", archive);
+            backup_manifest_free(&session->previous);
         }
+    }
+    if (0 != tar_init(&session->ctx, session->compacted ? session->compacted : archive,
+                      session->compacted ? "w" : "a")) {
+        debug_log("Backup: unable to init tar archive: %s", archive);
+        tar_deinit(&session->ctx);
+        backup_manifest_free(&session->previous);
+        free(session->compacted);
+        free(session->archive);
+        return false;
+    }
+    return true;
+}
 
-        for (size_t i = 0; i < backup_boot_files_list_size; ++i) {
-            const char *filename = backup_boot_files[i];
-            char *filename_from = (char *) calloc(1, strlen(filename) + strlen(handle->backup_from_os) + 2);
-            char *filename_to = (char *) calloc(1, strlen(filename) + strlen(handle->backup_to) + 2);
-            sprintf(filename_from, "%s/%s", handle->backup_from_os, filename);
-            sprintf(filename_to, "%s/%s", handle->backup_to, filename);
-            path_remove_dup_slash(filename_from);
-            path_remove_dup_slash(filename_to);
-            if (0 != tar_file(&ctx, filename_from, filename)) {
-                free(filename_from);
-                success = false;
-                debug_log("Backup: backing up file %s failed", filename);
-                break;
-            }
-            free(filename_from);
-            free(filename_to);
+bool backup_session_open_store(struct backup_session_s *session, const char *store) {
+    session->stored = true;
+    backup_manifest_init(&session->previous);
+    backup_manifest_init(&session->index);
+    const int ret = backup_store_open(&session->store, store);
+    if (ret != ErrorBackupStoreOk) {
+        debug_log("Backup: unable to open backup store %s: %s", store, backup_store_strerror(ret));
+        backup_store_close(&session->store);
+        return false;
+    }
+    return true;
+}
+
+void backup_session_previous(struct backup_handle_s *handle, struct backup_manifest_s *previous) {
+    struct backup_store_generation_s generation;
+    unsigned latest = 0;
+    if (handle->backup_store == NULL) {
+        backup_manifest_read(previous, handle->backup_to);
+        if (archive_compact_due(handle->backup_to, previous)) {
+            backup_manifest_free(previous);
+        }
+        return;
+    }
+    backup_store_generation_init(&generation);
+    if (backup_store_latest(handle->backup_store, &latest) == ErrorBackupStoreOk &&
+        backup_store_generation_load(handle->backup_store, latest, &generation) == ErrorBackupStoreOk) {
+        const struct tar_position_s position = {0};
+        const unsigned char md5[BACKUP_MANIFEST_MD5_SIZE] = {0};
+        for (size_t i = 0; i < generation.count; ++i) {
+            const struct backup_store_file_s *file = &generation.files[i];
+            backup_manifest_add(previous, backup_store_name(&generation, file), &position, file->size, file->mtime,
+                                md5);
         }
+    }
+    backup_store_generation_free(&generation);
+}
 
-        if (0 != tar_deinit(&ctx)) {
-            debug_log("Backup: tar deinit failed");
+bool backup_session_file(struct backup_session_s *session, const char *path, const char *name) {
+    if (session->stored) {
+        return backup_store_file(&session->store, path, name) == ErrorBackupStoreOk;
+    }
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        debug_log("Backup: ignored non existing file: %s", path);
+        return true;
+    }
+    const struct backup_manifest_entry_s *entry = unchanged_entry(&session->previous, name, &st);
+    if (entry != NULL) {
+        debug_log("Backup: %s not changed since the last backup", name);
+        return 0 == backup_manifest_add(&session->index, name, &entry->position, entry->size, entry->mtime,
+                                        entry->md5);
+    }
+    struct tar_position_s position;
+    if (ErrorTarOk != tar_write_position(&session->ctx, &position) || 0 != tar_file(&session->ctx, path, name)) {
+        debug_log("Backup: backing up file %s failed", path);
+        return false;
+    }
+    return 0 == backup_manifest_add(&session->index, name, &position, st.st_size, st.st_mtime, session->ctx.md5);
+}
+
+bool backup_session_close(struct backup_session_s *session, bool success) {
+    if (session->stored) {
+        success = success && backup_store_commit(&session->store) == ErrorBackupStoreOk;
+        backup_store_close(&session->store);
+        return success;
+    }
+    char *text = NULL;
+    size_t size = 0;
+    /// failed session leaves the mark of the previous one - its index and the entries it points to are intact
+    if (success && (0 != backup_manifest_format(&session->index, &text, &size) ||
+                    ErrorTarOk != tar_write_mark(&session->ctx) ||
+                    ErrorTarOk != tar_data(&session->ctx, BACKUP_INDEX_NAME, text, size))) {
+        debug_log("Backup: unable to write backup index");
+        success = false;
+    }
+    free(text);
+    if (0 != tar_deinit(&session->ctx)) {
+        debug_log("Backup: tar deinit failed");
+        success = false;
+    }
+    /// failed compaction leaves the grown archive as it was
+    if (session->compacted != NULL && success) {
+        unlink(session->archive);
+        if (rename(session->compacted, session->archive) != 0) {
+            debug_log("Backup: unable to replace %s: %d", session->archive, errno);
             success = false;
-            break;
         }
-        return success;
-    } while (0);
+    } else if (session->compacted != NULL) {
+        unlink(session->compacted);
+    }
+    free(session->compacted);
+    free(session->archive);
+    backup_manifest_free(&session->previous);
+    backup_manifest_free(&session->index);
+    return success;
+}
 
-    tar_deinit(&ctx);
+bool backup_boot_partition(struct backup_handle_s *handle, struct backup_session_s *session) {
+    bool success = true;
+    debug_log("Backup: backing up boot partition to %s", handle->backup_to);
+    for (size_t i = 0; i < backup_boot_files_list_size && success; ++i) {
+        const char *filename = backup_boot_files[i];
+        char *filename_from = (char *) calloc(1, strlen(filename) + strlen(handle->backup_from_os) + 2);
+        sprintf(filename_from, "%s/%s", handle->backup_from_os, filename);
+        path_remove_dup_slash(filename_from);
+        success = backup_session_file(session, filename_from, filename);
+        free(filename_from);
+    }
     return success;
 }
 
+/// archive bytes the file takes: header, data padded to whole records, nothing for an unchanged file
+/// and its line of the index
+/// the store takes the data and the chunk list, only the chunk list for an unchanged file
+static unsigned long long backup_file_size(struct backup_handle_s *handle,
+                                           const struct backup_manifest_s *previous,
+                                           const char *path,
+                                           const char *name) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return 0;
+    }
+    const bool unchanged = unchanged_entry(previous, name, &st) != NULL;
+    if (handle->backup_store != NULL) {
+        return backup_store_file_bytes(name, st.st_size) - (unchanged ? st.st_size : 0);
+    }
+    unsigned long long size = backup_manifest_line_size(name);
+    if (!unchanged) {
+        size += TAR_RECORD_SIZE +
+                ((unsigned long long) st.st_size + TAR_RECORD_SIZE - 1) / TAR_RECORD_SIZE * TAR_RECORD_SIZE;
+    }
+    return size;
+}
+
+unsigned long long backup_session_size(struct backup_handle_s *handle) {
+    if (handle->backup_store != NULL) {
+        return 0;
+    }
+    /// index header and its last padded record, trailer, end record in a record of its own
+    return TAR_RECORD_SIZE * 2 + TAR_RECORD_SIZE * 2 + TAR_RECORD_SIZE;
+}
+
+unsigned long long backup_boot_partition_size(struct backup_handle_s *handle,
+                                              const struct backup_manifest_s *previous) {
+    unsigned long long bytes = 0;
+    for (size_t i = 0; i < backup_boot_files_list_size; ++i) {
+        char *filename_from = (char *) calloc(1, strlen(backup_boot_files[i]) + strlen(handle->backup_from_os) + 2);
+        sprintf(filename_from, "%s/%s", handle->backup_from_os, backup_boot_files[i]);
+        path_remove_dup_slash(filename_from);
+        bytes += backup_file_size(handle, previous, filename_from, backup_boot_files[i]);
+        free(filename_from);
+    }
+    return bytes;
+}
+
 struct list_node_t {
     struct list_node_t *next;
     char *data;
@@ -147,57 +342,51 @@ int get_files_flat(const char *path, const char **file_types, size_t file_types_
     return handle_walk.error;
 }
 
-bool backup_user_data(struct backup_handle_s *handle) {
-    bool success = true;
-    struct tar_ctx ctx;
+bool backup_user_data(struct backup_handle_s *handle, struct backup_session_s *session) {
     debug_log("Backup: backing up user data to %s", handle->backup_to);
-    do {
-        if (0 != tar_init(&ctx, handle->backup_to, "a")) {
-            debug_log("Backup: unable to init tar archive: %s", handle->backup_to);
-            success = false;
-            break;
-        }
-
-        size_t file_types_cnt = sizeof(user_file_types_to_backup) / sizeof(user_file_types_to_backup[0]);
-        struct list_node_t *nodes = list_create();
-        int ret = get_files_flat(handle->backup_from_user, user_file_types_to_backup, file_types_cnt, nodes);
-        if (ret != 0) {
-            debug_log("Backup: failed to get files list: %d", ret);
-            tar_deinit(&ctx);
-            return false;
-        }
-
-        struct list_node_t *node = nodes;
-        while (node != NULL) {
-            if (node->data == NULL) {
-                node = node->next;
-                continue;
-            }
-            char *filename_from = (char *) calloc(1, strlen(node->data) + strlen(handle->backup_from_user) + 2);
-            sprintf(filename_from, "%s/%s", handle->backup_from_user, node->data);
-            path_remove_dup_slash(filename_from);
-            if (0 != tar_file(&ctx, filename_from, node->data)) {
-                free(filename_from);
-                success = false;
-                debug_log("Backup: backing up file %s failed", filename_from);
-                break;
-            }
-            node = node->next;
-            free(filename_from);
-        }
+    size_t file_types_cnt = sizeof(user_file_types_to_backup) / sizeof(user_file_types_to_backup[0]);
+    struct list_node_t *nodes = list_create();
+    int ret = get_files_flat(handle->backup_from_user, user_file_types_to_backup, file_types_cnt, nodes);
+    if (ret != 0) {
+        debug_log("Backup: failed to get files list: %d", ret);
         list_free(&nodes);
+        return false;
+    }
 
-        if (0 != tar_deinit(&ctx)) {
-            debug_log("Backup: tar deinit failed");
-            success = false;
-            break;
+    bool success = true;
+    for (struct list_node_t *node = nodes; node != NULL && success; node = node->next) {
+        if (node->data == NULL) {
+            continue;
         }
-        return success;
-    } while (0);
-    tar_deinit(&ctx);
+        char *filename_from = (char *) calloc(1, strlen(node->data) + strlen(handle->backup_from_user) + 2);
+        sprintf(filename_from, "%s/%s", handle->backup_from_user, node->data);
+        path_remove_dup_slash(filename_from);
+        success = backup_session_file(session, filename_from, node->data);
+        free(filename_from);
+    }
+    list_free(&nodes);
     return success;
 }
 
+unsigned long long backup_user_data_size(struct backup_handle_s *handle, const struct backup_manifest_s *previous) {
+    unsigned long long bytes = 0;
+    size_t file_types_cnt = sizeof(user_file_types_to_backup) / sizeof(user_file_types_to_backup[0]);
+    struct list_node_t *nodes = list_create();
+    get_files_flat(handle->backup_from_user, user_file_types_to_backup, file_types_cnt, nodes);
+    for (struct list_node_t *node = nodes; node != NULL; node = node->next) {
+        if (node->data == NULL) {
+            continue;
+        }
+        char *filename_from = (char *) calloc(1, strlen(node->data) + strlen(handle->backup_from_user) + 2);
+        sprintf(filename_from, "%s/%s", handle->backup_from_user, node->data);
+        path_remove_dup_slash(filename_from);
+        bytes += backup_file_size(handle, previous, filename_from, node->data);
+        free(filename_from);
+    }
+    list_free(&nodes);
+    return bytes;
+}
+
 bool check_backup_entries(struct backup_handle_s *handle) {
     debug_log("Backup: checking backup paths");
     bool ret = handle->backup_from_os != NULL && handle->backup_from_user != NULL && handle->backup_to != NULL;
@@ -240,6 +429,7 @@ int tar_callback(const char *path, enum dir_handling_type_e what, struct dir_han
     return ret;
 }
 
+/// written next to backup_to and renamed over it when complete - previous archive stays until then
 bool backup_whole_directory(struct backup_handle_s *handle) {
     bool success = true;
 
@@ -248,10 +438,18 @@ bool backup_whole_directory(struct backup_handle_s *handle) {
     memset(&handle_walk, 0, sizeof handle_walk);
     unsigned int recursion_limit = 100;
     struct tar_ctx ctx;
+    /// compressed archive keeps its extension last
+    const char *extension = string_match_end(handle->backup_to, TAR_LZ4_EXTENSION) ? TAR_LZ4_EXTENSION : "";
+    const size_t stem = strlen(handle->backup_to) - strlen(extension);
+    char *tmp_path = (char *) calloc(1, strlen(handle->backup_to) + sizeof ".tmp");
+    if (tmp_path == NULL) {
+        return false;
+    }
+    sprintf(tmp_path, "%.*s.tmp%s", (int) stem, handle->backup_to, extension);
 
     do {
-        if (0 != tar_init(&ctx, handle->backup_to, "w")) {
-            debug_log("Backup: unable to init tar archive: %s", handle->backup_to);
+        if (0 != tar_init(&ctx, tmp_path, "w")) {
+            debug_log("Backup: unable to init tar archive: %s", tmp_path);
             success = false;
             break;
         }
@@ -271,10 +469,22 @@ bool backup_whole_directory(struct backup_handle_s *handle) {
             debug_log("Backup: tar deinit failed");
             success = false;
         }
+        /// FAT refuses to rename over an existing file
+        if (success && rename(tmp_path, handle->backup_to) != 0 &&
+            (unlink(handle->backup_to) != 0 || rename(tmp_path, handle->backup_to) != 0)) {
+            debug_log("Backup: unable to replace %s: %d", handle->backup_to, errno);
+            success = false;
+        }
+        if (!success) {
+            unlink(tmp_path);
+        }
+        free(tmp_path);
         return success;
 
     } while (0);
 
     tar_deinit(&ctx);
+    unlink(tmp_path);
+    free(tmp_path);
     return success;
 }
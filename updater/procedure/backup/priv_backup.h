@@ -6,17 +6,60 @@ extern "C"
 #endif
 
 #include "backup.h"
+#include "backup_manifest.h"
+#include "backup_store.h"
 #include <common/log.h>
+#include <common/tar.h>
+
+/// one writer session of the backup archive: all backed up files are appended through it, the archive
+/// is finalized once with the index of the session as its marked last entry
+/// session of the chunk store writes a generation instead
+struct backup_session_s {
+    struct tar_ctx ctx;
+    struct backup_manifest_s previous; /// index of the archive when the session started
+    struct backup_manifest_s index;    /// every file backed up by the session, appended or unchanged
+    struct backup_store_writer_s store;
+    bool stored;                       /// session writes to the store, see backup_session_open_store
+    char *compacted;                   /// archive written anew instead of appending, NULL - appending
+    char *archive;                     /// archive replaced by the compacted one when the session succeeds
+};
+
+/// archive larger than this many times the files of its index and one session is compacted
+#define BACKUP_ARCHIVE_COMPACT_RATIO 2
 
 /// assert that paths from -> to are proper
 bool check_backup_entries(struct backup_handle_s *handle);
+
+/// read the index of the archive and open it for appending
+/// archive grown over BACKUP_ARCHIVE_COMPACT_RATIO is written anew aside with every file instead
+bool backup_session_open(struct backup_session_s *session, const char *archive);
+/// start a generation of the chunk store
+bool backup_session_open_store(struct backup_session_s *session, const char *store);
+/// what the next session of the handle compares the files with: index of the archive or the latest
+/// generation of the store, only names, sizes and mtimes; none when the archive is due to be compacted
+void backup_session_previous(struct backup_handle_s *handle, struct backup_manifest_s *previous);
+/// append the file as name, unless the previous index has it with the same size and mtime
+/// not existing file is ignored
+bool backup_session_file(struct backup_session_s *session, const char *path, const char *name);
+/// write the index when success and finalize the archive, true when both went fine
+/// store session commits the generation when success
+bool backup_session_close(struct backup_session_s *session, bool success);
+
 /// backup only required data stored on 1:/ (boot) partition
 /// - boot.bin
 /// - version.json
-bool backup_boot_partition(struct backup_handle_s *handle);
+bool backup_boot_partition(struct backup_handle_s *handle, struct backup_session_s *session);
 /// backup only required data stored on 3:/ (user) partition
 /// all: *db files
-bool backup_user_data(struct backup_handle_s *handle);
+bool backup_user_data(struct backup_handle_s *handle, struct backup_session_s *session);
+
+/// bytes backup_boot_partition appends to the backup archive with the previous index
+unsigned long long backup_boot_partition_size(struct backup_handle_s *handle,
+                                              const struct backup_manifest_s *previous);
+/// bytes backup_user_data appends to the backup archive with the previous index
+unsigned long long backup_user_data_size(struct backup_handle_s *handle, const struct backup_manifest_s *previous);
+/// bytes every session appends: index entry and finalization of the archive
+unsigned long long backup_session_size(struct backup_handle_s *handle);
 
 /// UNUSED:
 
@@ -0,0 +1,239 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <common/boot_files.h>
+#include <common/path_opts.h>
+#include <common/stream.h>
+#include "priv_restore.h"
+
+static bool is_boot_file(const char *name) {
+    for (size_t i = 0; i < backup_boot_files_list_size; ++i) {
+        if (strcmp(name, backup_boot_files[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+char *restore_path(const struct backup_handle_s *handle, const char *name) {
+    const char *dir = is_boot_file(name) ? handle->backup_from_os : handle->backup_from_user;
+    char *path = malloc(strlen(dir) + strlen(name) + 2);
+    if (path != NULL) {
+        sprintf(path, "%s/%s", dir, name);
+        path_remove_dup_slash(path);
+    }
+    return path;
+}
+
+bool restore_file_matches(const char *path, const struct backup_manifest_entry_s *entry) {
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode) || (uint32_t) st.st_size != entry->size) {
+        return false;
+    }
+    unsigned char md5[BACKUP_MANIFEST_MD5_SIZE];
+    if (stream_file_md5(path, md5) != ErrorStreamOk) {
+        debug_log("Restore: unable to hash %s", path);
+        return false;
+    }
+    return memcmp(md5, entry->md5, sizeof md5) == 0;
+}
+
+/// rename over the installed file, FAT refuses to rename over an existing file
+static int replace_file(const char *from, const char *to) {
+    if (rename(from, to) == 0) {
+        return 0;
+    }
+    if (unlink(to) != 0 && errno != ENOENT) {
+        return -errno;
+    }
+    return rename(from, to) == 0 ? 0 : -errno;
+}
+
+static int unpack_to(struct tar_ctx *ctx, const char *out) {
+    struct stream_source_s source;
+    struct stream_stage_s stages[2];
+    stream_tar_source(&source, ctx);
+    stream_md5_stage(&stages[1], ctx->md5);
+    int ret = stream_file_sink(&stages[0], out);
+    if (ret == ErrorStreamOk) {
+        ret = stream_run(&source, stages, 2, NULL);
+    }
+    stream_stage_close(&stages[0]);
+    stream_stage_close(&stages[1]);
+    stream_source_close(&source);
+    return ret;
+}
+
+bool restore_file(struct tar_ctx *ctx,
+                  const struct backup_manifest_s *index,
+                  const struct backup_manifest_entry_s *entry,
+                  const char *path) {
+    const char *name = backup_manifest_name(index, entry);
+    mtar_header_t header;
+    if (tar_seek_position(ctx, &entry->position) != ErrorTarOk || tar_read_header(ctx, &header) != ErrorTarOk) {
+        debug_log("Restore: unable to read entry of %s at %u", name, entry->position.offset);
+        return false;
+    }
+    const char *header_name = strncmp(header.name, "./", 2) == 0 ? header.name + 2 : header.name;
+    if (header.type != MTAR_TREG || header.size != entry->size || strcmp(header_name, name) != 0) {
+        debug_log("Restore: entry at %u isn't %s", entry->position.offset, name);
+        return false;
+    }
+
+    char *out = malloc(strlen(path) + sizeof RESTORE_EXTENSION);
+    if (out == NULL) {
+        return false;
+    }
+    sprintf(out, "%s%s", path, RESTORE_EXTENSION);
+    debug_log("Restore: unpacking %s (%u kB)", path, entry->size / 1024);
+
+    bool success = true;
+    int ret = unpack_to(ctx, out);
+    if (ret != ErrorStreamOk) {
+        debug_log("Restore: failed to unpack %s: %s", out, stream_strerror(ret));
+        success = false;
+    } else if (memcmp(ctx->md5, entry->md5, BACKUP_MANIFEST_MD5_SIZE) != 0) {
+        debug_log("Restore: %s doesn't match digest from %s", name, BACKUP_INDEX_NAME);
+        success = false;
+    } else if ((ret = replace_file(out, path)) != 0) {
+        debug_log("Restore: unable to replace %s: %d", path, ret);
+        success = false;
+    }
+    if (!success) {
+        unlink(out);
+    }
+    free(out);
+    return success;
+}
+
+bool restore_store_file(const char *store,
+                        const struct backup_store_generation_s *generation,
+                        const struct backup_store_file_s *file,
+                        const char *path,
+                        void *buffer) {
+    char *out = malloc(strlen(path) + sizeof RESTORE_EXTENSION);
+    if (out == NULL) {
+        return false;
+    }
+    sprintf(out, "%s%s", path, RESTORE_EXTENSION);
+    debug_log("Restore: writing %s (%u kB) from %u chunks", path, file->size / 1024, file->chunk_count);
+
+    FILE *restored = fopen(out, "wb");
+    int ret = restored ? ErrorBackupStoreOk : ErrorBackupStoreIo;
+    size_t total = 0;
+    for (size_t i = 0; ret == ErrorBackupStoreOk && i < file->chunk_count; ++i) {
+        size_t size = 0;
+        ret = backup_store_chunk_read(store, &generation->chunks[file->chunk + i], buffer, &size);
+        if (ret == ErrorBackupStoreOk && fwrite(buffer, 1, size, restored) != size) {
+            ret = ErrorBackupStoreIo;
+        }
+        total += size;
+    }
+    if (restored != NULL && fclose(restored) != 0) {
+        ret = ErrorBackupStoreIo;
+    }
+    if (ret == ErrorBackupStoreOk && total != file->size) {
+        ret = ErrorBackupStoreChunk;
+    }
+    if (ret == ErrorBackupStoreOk && replace_file(out, path) != 0) {
+        ret = ErrorBackupStoreIo;
+    }
+    if (ret != ErrorBackupStoreOk) {
+        debug_log("Restore: unable to restore %s: %s", path, backup_store_strerror(ret));
+        unlink(out);
+    }
+    free(out);
+    return ret == ErrorBackupStoreOk;
+}
+
+bool restore_archive_changed(struct backup_handle_s *handle, struct backup_restore_result_s *result) {
+    struct backup_manifest_s index;
+    backup_manifest_init(&index);
+    if (backup_manifest_read(&index, handle->backup_to) != 0 || index.count == 0) {
+        debug_log("Restore: no index in %s, files can't be restored selectively", handle->backup_to);
+        backup_manifest_free(&index);
+        return false;
+    }
+
+    struct tar_ctx ctx;
+    bool success = tar_init(&ctx, handle->backup_to, "r") == ErrorTarOk;
+    for (size_t i = 0; success && i < index.count; ++i) {
+        const struct backup_manifest_entry_s *entry = &index.entries[i];
+        char *path = restore_path(handle, backup_manifest_name(&index, entry));
+        if (path == NULL) {
+            success = false;
+            break;
+        }
+        ++result->checked_files;
+        if (!restore_file_matches(path, entry)) {
+            success = restore_file(&ctx, &index, entry, path);
+            result->restored_files += success ? 1 : 0;
+            result->restored_bytes += success ? entry->size : 0;
+        }
+        free(path);
+    }
+    tar_deinit(&ctx);
+    backup_manifest_free(&index);
+
+    debug_log("Restore: %u of %u files restored from archive (%u kB)", result->restored_files, result->checked_files,
+              result->restored_bytes / 1024);
+    return success;
+}
+
+/// restore the files differing from the generation, a file which can't be restored doesn't stop the others
+static bool restore_generation(struct backup_handle_s *handle,
+                               const struct backup_store_generation_s *generation,
+                               void *buffer,
+                               struct backup_restore_result_s *result) {
+    bool success = true;
+    result->checked_files = 0;
+    for (size_t i = 0; i < generation->count; ++i) {
+        const struct backup_store_file_s *file = &generation->files[i];
+        char *path = restore_path(handle, backup_store_name(generation, file));
+        if (path == NULL) {
+            return false;
+        }
+        ++result->checked_files;
+        if (!backup_store_file_matches(path, generation, file, buffer)) {
+            const bool restored = restore_store_file(handle->backup_store, generation, file, path, buffer);
+            result->restored_files += restored ? 1 : 0;
+            result->restored_bytes += restored ? file->size : 0;
+            success = success && restored;
+        }
+        free(path);
+    }
+    return success;
+}
+
+bool restore_store_changed(struct backup_handle_s *handle, struct backup_restore_result_s *result) {
+    unsigned latest = 0;
+    if (backup_store_latest(handle->backup_store, &latest) != ErrorBackupStoreOk) {
+        return false;
+    }
+    void *buffer = malloc(BACKUP_STORE_CHUNK_SIZE);
+    if (buffer == NULL) {
+        return false;
+    }
+    bool success = false;
+    /// generation with a damaged chunk or list is restored from the older kept one, newest first - every file
+    /// is compared again, so the files end up as in the generation restored last
+    for (unsigned number = latest; !success && number > 0 && number + BACKUP_STORE_GENERATIONS > latest; --number) {
+        struct backup_store_generation_s generation;
+        backup_store_generation_init(&generation);
+        success = backup_store_generation_load(handle->backup_store, number, &generation) == ErrorBackupStoreOk &&
+                  restore_generation(handle, &generation, buffer, result);
+        backup_store_generation_free(&generation);
+        if (success) {
+            result->generation = number;
+            debug_log("Restore: %u of %u files restored from generation %u", result->restored_files,
+                      result->checked_files, number);
+        } else {
+            debug_log("Restore: generation %u can't be restored", number);
+        }
+    }
+    free(buffer);
+    return success;
+}
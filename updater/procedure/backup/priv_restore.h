@@ -0,0 +1,49 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <common/tar.h>
+#include "backup.h"
+#include "backup_manifest.h"
+#include "backup_store.h"
+
+/// selective restore (see backup_restore_changed): a file is written next to the installed one as
+/// <name>.restore and renamed over it once its digest matches the backup, the installed file is never
+/// half written
+
+#define RESTORE_EXTENSION ".restore"
+
+/// where the backed up file is installed: boot files in backup_from_os, the rest in backup_from_user
+/// caller frees
+char *restore_path(const struct backup_handle_s *handle, const char *name);
+
+/// installed file has the size and the md5 of its index entry, md5 is computed only for the same size
+bool restore_file_matches(const char *path, const struct backup_manifest_entry_s *entry);
+
+/// read the entry from its position in the opened archive and put it at path
+bool restore_file(struct tar_ctx *ctx,
+                  const struct backup_manifest_s *index,
+                  const struct backup_manifest_entry_s *entry,
+                  const char *path);
+
+/// write the file of the store generation to path from its chunks
+bool restore_store_file(const char *store,
+                        const struct backup_store_generation_s *generation,
+                        const struct backup_store_file_s *file,
+                        const char *path,
+                        void *buffer);
+
+/// restore the files differing from the index of the archive backup_to
+bool restore_archive_changed(struct backup_handle_s *handle, struct backup_restore_result_s *result);
+
+/// restore the files differing from the latest generation of backup_store, older kept generations are tried
+/// when it can't be restored
+bool restore_store_changed(struct backup_handle_s *handle, struct backup_restore_result_s *result);
+
+#ifdef __cplusplus
+}
+#endif
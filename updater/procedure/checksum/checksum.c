@@ -5,24 +5,47 @@
 #include <md5/md5.h>
 #include <common/boot_files.h>
 #include <common/path_opts.h>
+#include <common/stream.h>
 
 #include "checksum.h"
 #include "checksum_priv.h"
 
-static void _autoclose(int *f) {
-    if (*f > 0) {
-        close(*f);
+#define UNUSED(expr) do { (void)(expr); } while (0)
+
+void checksum_digest_store(checksum_digests_s *digests, const char *name, const unsigned char *md5) {
+    if (digests == NULL || name == NULL || md5 == NULL) {
+        return;
+    }
+    /// only the files of the package root are verified, the same name deeper in the tree is another file
+    if (strncmp(name, "./", 2) == 0) {
+        name += 2;
+    }
+    for (size_t i = 0; i < verify_files_list_size; ++i) {
+        if (strcmp(name, verify_files[i]) == 0) {
+            memcpy(digests->md5[i], md5, CHECKSUM_MD5_SIZE);
+            digests->valid[i] = true;
+            return;
+        }
     }
 }
 
-#define UNUSED(expr) do { (void)(expr); } while (0)
-
-bool checksum_verify_all(verify_file_handle_s *handle, const char *tmp_path) {
+bool checksum_verify_all(verify_file_handle_s *handle, const checksum_digests_s *digests, const char *tmp_path) {
     bool ret = true;
     debug_log("Checksum: verifying all files");
 
     for (size_t i = 0; i < verify_files_list_size; ++i) {
         const char *filename = verify_files[i];
+        if (digests != NULL && digests->valid[i]) {
+            handle->file_to_verify = filename;
+            ret = checksum_verify_digest(handle, digests->md5[i]);
+            if (!ret) {
+                return ret;
+            }
+            continue;
+        }
+        if (tmp_path == NULL) {
+            continue;
+        }
         char *filepath = (char *) calloc(1, strlen(filename) + strlen(tmp_path) + 1);
         sprintf(filepath, "%s/%s", tmp_path, filename);
         if (!path_check_if_exists(filepath)) {
@@ -40,12 +63,10 @@ bool checksum_verify_all(verify_file_handle_s *handle, const char *tmp_path) {
 }
 
 bool checksum_verify(verify_file_handle_s *handle) {
-    unsigned char calculated_checksum[16];
-    char calculated_checksum_readable[33];
+    unsigned char calculated_checksum[CHECKSUM_MD5_SIZE];
 
     debug_log("Checksum: verifying file: %s", handle->file_to_verify);
 
-    int file_to_verify_fd __attribute__((__cleanup__(_autoclose))) = -1;
     bool ret = false;
 
     if (handle == NULL) {
@@ -62,14 +83,31 @@ bool checksum_verify(verify_file_handle_s *handle) {
         debug_log("Checksum: file to verify is a NULL");
         goto exit;
     }
-    file_to_verify_fd = open(handle->file_to_verify, O_RDONLY);
-    if (file_to_verify_fd <= 0) {
-        debug_log("Checksum: failed to open the file");
+    if (stream_file_md5(handle->file_to_verify, calculated_checksum) != ErrorStreamOk) {
+        debug_log("Checksum: failed to read the file");
+        goto exit;
+    }
+    ret = checksum_verify_digest(handle, calculated_checksum);
+
+    exit:
+    return ret;
+}
+
+bool checksum_verify_digest(verify_file_handle_s *handle, const unsigned char *md5) {
+    char calculated_checksum_readable[33];
+    bool ret = false;
+
+    if (handle == NULL || handle->file_to_verify == NULL || md5 == NULL) {
+        debug_log("Checksum: nothing to verify");
+        goto exit;
+    }
+
+    if (handle->version_json.valid == false) {
+        debug_log("Checksum: version.json is not valid");
         goto exit;
     }
 
-    MD5_File(calculated_checksum, handle->file_to_verify);
-    checksum_get_readable(calculated_checksum, calculated_checksum_readable);
+    checksum_get_readable(md5, calculated_checksum_readable);
 
     version_json_file_s file_version = json_get_file_from_version(&handle->version_json, handle->file_to_verify);
     if (file_version.valid == false) {
@@ -9,12 +9,30 @@ extern "C"
 #include <common/log.h>
 #include <common/version_json.h>
 #include <common/types.h>
+#include <common/boot_files.h>
 
+#define CHECKSUM_MD5_SIZE 16
 
-bool checksum_verify_all(verify_file_handle_s *handle, const char *tmp_path);
+/// md5 of verified files calculated while unpacking - indexed as verify_files
+typedef struct checksum_digests_s {
+    unsigned char md5[VERIFY_FILES_LIST_SIZE][CHECKSUM_MD5_SIZE];
+    bool valid[VERIFY_FILES_LIST_SIZE];
+} checksum_digests_s;
+
+/// store md5 of unpacked file if it is one of verify_files, other files are ignored
+/// name is the package entry name - exactly the verify_files name, with or without leading ./
+void checksum_digest_store(checksum_digests_s *digests, const char *name, const unsigned char *md5);
+
+/// verify files from tmp_path against version.json
+/// digests calculated during unpack are compared in memory, files without digest are read from disk
+/// tmp_path NULL - files are not on the disk, only the digests are verified
+bool checksum_verify_all(verify_file_handle_s *handle, const checksum_digests_s *digests, const char *tmp_path);
 
 bool checksum_verify(verify_file_handle_s *handle);
 
+/// compare already calculated md5 of handle->file_to_verify with version.json
+bool checksum_verify_digest(verify_file_handle_s *handle, const unsigned char *md5);
+
 #ifdef __cplusplus
 }
 #endif
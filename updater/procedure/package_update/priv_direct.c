@@ -0,0 +1,175 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <common/delta.h>
+#include <common/match.h>
+#include <common/stream.h>
+#include "priv_direct.h"
+#include "priv_partition.h"
+#include "priv_update.h"
+
+bool direct_entry(const struct update_handle_s *handle, const char *name, unsigned char dest) {
+    unsigned partition;
+    return handle->direct_user && dest == UnpackDestUser && !string_match_end(name, DELTA_EXTENSION) &&
+           !partition_image_name(name, &partition);
+}
+
+char *direct_path(const struct update_handle_s *handle, const char *name) {
+    if (strncmp(name, "./", 2) == 0) {
+        name += 2;
+    }
+    char *path = malloc(strlen(handle->update_user) + strlen(name) + sizeof DIRECT_NEW_EXTENSION + 1);
+    if (path != NULL) {
+        sprintf(path, "%s/%s%s", handle->update_user, name, DIRECT_NEW_EXTENSION);
+    }
+    return path;
+}
+
+int direct_unpack(const struct update_handle_s *handle, struct tar_ctx *ctx, const mtar_header_t *header) {
+    memset(ctx->md5, 0, sizeof ctx->md5);
+    char *out = direct_path(handle, header->name);
+    if (out == NULL) {
+        return -ENOMEM;
+    }
+    debug_log("Direct: unpacking file (%d.%dkb) to %s", header->size / 1024, header->size % 1024, out);
+
+    struct stream_source_s source;
+    struct stream_stage_s stages[2];
+    stream_tar_source(&source, ctx);
+    stream_md5_stage(&stages[1], ctx->md5);
+    int ret = stream_file_sink(&stages[0], out);
+    if (ret == ErrorStreamOk) {
+        ret = stream_run(&source, stages, 2, NULL);
+    }
+    stream_stage_close(&stages[0]);
+    stream_stage_close(&stages[1]);
+    stream_source_close(&source);
+
+    if (ret != ErrorStreamOk) {
+        debug_log("Direct: failed to unpack %s: %s", out, stream_strerror(ret));
+        memset(ctx->md5, 0, sizeof ctx->md5);
+        unlink(out);
+        free(out);
+        return -EIO;
+    }
+    free(out);
+    return 0;
+}
+
+/// rename over the old file, FAT refuses to rename over an existing file
+static int replace_file(const char *from, const char *to) {
+    if (rename(from, to) == 0) {
+        return 0;
+    }
+    if (errno == ENOENT) {
+        return -ENOENT;
+    }
+    if (unlink(to) != 0 && errno != ENOENT) {
+        return -errno;
+    }
+    return rename(from, to) == 0 ? 0 : -errno;
+}
+
+/// installed file kept as <name>.old while the commit goes on, see direct_rollback
+static char *original_path(const char *installed) {
+    char *path = malloc(strlen(installed) + sizeof DIRECT_OLD_EXTENSION);
+    if (path != NULL) {
+        sprintf(path, "%s%s", installed, DIRECT_OLD_EXTENSION);
+    }
+    return path;
+}
+
+static bool exists(const char *path) {
+    return access(path, F_OK) == 0;
+}
+
+/// move the installed file aside as <name>.old and put <name>.new in its place
+/// state of an interrupted commit: <name>.old exists - the installed file is the original already moved aside
+static int install_file(const char *from, const char *to, const char *old) {
+    if (!exists(from)) {
+        /// skipped as installed or renamed before the interruption
+        return -ENOENT;
+    }
+    if (!exists(old)) {
+        if (exists(to) && rename(to, old) != 0) {
+            return -errno;
+        }
+    } else if (unlink(to) != 0 && errno != ENOENT) {
+        return -errno;
+    }
+    return replace_file(from, to);
+}
+
+/// calls fn with the .new, installed and .old path of every direct entry, stops on false
+static bool for_each_direct(const struct update_handle_s *handle,
+                            const struct tar_index_s *index,
+                            bool (*fn)(const char *from, const char *to, const char *old, void *arg),
+                            void *arg) {
+    bool ret = true;
+    for (size_t i = 0; ret && i < index->count; ++i) {
+        const struct tar_index_entry_s *entry = &index->entries[i];
+        const char *name = tar_index_name(index, entry);
+        if (entry->type != MTAR_TREG || !direct_entry(handle, name, entry->dest)) {
+            continue;
+        }
+        char *from = direct_path(handle, name);
+        char *to = from ? strndup(from, strlen(from) - strlen(DIRECT_NEW_EXTENSION)) : NULL;
+        char *old = to ? original_path(to) : NULL;
+        ret = old != NULL && fn(from, to, old, arg);
+        free(from);
+        free(to);
+        free(old);
+    }
+    return ret;
+}
+
+static bool commit_file(const char *from, const char *to, const char *old, void *arg) {
+    const int ret = install_file(from, to, old);
+    if (ret != 0 && ret != -ENOENT) {
+        debug_log("Direct: rename %s -> %s failed: %d", from, to, ret);
+        return false;
+    }
+    *(size_t *) arg += ret == 0;
+    return true;
+}
+
+static bool remove_original(const char *from, const char *to, const char *old, void *arg) {
+    (void) from;
+    (void) to;
+    (void) arg;
+    if (unlink(old) != 0 && errno != ENOENT) {
+        debug_log("Direct: unable to remove %s: %d", old, errno);
+    }
+    return true;
+}
+
+static bool restore_original(const char *from, const char *to, const char *old, void *arg) {
+    (void) arg;
+    if (unlink(from) != 0 && errno != ENOENT) {
+        debug_log("Direct: unable to remove %s: %d", from, errno);
+    }
+    if (exists(old)) {
+        const int ret = replace_file(old, to);
+        if (ret != 0) {
+            debug_log("Direct: unable to restore %s: %d", to, ret);
+        }
+    }
+    return true;
+}
+
+bool direct_commit(const struct update_handle_s *handle, const struct tar_index_s *index) {
+    size_t renamed = 0;
+    if (!for_each_direct(handle, index, commit_file, &renamed)) {
+        return false;
+    }
+    /// every file is in place - the originals aren't needed any more
+    for_each_direct(handle, index, remove_original, NULL);
+    debug_log("Direct: %u user files installed", renamed);
+    return true;
+}
+
+void direct_rollback(const struct update_handle_s *handle, const struct tar_index_s *index) {
+    for_each_direct(handle, index, restore_original, NULL);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <common/tar.h>
+
+#include "update.h"
+#include "common/log.h"
+
+/// direct install of user files (handle->direct_user): a file is unpacked next to its destination as
+/// <name>.new and renamed over the old file once the package is verified - there is no tmp_user copy,
+/// no move walk and no tmp cleanup walk
+///
+/// the package index is the rollback list: every user file of the package is either not written,
+/// still <name>.new or already renamed, so commit and rollback only go through the index entries
+/// the installed file is moved aside as <name>.old before <name>.new takes its place and removed once
+/// every file of the package is in place - commit failed half way is rolled back to the installed files,
+/// files the package adds are left
+/// deltas are rebuilt from the installed file, they are still unpacked to tmp_user
+
+#define DIRECT_NEW_EXTENSION ".new"
+#define DIRECT_OLD_EXTENSION ".old"
+
+/// entry of that name and destination is unpacked next to its destination
+bool direct_entry(const struct update_handle_s *handle, const char *name, unsigned char dest);
+
+/// where the entry is unpacked to: {update_user}/{name}.new, caller frees
+char *direct_path(const struct update_handle_s *handle, const char *name);
+
+/// unpack current entry of the archive to direct_path, md5 of the data is stored in ctx->md5
+int direct_unpack(const struct update_handle_s *handle, struct tar_ctx *ctx, const mtar_header_t *header);
+
+/// rename unpacked files over the installed ones, files already renamed by an interrupted update are skipped
+/// the installed files are kept until all the files are renamed, failed commit is undone by direct_rollback
+bool direct_commit(const struct update_handle_s *handle, const struct tar_index_s *index);
+
+/// remove the files not renamed yet and put back the installed ones moved aside by direct_commit
+void direct_rollback(const struct update_handle_s *handle, const struct tar_index_s *index);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,117 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <common/lz4_frame.h>
+#include <hal/security.h>
+#include <hal/hwcrypt/signature.h>
+#include "priv_fingerprint.h"
+
+static uint32_t record_checksum(const struct fingerprint_record_s *record) {
+    return lz4_xxh32(record, offsetof(struct fingerprint_record_s, checksum), 0);
+}
+
+static bool archive_size(const char *package, uint32_t *size) {
+    struct stat st;
+    if (stat(package, &st) != 0) {
+        return false;
+    }
+    *size = (uint32_t) st.st_size;
+    return true;
+}
+
+static bool record_load(const char *path, struct fingerprint_record_s *record) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    const bool complete = read(fd, record, sizeof *record) == (ssize_t) sizeof *record;
+    close(fd);
+    if (!complete || memcmp(record->magic, FINGERPRINT_MAGIC, FINGERPRINT_MAGIC_SIZE) != 0 ||
+        record->checksum != record_checksum(record)) {
+        debug_log("Fingerprint: %s is corrupted", path);
+        return false;
+    }
+    return true;
+}
+
+/// same hash as the recorded one, from the signature if there is a valid one
+static bool hash_matches(const char *package, const struct sha256_hash *recorded) {
+    if (!sec_configuration_is_open()) {
+        const char sig_ext[] = ".sig";
+        char *signature = malloc(strlen(package) + sizeof sig_ext);
+        if (signature == NULL) {
+            return false;
+        }
+        sprintf(signature, "%s%s", package, sig_ext);
+        const int err = sec_verify_hash(recorded, signature);
+        free(signature);
+        if (err == sec_verify_ok) {
+            return true;
+        }
+        debug_log("Fingerprint: signature doesn't match recorded hash: %d", err);
+    }
+    struct sha256_hash hash;
+    if (sha256_file(package, &hash) != 0) {
+        debug_log("Fingerprint: unable to hash %s", package);
+        return false;
+    }
+    return memcmp(hash.value, recorded->value, sizeof hash.value) == 0;
+}
+
+bool fingerprint_applied(const char *path, const char *package, const struct tar_index_s *index) {
+    struct fingerprint_record_s record;
+    uint32_t size = 0;
+    if (path == NULL || !record_load(path, &record)) {
+        return false;
+    }
+    if (record.package_id != tar_index_id(index) || record.package_bytes != index->total_bytes ||
+        !archive_size(package, &size) || record.archive_size != size) {
+        debug_log("Fingerprint: package differs from the last applied one");
+        return false;
+    }
+    if (!hash_matches(package, &record.hash)) {
+        debug_log("Fingerprint: package content differs from the last applied one");
+        return false;
+    }
+    return true;
+}
+
+bool fingerprint_record(const char *path,
+                        const char *package,
+                        const struct tar_index_s *index,
+                        const struct sha256_hash *hash) {
+    struct fingerprint_record_s record;
+    memset(&record, 0, sizeof record);
+    memcpy(record.magic, FINGERPRINT_MAGIC, FINGERPRINT_MAGIC_SIZE);
+    record.package_id = tar_index_id(index);
+    record.package_bytes = index->total_bytes;
+    record.hash = *hash;
+    if (!archive_size(package, &record.archive_size)) {
+        return false;
+    }
+    record.checksum = record_checksum(&record);
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (fd < 0) {
+        debug_log("Fingerprint: unable to open %s: %d", path, errno);
+        return false;
+    }
+    bool ret = write(fd, &record, sizeof record) == (ssize_t) sizeof record;
+    ret = close(fd) == 0 && ret;
+    if (!ret) {
+        debug_log("Fingerprint: unable to write %s: %d", path, errno);
+        unlink(path);
+    }
+    return ret;
+}
+
+void fingerprint_remove(const char *path) {
+    if (path != NULL && unlink(path) != 0 && errno != ENOENT) {
+        debug_log("Fingerprint: unable to remove %s: %d", path, errno);
+    }
+}
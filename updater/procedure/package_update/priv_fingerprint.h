@@ -0,0 +1,48 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <common/tar.h>
+#include <hal/hwcrypt/sha256.h>
+
+#include "update.h"
+#include "common/log.h"
+
+/// fingerprint of the last applied package - the same package requested again (e.g. the os didn't
+/// read the status before a crash) is reported as applied instead of going through backup, unpack and move
+
+#define FINGERPRINT_MAGIC "PUFPRT1"
+#define FINGERPRINT_MAGIC_SIZE 8
+
+/// fingerprint file content
+struct fingerprint_record_s {
+    char magic[FINGERPRINT_MAGIC_SIZE];
+    uint32_t package_id;     /// tar_index_id of the package - other packages are told apart without reading data
+    uint32_t package_bytes;  /// size of package files
+    uint32_t archive_size;   /// size of the package file
+    struct sha256_hash hash; /// sha256 of the whole package, calculated for the signature check
+    uint32_t checksum;       /// xxh32 of the fields above
+};
+
+/// package is the one recorded: its index and size match the record and so does its sha256
+/// signed package is checked with its signature against the recorded hash - no package data is read,
+/// otherwise the package is hashed
+bool fingerprint_applied(const char *path, const char *package, const struct tar_index_s *index);
+
+/// record applied package with its hash
+bool fingerprint_record(const char *path,
+                        const char *package,
+                        const struct tar_index_s *index,
+                        const struct sha256_hash *hash);
+
+/// installed files don't come from a single package any more
+void fingerprint_remove(const char *path);
+
+#ifdef __cplusplus
+}
+#endif
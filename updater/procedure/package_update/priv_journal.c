@@ -0,0 +1,232 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <common/delta.h>
+#include <common/lz4_frame.h>
+#include <common/match.h>
+#include <common/stream.h>
+#include "priv_journal.h"
+#include "priv_update.h"
+#include "priv_direct.h"
+
+static uint32_t record_checksum(const struct journal_record_s *record) {
+    return lz4_xxh32(record, offsetof(struct journal_record_s, checksum), 0);
+}
+
+/// xxh32 of the signature file next to the package, 0 when there is none
+static uint32_t signature_id(const char *package) {
+    const char sig_ext[] = ".sig";
+    /// signature file is a few hundred bytes, longer one is told apart by its size as well
+    unsigned char data[1024];
+    char *signature = malloc(strlen(package) + sizeof sig_ext);
+    if (signature == NULL) {
+        return 0;
+    }
+    sprintf(signature, "%s%s", package, sig_ext);
+    const int fd = open(signature, O_RDONLY);
+    free(signature);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    const ssize_t size = fstat(fd, &st) == 0 ? read(fd, data, sizeof data) : -1;
+    close(fd);
+    return size > 0 ? lz4_xxh32(data, (size_t) size, (uint32_t) st.st_size) : 0;
+}
+
+/// false when the package archive can't be stat'ed - the journal can't be bound to it
+static bool record_reset(struct journal_record_s *record, const char *package, const struct tar_index_s *index) {
+    memset(record, 0, sizeof *record);
+    memcpy(record->magic, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE);
+    record->package_id = tar_index_id(index);
+    record->package_bytes = index->total_bytes;
+    record->last_file = JOURNAL_NO_FILE;
+    struct stat st;
+    if (package == NULL || stat(package, &st) != 0) {
+        return false;
+    }
+    record->archive_size = (uint32_t) st.st_size;
+    record->content_id = index->content_id;
+    record->signature_id = signature_id(package);
+    return true;
+}
+
+static bool journal_write(struct journal_s *journal) {
+    journal->record.checksum = record_checksum(&journal->record);
+    journal->unjournaled = 0;
+    int fd = open(journal->path, O_WRONLY | O_CREAT | O_TRUNC);
+    if (fd < 0) {
+        debug_log("Journal: unable to open %s: %d", journal->path, errno);
+        return false;
+    }
+    bool ret = write(fd, &journal->record, sizeof journal->record) == (ssize_t) sizeof journal->record;
+    /// record has to be on the storage before the update goes on
+    ret = fsync(fd) == 0 && ret;
+    ret = close(fd) == 0 && ret;
+    if (!ret) {
+        debug_log("Journal: unable to write %s: %d", journal->path, errno);
+    }
+    return ret;
+}
+
+void journal_open(struct journal_s *journal,
+                  const char *path,
+                  const char *package,
+                  const struct tar_index_s *index) {
+    memset(journal, 0, sizeof *journal);
+    journal->path = path;
+    const bool stamped = record_reset(&journal->record, package, index);
+    if (path == NULL) {
+        return;
+    }
+    if (!stamped) {
+        debug_log("Journal: unable to stat package %s, update starts over", package ? package : "");
+        journal_remove(journal);
+        return;
+    }
+    /// same layout and sizes, different data - nothing but the signature or the digests tells it apart
+    if (journal->record.signature_id == 0 && !index->digests) {
+        debug_log("Journal: package has no signature nor digests, update isn't resumed");
+        journal_remove(journal);
+        journal->path = NULL;
+        return;
+    }
+
+    struct journal_record_s record;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return;
+    }
+    const bool complete = read(fd, &record, sizeof record) == (ssize_t) sizeof record;
+    close(fd);
+
+    if (!complete || memcmp(record.magic, JOURNAL_MAGIC, JOURNAL_MAGIC_SIZE) != 0 ||
+        record.checksum != record_checksum(&record)) {
+        debug_log("Journal: %s is corrupted, update starts over", path);
+        journal_remove(journal);
+        return;
+    }
+    if (record.package_id != journal->record.package_id || record.package_bytes != journal->record.package_bytes ||
+        record.archive_size != journal->record.archive_size ||
+        record.content_id != journal->record.content_id ||
+        record.signature_id != journal->record.signature_id) {
+        debug_log("Journal: %s is of another package, update starts over", path);
+        journal_remove(journal);
+        return;
+    }
+    journal->record = record;
+    debug_log("Journal: resuming update, phases: 0x%x, entry: %u", record.phases, record.entry);
+}
+
+bool journal_has(const struct journal_s *journal, enum journal_phase_e phase) {
+    return journal->path != NULL && (journal->record.phases & phase) == (uint32_t) phase;
+}
+
+bool journal_phase(struct journal_s *journal, enum journal_phase_e phase) {
+    if (journal->path == NULL) {
+        return true;
+    }
+    journal->record.phases |= phase;
+    if (phase & JournalCatalog) {
+        /// catalogs are empty - unpack starts over
+        journal->record.entry = 0;
+        journal->record.offset = 0;
+        journal->record.last_file = JOURNAL_NO_FILE;
+    }
+    return journal_write(journal);
+}
+
+bool journal_entry(struct journal_s *journal,
+                   const struct tar_index_s *index,
+                   size_t entry,
+                   size_t bytes,
+                   const unsigned char *md5) {
+    if (journal->path == NULL || index == NULL || entry >= index->count) {
+        return true;
+    }
+    struct journal_record_s *record = &journal->record;
+    if (md5 != NULL) {
+        record->last_file = entry;
+        memcpy(record->md5, md5, TAR_MD5_SIZE);
+    }
+    record->entry = entry + 1;
+    record->offset = record->entry < index->count ? index->entries[record->entry].offset : 0;
+    journal->unjournaled += bytes;
+    if (journal->unjournaled < JOURNAL_INTERVAL_BYTES || record->entry >= index->count) {
+        return true;
+    }
+    return journal_write(journal);
+}
+
+/// md5 of the file unpacked from the entry, delta entries are unpacked without the extension
+/// and direct user files with the .new one, see priv_direct.h
+static bool tmp_file_md5(const struct update_handle_s *handle,
+                         const struct tar_index_s *index,
+                         const struct tar_index_entry_s *entry,
+                         unsigned char md5[TAR_MD5_SIZE]) {
+    const char *name = tar_index_name(index, entry);
+    const char *dir = entry->dest == UnpackDestOs ? handle->tmp_os : handle->tmp_user;
+    size_t name_len = strlen(name);
+    if (string_match_end(name, DELTA_EXTENSION)) {
+        name_len -= strlen(DELTA_EXTENSION);
+    }
+    const bool direct = direct_entry(handle, name, entry->dest);
+    char *path = direct ? direct_path(handle, name) : malloc(strlen(dir) + name_len + 2);
+    if (path == NULL) {
+        return false;
+    }
+    if (!direct) {
+        sprintf(path, "%s/%.*s", dir, (int) name_len, name);
+    }
+
+    struct stream_source_s source;
+    struct stream_stage_s hash;
+    size_t size = 0;
+    stream_md5_stage(&hash, md5);
+    int ret = stream_file_source(&source, path, NULL, STREAM_BUFFER_SIZE);
+    free(path);
+    if (ret == ErrorStreamOk) {
+        ret = stream_run(&source, &hash, 1, &size);
+    }
+    stream_source_close(&source);
+    stream_stage_close(&hash);
+    /// delta rebuilt file size is not the entry size
+    return ret == ErrorStreamOk && (size == entry->size || string_match_end(name, DELTA_EXTENSION));
+}
+
+size_t journal_resume(struct journal_s *journal,
+                      const struct update_handle_s *handle,
+                      const struct tar_index_s *index) {
+    const struct journal_record_s *record = &journal->record;
+    journal->resume = 0;
+    if (!journal_has(journal, JournalCatalog) || journal_has(journal, JournalUnpacked) || record->entry == 0) {
+        return 0;
+    }
+    if (record->entry >= index->count || index->entries[record->entry].offset != record->offset) {
+        debug_log("Journal: entry %u out of package, unpack starts over", record->entry);
+        return 0;
+    }
+    if (record->last_file != JOURNAL_NO_FILE) {
+        unsigned char md5[TAR_MD5_SIZE];
+        if (record->last_file >= record->entry ||
+            !tmp_file_md5(handle, index, &index->entries[record->last_file], md5) ||
+            memcmp(md5, record->md5, TAR_MD5_SIZE) != 0) {
+            debug_log("Journal: last unpacked file doesn't match, unpack starts over");
+            return 0;
+        }
+    }
+    journal->resume = record->entry;
+    debug_log("Journal: unpack continues from entry %u", record->entry);
+    return journal->resume;
+}
+
+void journal_remove(struct journal_s *journal) {
+    if (journal->path != NULL && unlink(journal->path) != 0 && errno != ENOENT) {
+        debug_log("Journal: unable to remove %s: %d", journal->path, errno);
+    }
+}
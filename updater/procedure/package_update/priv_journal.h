@@ -0,0 +1,91 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <common/tar.h>
+
+#include "update.h"
+#include "common/log.h"
+
+/// write-ahead record of the update progress, so an update interrupted by power loss
+/// continues where it stopped instead of starting from the backup again
+
+#define JOURNAL_MAGIC "PUJRNL3"
+#define JOURNAL_MAGIC_SIZE 8
+/// unpacked data between journal writes - at most that much is unpacked again after power loss
+#define JOURNAL_INTERVAL_BYTES (1024 * 1024)
+/// no file completed yet
+#define JOURNAL_NO_FILE UINT32_MAX
+
+/// completed update phases
+enum journal_phase_e {
+    JournalBackup = 1 << 0,   /// backup written or not required
+    JournalCatalog = 1 << 1,  /// tmp catalogs created, unpack in progress
+    JournalUnpacked = 1 << 2, /// whole package unpacked
+    JournalVerified = 1 << 3, /// package verified, files are being moved
+    JournalUnsigned = 1 << 4, /// signature check result - package is not signed
+};
+
+/// journal file content
+struct journal_record_s {
+    char magic[JOURNAL_MAGIC_SIZE];
+    uint32_t package_id;           /// hash of the package index - journal of another package is dropped
+    uint32_t package_bytes;        /// size of package files
+    uint32_t archive_size;         /// size of the package archive
+    uint32_t content_id;           /// tar_index_s content_id - entry headers and declared digests
+    uint32_t signature_id;         /// xxh32 of the package signature file, 0 without one
+    uint32_t phases;               /// journal_phase_e bits
+    uint32_t entry;                /// index entry unpack continues from
+    uint32_t offset;               /// archive offset of that entry
+    uint32_t last_file;            /// index entry of the last unpacked file, JOURNAL_NO_FILE if none
+    unsigned char md5[TAR_MD5_SIZE]; /// md5 of the last unpacked file
+    uint32_t checksum;             /// xxh32 of the fields above
+};
+
+struct journal_s {
+    const char *path; /// NULL - journal disabled, nothing is written and nothing resumed
+    struct journal_record_s record;
+    size_t unjournaled; /// bytes unpacked since the last write
+    size_t resume;      /// index entry unpack continues from, see journal_resume
+};
+
+/// load journal of the package, journal of other package or corrupted one is started over
+/// the package is told apart by its index, its headers and the archive file - rebuilt package with the same
+/// layout and sizes is another package
+/// tmp files are resumed only for a package bound to its content: by the signature file or by the digests
+/// of every file in the index, the journal of other packages is disabled
+void journal_open(struct journal_s *journal,
+                  const char *path,
+                  const char *package,
+                  const struct tar_index_s *index);
+
+bool journal_has(const struct journal_s *journal, enum journal_phase_e phase);
+
+/// record completed phase, JournalCatalog drops the unpack progress
+bool journal_phase(struct journal_s *journal, enum journal_phase_e phase);
+
+/// record unpacked index entry - written every JOURNAL_INTERVAL_BYTES of unpacked data
+/// md5 is the digest of the entry file, NULL when nothing was written to tmp for the entry
+bool journal_entry(struct journal_s *journal,
+                   const struct tar_index_s *index,
+                   size_t entry,
+                   size_t bytes,
+                   const unsigned char *md5);
+
+/// find index entry to continue unpack from and store it in journal->resume
+/// 0 when there is nothing to resume or the last journaled file in tmp doesn't match its digest
+size_t journal_resume(struct journal_s *journal,
+                      const struct update_handle_s *handle,
+                      const struct tar_index_s *index);
+
+/// update finished or failed - next one starts from the beginning
+void journal_remove(struct journal_s *journal);
+
+#ifdef __cplusplus
+}
+#endif
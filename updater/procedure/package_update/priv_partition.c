@@ -0,0 +1,191 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <hal/blk_dev.h>
+#include <hal/tinyvfs.h>
+#include <common/sparse.h>
+#include <common/stream.h>
+#include "priv_partition.h"
+
+/// highest partition number blk_disk_handle takes
+#define PARTITION_MAX 31
+
+bool partition_image_name(const char *name, unsigned *partition) {
+    if (strncmp(name, "./", 2) == 0) {
+        name += 2;
+    }
+    if (strncmp(name, PARTITION_IMAGE_PREFIX, strlen(PARTITION_IMAGE_PREFIX)) != 0) {
+        return false;
+    }
+    name += strlen(PARTITION_IMAGE_PREFIX);
+    char *end = NULL;
+    const unsigned long number = strtoul(name, &end, 10);
+    if (end == name || *name < '0' || *name > '9' || strcmp(end, PARTITION_IMAGE_EXTENSION) != 0 ||
+        number > PARTITION_MAX) {
+        return false;
+    }
+    *partition = number;
+    return true;
+}
+
+bool partition_image_allowed(const struct update_handle_s *handle, unsigned partition) {
+    return partition <= PARTITION_MAX && (handle->image_partitions & (1u << partition)) != 0;
+}
+
+int partition_image_hash(struct tar_ctx *ctx) {
+    struct stream_source_s source;
+    struct stream_stage_s hash;
+    stream_tar_source(&source, ctx);
+    stream_md5_stage(&hash, ctx->md5);
+    const int ret = stream_run(&source, &hash, 1, NULL);
+    stream_stage_close(&hash);
+    stream_source_close(&source);
+    if (ret != ErrorStreamOk) {
+        debug_log("Partition: failed to hash image: %s", stream_strerror(ret));
+        memset(ctx->md5, 0, sizeof ctx->md5);
+        return -EIO;
+    }
+    return 0;
+}
+
+static int sparse_feed(void *arg, const void *data, size_t size) {
+    return sparse_apply_feed(arg, data, size);
+}
+
+/// stream the entry through the image writer, its data md5 on the way
+static int write_image(struct tar_ctx *ctx, struct sparse_apply_s *sparse) {
+    struct stream_source_s source;
+    struct stream_stage_s stages[2];
+    stream_tar_source(&source, ctx);
+    stream_md5_stage(&stages[0], ctx->md5);
+    stream_callback_stage(&stages[1], sparse_feed, sparse);
+    const int ret = stream_run(&source, stages, 2, NULL);
+    stream_stage_close(&stages[0]);
+    stream_stage_close(&stages[1]);
+    stream_source_close(&source);
+    if (ret == ErrorStreamRead) {
+        debug_log("Partition: failed to read image from archive");
+        return ErrorSparseIo;
+    }
+    if (sparse->error != ErrorSparseOk) {
+        return sparse->error;
+    }
+    return ret == ErrorStreamOk ? sparse_apply_finish(sparse) : ErrorSparseIo;
+}
+
+/// write current entry of the archive to the partition, md5 of the entry data is stored in ctx->md5
+static int image_write(struct tar_ctx *ctx, const mtar_header_t *header, unsigned partition) {
+    memset(ctx->md5, 0, sizeof ctx->md5);
+    const int device = blk_disk_handle(blkdev_emmc_user, partition);
+    debug_log("Partition: writing image (%d.%dkb) to partition %u", header->size / 1024, header->size % 1024,
+              partition);
+
+    const int unmounted = vfs_unmount_device(device);
+    if (unmounted < 0) {
+        debug_log("Partition: unable to unmount partition %u: %d", partition, unmounted);
+        return unmounted;
+    }
+
+    struct sparse_apply_s sparse;
+    int ret = sparse_apply_init(&sparse, device);
+    if (ret == ErrorSparseOk) {
+        ret = write_image(ctx, &sparse);
+    }
+    if (ret == ErrorSparseOk) {
+        ret = sparse_apply_verify(&sparse);
+    }
+    sparse_apply_deinit(&sparse);
+
+    if (unmounted > 0) {
+        const int err = vfs_remount_device(device);
+        if (err) {
+            debug_log("Partition: partition %u doesn't mount after the write: %d", partition, err);
+            ret = ret == ErrorSparseOk ? ErrorSparseVerify : ret;
+        }
+    }
+    if (ret != ErrorSparseOk) {
+        debug_log("Partition: image of partition %u failed: %s", partition, sparse_strerror(ret));
+        memset(ctx->md5, 0, sizeof ctx->md5);
+        return -EIO;
+    }
+    return 0;
+}
+
+static const unsigned char *image_digest(const struct manifest_s *manifest, const char *name) {
+    return manifest != NULL && manifest->count > 0 ? manifest_find(manifest, name) : NULL;
+}
+
+/// hash the entry, compare it with its digest and only then write it
+/// without a digest (unpack resumed, package without manifest) the hash read before the write is the digest
+static int image_entry_write(struct tar_ctx *ctx,
+                             const struct tar_index_entry_s *entry,
+                             const char *name,
+                             const unsigned char *md5,
+                             unsigned partition) {
+    mtar_header_t header;
+    if (tar_seek_entry(ctx, entry) != ErrorTarOk || tar_read_header(ctx, &header) != ErrorTarOk ||
+        partition_image_hash(ctx) != 0) {
+        debug_log("Partition: unable to read %s from package", name);
+        return -EIO;
+    }
+    if (md5 != NULL && memcmp(ctx->md5, md5, MANIFEST_MD5_SIZE) != 0) {
+        debug_log("Partition: %s doesn't match its digest", name);
+        return -EBADMSG;
+    }
+    unsigned char expected[MANIFEST_MD5_SIZE];
+    memcpy(expected, ctx->md5, sizeof expected);
+    if (tar_seek_entry(ctx, entry) != ErrorTarOk || tar_read_header(ctx, &header) != ErrorTarOk) {
+        debug_log("Partition: unable to read %s from package", name);
+        return -EIO;
+    }
+    int ret = image_write(ctx, &header, partition);
+    if (ret == 0 && memcmp(ctx->md5, expected, sizeof expected) != 0) {
+        debug_log("Partition: %s changed while it was written", name);
+        ret = -EBADMSG;
+    }
+    return ret;
+}
+
+bool partition_images_write(const struct update_handle_s *handle,
+                            const struct tar_index_s *index,
+                            const struct manifest_s *declared,
+                            const struct manifest_s *hashed) {
+    struct tar_ctx ctx;
+    bool opened = false;
+    int ret = 0;
+    for (size_t i = 0; ret == 0 && i < index->count; ++i) {
+        const struct tar_index_entry_s *entry = &index->entries[i];
+        const char *name = tar_index_name(index, entry);
+        unsigned partition = 0;
+        if (entry->type != MTAR_TREG || !partition_image_name(name, &partition)) {
+            continue;
+        }
+        const unsigned char *md5 = image_digest(declared, name);
+        if (md5 == NULL) {
+            md5 = image_digest(hashed, name);
+        }
+        if (handle->unsigned_tar) {
+            debug_log("Partition: %s not written, package is not signed", name);
+            ret = -EPERM;
+        } else if (!partition_image_allowed(handle, partition)) {
+            debug_log("Partition: raw image of partition %u is not allowed", partition);
+            ret = -EPERM;
+        } else {
+            if (!opened) {
+                opened = true;
+                if (tar_init(&ctx, handle->update_from, "r") != ErrorTarOk) {
+                    debug_log("Partition: unable to open package %s", handle->update_from);
+                    ret = -EIO;
+                }
+            }
+            if (ret == 0) {
+                ret = image_entry_write(&ctx, entry, name, md5, partition);
+            }
+        }
+    }
+    /// failed init keeps what it took as well
+    if (opened) {
+        tar_deinit(&ctx);
+    }
+    return ret == 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <common/tar.h>
+#include <common/manifest.h>
+
+#include "update.h"
+#include "common/log.h"
+
+/// raw partition images: package entry partition<N>.img is a sparse image (see common/sparse.h) written
+/// straight to partition N of the eMMC user area - it's not unpacked to tmp, doesn't take space on the
+/// filesystems and isn't moved
+///
+/// nothing can undo the write, so the unpack only hashes the image: it's written by partition_images_write
+/// once the package is verified, the data is hashed again and compared with the digest before the partition
+/// is touched
+/// mounted partition is unmounted for the write and mounted again after, the written data is read back
+/// and compared with the image digest; there is no backup of the partition, failed write fails the update
+
+#define PARTITION_IMAGE_PREFIX "partition"
+#define PARTITION_IMAGE_EXTENSION ".img"
+
+/// entry name is a partition image, partition number stored in partition
+bool partition_image_name(const char *name, unsigned *partition);
+
+/// partition can be written with a raw image, see update_handle_s image_partitions
+bool partition_image_allowed(const struct update_handle_s *handle, unsigned partition);
+
+/// md5 of the current entry data stored in ctx->md5, nothing is written
+int partition_image_hash(struct tar_ctx *ctx);
+
+/// write the images of the verified package to their partitions
+/// image digest is taken from declared (the package manifest) or hashed (sorted, calculated by the unpack),
+/// image not matching it isn't written, neither is any image of unsigned package
+bool partition_images_write(const struct update_handle_s *handle,
+                            const struct tar_index_s *index,
+                            const struct manifest_s *declared,
+                            const struct manifest_s *hashed);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,218 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <common/delta.h>
+#include <common/match.h>
+#include <common/path_opts.h>
+#include <common/stream.h>
+#include "priv_ram_stage.h"
+#include "priv_partition.h"
+#include "priv_update.h"
+
+/// staged file is written next to the old one and renamed over it
+static const char ram_stage_new_ext[] = ".new";
+
+/// package entry name without leading ./ and trailing /
+static char *stage_name(const char *name) {
+    if (strncmp(name, "./", 2) == 0) {
+        name += 2;
+    }
+    char *out = strdup(name);
+    if (out != NULL) {
+        path_remove_trailing_slash(out);
+    }
+    return out;
+}
+
+bool ram_stage_eligible(const struct update_handle_s *handle,
+                        const struct tar_index_s *index,
+                        const struct journal_s *journal) {
+    if (handle->stage_budget == 0) {
+        return false;
+    }
+    if (index->total_bytes > handle->stage_budget) {
+        debug_log("Stage: package files (%u bytes) exceed RAM budget (%u bytes)", index->total_bytes,
+                  handle->stage_budget);
+        return false;
+    }
+    if (journal_has(journal, JournalCatalog) || journal_has(journal, JournalUnpacked) ||
+        journal_has(journal, JournalVerified)) {
+        debug_log("Stage: interrupted unpack to tmp is continued");
+        return false;
+    }
+    for (size_t i = 0; i < index->count; ++i) {
+        const char *name = tar_index_name(index, &index->entries[i]);
+        unsigned partition;
+        if (partition_image_name(name, &partition)) {
+            debug_log("Stage: %s is written straight to partition %u", name, partition);
+            return false;
+        }
+        if (string_match_end(name, DELTA_EXTENSION) || strcmp(path_basename_const(name), "SRK_fuses.bin") == 0) {
+            debug_log("Stage: %s has to be unpacked to tmp", name);
+            return false;
+        }
+    }
+    return true;
+}
+
+void ram_stage_init(struct ram_stage_s *stage, size_t budget) {
+    memset(stage, 0, sizeof *stage);
+    stage->budget = budget;
+}
+
+static struct ram_stage_entry_s *stage_append(struct ram_stage_s *stage) {
+    if (stage->count == stage->capacity) {
+        const size_t capacity = stage->capacity ? stage->capacity * 2 : 32;
+        struct ram_stage_entry_s *entries = realloc(stage->entries, capacity * sizeof *entries);
+        if (entries == NULL) {
+            return NULL;
+        }
+        stage->entries = entries;
+        stage->capacity = capacity;
+    }
+    struct ram_stage_entry_s *entry = &stage->entries[stage->count];
+    memset(entry, 0, sizeof *entry);
+    return entry;
+}
+
+int ram_stage_add(struct ram_stage_s *stage,
+                  struct tar_ctx *ctx,
+                  const mtar_header_t *header,
+                  unsigned char dest,
+                  unsigned char md5[16]) {
+    if (header->type == MTAR_TREG && header->size > stage->budget - stage->bytes) {
+        debug_log("Stage: %s exceeds RAM budget", header->name);
+        stage->out_of_memory = true;
+        return -ENOMEM;
+    }
+    struct ram_stage_entry_s *entry = stage_append(stage);
+    char *name = stage_name(header->name);
+    unsigned char *data = header->type == MTAR_TREG ? malloc(header->size + 1) : NULL;
+    if (entry == NULL || name == NULL || (header->type == MTAR_TREG && data == NULL)) {
+        debug_log("Stage: unable to allocate %s (%u bytes)", header->name, header->size);
+        free(name);
+        free(data);
+        stage->out_of_memory = true;
+        return -ENOMEM;
+    }
+
+    if (header->type == MTAR_TREG) {
+        struct stream_source_s source;
+        struct stream_stage_s stages[2];
+        stream_tar_source(&source, ctx);
+        stream_memory_sink(&stages[0], data, header->size);
+        stream_md5_stage(&stages[1], md5);
+        const int ret = stream_run(&source, stages, 2, NULL);
+        stream_stage_close(&stages[1]);
+        stream_stage_close(&stages[0]);
+        stream_source_close(&source);
+        if (ret != ErrorStreamOk) {
+            debug_log("Stage: unable to read %s: %s", header->name, stream_strerror(ret));
+            free(name);
+            free(data);
+            return -EIO;
+        }
+        data[header->size] = '\0';
+    }
+
+    entry->name = name;
+    entry->type = header->type;
+    entry->dest = dest;
+    entry->data = data;
+    entry->size = header->type == MTAR_TREG ? header->size : 0;
+    stage->bytes += entry->size;
+    stage->count++;
+    return 0;
+}
+
+const struct ram_stage_entry_s *ram_stage_find(const struct ram_stage_s *stage, const char *name) {
+    if (strncmp(name, "./", 2) == 0) {
+        name += 2;
+    }
+    for (size_t i = 0; i < stage->count; ++i) {
+        if (stage->entries[i].type == MTAR_TREG && strcmp(stage->entries[i].name, name) == 0) {
+            return &stage->entries[i];
+        }
+    }
+    return NULL;
+}
+
+/// file written under temporary name first - old file is replaced only by complete data
+static int install_file(const struct ram_stage_entry_s *entry, const char *path) {
+    char *new_path = malloc(strlen(path) + sizeof ram_stage_new_ext);
+    if (new_path == NULL) {
+        return -ENOMEM;
+    }
+    sprintf(new_path, "%s%s", path, ram_stage_new_ext);
+
+    struct stream_source_s source;
+    struct stream_stage_s sink;
+    stream_memory_source(&source, entry->data, entry->size, STREAM_BUFFER_SIZE);
+    int ret = stream_file_sink(&sink, new_path);
+    if (ret == ErrorStreamOk) {
+        ret = stream_run(&source, &sink, 1, NULL);
+    }
+    stream_stage_close(&sink);
+    stream_source_close(&source);
+    if (ret != ErrorStreamOk) {
+        debug_log("Stage: unable to write %s: %s", new_path, stream_strerror(ret));
+        unlink(new_path);
+        free(new_path);
+        return -EIO;
+    }
+
+    struct stat st;
+    if (stat(path, &st) == 0 && unlink(path) != 0) {
+        debug_log("Stage: unable to remove old %s: %d", path, errno);
+        ret = -errno;
+    } else if (rename(new_path, path) != 0) {
+        debug_log("Stage: rename %s -> %s failed: %d", new_path, path, errno);
+        ret = -errno;
+    }
+    free(new_path);
+    return ret;
+}
+
+bool ram_stage_install(const struct ram_stage_s *stage, const char *os, const char *user) {
+    for (size_t i = 0; i < stage->count; ++i) {
+        const struct ram_stage_entry_s *entry = &stage->entries[i];
+        if (entry->name[0] == '\0' || strcmp(entry->name, ".") == 0) {
+            continue;
+        }
+        const char *root = entry->dest == UnpackDestOs ? os : user;
+        char *path = malloc(strlen(root) + strlen(entry->name) + 2);
+        if (path == NULL) {
+            return false;
+        }
+        sprintf(path, "%s/%s", root, entry->name);
+        int ret = 0;
+        if (entry->type == MTAR_TDIR) {
+            ret = mkdir(path, 0666);
+            if (ret != 0 && errno == EEXIST) {
+                ret = 0;
+            }
+        } else {
+            debug_log("Stage: installing %s (%u bytes)", path, entry->size);
+            ret = install_file(entry, path);
+        }
+        if (ret != 0) {
+            debug_log("Stage: unable to install %s: %d", path, errno);
+            free(path);
+            return false;
+        }
+        free(path);
+    }
+    return true;
+}
+
+void ram_stage_free(struct ram_stage_s *stage) {
+    for (size_t i = 0; i < stage->count; ++i) {
+        free(stage->entries[i].name);
+        free(stage->entries[i].data);
+    }
+    free(stage->entries);
+    memset(stage, 0, sizeof *stage);
+}
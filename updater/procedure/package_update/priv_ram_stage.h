@@ -0,0 +1,62 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <common/tar.h>
+
+#include "update.h"
+#include "priv_journal.h"
+#include "common/log.h"
+
+/// small package is unpacked to SDRAM instead of the tmp catalogs: it's verified in memory and
+/// only the final files are written to the storage - no tmp writes, no move and no tmp cleanup
+
+/// package file or catalog kept in RAM until the package is verified
+struct ram_stage_entry_s {
+    char *name;          /// package entry name without leading ./
+    unsigned char type;  /// MTAR_TREG or MTAR_TDIR
+    unsigned char dest;  /// unpack_dest_e
+    unsigned char *data; /// file data, zero terminated
+    size_t size;
+};
+
+struct ram_stage_s {
+    struct ram_stage_entry_s *entries;
+    size_t count;
+    size_t capacity;
+    size_t bytes;       /// file data held
+    size_t budget;      /// file data limit
+    bool out_of_memory; /// unpack failed on the budget or allocation, not on the package
+};
+
+/// package can be staged: its files fit in the budget, interrupted unpack to tmp isn't resumed,
+/// there are no deltas (built against files on the storage) and no keys to program (read from tmp)
+bool ram_stage_eligible(const struct update_handle_s *handle,
+                        const struct tar_index_s *index,
+                        const struct journal_s *journal);
+
+void ram_stage_init(struct ram_stage_s *stage, size_t budget);
+
+/// read current entry of the archive, md5 of a file is stored in md5
+int ram_stage_add(struct ram_stage_s *stage,
+                  struct tar_ctx *ctx,
+                  const mtar_header_t *header,
+                  unsigned char dest,
+                  unsigned char md5[16]);
+
+/// staged entry by name (without leading ./), NULL if not found
+const struct ram_stage_entry_s *ram_stage_find(const struct ram_stage_s *stage, const char *name);
+
+/// write staged catalogs and files to the destinations, old files are replaced
+bool ram_stage_install(const struct ram_stage_s *stage, const char *os, const char *user);
+
+void ram_stage_free(struct ram_stage_s *stage);
+
+#ifdef __cplusplus
+}
+#endif
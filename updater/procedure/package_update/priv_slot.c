@@ -0,0 +1,112 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <common/boot_slot.h>
+#include <common/path_opts.h>
+#include <common/stream.h>
+#include <procedure/backup/dir_walker.h>
+#include "priv_slot.h"
+#include "priv_tmp.h"
+
+struct slot_copy_s {
+    const char *from;
+    const char *to;
+    size_t copied;
+};
+
+static int copy_file(const char *from, const char *to) {
+    struct stream_source_s source;
+    struct stream_stage_s sink;
+    int ret = stream_file_source(&source, from, NULL, STREAM_BUFFER_SIZE);
+    if (ret == ErrorStreamOk) {
+        ret = stream_file_sink(&sink, to);
+        if (ret == ErrorStreamOk) {
+            ret = stream_run(&source, &sink, 1, NULL);
+        }
+        stream_stage_close(&sink);
+    }
+    stream_source_close(&source);
+    if (ret != ErrorStreamOk) {
+        debug_log("Slot: copy %s -> %s failed: %s", from, to, stream_strerror(ret));
+        unlink(to);
+        return -EIO;
+    }
+    return 0;
+}
+
+/// files already in the new slot come from the package, the rest is what the package doesn't bring
+static int copy_missing_callback(const char *path, enum dir_handling_type_e what, struct dir_handler_s *h, void *d) {
+    struct slot_copy_s *data = d;
+    const char *relative = path + strlen(h->root_catalog);
+    char *to = malloc(strlen(data->to) + strlen(relative) + 1);
+    if (to == NULL) {
+        return -ENOMEM;
+    }
+    sprintf(to, "%s%s", data->to, relative);
+
+    int ret = 0;
+    struct stat st;
+    if (what == DirHandlingDir) {
+        ret = mkdir(to, 0666);
+        if (ret != 0 && errno == EEXIST) {
+            ret = 0;
+        }
+    } else if (stat(to, &st) != 0) {
+        debug_log("Slot: keeping %s", relative);
+        ret = copy_file(path, to);
+        data->copied++;
+    }
+    free(to);
+    return ret;
+}
+
+bool slot_prepare(const struct update_handle_s *handle) {
+    debug_log("Slot: clearing inactive slot %s", handle->tmp_os);
+    return tmp_recreate_catalog(handle->tmp_os);
+}
+
+bool slot_activate(const struct update_handle_s *handle) {
+    struct slot_copy_s data = {.from = handle->update_os, .to = handle->tmp_os};
+    struct dir_handler_s walk;
+    memset(&walk, 0, sizeof walk);
+    unsigned int recursion_limit = 100;
+
+    /// nothing to keep when the active slot was never created
+    if (path_check_if_exists(handle->update_os)) {
+        recursive_dir_walker_init(&walk, copy_missing_callback, &data);
+        recursive_dir_walker(handle->update_os, &walk, &recursion_limit);
+        recursive_dir_walker_deinit(&walk);
+        if (walk.error) {
+            debug_log("Slot: unable to complete %s: %s", handle->tmp_os, dir_handling_strerror(walk.error));
+            return false;
+        }
+        debug_log("Slot: %u files kept from %s", data.copied, handle->update_os);
+    }
+
+    /// .boot.json delivered with the new os is the base of the switched one
+    const char boot_json_name[] = "/.boot.json";
+    char *template_json = malloc(strlen(handle->tmp_os) + sizeof boot_json_name);
+    if (template_json == NULL) {
+        return false;
+    }
+    sprintf(template_json, "%s%s", handle->tmp_os, boot_json_name);
+    const int ret = boot_slot_switch(handle->boot_json,
+                                     path_check_if_exists(template_json) ? template_json : NULL,
+                                     path_basename_const(handle->tmp_os));
+    free(template_json);
+    if (ret != ErrorBootSlotOk) {
+        debug_log("Slot: unable to activate %s: %s", handle->tmp_os, boot_slot_strerror(ret));
+        return false;
+    }
+    return true;
+}
+
+void slot_discard(const struct update_handle_s *handle) {
+    debug_log("Slot: clearing partial os in %s", handle->tmp_os);
+    if (!tmp_recreate_catalog(handle->tmp_os)) {
+        debug_log("Slot: unable to clear %s", handle->tmp_os);
+    }
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+
+#include "update.h"
+#include "common/log.h"
+
+/// A/B os slots, see common/boot_slot.h - os files are unpacked straight into the inactive slot
+/// (handle->tmp_os) and the active slot (handle->update_os) is left untouched as the backup of the os
+
+/// create the inactive slot empty, the os it held is removed
+/// the tmp catalog setup does it for the update unpacked to tmp
+bool slot_prepare(const struct update_handle_s *handle);
+
+/// copy the files not in the package from the active slot and switch .boot.json to the inactive slot
+/// os files of the package are never skipped as installed with slots, see unpack
+bool slot_activate(const struct update_handle_s *handle);
+
+/// failed update - the inactive slot holds a partial os, it's left empty so nothing starts or reuses it
+void slot_discard(const struct update_handle_s *handle);
+
+#ifdef __cplusplus
+}
+#endif
@@ -0,0 +1,142 @@
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <sys/statvfs.h>
+#include "priv_space.h"
+#include "priv_partition.h"
+#include "priv_update.h"
+
+enum space_target_e {
+    SpaceTargetOs,
+    SpaceTargetUser,
+    SpaceTargetBackup,
+    SpaceTargetCount,
+};
+
+/// filesystem that has to take part of the update data
+struct space_target_s {
+    const char *name;
+    char *path;                  /// any path on the filesystem
+    struct statvfs stat;
+    unsigned long long required; /// bytes, summed up for targets sharing the filesystem
+    bool used;
+};
+
+static void space_targets_clean_up(struct space_target_s (*targets)[SpaceTargetCount]) {
+    for (size_t i = 0; i < SpaceTargetCount; ++i) {
+        free((*targets)[i].path);
+    }
+}
+
+/// catalog of the file - backup archive may not exist yet, its catalog does
+static char *parent_catalog(const char *path) {
+    char *parent = strdup(path);
+    if (parent == NULL) {
+        return NULL;
+    }
+    char *slash = strrchr(parent, '/');
+    if (slash == parent) {
+        slash[1] = '\0';
+    } else if (slash != NULL) {
+        *slash = '\0';
+    }
+    return parent;
+}
+
+/// no filesystem id available on target - same geometry and usage means the same filesystem
+/// for different filesystems this can only overestimate the space needed
+static bool same_filesystem(const struct statvfs *lhs, const struct statvfs *rhs) {
+    return lhs->f_frsize == rhs->f_frsize && lhs->f_blocks == rhs->f_blocks && lhs->f_bfree == rhs->f_bfree;
+}
+
+unsigned long long space_required(const struct tar_index_s *index, unsigned char dest, unsigned long cluster) {
+    unsigned long long bytes = 0;
+    if (cluster == 0) {
+        cluster = 1;
+    }
+    for (size_t i = 0; i < index->count; ++i) {
+        const struct tar_index_entry_s *entry = &index->entries[i];
+        unsigned partition;
+        /// raw partition images are written to their partitions, see priv_partition.h
+        if (entry->dest != dest || partition_image_name(tar_index_name(index, entry), &partition)) {
+            continue;
+        }
+        if (entry->type == MTAR_TREG) {
+            bytes += ((unsigned long long) entry->size + cluster - 1) / cluster * cluster;
+        } else if (entry->type == MTAR_TDIR) {
+            bytes += cluster;
+        }
+    }
+    return bytes;
+}
+
+bool space_check(const struct update_handle_s *handle,
+                 const struct tar_index_s *index,
+                 unsigned long long backup_bytes) {
+    struct space_target_s targets[SpaceTargetCount] __attribute__((__cleanup__(space_targets_clean_up)));
+    memset(targets, 0, sizeof targets);
+    targets[SpaceTargetOs].name = "os";
+    targets[SpaceTargetOs].path = strdup(handle->update_os);
+    targets[SpaceTargetUser].name = "user";
+    targets[SpaceTargetUser].path = strdup(handle->update_user);
+    if (backup_bytes > 0) {
+        targets[SpaceTargetBackup].name = "backup";
+        targets[SpaceTargetBackup].path = parent_catalog(handle->backup_full_path);
+    }
+
+    for (size_t i = 0; i < SpaceTargetCount; ++i) {
+        if (targets[i].name == NULL) {
+            continue;
+        }
+        if (targets[i].path == NULL) {
+            debug_log("Space: out of memory");
+            return false;
+        }
+        if (statvfs(targets[i].path, &targets[i].stat) != 0) {
+            debug_log("Space: unable to stat %s filesystem %s: %d", targets[i].name, targets[i].path, errno);
+            return false;
+        }
+    }
+
+    targets[SpaceTargetOs].required =
+            space_required(index, UnpackDestOs, targets[SpaceTargetOs].stat.f_frsize);
+    targets[SpaceTargetUser].required =
+            space_required(index, UnpackDestUser, targets[SpaceTargetUser].stat.f_frsize);
+    targets[SpaceTargetBackup].required = backup_bytes;
+
+    /// accumulate requirements on the first target of every filesystem
+    for (size_t i = 0; i < SpaceTargetCount; ++i) {
+        if (targets[i].name == NULL) {
+            continue;
+        }
+        targets[i].used = true;
+        for (size_t j = 0; j < i; ++j) {
+            if (targets[j].used && same_filesystem(&targets[j].stat, &targets[i].stat)) {
+                targets[j].required += targets[i].required;
+                targets[i].used = false;
+                break;
+            }
+        }
+    }
+
+    bool success = true;
+    for (size_t i = 0; i < SpaceTargetCount; ++i) {
+        if (!targets[i].used) {
+            continue;
+        }
+        const unsigned long long cluster = targets[i].stat.f_frsize;
+        const unsigned long long available =
+                targets[i].stat.f_bfree > SPACE_RESERVE_CLUSTERS
+                        ? (targets[i].stat.f_bfree - SPACE_RESERVE_CLUSTERS) * cluster
+                        : 0;
+        /// KiB - nano printf has no long long
+        debug_log("Space: %s requires %lu KiB, %lu KiB available", targets[i].name,
+                  (unsigned long) (targets[i].required / 1024), (unsigned long) (available / 1024));
+        if (targets[i].required > available) {
+            debug_log("Space: not enough space on %s: missing %lu KiB", targets[i].name,
+                      (unsigned long) ((targets[i].required - available + 1023) / 1024));
+            success = false;
+        }
+    }
+    return success;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <stdbool.h>
+#include <common/tar.h>
+
+#include "update.h"
+#include "common/log.h"
+
+/// free clusters left untouched on every filesystem for metadata: catalogs, FAT, journal
+#define SPACE_RESERVE_CLUSTERS 16
+
+/// bytes taken by package entries of the destination on a filesystem with the cluster size
+/// every file and catalog takes whole clusters
+unsigned long long space_required(const struct tar_index_s *index, unsigned char dest, unsigned long cluster);
+
+/// check if unpack to handle os and user catalogs and backup of backup_bytes to handle backup
+/// will fit on their filesystems - fails before anything is written
+bool space_check(const struct update_handle_s *handle,
+                 const struct tar_index_s *index,
+                 unsigned long long backup_bytes);
+
+#ifdef __cplusplus
+}
+#endif
@@ -102,8 +102,7 @@ bool recursive_unlink(const char *what, bool factory_reset) {
     return success;
 }
 
-static bool create_single(const char *what, struct update_handle_s *handle) {
-    (void) handle;
+bool tmp_recreate_catalog(const char *what) {
     bool success = true;
 
     struct stat data;
@@ -135,12 +134,12 @@ bool tmp_create_catalog(struct update_handle_s *handle) {
     bool retval = true;
     debug_log("TMP dir: create temp catalog");
 
-    if (!create_single(handle->tmp_os, handle)) {
+    if (!tmp_recreate_catalog(handle->tmp_os)) {
         retval = false;
         goto exit;
     }
 
-    if (!create_single(handle->tmp_user, handle)) {
+    if (!tmp_recreate_catalog(handle->tmp_user)) {
         retval = false;
         goto exit;
     }
@@ -152,6 +151,9 @@ bool tmp_create_catalog(struct update_handle_s *handle) {
 
 struct mv_data_s {
     const char *to;
+    size_t catalogs_renamed; /// catalogs moved with their whole content
+    size_t files_renamed;
+    bool leftovers;          /// merged catalog not removed, tmp has to be cleaned up
 };
 
 int mv_callback(const char *path, enum dir_handling_type_e what, struct dir_handler_s *h, void *d) {
@@ -170,17 +172,28 @@ int mv_callback(const char *path, enum dir_handling_type_e what, struct dir_hand
     debug_log("TMP move: path: %s", final_path);
 
     switch (what) {
-        case DirHandlingDir:
+        case DirHandlingDir: {
+            /// catalog new to the destination is moved at once, only existing ones are merged file by file
+            struct stat st;
+            if (stat(final_path, &st) != 0 && errno == ENOENT) {
+                if (rename(path, final_path) == 0) {
+                    data->catalogs_renamed++;
+                    h->skip_dir = true;
+                    break;
+                }
+                debug_log("TMP dir: rename %s -> %s failed: %d, merging files", path, final_path, errno);
+            }
             ret = mkdir(final_path, 0666);
             if (ret != 0 && errno == EEXIST) {
                 debug_log("TMP dir: mkdir - directory already exists %s %d", final_path, ret);
                 ret = 0;
             }
             debug_log("TMP dir: created directory %s %d", final_path, ret);
+        }
             break;
         case DirHandlingFile: {
-            struct stat data;
-            ret = stat(final_path, &data);
+            struct stat st;
+            ret = stat(final_path, &st);
             if (ret == 0) {
                 ret = unlink(final_path);
                 if (ret != 0) {
@@ -191,6 +204,8 @@ int mv_callback(const char *path, enum dir_handling_type_e what, struct dir_hand
             ret = rename(path, final_path);
             if (ret)
                 debug_log("TMP dir: rename %s -> %s failed: %d %d %s\n", path, final_path, ret, errno, strerror(errno));
+            else
+                data->files_renamed++;
         }
             break;
         default:
@@ -203,6 +218,17 @@ int mv_callback(const char *path, enum dir_handling_type_e what, struct dir_hand
     return ret;
 }
 
+/// merged catalog is empty after the walk went through it
+static int mv_dir_closed_callback(const char *path, struct dir_handler_s *h, void *d) {
+    (void) h;
+    struct mv_data_s *data = (struct mv_data_s *) (d);
+    if (rmdir(path) != 0) {
+        debug_log("TMP move: unable to remove moved catalog %s: %d", path, errno);
+        data->leftovers = true;
+    }
+    return 0;
+}
+
 static bool recursive_mv(const char *what, const char *where) {
     (void) where;
     bool success = true;
@@ -210,10 +236,17 @@ static bool recursive_mv(const char *what, const char *where) {
     memset(&handle_walk, 0, sizeof handle_walk);
     unsigned int recursion_limit = 100;
 
+    /// already moved and removed by the interrupted update
+    if (!path_check_if_exists(what)) {
+        debug_log("Move: nothing to move from: %s", what);
+        return true;
+    }
+
     do {
         struct mv_data_s data = {NULL};
         data.to = where;
         recursive_dir_walker_init(&handle_walk, mv_callback, &data);
+        handle_walk.callback_dir_closed = mv_dir_closed_callback;
         recursive_dir_walker(what, &handle_walk, &recursion_limit);
         recursive_dir_walker_deinit(&handle_walk);
 
@@ -223,10 +256,14 @@ static bool recursive_mv(const char *what, const char *where) {
             break;
         }
 
-        debug_log("Move: removing data after moving: %s", what);
-        if (!recursive_unlink(what, NULL) != 0) {
-            success = false;
-            break;
+        debug_log("Move: %u catalogs and %u files moved from: %s", data.catalogs_renamed, data.files_renamed, what);
+        /// moved catalogs are removed by the walk, tmp is empty unless one of them wasn't
+        if (data.leftovers) {
+            debug_log("Move: removing data after moving: %s", what);
+            if (!recursive_unlink(what, NULL) != 0) {
+                success = false;
+                break;
+            }
         }
 
     } while (0);
@@ -237,13 +274,14 @@ static bool recursive_mv(const char *what, const char *where) {
 bool tmp_files_move(struct update_handle_s *handle) {
     bool success = true;
 
-    debug_log("Move: move user data from tmp...");
-    if (!recursive_mv(handle->tmp_os, handle->update_os)) {
+    /// os slot is activated in place, see priv_slot.h
+    debug_log("Move: move os data from tmp...");
+    if (handle->boot_json == NULL && !recursive_mv(handle->tmp_os, handle->update_os)) {
         success = false;
         goto exit;
     }
 
-    debug_log("Move: move os data from tmp...");
+    debug_log("Move: move user data from tmp...");
     if (!recursive_mv(handle->tmp_user, handle->update_user)) {
         success = false;
         goto exit;
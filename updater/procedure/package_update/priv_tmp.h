@@ -12,9 +12,12 @@ extern "C"
 
 /// create temporary catalog for update - removes old catalog if exists in that place
 bool tmp_create_catalog(struct update_handle_s *handle);
+/// create empty catalog, old catalog with its content is removed
+bool tmp_recreate_catalog(const char *what);
 /// Move files:
-/// 1. recursive: from {catalog}/{handle_os} move to {handle os}
+/// 1. recursive: from {catalog}/{handle_os} move to {handle os}, skipped for os slots - handle boot_json set
 /// 2. recursive: from {catalog}/{handle_user} move to {handle user}
+/// catalogs missing in the destination are renamed with their content, existing ones are merged file by file
 bool tmp_files_move(struct update_handle_s *handle);
 
 bool recursive_unlink(const char *what, bool factory_reset);
@@ -1,9 +1,15 @@
 #include <common/tar.h>
 #include <common/match.h>
-#include <microtar/microtar.h>
+#include <common/delta.h>
 #include <string.h>
+#include <stdlib.h>
+#include <sys/stat.h>
 #include "priv_update.h"
+#include "priv_ram_stage.h"
+#include "priv_direct.h"
+#include "priv_partition.h"
 #include "procedure/checksum/checksum.h"
+#include "procedure/backup/backup_manifest.h"
 
 bool is_os_file(const char *file) {
     const char *os_files[] = {
@@ -29,10 +35,92 @@ bool should_not_be_on_os_but_is(const char *file) {
     return string_match_any_of_partial(file, os_files, sizeof(os_files) / sizeof(os_files[0]));
 }
 
-bool unpack(struct update_handle_s *handle) {
+unsigned char unpack_destination(const char *name) {
+    /// delta goes where the file it rebuilds goes
+    char *target = NULL;
+    if (string_match_end(name, DELTA_EXTENSION)) {
+        target = strndup(name, strlen(name) - strlen(DELTA_EXTENSION));
+        name = target ? target : name;
+    }
+    const unsigned char dest = is_os_file(name) || should_not_be_on_os_but_is(name) ? UnpackDestOs : UnpackDestUser;
+    free(target);
+    return dest;
+}
+
+/// log progress every 10% of the package data
+static void report_progress(const struct tar_index_s *index, size_t done, unsigned *reported) {
+    if (index == NULL || index->total_bytes == 0) {
+        return;
+    }
+    const unsigned percent = (unsigned) ((unsigned long long) done * 100 / index->total_bytes);
+    if (percent >= *reported + 10 || (percent == 100 && *reported != 100)) {
+        *reported = percent;
+        debug_log("Update: unpacked %u%% (%u of %u bytes)", percent, done, index->total_bytes);
+    }
+}
+
+/// package entry name without leading ./
+static const char *entry_name(const char *name) {
+    return strncmp(name, "./", 2) == 0 ? name + 2 : name;
+}
+
+/// file is installed if the installed digest is the declared one and the size didn't change since
+static bool is_installed(const char *installed_dir, const struct unpack_skip_s *skip, const mtar_header_t *header) {
+    if (skip == NULL || skip->installed == NULL || skip->package == NULL) {
+        return false;
+    }
+    const unsigned char *declared = manifest_find(skip->package, header->name);
+    const unsigned char *installed = manifest_find(skip->installed, header->name);
+    if (declared == NULL || installed == NULL || memcmp(declared, installed, MANIFEST_MD5_SIZE) != 0) {
+        return false;
+    }
+    const char *name = entry_name(header->name);
+    char *path = malloc(strlen(installed_dir) + strlen(name) + 2);
+    if (path == NULL) {
+        return false;
+    }
+    sprintf(path, "%s/%s", installed_dir, name);
+    struct stat st;
+    const bool same_size = stat(path, &st) == 0 && S_ISREG(st.st_mode) && (size_t) st.st_size == header->size;
+    free(path);
+    return same_size;
+}
+
+/// unpacked file has to match the digest declared in the package manifest
+static bool matches_declared(const struct unpack_skip_s *skip, const char *name, const unsigned char *md5) {
+    if (skip == NULL || skip->package == NULL) {
+        return true;
+    }
+    const unsigned char *declared = manifest_find(skip->package, name);
+    if (declared != NULL && memcmp(declared, md5, MANIFEST_MD5_SIZE) != 0) {
+        debug_log("Update: %s doesn't match digest from %s", name, MANIFEST_PACKAGE_NAME);
+        return false;
+    }
+    return true;
+}
+
+void unpack_result_free(struct unpack_result_s *result) {
+    manifest_free(&result->unpacked);
+    manifest_free(&result->images);
+}
+
+bool unpack(struct update_handle_s *handle,
+            const struct tar_index_s *index,
+            const struct unpack_skip_s *skip,
+            struct journal_s *journal,
+            bool hash_package,
+            struct ram_stage_s *stage,
+            struct unpack_result_s *unpack_result) {
     bool ret = true;
     int result = 0;
     struct tar_ctx ctx;
+    size_t unpacked_bytes = 0;
+    size_t entry = 0;
+    unsigned reported_percent = 0;
+
+    memset(unpack_result, 0, sizeof *unpack_result);
+    manifest_init(&unpack_result->unpacked);
+    manifest_init(&unpack_result->images);
 
     do {
         if (0 != tar_init(&ctx, handle->update_from, "r")) {
@@ -41,25 +129,104 @@ bool unpack(struct update_handle_s *handle) {
             break;
         }
 
-        int lib_error = MTAR_ESUCCESS;
-        mtar_header_t header;
-
-        while ((lib_error = (mtar_read_header(&ctx.tar, &header))) != MTAR_ENULLRECORD) {
-            lib_error = mtar_read_header(&ctx.tar, &header);
+        if (hash_package && tar_hash_enable(&ctx) != ErrorTarOk) {
+            debug_log("Update: unable to hash package: %s", handle->update_from);
+            ret = false;
+            break;
+        }
 
-            if (lib_error != 0 && lib_error != MTAR_ENULLRECORD) {
+        /// entries before the journaled one are already in tmp
+        if (journal != NULL && index != NULL && journal->resume > 0) {
+            entry = journal->resume;
+            if (tar_seek_entry(&ctx, &index->entries[entry]) != ErrorTarOk) {
+                debug_log("Update: unable to resume unpack from entry %u", entry);
+                ret = false;
                 break;
             }
-
-            const char *to = handle->tmp_user;
-            if (is_os_file(header.name) || should_not_be_on_os_but_is(header.name)) {
-                to = handle->tmp_os;
+            for (size_t i = 0; i < entry; ++i) {
+                unpacked_bytes += index->entries[i].type == MTAR_TREG ? index->entries[i].size : 0;
             }
+            unpack_result->resumed = true;
+        }
 
-            if (header.type == MTAR_TDIR) {
+        int tar_error = ErrorTarOk;
+        mtar_header_t header;
+
+        while ((tar_error = tar_read_header(&ctx, &header)) == ErrorTarOk) {
+            const bool os = unpack_destination(header.name) == UnpackDestOs;
+            const bool direct = stage == NULL && direct_entry(handle, header.name, os ? UnpackDestOs : UnpackDestUser);
+            const char *to = direct ? handle->update_user : os ? handle->tmp_os : handle->tmp_user;
+
+            const char *installed_dir = os ? handle->update_os : handle->update_user;
+            const bool delta = string_match_end(header.name, DELTA_EXTENSION);
+            /// boot files are verified from the tmp catalog, they are always unpacked
+            /// os slot starts empty - os file skipped there would be copied from the active slot anyway
+            const bool skippable = !delta && !is_os_file(entry_name(header.name)) && !(os && handle->boot_json);
+            bool written = false;
+            unsigned partition = 0;
+            const bool image = header.type == MTAR_TREG && partition_image_name(header.name, &partition);
+
+            if (header.type == MTAR_TDIR && stage != NULL) {
+                result = ram_stage_add(stage, &ctx, &header, os ? UnpackDestOs : UnpackDestUser, NULL);
+            } else if (header.type == MTAR_TDIR) {
                 result = un_tar_catalog(&ctx, &header, to);
+            } else if (header.type == MTAR_TREG && (strcmp(entry_name(header.name), MANIFEST_PACKAGE_NAME) == 0 ||
+                                                    strcmp(entry_name(header.name), BACKUP_INDEX_NAME) == 0)) {
+                /// package manifest is read by the update before unpack, backup index is read by recovery from
+                /// backup, neither is installed
+                unpacked_bytes += header.size;
+            } else if (image) {
+                /// only hashed - written to the partition by partition_images_write once the package is verified
+                /// there is no file to journal or to record as installed
+                if (!partition_image_allowed(handle, partition)) {
+                    debug_log("Update: raw image of partition %u is not allowed", partition);
+                    result = -1;
+                } else {
+                    result = partition_image_hash(&ctx);
+                }
+                if (result == 0 && !matches_declared(skip, header.name, ctx.md5)) {
+                    result = -1;
+                }
+                if (result == 0) {
+                    result = manifest_add(&unpack_result->images, header.name, ctx.md5);
+                }
+                if (result == 0) {
+                    unpacked_bytes += header.size;
+                    report_progress(index, unpacked_bytes, &reported_percent);
+                }
+            } else if (header.type == MTAR_TREG && skippable && is_installed(installed_dir, skip, &header)) {
+                debug_log("Update: %s already installed, skipped", header.name);
+                unpack_result->skipped_files++;
+                unpack_result->skipped_bytes += header.size;
+                unpacked_bytes += header.size;
+                report_progress(index, unpacked_bytes, &reported_percent);
             } else if (header.type == MTAR_TREG) {
-                result = un_tar_file(&ctx, &header, to);
+                if (stage != NULL) {
+                    /// deltas are never staged, see ram_stage_eligible
+                    result = delta ? -1 : ram_stage_add(stage, &ctx, &header, os ? UnpackDestOs : UnpackDestUser,
+                                                        ctx.md5);
+                } else if (direct) {
+                    result = direct_unpack(handle, &ctx, &header);
+                } else if (delta) {
+                    result = un_tar_delta(&ctx, &header, installed_dir, to);
+                } else {
+                    result = un_tar_file(&ctx, &header, to);
+                }
+                if (result == 0 && !matches_declared(skip, header.name, ctx.md5)) {
+                    result = -1;
+                }
+                if (result == 0) {
+                    result = manifest_add(&unpack_result->unpacked, header.name, ctx.md5);
+                }
+                if (result == 0) {
+                    /// verified boot files are os files, see checksum_verify_all
+                    if (os) {
+                        checksum_digest_store(&unpack_result->digests, header.name, ctx.md5);
+                    }
+                    unpacked_bytes += header.size;
+                    report_progress(index, unpacked_bytes, &reported_percent);
+                    written = true;
+                }
             }
 
             if (result != 0) {
@@ -67,17 +234,36 @@ bool unpack(struct update_handle_s *handle) {
                 break;
             }
 
-            if (tar_next(&ctx)) {
-                ret = false;
-                break;
+            if (journal != NULL) {
+                journal_entry(journal, index, entry, header.type == MTAR_TREG ? header.size : 0,
+                              written ? ctx.md5 : NULL);
             }
+            ++entry;
+        }
+
+        if (!ret) {
+            break;
         }
 
-        if (0 != lib_error && lib_error != MTAR_ENULLRECORD) {
-            debug_log("Update: tar error %d", lib_error);
+        if (tar_error != ErrorTarEnd) {
+            debug_log("Update: tar error %s", tar_strerror(tar_error));
             ret = false;
             break;
         }
+
+        if (ret && hash_package) {
+            if (tar_hash_finish(&ctx, &unpack_result->package_hash) != ErrorTarOk) {
+                debug_log("Update: unable to finish package hash");
+                ret = false;
+                break;
+            }
+            unpack_result->package_hash_valid = true;
+        }
+
+        if (unpack_result->skipped_files > 0) {
+            debug_log("Update: %u installed files skipped (%u kB)", unpack_result->skipped_files,
+                      unpack_result->skipped_bytes / 1024);
+        }
     } while (0);
 
 
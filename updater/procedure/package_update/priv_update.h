@@ -6,9 +6,67 @@ extern "C"
 #endif
 
 #include "update.h"
+#include "priv_journal.h"
 #include "common/log.h"
+#include "procedure/checksum/checksum.h"
+#include <common/tar.h>
+#include <common/manifest.h>
+#include <hal/hwcrypt/sha256.h>
 
-bool unpack(struct update_handle_s *handle);
+/// where package entries are unpacked to
+enum unpack_dest_e {
+    UnpackDestUser,
+    UnpackDestOs,
+};
+
+/// data gathered while streaming the package, used by the later update stages
+struct unpack_result_s {
+    checksum_digests_s digests;      /// md5 of verified files calculated during unpack
+    struct sha256_hash package_hash; /// sha256 of the whole package - for the signature check
+    bool package_hash_valid;         /// package_hash was calculated
+    struct manifest_s unpacked;      /// md5 of unpacked files - installed manifest update
+    struct manifest_s images;        /// md5 of partition images, written after the package is verified
+    size_t skipped_files;            /// files already installed, not unpacked
+    size_t skipped_bytes;
+    bool resumed;                    /// unpack continued from the journal, result covers only the resumed part
+};
+
+/// digests to decide which files are already installed
+struct unpack_skip_s {
+    const struct manifest_s *installed; /// digests of the installed files
+    const struct manifest_s *package;   /// digests declared by the package
+};
+
+struct ram_stage_s;
+
+/// destination of the package entry - tar_index_build callback
+unsigned char unpack_destination(const char *name);
+
+/// unpack the package to tmp catalogs
+/// index of the package is optional, with it exact progress is reported
+/// with hash_package set every package byte is hashed while it's read, so the signature
+/// can be checked without reading the package again
+/// with skip set files with the declared digest equal to the installed one are not unpacked
+/// and unpacked files with a declared digest have to match it
+/// with journal set the progress is journaled and unpack continues from journal->resume,
+/// resume requires the index
+/// with stage set the files are unpacked to RAM instead of the tmp catalogs, see priv_ram_stage.h
+/// otherwise with handle->direct_user set user files are unpacked next to their destination, see priv_direct.h
+bool unpack(struct update_handle_s *handle,
+            const struct tar_index_s *index,
+            const struct unpack_skip_s *skip,
+            struct journal_s *journal,
+            bool hash_package,
+            struct ram_stage_s *stage,
+            struct unpack_result_s *result);
+
+void unpack_result_free(struct unpack_result_s *result);
+
+/// last steps of the update, after everything else is installed - the bootloader,
+/// then the fingerprint, so a failed step leaves the package not applied
+bool update_finish(const struct update_handle_s *handle,
+                   const struct tar_index_s *index,
+                   const struct unpack_result_s *unpack_result);
 
 #ifdef __cplusplus
 }
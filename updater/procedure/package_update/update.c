@@ -8,8 +8,17 @@
 #include "update.h"
 #include "priv_update.h"
 #include "priv_tmp.h"
+#include "priv_space.h"
+#include "priv_journal.h"
+#include "priv_ram_stage.h"
+#include "priv_slot.h"
+#include "priv_direct.h"
+#include "priv_fingerprint.h"
+#include "priv_partition.h"
 #include "procedure/checksum/checksum.h"
 #include "procedure/version/version.h"
+#include <common/boot_files.h>
+#include <common/delta.h>
 #include "procedure/backup/backup.h"
 #include "procedure/package_update/update_ecoboot.h"
 #include <procedure/security/pgmkeys.h>
@@ -20,6 +29,22 @@ static void str_clean_up(char **str) {
     }
 }
 
+static void tar_index_cleanup(struct tar_index_s *index) {
+    tar_index_free(index);
+}
+
+static void manifest_cleanup(struct manifest_s *manifest) {
+    manifest_free(manifest);
+}
+
+static void unpack_result_cleanup(struct unpack_result_s *result) {
+    unpack_result_free(result);
+}
+
+static void ram_stage_cleanup(struct ram_stage_s *stage) {
+    ram_stage_free(stage);
+}
+
 static void verify_file_handle_cleanup(verify_file_handle_s *handle) {
     if (handle) {
         if (handle->current_version_json.boot.md5sum)
@@ -38,7 +63,8 @@ static void verify_file_handle_cleanup(verify_file_handle_s *handle) {
     }
 }
 
-static int signature_check(const char *name) {
+/// verify package signature, hash calculated while unpacking is used when available
+static int signature_check(const char *name, const struct unpack_result_s *unpack_result) {
     if (sec_configuration_is_open()) {
         return sec_verify_ok;
     }
@@ -46,9 +72,150 @@ static int signature_check(const char *name) {
     char *signature_name __attribute__((__cleanup__(str_clean_up))) = malloc(strlen(name) + sizeof(sig_ext));
     strcpy(signature_name, name);
     strcat(signature_name, sig_ext);
+    if (unpack_result->package_hash_valid) {
+        return sec_verify_hash(&unpack_result->package_hash, signature_name);
+    }
     return sec_verify_file(name, signature_name);
 }
 
+/// check versions of the package files against the current ones before anything is written
+/// version.json is read straight from the package, only files present in the package are checked
+static bool version_check_package(const struct update_handle_s *handle, const struct tar_index_s *index) {
+    const size_t version_json_max_size = 4096;
+    const struct tar_index_entry_s *entry = tar_index_find(index, "version.json");
+    if (entry == NULL) {
+        debug_log("Update: no version.json in package");
+        return false;
+    }
+    char *version_json __attribute__((__cleanup__(str_clean_up))) = NULL;
+    if (tar_read_entry(handle->update_from, entry, version_json_max_size, &version_json) != ErrorTarOk) {
+        debug_log("Update: unable to read version.json from package");
+        return false;
+    }
+
+    verify_file_handle_s verify_handle __attribute__((__cleanup__(verify_file_handle_cleanup))) =
+            json_get_verify_files_from_string(version_json, handle->current_version_json);
+    for (size_t i = 0; i < verify_files_list_size; ++i) {
+        char delta_name[64];
+        snprintf(delta_name, sizeof delta_name, "%s%s", verify_files[i], DELTA_EXTENSION);
+        if (tar_index_find(index, verify_files[i]) == NULL && tar_index_find(index, delta_name) == NULL) {
+            continue;
+        }
+        verify_handle.file_to_verify = verify_files[i];
+        if (!version_check(&verify_handle, handle->enabled.allow_downgrade)) {
+            debug_log("Update: version check of %s failed", verify_files[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+/// check versions of the files unpacked to RAM, same as version_check_all for the tmp catalog
+static bool version_check_staged(verify_file_handle_s *verify_handle,
+                                 const struct ram_stage_s *stage,
+                                 bool allow_downgrade) {
+    for (size_t i = 0; i < verify_files_list_size; ++i) {
+        if (ram_stage_find(stage, verify_files[i]) == NULL) {
+            continue;
+        }
+        verify_handle->file_to_verify = verify_files[i];
+        if (!version_check(verify_handle, allow_downgrade)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/// files unpacked to the tmp catalogs, interrupted unpack is continued from the journal
+static bool unpack_to_tmp(struct update_handle_s *handle,
+                          const struct tar_index_s *index,
+                          const struct unpack_skip_s *skip,
+                          struct journal_s *journal,
+                          bool hash_package,
+                          struct unpack_result_s *unpack_result) {
+    if (journal_has(journal, JournalUnpacked) || journal_resume(journal, handle, index) > 0) {
+        debug_log("Update: temporary catalog kept from interrupted update");
+    } else {
+        debug_log("Update: setup temporary catalog");
+        /// partial .new files of an interrupted unpack would be renamed over the skipped installed files
+        if (handle->direct_user) {
+            direct_rollback(handle, index);
+        }
+        if (!tmp_create_catalog(handle)) {
+            debug_log("Update: tmp setup failed");
+            return false;
+        }
+        journal_phase(journal, JournalCatalog);
+    }
+
+    if (journal_has(journal, JournalUnpacked)) {
+        debug_log("Update: package already unpacked");
+        unpack_result->resumed = true;
+        return true;
+    }
+    debug_log("Update: unpacking update archive");
+    if (!unpack(handle, index, skip, journal, hash_package, NULL, unpack_result)) {
+        debug_log("Update: unpacking error");
+        return false;
+    }
+    journal_phase(journal, JournalUnpacked);
+    return true;
+}
+
+/// digests from the index of sector aligned package, tar archive leaves the manifest empty
+static bool package_index_digests(const struct update_handle_s *handle, struct manifest_s *manifest) {
+    struct tar_ctx ctx;
+    mtar_header_t header;
+    int ret = tar_init(&ctx, handle->update_from, "r");
+    while (ret == ErrorTarOk && (ret = tar_read_header(&ctx, &header)) == ErrorTarOk) {
+        const unsigned char *md5 = tar_entry_md5(&ctx);
+        if (md5 == NULL) {
+            debug_log("Update: no %s in package, all files unpacked", MANIFEST_PACKAGE_NAME);
+            break;
+        }
+        if (header.type == MTAR_TREG && manifest_add(manifest, header.name, md5) != 0) {
+            ret = ErrorTarStd;
+        }
+    }
+    tar_deinit(&ctx);
+    return ret == ErrorTarOk || ret == ErrorTarEnd;
+}
+
+/// digests declared by the package, missing package manifest leaves it empty - nothing is skipped
+static bool package_manifest_load(const struct update_handle_s *handle,
+                                  const struct tar_index_s *index,
+                                  struct manifest_s *manifest) {
+    const size_t manifest_max_size = 1024 * 1024;
+    const struct tar_index_entry_s *entry = tar_index_find(index, MANIFEST_PACKAGE_NAME);
+    if (entry == NULL) {
+        if (!package_index_digests(handle, manifest)) {
+            return false;
+        }
+        manifest_sort(manifest);
+        return true;
+    }
+    char *text __attribute__((__cleanup__(str_clean_up))) = NULL;
+    if (tar_read_entry(handle->update_from, entry, manifest_max_size, &text) != ErrorTarOk) {
+        debug_log("Update: unable to read %s from package", MANIFEST_PACKAGE_NAME);
+        return false;
+    }
+    if (manifest_parse(manifest, text) != 0) {
+        return false;
+    }
+    manifest_sort(manifest);
+    return true;
+}
+
+/// installed manifest describes the files the update moved - refreshed after the move succeeded
+static void installed_manifest_update(const struct update_handle_s *handle,
+                                      struct manifest_s *installed,
+                                      const struct manifest_s *unpacked) {
+    if (manifest_merge(installed, unpacked) != 0 || manifest_save(installed, handle->installed_manifest) != 0) {
+        debug_log("Update: unable to update %s, next update unpacks all files", handle->installed_manifest);
+        unlink(handle->installed_manifest);
+    }
+}
+
 void update_firmware_init(struct update_handle_s *h) {
     memset(h, 0, sizeof *h);
 }
@@ -79,28 +246,115 @@ static void program_secure_fuses(const struct update_handle_s *handle) {
     }
 }
 
+bool update_finish(const struct update_handle_s *handle,
+                   const struct tar_index_s *index,
+                   const struct unpack_result_s *unpack_result) {
+    // Finally update the ecoboot bin
+    const char *os_updated = handle->boot_json ? handle->tmp_os : handle->update_os;
+    int ecoboot_package_status = ecoboot_in_package(os_updated, ecoboot_filename);
+    if (ecoboot_package_status == 1) {
+        debug_log("Update: updating %s",ecoboot_filename);
+        const int eco_status = ecoboot_update(os_updated, ecoboot_filename);
+        if (eco_status != error_eco_update_ok) {
+            if (eco_status != error_eco_vfs && errno != ENOENT) {
+                debug_log("Update: %s update error, errno: %d", ecoboot_filename, errno);
+                return false;
+            }
+        } else {
+            debug_log("Update: %s updated successfully", ecoboot_filename);
+        }
+    }
+    else {
+        debug_log("Update: No %s in package", ecoboot_filename);
+    }
+
+    /// hash of a resumed update isn't known, unsigned package is reported as such every time
+    if (handle->fingerprint != NULL && unpack_result->package_hash_valid && !handle->unsigned_tar) {
+        fingerprint_record(handle->fingerprint, handle->update_from, index, &unpack_result->package_hash);
+    }
+    return true;
+}
+
 bool update_firmware(struct update_handle_s *handle) {
     debug_log("Starting firmware update");
     bool success = false;
+    struct unpack_result_s unpack_result __attribute__((__cleanup__(unpack_result_cleanup)));
+    struct tar_index_s index __attribute__((__cleanup__(tar_index_cleanup)));
+    struct manifest_s installed __attribute__((__cleanup__(manifest_cleanup)));
+    struct manifest_s package __attribute__((__cleanup__(manifest_cleanup)));
+    struct ram_stage_s stage __attribute__((__cleanup__(ram_stage_cleanup)));
+    bool staged = false;
+    bool slot_written = false; /// inactive os slot holds the os of this update, not the previous one
+    bool direct_written = false; /// user files of this update are next to their destination, not renamed yet
+    const struct unpack_skip_s skip = {.installed = &installed, .package = &package};
+    struct journal_s journal;
     struct backup_handle_s backup_handle = {
             .backup_from_os = handle->update_os,
             .backup_from_user = handle->update_user,
-            .backup_to = handle->backup_full_path
+            .backup_to = handle->backup_full_path,
+            .backup_store = handle->backup_store,
+            .boot_in_slot = handle->boot_json != NULL
     };
-    if (handle->enabled.check_sign) {
-        debug_log("Update: signature check");
-        const int err = signature_check(handle->update_from);
-        if (err) {
-            handle->unsigned_tar = true;
-        } else {
-            handle->unsigned_tar = false;
+    memset(&unpack_result, 0, sizeof unpack_result);
+    memset(&journal, 0, sizeof journal);
+    manifest_init(&installed);
+    manifest_init(&package);
+    ram_stage_init(&stage, handle->stage_budget);
+    debug_log("Update: indexing update archive");
+    if (tar_index_build(&index, handle->update_from, unpack_destination) != ErrorTarOk) {
+        debug_log("Update: unable to index update archive: %s", handle->update_from);
+        success = false;
+        goto exit;
+    }
+    debug_log("Update: %u files, os: %u bytes, user: %u bytes", index.count, index.dest_bytes[UnpackDestOs],
+              index.dest_bytes[UnpackDestUser]);
+
+    journal_open(&journal, handle->journal, handle->update_from, &index);
+    if (journal_has(&journal, JournalVerified)) {
+        /// files are partially moved already - checks passed before the move started
+        debug_log("Update: resuming moving files");
+        handle->unsigned_tar = journal_has(&journal, JournalUnsigned);
+        unpack_result.resumed = true;
+        slot_written = handle->boot_json != NULL;
+        direct_written = handle->direct_user;
+        goto move;
+    }
+
+    /// same package requested again - nothing is read but the signature (open configuration: the package)
+    if (!journal_has(&journal, JournalBackup) && fingerprint_applied(handle->fingerprint, handle->update_from, &index)) {
+        debug_log("Update: package already applied");
+        success = true;
+        goto exit;
+    }
+
+    /// reject the update before backup and unpack spend minutes on the storage
+    unsigned long long backup_bytes = 0;
+    if (handle->enabled.backup && !journal_has(&journal, JournalBackup) &&
+        !backup_estimate_size(&backup_handle, &backup_bytes)) {
+        debug_log("Update: unable to estimate backup size");
+        success = false;
+        goto exit;
+    }
+    if (handle->enabled.check_version) {
+        debug_log("Update: verify package versions");
+        if (!version_check_package(handle, &index)) {
+            debug_log("Update: package rejected by version check");
+            success = false;
+            goto exit;
+        }
+    }
+
+    /// resumed update already has its data on the storage
+    if (!journal_has(&journal, JournalBackup)) {
+        debug_log("Update: checking free space");
+        if (!space_check(handle, &index, backup_bytes)) {
+            debug_log("Update: not enough free space");
+            success = false;
+            goto exit;
         }
-        debug_log("Update: package is signed: %s", handle->unsigned_tar ? "FALSE" : "TRUE");
-    } else {
-        debug_log("Update: package signature check skipped");
     }
 
-    if (handle->enabled.backup) {
+    if (handle->enabled.backup && !journal_has(&journal, JournalBackup)) {
         debug_log("Update: performing backup");
         if (handle->enabled.backup && !backup_previous_firmware(&backup_handle)) {
             debug_log("Update: backup error");
@@ -108,29 +362,72 @@ bool update_firmware(struct update_handle_s *handle) {
             goto exit;
         }
     }
+    journal_phase(&journal, JournalBackup);
+    slot_written = handle->boot_json != NULL;
 
-    debug_log("Update: setup temporary catalog");
-    if (!tmp_create_catalog(handle)) {
-        debug_log("Update: tmp setup failed");
-        success = false;
-        goto exit;
+    if (handle->installed_manifest != NULL) {
+        debug_log("Update: loading installed files manifest");
+        if (manifest_load(&installed, handle->installed_manifest) != 0 ||
+            !package_manifest_load(handle, &index, &package)) {
+            debug_log("Update: manifest error, all files unpacked");
+            manifest_free(&installed);
+            manifest_free(&package);
+        }
+        manifest_sort(&installed);
     }
 
-    debug_log("Update: unpacking update archive");
-    if (!unpack(handle)) {
-        debug_log("Update: unpacking error");
+    /// the hash is the package fingerprint as well
+    const bool hash_package =
+            (handle->enabled.check_sign && !sec_configuration_is_open()) || handle->fingerprint != NULL;
+    /// staged package isn't journaled - interrupted update unpacks it again, nothing is on the storage yet
+    staged = ram_stage_eligible(handle, &index, &journal);
+    if (staged) {
+        debug_log("Update: unpacking update archive to RAM");
+        if (!unpack(handle, &index, handle->installed_manifest ? &skip : NULL, NULL, hash_package, &stage,
+                    &unpack_result)) {
+            if (!stage.out_of_memory) {
+                debug_log("Update: unpacking error");
+                success = false;
+                goto exit;
+            }
+            debug_log("Update: package doesn't fit in RAM");
+            ram_stage_free(&stage);
+            unpack_result_free(&unpack_result);
+            staged = false;
+        }
+    }
+    direct_written = !staged && handle->direct_user;
+    if (!staged && !unpack_to_tmp(handle, &index, handle->installed_manifest ? &skip : NULL, &journal, hash_package,
+                                  &unpack_result)) {
         success = false;
         goto exit;
     }
 
+    /// package is hashed during unpack - nothing from tmp is moved before the signature is decided
+    if (handle->enabled.check_sign) {
+        debug_log("Update: signature check");
+        const int err = signature_check(handle->update_from, &unpack_result);
+        if (err) {
+            handle->unsigned_tar = true;
+        } else {
+            handle->unsigned_tar = false;
+        }
+        debug_log("Update: package is signed: %s", handle->unsigned_tar ? "FALSE" : "TRUE");
+    } else {
+        debug_log("Update: package signature check skipped");
+    }
+
     if (handle->enabled.check_checksum || handle->enabled.check_version) {
         debug_log("Update: verify files");
+        const struct ram_stage_entry_s *staged_version = staged ? ram_stage_find(&stage, "version.json") : NULL;
         verify_file_handle_s verify_handle __attribute__((__cleanup__(verify_file_handle_cleanup))) =
-                json_get_verify_files(handle->new_version_json, handle->current_version_json);
+                staged ? json_get_verify_files_from_string(staged_version ? (const char *) staged_version->data : "",
+                                                           handle->current_version_json)
+                       : json_get_verify_files(handle->new_version_json, handle->current_version_json);
 
         if (handle->enabled.check_checksum) {
             debug_log("Update: verify checksum");
-            if (!checksum_verify_all(&verify_handle, handle->tmp_os)) {
+            if (!checksum_verify_all(&verify_handle, &unpack_result.digests, staged ? NULL : handle->tmp_os)) {
                 debug_log("Update: checksum mismatch!");
                 success = false;
                 goto exit;
@@ -138,7 +435,10 @@ bool update_firmware(struct update_handle_s *handle) {
         }
         if (handle->enabled.check_version) {
             debug_log("Update: verify versions");
-            if (!version_check_all(&verify_handle, handle->tmp_os, handle->enabled.allow_downgrade)) {
+            const bool versions_ok =
+                    staged ? version_check_staged(&verify_handle, &stage, handle->enabled.allow_downgrade)
+                           : version_check_all(&verify_handle, handle->tmp_os, handle->enabled.allow_downgrade);
+            if (!versions_ok) {
                 debug_log("Update: verify version failed");
                 success = false;
                 goto exit;
@@ -146,35 +446,90 @@ bool update_firmware(struct update_handle_s *handle) {
         }
     }
 
-    debug_log("Update: program fuses");
-    program_secure_fuses(handle);
+    /// raw images can't be undone - they're written once the package is verified, staged package has none
+    if (!staged) {
+        manifest_sort(&unpack_result.images);
+        if (!partition_images_write(handle, &index, &package, &unpack_result.images)) {
+            debug_log("Update: partition image error");
+            success = false;
+            goto exit;
+        }
+    }
 
-    debug_log("Update: moving files from tmp to destination");
-    if (!tmp_files_move(handle)) {
-        debug_log("Update: moving error");
-        success = false;
-        goto exit;
+    /// staged package has no keys, see ram_stage_eligible
+    if (!staged) {
+        debug_log("Update: program fuses");
+        program_secure_fuses(handle);
     }
 
-    // Finally update the ecoboot bin
-    int ecoboot_package_status = ecoboot_in_package(handle->update_os, ecoboot_filename);
-    if (ecoboot_package_status == 1) {
-        debug_log("Update: updating %s",ecoboot_filename);
-        const int eco_status = ecoboot_update(handle->update_os, ecoboot_filename);
-        if (eco_status != error_eco_update_ok) {
-            if (eco_status != error_eco_vfs && errno != ENOENT) {
-                debug_log("Update: %s update error, errno: %d", ecoboot_filename, errno);
-                success = false;
-                goto exit;
-            }
-        } else {
-            debug_log("Update: %s updated successfully", ecoboot_filename);
+    /// interrupted move leaves files not matching the manifest
+    if (handle->installed_manifest != NULL) {
+        unlink(handle->installed_manifest);
+    }
+    fingerprint_remove(handle->fingerprint);
+    /// staged files are gone after power loss - the update starts over instead of moving from tmp
+    if (!staged) {
+        journal_phase(&journal, handle->unsigned_tar ? JournalVerified | JournalUnsigned : JournalVerified);
+    }
+
+    move:
+    if (staged) {
+        debug_log("Update: writing %u bytes of files from RAM to destination", stage.bytes);
+        if (handle->boot_json != NULL && !slot_prepare(handle)) {
+            debug_log("Update: os slot error");
+            success = false;
+            goto exit;
+        }
+        if (!ram_stage_install(&stage, handle->boot_json ? handle->tmp_os : handle->update_os,
+                               handle->update_user)) {
+            debug_log("Update: writing error");
+            success = false;
+            goto exit;
         }
+        ram_stage_free(&stage);
+    } else {
+        debug_log("Update: moving files from tmp to destination");
+        if (!tmp_files_move(handle)) {
+            debug_log("Update: moving error");
+            success = false;
+            goto exit;
+        }
+        if (handle->direct_user && !direct_commit(handle, &index)) {
+            debug_log("Update: installing user files error");
+            success = false;
+            goto exit;
+        }
+        direct_written = false;
     }
-    else {
-        debug_log("Update: No %s in package", ecoboot_filename);
+
+    /// last step of the os update - until the switch the previous os is started
+    if (handle->boot_json != NULL) {
+        debug_log("Update: activating os slot %s", handle->tmp_os);
+        if (!slot_activate(handle)) {
+            debug_log("Update: os slot error");
+            success = false;
+            goto exit;
+        }
+        slot_written = false;
+    }
+
+    /// digests of files unpacked before the interruption are lost - next update unpacks everything
+    if (handle->installed_manifest != NULL && !unpack_result.resumed) {
+        installed_manifest_update(handle, &installed, &unpack_result.unpacked);
+    }
+    if (!update_finish(handle, &index, &unpack_result)) {
+        success = false;
+        goto exit;
     }
     success = true;
     exit:
+    if (!success && slot_written) {
+        slot_discard(handle);
+    }
+    if (!success && direct_written) {
+        direct_rollback(handle, &index);
+    }
+    /// failed update starts over, it's not resumed
+    journal_remove(&journal);
     return success;
 }
@@ -6,8 +6,14 @@ extern "C"
 #endif
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <common/log.h>
 
+/// packages with files up to that size are unpacked to RAM, the rest of the 9.8 MB SDRAM heap
+/// is left for the package reader, decompression and the write buffers
+#define UPDATE_STAGE_BUDGET (6 * 1024 * 1024)
+
 enum update_error_e {
     ErrorUpdateOk,
     ErrorSignCheck,
@@ -19,7 +25,8 @@ enum update_error_e {
     ErrorVersion,
     ErrorMove,
     ErrorUpdateEcoboot,
-    ErrorKeyPgm
+    ErrorKeyPgm,
+    ErrorSpace
 };
 
 struct update_handle_s {
@@ -28,11 +35,25 @@ struct update_handle_s {
     const char *update_user;           /// location we want to update the update user data: assets, sql etc
     /// on target this would mean partition nr 3
     const char *backup_full_path;      /// full path where to put backup
+    const char *backup_store;          /// chunk store catalog used instead of backup_full_path, NULL for none,
+                                       /// see procedure/backup/backup_store.h
     const char *factory_full_path;     /// full path where from to take factory img
     const char *tmp_os;                /// temporary os catalog to perform unpack - to not mv between fs-es
     const char *tmp_user;              /// temporary user catalog to perform unpack - to not mv between fs-es
     const char *current_version_json;  /// path to current version.json
     const char *new_version_json;      /// path to new version.json
+    const char *installed_manifest;    /// digests of the installed files, NULL disables skipping them
+    const char *journal;               /// update progress journal to resume interrupted update, NULL disables it
+    const char *fingerprint;           /// sha256 of the last applied package, the same package isn't applied again,
+                                       /// NULL disables it, see priv_fingerprint.h
+    const char *boot_json;             /// A/B os slots, see common/boot_slot.h: update_os is the active slot, tmp_os the
+                                       /// inactive one which becomes active, NULL - os files are moved to update_os
+    size_t stage_budget;               /// packages with files up to that size are verified in RAM before anything is
+                                       /// written to the storage, 0 always unpacks to the tmp catalogs
+    bool direct_user;                  /// user files are unpacked next to their destination instead of tmp_user and
+                                       /// renamed over the old files after verification, see priv_direct.h
+    uint32_t image_partitions;         /// bit n set - partition n of the eMMC user area can be written with a raw image
+                                       /// from the package, 0 refuses raw images, see priv_partition.h
     bool unsigned_tar;                 /// returns true when tar doesn't have a valid signature in closed secure mode
 
     /// options to perform with update_firmware
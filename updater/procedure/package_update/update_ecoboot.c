@@ -7,6 +7,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <hal/blk_dev.h>
+#include <common/stream.h>
 
 const char* const ecoboot_filename = "ecoboot.bin";
 
@@ -15,36 +16,18 @@ const char* const ecoboot_filename = "ecoboot.bin";
 // Number of sectors per transfer
 #define SECTORS_PER_TRANSFER 32
 
-//! For cleanup dynamic resources
-static void free_clean_up(uint8_t **ptr) {
-    free(*ptr);
-}
-
 // Char cleanup
 static void free_str_clean_up(char **ptr) {
     free(*ptr);
 }
 
-//! Cleanup file descriptor
-static void file_clean_up(FILE **fil) {
-    if (*fil) {
-        fclose(*fil);
-    }
-}
-
-/** Open ecoboot file in read only mode
- * and verify ecoboot header
+/** Verify ecoboot file header
  * @param[in] path Path to the ecoboot image
- * @param[out] file STDIO file handle
  * @return if positive image size otherwise error
  */
-static int open_ecoboot_file(const char *path, FILE **file) {
+static int check_ecoboot_file(const char *path) {
     const off_t minimal_size = 64 * 1024;
     struct stat st;
-    if (!file) {
-        debug_log("Ecoboot update: filename not provided");
-        return -EINVAL;
-    }
     if (stat(path, &st)) {
         debug_log("Ecoboot update: failed to stat file: %s, errno: %d", path, errno);
         return -errno;
@@ -57,11 +40,6 @@ static int open_ecoboot_file(const char *path, FILE **file) {
         debug_log("Ecoboot update: %s is too small", path);
         return -ENOEXEC;
     }
-    *file = fopen(path, "r");
-    if (!*file) {
-        debug_log("Ecoboot update: failed to open file %s", path);
-        return -errno;
-    }
     return st.st_size;
 }
 
@@ -71,52 +49,31 @@ static int open_ecoboot_file(const char *path, FILE **file) {
  */
 static int flash_ecoboot(const char *path) {
     blk_dev_info_t blk;
-    int err, fil_size;
-    FILE *fil __attribute__((__cleanup__(file_clean_up))) = NULL;
+    int err;
+    struct stream_source_s source;
+    struct stream_stage_s sink;
     if ((err = blk_info(ECO_PARTITION, &blk))) {
         debug_log("Ecoboot update: %s", err == -ENXIO ? "can't find partition" : "parameter is invalid");
         return err;
     }
-    uint8_t *sect_buf __attribute__((__cleanup__(free_clean_up))) = malloc(blk.sector_size * SECTORS_PER_TRANSFER);
-    if (!sect_buf) {
-        debug_log("Ecoboot update: failed to allocate memory");
-        return -errno;
-    }
-
-    if ((fil_size = open_ecoboot_file(path, &fil)) <= 0) {
-        return fil_size;
+    if ((err = check_ecoboot_file(path)) <= 0) {
+        return err;
     }
-    for (lba_t lba = 0, sz = fil_size; !feof(fil) && !ferror(fil);) {
-        if (sz < blk.sector_size * SECTORS_PER_TRANSFER) {
-            memset(sect_buf, 0, blk.sector_size);
-            if (!fread(sect_buf, sz, 1, fil)) {
-                break;
-            }
-            sz = 0;
-        } else {
-            const size_t nread = fread(sect_buf, blk.sector_size, SECTORS_PER_TRANSFER, fil);
-            if (nread == 0) {
-                if (!ferror(fil)) {
-                    sz -= blk.sector_size * nread;
-                    continue;
-                } else {
-                    break;
-                }
-            }
-            sz -= blk.sector_size * nread;
-        }
-        if ((err = blk_write(ECO_PARTITION, lba, SECTORS_PER_TRANSFER, sect_buf))) {
-            debug_log("Ecoboot update: failed to write block of data: %d", err);
-            return err;
+    const size_t transfer_size = blk.sector_size * SECTORS_PER_TRANSFER;
+    err = stream_blk_sink(&sink, ECO_PARTITION, 0, transfer_size);
+    if (err == ErrorStreamOk) {
+        err = stream_file_source(&source, path, NULL, transfer_size);
+        if (err == ErrorStreamOk) {
+            err = stream_run(&source, &sink, 1, NULL);
         }
-        lba += SECTORS_PER_TRANSFER;
+        stream_source_close(&source);
     }
-    if (ferror(fil)) {
-        debug_log("Ecoboot update: file error: %d", errno);
-        return -errno;
-    } else {
-        return 0;
+    stream_stage_close(&sink);
+    if (err != ErrorStreamOk) {
+        debug_log("Ecoboot update: failed to write: %s", stream_strerror(err));
+        return -EIO;
     }
+    return 0;
 }
 
 /** Verify the ecoboot
@@ -126,60 +83,37 @@ static int flash_ecoboot(const char *path) {
 static int verify_ecoboot(const char *path) {
     blk_dev_info_t blk;
     int err, fil_size;
-    FILE *fil __attribute__((__cleanup__(file_clean_up))) = NULL;
+    struct stream_source_s flashed;
+    struct stream_source_s file;
+    struct stream_stage_s compare;
     if ((err = blk_info(ECO_PARTITION, &blk))) {
         debug_log("Ecoboot update: %s", err == -ENXIO ? "can't find partition" : "parameter is invalid");
         return err;
     }
-    uint8_t *buf1 __attribute__((__cleanup__(free_clean_up))) = malloc(blk.sector_size * SECTORS_PER_TRANSFER);
-    if (!buf1) {
-        debug_log("Ecoboot update: failed to allocate memory");
-        return -errno;
-    }
-    uint8_t *buf2 __attribute__((__cleanup__(free_clean_up))) = malloc(blk.sector_size * SECTORS_PER_TRANSFER);
-    if (!buf2) {
-        debug_log("Ecoboot update: failed to allocate memory");
-        return -errno;
-    }
-    if ((fil_size = open_ecoboot_file(path, &fil)) <= 0) {
+    if ((fil_size = check_ecoboot_file(path)) <= 0) {
         return fil_size;
     }
-    for (lba_t lba = 0, sz = fil_size; !feof(fil) && !ferror(fil);) {
-        if ((err = blk_read(ECO_PARTITION, lba, SECTORS_PER_TRANSFER, buf1))) {
-            debug_log("Ecoboot update: failed to read block of data: %d", err);
-            return err;
-        }
-        lba += SECTORS_PER_TRANSFER;
-
-        if (sz < blk.sector_size * SECTORS_PER_TRANSFER) {
-            memset(buf2, 0, blk.sector_size);
-            if (!fread(buf2, sz, 1, fil)) {
-                break;
-            }
-            sz = 0;
-        } else {
-            const size_t nread = fread(buf2, blk.sector_size, SECTORS_PER_TRANSFER, fil);
-            if (nread == 0) {
-                if (!ferror(fil)) {
-                    sz -= blk.sector_size * nread;
-                    continue;
-                } else {
-                    break;
-                }
-            }
-            sz -= blk.sector_size * nread;
-        }
-        if (memcmp(buf1, buf2, blk.sector_size * SECTORS_PER_TRANSFER) != 0) {
-            debug_log("Ecoboot update: files mismatch!");
-            return error_eco_verify;
+    const size_t transfer_size = blk.sector_size * SECTORS_PER_TRANSFER;
+    err = stream_file_source(&file, path, NULL, transfer_size);
+    if (err == ErrorStreamOk) {
+        err = stream_blk_source(&flashed, ECO_PARTITION, 0, fil_size, transfer_size);
+        if (err == ErrorStreamOk) {
+            stream_compare_stage(&compare, &file);
+            err = stream_run(&flashed, &compare, 1, NULL);
+            stream_stage_close(&compare);
         }
+        stream_source_close(&flashed);
     }
-    if (ferror(fil)) {
-        debug_log("Ecoboot update: file error: %d", errno);
-        return -errno;
-    } else {
-        return 0;
+    stream_source_close(&file);
+    if (err == ErrorStreamMismatch || err == ErrorStreamSize) {
+        debug_log("Ecoboot update: files mismatch!");
+        return error_eco_verify;
+    }
+    if (err != ErrorStreamOk) {
+        debug_log("Ecoboot update: failed to read: %s", stream_strerror(err));
+        return -EIO;
     }
+    return 0;
 }
 
 // Update the ecoboot
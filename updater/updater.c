@@ -4,10 +4,14 @@
 #include <hal/tinyvfs.h>
 #include <hal/blk_dev.h>
 #include <procedure/package_update/update.h>
+#include <procedure/backup/backup.h>
 #include <procedure/security/pgmkeys.h>
 #include <procedure/factory/factory.h>
 #include <common/status_json.h>
 #include <common/version_json.h>
+#include <common/path_opts.h>
+#include <common/boot_slot.h>
+#include <common/io_buffer.h>
 #include <gui/gui.h>
 #include <string.h>
 #include <stdbool.h>
@@ -31,14 +35,44 @@ int __attribute__((noinline, used)) main() {
         goto exit_no_save;
     }
 
+    /// archives opened during the session share one buffer, sized for the eMMC the user partition is on
+    err = io_buffer_init(io_buffer_probe(blk_disk_handle(blkdev_emmc_user, 3)));
+    if (err) {
+        debug_log("IO buffer: %s, archives allocate their own buffers", io_buffer_strerror(err));
+    }
+
+    /// os is updated in the inactive A/B slot, unreadable .boot.json - os files are moved to the active one
+    static const char boot_json[] = "/os/.boot.json";
+    char active_slot[BOOT_SLOT_NAME_MAX];
+    const bool slots = boot_slot_active(boot_json, active_slot) == ErrorBootSlotOk;
+    if (!slots) {
+        strcpy(active_slot, boot_slots[0]);
+    }
+    char os_active[32];
+    char os_inactive[32];
+    char current_version_path[48];
+    char new_version_path[48];
+    snprintf(os_active, sizeof os_active, "/os/%s", active_slot);
+    snprintf(os_inactive, sizeof os_inactive, "/os/%s", boot_slot_other(active_slot));
+    snprintf(current_version_path, sizeof current_version_path, "%s/version.json", os_active);
+    snprintf(new_version_path, sizeof new_version_path, "%s/version.json", slots ? os_inactive : "/os/tmp");
+
     struct update_handle_s handle;
     memset(&handle, 0, sizeof handle);
-    handle.update_os = "/os/current";
+    handle.update_os = os_active;
     handle.update_user = "/user";
-    handle.tmp_os = "/os/tmp";
+    handle.tmp_os = slots ? os_inactive : "/os/tmp";
     handle.tmp_user = "/user/tmp";
-    handle.current_version_json = "/os/current/version.json";
-    handle.new_version_json = "/os/tmp/version.json";
+    handle.current_version_json = current_version_path;
+    handle.new_version_json = new_version_path;
+    handle.boot_json = slots ? boot_json : NULL;
+    handle.installed_manifest = "/user/.installed.md5";
+    handle.journal = "/user/.update.journal";
+    handle.fingerprint = "/user/.update.sha256";
+    handle.stage_budget = UPDATE_STAGE_BUDGET;
+    handle.direct_user = true;
+    /// raw images only for partitions the updater doesn't use: 0 is the whole disk, 1-3 are mounted above
+    handle.image_partitions = ~((1u << 4) - 1);
 
     const struct version_json_s current_version_json = json_get_version_struct(handle.current_version_json);
 
@@ -63,8 +97,12 @@ int __attribute__((noinline, used)) main() {
             debug_log("System update start");
             gui_show_screen(ScreenUpdateInProgress);
 
-            handle.update_from = "/user/update.tar";
-            handle.backup_full_path = "/backup/backup.tar";
+            /// compressed package is used when there is no plain one
+            handle.update_from = path_check_if_exists("/user/update.tar") ? "/user/update.tar" : "/user/update.tar.lz4";
+            /// user databases and logs compress well, /backup is small
+            handle.backup_full_path = "/backup/backup.tar.lz4";
+            /// a few restore points, each backup writes only what changed since the previous one
+            handle.backup_store = "/backup/store";
             handle.enabled.backup = true;
             handle.enabled.check_checksum = true;
             handle.enabled.check_sign = true;
@@ -90,14 +128,53 @@ int __attribute__((noinline, used)) main() {
             debug_log("System recovery start");
             gui_show_screen(ScreenRecoveryInProgress);
 
-            handle.update_from = "/backup/backup.tar";
+            /// backup made before backups were compressed is used when there is no compressed one
+            handle.update_from =
+                    path_check_if_exists("/backup/backup.tar.lz4") ? "/backup/backup.tar.lz4" : "/backup/backup.tar";
+            /// backup of a slot update has no os files - the previous os is started from its slot
+            char previous_boot[48];
+            snprintf(previous_boot, sizeof previous_boot, "%s/boot.bin", os_inactive);
+            if (slots && path_check_if_exists(previous_boot)) {
+                if (boot_slot_switch(boot_json, NULL, boot_slot_other(active_slot)) != ErrorBootSlotOk) {
+                    status.operation_result = OPERATION_FAILURE;
+                    debug_log("Recovery: unable to switch to the previous os slot");
+                    gui_show_screen(ScreenRecoveryFailed);
+                    goto exit;
+                }
+                handle.update_os = os_inactive;
+            }
+            handle.boot_json = NULL;
+            handle.tmp_os = "/os/tmp";
+            handle.new_version_json = "/os/tmp/version.json";
             handle.enabled.backup = false;
             handle.enabled.check_checksum = true;
             handle.enabled.check_sign = false;
             handle.enabled.check_version = false;
             handle.enabled.allow_downgrade = false;
 
-            if (!update_firmware(&handle)) {
+            /// usually a few files are broken - only those are read from the backup, the latest generation
+            /// of the store when there is one, the older generations when it's damaged
+            struct backup_handle_s restore_handle = {
+                    .backup_from_os = handle.update_os,
+                    .backup_from_user = handle.update_user,
+                    .backup_to = handle.update_from,
+                    .backup_store = "/backup/store",
+            };
+            struct backup_restore_result_s restored;
+            const bool selective = backup_restore_changed(&restore_handle, &restored);
+            /// installed files don't match what the last update recorded any more
+            unlink(handle.installed_manifest);
+            unlink(handle.fingerprint);
+            bool recovered = selective;
+            /// the archive is there for a backup made before the store, the store replaces it
+            if (!selective && path_check_if_exists(handle.update_from)) {
+                debug_log("Recovery: selective restore failed, restoring whole backup %s", handle.update_from);
+                recovered = update_firmware(&handle);
+            } else if (!selective) {
+                debug_log("Recovery: selective restore failed, no backup archive to restore");
+            }
+
+            if (!recovered) {
                 status.operation_result = OPERATION_FAILURE;
                 debug_log("Recovery: recovery failed");
                 gui_show_screen(ScreenRecoveryFailed);
@@ -116,6 +193,8 @@ int __attribute__((noinline, used)) main() {
             const struct factory_reset_handle frhandle = {
                     .user_dir = handle.update_user
             };
+            /// user files of the applied package are removed - the same package has to be applied again
+            unlink(handle.fingerprint);
             if (!factory_reset(&frhandle)) {
                 status.operation_result = OPERATION_FAILURE;
                 debug_log("Factory reset: factory reset failed");
@@ -132,9 +211,13 @@ int __attribute__((noinline, used)) main() {
             debug_log("Keys programming start");
             gui_show_screen(ScreenKeysInProgress);
 
+            char srk_file[48];
+            char chksum_srk_file[48];
+            snprintf(srk_file, sizeof srk_file, "%s/SRK_fuses.bin", os_active);
+            snprintf(chksum_srk_file, sizeof chksum_srk_file, "%s/SRK_fuses.bin.md5", os_active);
             const struct program_keys_handle pghandle = {
-                    .srk_file = "/os/current/SRK_fuses.bin",
-                    .chksum_srk_file = "/os/current/SRK_fuses.bin.md5"
+                    .srk_file = srk_file,
+                    .chksum_srk_file = chksum_srk_file
             };
             if (program_keys(&pghandle)) {
                 status.operation_result = OPERATION_FAILURE;
@@ -168,6 +251,7 @@ int __attribute__((noinline, used)) main() {
     debug_log("Process finished, exiting...");
     msleep(5000);
     gui_clear_display();
+    io_buffer_deinit();
     err = vfs_unmount_deinit();
     system_deinitialize();
 